@@ -0,0 +1,108 @@
+#include "adaptive_buffering.h"
+
+#include <assert.h>
+
+// Raise or lower the target by at least 10ms
+#define STEP_MS 10
+// Lower the target only if it exceeds the desired target by more than 10ms
+#define LOWER_THRESHOLD_MS 10
+// Start lowering the target only after 10 consecutive periods of low jitter
+#define LOWER_DELAY 10
+
+static void
+reset_period(struct sc_adaptive_buffering *ab, unsigned i) {
+    ab->transit_min[i] = INT64_MAX;
+    ab->transit_max[i] = INT64_MIN;
+}
+
+void
+sc_adaptive_buffering_init(struct sc_adaptive_buffering *ab,
+                           uint32_t sample_rate, uint32_t target,
+                           uint32_t min_target, uint32_t max_target) {
+    assert(min_target <= target && target <= max_target);
+
+    ab->sample_rate = sample_rate;
+    ab->min_target = min_target;
+    ab->max_target = max_target;
+    ab->target = target;
+
+    for (unsigned i = 0; i < SC_ADAPTIVE_BUFFERING_WINDOW; ++i) {
+        reset_period(ab, i);
+    }
+    ab->period = 0;
+    ab->lower_count = 0;
+    ab->jitter = 0;
+}
+
+void
+sc_adaptive_buffering_push(struct sc_adaptive_buffering *ab, int64_t pts,
+                           sc_tick arrival) {
+    // The device and computer clocks are different, but only the variation of
+    // the transit time matters (the clock drift is negligible over a few
+    // seconds)
+    sc_tick transit = arrival - pts;
+
+    unsigned i = ab->period;
+    ab->transit_min[i] = MIN(ab->transit_min[i], transit);
+    ab->transit_max[i] = MAX(ab->transit_max[i], transit);
+}
+
+static uint32_t
+to_samples(struct sc_adaptive_buffering *ab, sc_tick duration) {
+    return duration * ab->sample_rate / SC_TICK_FREQ;
+}
+
+bool
+sc_adaptive_buffering_update(struct sc_adaptive_buffering *ab,
+                             uint32_t underflow) {
+    sc_tick transit_min = INT64_MAX;
+    sc_tick transit_max = INT64_MIN;
+    for (unsigned i = 0; i < SC_ADAPTIVE_BUFFERING_WINDOW; ++i) {
+        transit_min = MIN(transit_min, ab->transit_min[i]);
+        transit_max = MAX(transit_max, ab->transit_max[i]);
+    }
+
+    // Start a new period, forgetting the oldest one
+    ab->period = (ab->period + 1) % SC_ADAPTIVE_BUFFERING_WINDOW;
+    reset_period(ab, ab->period);
+
+    ab->jitter = transit_max >= transit_min ? transit_max - transit_min : 0;
+
+    // The minimal target absorbs the regular variations (the packets are
+    // produced and consumed by blocks), the additional buffering absorbs the
+    // jitter (with a margin of 25%)
+    uint32_t jitter = to_samples(ab, ab->jitter);
+    uint64_t desired = (uint64_t) ab->min_target + jitter + jitter / 4;
+    desired = MIN(desired, ab->max_target);
+
+    uint32_t step = to_samples(ab, SC_TICK_FROM_MS(STEP_MS));
+    uint32_t lower_threshold =
+        to_samples(ab, SC_TICK_FROM_MS(LOWER_THRESHOLD_MS));
+
+    uint64_t target = ab->target;
+    if (underflow) {
+        // The target is too low, whatever the estimated jitter
+        target = MAX(desired, target + MAX(underflow, step));
+        ab->lower_count = 0;
+    } else if (desired >= target + step / 2) {
+        target = desired;
+        ab->lower_count = 0;
+    } else if (desired + lower_threshold < target) {
+        if (ab->lower_count < LOWER_DELAY) {
+            ++ab->lower_count;
+        } else {
+            // Lower progressively (one step per period)
+            target = MAX(desired, target - step);
+        }
+    } else {
+        ab->lower_count = 0;
+    }
+
+    target = CLAMP(target, ab->min_target, ab->max_target);
+    if (target == ab->target) {
+        return false;
+    }
+
+    ab->target = target;
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef SC_ADAPTIVE_BUFFERING_H
+#define SC_ADAPTIVE_BUFFERING_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "util/tick.h"
+
+// Number of 1-second periods to estimate the jitter
+#define SC_ADAPTIVE_BUFFERING_WINDOW 4
+
+/**
+ * Adapt the audio target buffering to the network jitter
+ *
+ * The jitter is estimated from the variation of the transit time (the arrival
+ * time minus the pts) of the packets over the last few seconds. The underflow
+ * (silence inserted because samples were missing) is also taken into account.
+ *
+ * The target is raised immediately (on underflow, or if the jitter increases),
+ * but it is lowered only progressively, once the jitter has been low for
+ * several seconds (hysteresis).
+ *
+ * All values are expressed in samples.
+ */
+struct sc_adaptive_buffering {
+    uint32_t sample_rate;
+    uint32_t min_target;
+    uint32_t max_target;
+    uint32_t target;
+
+    // Min and max transit times for each period (the current one is at
+    // index period)
+    sc_tick transit_min[SC_ADAPTIVE_BUFFERING_WINDOW];
+    sc_tick transit_max[SC_ADAPTIVE_BUFFERING_WINDOW];
+    unsigned period;
+
+    // Number of consecutive periods where the target could be lowered
+    unsigned lower_count;
+
+    // The jitter estimated on the last update (for logging)
+    sc_tick jitter;
+};
+
+void
+sc_adaptive_buffering_init(struct sc_adaptive_buffering *ab,
+                           uint32_t sample_rate, uint32_t target,
+                           uint32_t min_target, uint32_t max_target);
+
+/**
+ * Register the arrival of a packet
+ *
+ * The pts is in microseconds.
+ */
+void
+sc_adaptive_buffering_push(struct sc_adaptive_buffering *ab, int64_t pts,
+                           sc_tick arrival);
+
+/**
+ * Update the target, to be called every second
+ *
+ * The underflow is the number of samples inserted since the last update.
+ *
+ * Return true if the target changed.
+ */
+bool
+sc_adaptive_buffering_update(struct sc_adaptive_buffering *ab,
+                             uint32_t underflow);
+
+#endif
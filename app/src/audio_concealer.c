@@ -0,0 +1,154 @@
+#include "audio_concealer.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/log.h"
+#include "util/memory.h"
+
+bool
+sc_audio_concealer_init(struct sc_audio_concealer *ac, unsigned channels,
+                        uint32_t sample_rate) {
+    assert(channels);
+    assert(sample_rate >= 200);
+
+    ac->channels = channels;
+    ac->period = sample_rate / 100; // 10ms
+    ac->fade_out = sample_rate / 50; // 20ms
+    ac->crossfade = sample_rate / 200; // 5ms
+
+    // One more sample to store the concealment signal while crossfading
+    ac->history = sc_allocarray((ac->period + 1) * channels, sizeof(float));
+    if (!ac->history) {
+        LOG_OOM();
+        return false;
+    }
+
+    ac->history_count = 0;
+    ac->position = 0;
+    ac->crossfade_position = 0;
+    ac->concealed_samples = 0;
+    ac->concealment_count = 0;
+
+    return true;
+}
+
+void
+sc_audio_concealer_destroy(struct sc_audio_concealer *ac) {
+    free(ac->history);
+}
+
+static void
+sc_audio_concealer_save(struct sc_audio_concealer *ac, const float *samples,
+                        uint32_t count) {
+    unsigned channels = ac->channels;
+    uint32_t period = ac->period;
+
+    if (count >= period) {
+        memcpy(ac->history, samples + (count - period) * channels,
+               period * channels * sizeof(float));
+        ac->history_count = period;
+        return;
+    }
+
+    // Keep the most recent samples, and append the new ones
+    uint32_t keep = MIN(ac->history_count, period - count);
+    memmove(ac->history, ac->history + (ac->history_count - keep) * channels,
+            keep * channels * sizeof(float));
+    memcpy(ac->history + keep * channels, samples,
+           count * channels * sizeof(float));
+    ac->history_count = keep + count;
+}
+
+// Generate the next concealment sample (for all channels)
+static void
+sc_audio_concealer_next(struct sc_audio_concealer *ac, float *out) {
+    unsigned channels = ac->channels;
+    uint64_t k = ac->position++;
+
+    uint32_t len = ac->history_count;
+    if (!len || k >= ac->fade_out) {
+        memset(out, 0, channels * sizeof(float));
+        return;
+    }
+
+    // Replay the history backwards then forwards, so that there is no
+    // discontinuity (the first concealed sample is the last real sample)
+    uint64_t m = k % (2 * len);
+    uint32_t index = m < len ? len - 1 - m : m - len;
+    float gain = 1.0f - (float) k / ac->fade_out;
+
+    const float *src = &ac->history[index * channels];
+    for (unsigned c = 0; c < channels; ++c) {
+        out[c] = src[c] * gain;
+    }
+}
+
+void
+sc_audio_concealer_feed(struct sc_audio_concealer *ac, float *samples,
+                        uint32_t count) {
+    unsigned channels = ac->channels;
+
+    if (ac->position) {
+        // The concealment signal is stored after the history
+        float *concealed = &ac->history[ac->period * channels];
+
+        uint32_t i = 0;
+        for (; i < count && ac->crossfade_position < ac->crossfade; ++i) {
+            sc_audio_concealer_next(ac, concealed);
+            float t = (float) ++ac->crossfade_position / (ac->crossfade + 1);
+            float *s = &samples[i * channels];
+            for (unsigned c = 0; c < channels; ++c) {
+                s[c] = s[c] * t + concealed[c] * (1 - t);
+            }
+        }
+
+        if (ac->crossfade_position < ac->crossfade) {
+            // The concealment signal is generated from the history, so it must
+            // not change until the crossfade is complete
+            return;
+        }
+
+        // Crossfade complete
+        ac->position = 0;
+        ac->crossfade_position = 0;
+    }
+
+    sc_audio_concealer_save(ac, samples, count);
+}
+
+void
+sc_audio_concealer_feed_const(struct sc_audio_concealer *ac,
+                              const float *samples, uint32_t count) {
+    ac->position = 0;
+    ac->crossfade_position = 0;
+    sc_audio_concealer_save(ac, samples, count);
+}
+
+void
+sc_audio_concealer_conceal(struct sc_audio_concealer *ac, float *out,
+                           uint32_t count) {
+    if (!count) {
+        return;
+    }
+
+    if (!ac->position) {
+        ++ac->concealment_count;
+    }
+    // Restart the crossfade once real samples are available again
+    ac->crossfade_position = 0;
+    ac->concealed_samples += count;
+
+    unsigned channels = ac->channels;
+    uint32_t i = 0;
+    for (; i < count && ac->position < ac->fade_out; ++i) {
+        sc_audio_concealer_next(ac, &out[i * channels]);
+    }
+
+    if (i < count) {
+        // Faded out completely
+        memset(&out[i * channels], 0, (count - i) * channels * sizeof(float));
+        ac->position += count - i;
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef SC_AUDIO_CONCEALER_H
+#define SC_AUDIO_CONCEALER_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Audio concealment of missing samples (on buffer underflow)
+ *
+ * Inserting silence when samples are missing causes audible clicks (the signal
+ * drops instantly to zero). Instead, the concealer replays the last period of
+ * real samples back and forth (so that the signal is continuous, even at the
+ * turning points), with a fade-out. When real samples are available again,
+ * they are crossfaded with the concealment signal.
+ *
+ * Samples are interleaved floats. Counts are expressed in samples per channel.
+ */
+struct sc_audio_concealer {
+    unsigned channels;
+
+    // The last real samples (period samples per channel, plus one to store
+    // a concealment sample while crossfading)
+    float *history;
+    uint32_t period;
+    // Number of valid samples in history
+    uint32_t history_count;
+
+    uint32_t fade_out; // in samples
+    uint32_t crossfade; // in samples
+
+    // Number of samples concealed since the concealment started (0 if not
+    // concealing)
+    uint64_t position;
+    // Number of real samples crossfaded since the concealment ended
+    uint32_t crossfade_position;
+
+    // Statistics
+    uint64_t concealed_samples;
+    uint32_t concealment_count;
+};
+
+bool
+sc_audio_concealer_init(struct sc_audio_concealer *ac, unsigned channels,
+                        uint32_t sample_rate);
+
+void
+sc_audio_concealer_destroy(struct sc_audio_concealer *ac);
+
+/**
+ * Register real samples
+ *
+ * If samples were concealed just before, the first samples are crossfaded
+ * (modified in place) with the concealment signal.
+ */
+void
+sc_audio_concealer_feed(struct sc_audio_concealer *ac, float *samples,
+                        uint32_t count);
+
+/**
+ * Like sc_audio_concealer_feed(), but without crossfading the samples
+ */
+void
+sc_audio_concealer_feed_const(struct sc_audio_concealer *ac,
+                              const float *samples, uint32_t count);
+
+/**
+ * Generate concealment samples
+ */
+void
+sc_audio_concealer_conceal(struct sc_audio_concealer *ac, float *out,
+                           uint32_t count);
+
+#endif
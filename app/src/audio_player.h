@@ -6,6 +6,7 @@
 #include <SDL2/SDL_audio.h>
 
 #include "audio_regulator.h"
+#include "av_sync.h"
 #include "trait/frame_sink.h"
 #include "util/tick.h"
 
@@ -18,16 +19,25 @@ struct sc_audio_player {
     // blocks of 960 samples (20ms) or 1024 samples (~21.3ms), this target
     // value should be higher.
     sc_tick target_buffering_delay;
+    // The range to adapt the target buffering to the jitter (equal to
+    // target_buffering_delay to disable)
+    sc_tick min_target_buffering_delay;
+    sc_tick max_target_buffering_delay;
 
     // SDL audio output buffer size
     sc_tick output_buffer_duration;
 
+    // Audio clock to update for A/V synchronization (may be NULL)
+    struct sc_av_sync *av_sync;
+
     SDL_AudioDeviceID device;
     struct sc_audio_regulator audioreg;
 };
 
 void
 sc_audio_player_init(struct sc_audio_player *ap, sc_tick target_buffering,
-                     sc_tick audio_output_buffer);
+                     sc_tick min_target_buffering,
+                     sc_tick max_target_buffering,
+                     sc_tick audio_output_buffer, struct sc_av_sync *av_sync);
 
 #endif
@@ -8,6 +8,7 @@
 #include <libavutil/opt.h>
 
 #include "util/log.h"
+#include "util/tick.h"
 
 //#define SC_AUDIO_REGULATOR_DEBUG // uncomment to debug
 
@@ -29,6 +30,9 @@
  * too high, then latency will become unacceptable. This target value is
  * configured using the scrcpy option --audio-buffer.
  *
+ * If a range is configured (--audio-buffer-min and --audio-buffer-max), the
+ * target is adapted to the network jitter (see adaptive_buffering.h).
+ *
  * The regulator cannot adjust the sample input rate (it receives samples
  * produced in real-time) or the sample output rate (it must provide samples as
  * requested by the audio player). Therefore, it may only apply compensation by
@@ -54,10 +58,49 @@
  * Therefore, the regulator doesn't drop any sample on underflow. The
  * compensation mechanism will absorb the delay introduced by the inserted
  * silence.
+ *
+ * To avoid audible clicks, the missing samples are not replaced by pure
+ * silence, but by a concealment signal (see audio_concealer.h).
  */
 
 #define TO_BYTES(SAMPLES) sc_audiobuf_to_bytes(&ar->buf, (SAMPLES))
 #define TO_SAMPLES(BYTES) sc_audiobuf_to_samples(&ar->buf, (BYTES))
+#define TO_MS(SAMPLES) ((uint32_t) ((uint64_t) (SAMPLES) * 1000 \
+                                    / ar->sample_rate))
+
+// Return the PTS of the first of the samples just read, or -1 if unknown
+static int64_t
+sc_audio_regulator_get_pulled_pts(struct sc_audio_regulator *ar,
+                                  uint32_t read) {
+    if (!read) {
+        return -1;
+    }
+
+    // The PTS of the end of the buffer and the number of buffered samples must
+    // be consistent (see sc_audio_regulator_begin_update())
+    uint32_t seq = atomic_load_explicit(&ar->pts_seq, memory_order_acquire);
+    if (seq & 1) {
+        // The receiver thread is writing
+        return -1;
+    }
+
+    uint32_t remaining = sc_audiobuf_can_read(&ar->buf);
+    int64_t end_pts = atomic_load_explicit(&ar->end_pts,
+                                           memory_order_relaxed);
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&ar->pts_seq, memory_order_relaxed) != seq) {
+        return -1;
+    }
+
+    if (!end_pts) {
+        // Nothing received yet
+        return -1;
+    }
+
+    uint64_t samples = (uint64_t) remaining + read;
+    return end_pts - samples * 1000000 / ar->sample_rate;
+}
 
 void
 sc_audio_regulator_pull(struct sc_audio_regulator *ar, uint8_t *out,
@@ -66,9 +109,9 @@ sc_audio_regulator_pull(struct sc_audio_regulator *ar, uint8_t *out,
     LOGD("[Audio] Audio regulator pulls %" PRIu32 " samples", out_samples);
 #endif
 
-    // A lock is necessary in the rare case where the producer needs to drop
-    // samples already pushed (when the buffer is full)
-    sc_mutex_lock(&ar->mutex);
+    // This is called from the audio callback thread, it must never block. The
+    // producer never drops samples itself: the samples it drops are skipped
+    // by this read (see sc_audiobuf_drop()), without locking.
 
     bool played = atomic_load_explicit(&ar->played, memory_order_relaxed);
     if (!played) {
@@ -84,34 +127,48 @@ sc_audio_regulator_pull(struct sc_audio_regulator *ar, uint8_t *out,
             // whole buffer with silence (len is small compared to the
             // arbitrary margin value).
             memset(out, 0, out_samples * ar->sample_size);
-            sc_mutex_unlock(&ar->mutex);
+            ar->played_pts = -1;
             return;
         }
     }
 
     uint32_t read = sc_audiobuf_read(&ar->buf, out, out_samples);
+    ar->played_pts = sc_audio_regulator_get_pulled_pts(ar, read);
 
-    sc_mutex_unlock(&ar->mutex);
+    // The output samples are interleaved floats (SC_AV_SAMPLE_FMT)
+    float *samples = (float *) out;
+    if (read) {
+        // Crossfade with the concealment signal if an underflow just ended
+        sc_audio_concealer_feed(&ar->concealer, samples, read);
+    }
 
     if (read < out_samples) {
         uint32_t silence = out_samples - read;
-        // Insert silence. In theory, the inserted silent samples replace the
-        // missing real samples, which will arrive later, so they should be
+        // Insert concealment samples. In theory, the inserted samples replace
+        // the missing real samples, which will arrive later, so they should be
         // dropped to keep the latency minimal. However, this would cause very
         // audible glitches, so let the clock compensation restore the target
         // latency.
 #ifdef SC_AUDIO_REGULATOR_DEBUG
-        LOGD("[Audio] Buffer underflow, inserting silence: %" PRIu32 " samples",
+        LOGD("[Audio] Buffer underflow, concealing: %" PRIu32 " samples",
              silence);
 #endif
-        memset(out + TO_BYTES(read), 0, TO_BYTES(silence));
-
         bool received = atomic_load_explicit(&ar->received,
                                              memory_order_relaxed);
         if (received) {
+            uint32_t count = ar->concealer.concealment_count;
+            sc_audio_concealer_conceal(&ar->concealer,
+                                       samples + read * ar->channels, silence);
+            if (ar->concealer.concealment_count != count) {
+                atomic_fetch_add_explicit(&ar->concealments, 1,
+                                          memory_order_relaxed);
+            }
+
             // Inserting additional samples immediately increases buffering
             atomic_fetch_add_explicit(&ar->underflow, silence,
                                       memory_order_relaxed);
+        } else {
+            memset(out + TO_BYTES(read), 0, TO_BYTES(silence));
         }
     }
 
@@ -137,6 +194,98 @@ sc_audio_regulator_get_swr_buf(struct sc_audio_regulator *ar,
     return ar->swr_buf;
 }
 
+static bool
+sc_audio_regulator_can_bypass_swr(enum AVSampleFormat fmt) {
+    // Only the interleaved float samples (output by the Opus decoder) are
+    // written directly. For the other formats, swr_convert() (which is
+    // vectorized) is not measurably slower than a dedicated conversion.
+    return fmt == SC_AV_SAMPLE_FMT;
+}
+
+// The player thread computes the PTS of the samples it reads from the PTS of
+// the end of the buffer and the number of buffered samples. Each change of the
+// buffered samples is surrounded by a sequence counter update (odd during the
+// change), so that it never uses inconsistent values.
+static void
+sc_audio_regulator_begin_update(struct sc_audio_regulator *ar) {
+    atomic_fetch_add_explicit(&ar->pts_seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void
+sc_audio_regulator_end_update(struct sc_audio_regulator *ar, int64_t end_pts) {
+    atomic_store_explicit(&ar->end_pts, end_pts, memory_order_relaxed);
+    atomic_fetch_add_explicit(&ar->pts_seq, 1, memory_order_release);
+}
+
+// Write samples to the audio buffer, dropping the samples which do not fit if
+// it is full (this never blocks the consumer)
+//
+// end_pts is the PTS of the end of the buffer once written.
+static uint32_t
+sc_audio_regulator_write(struct sc_audio_regulator *ar, const uint8_t *data,
+                         uint32_t samples, int64_t end_pts,
+                         uint32_t *skipped_samples) {
+#ifdef SC_AUDIO_REGULATOR_DEBUG
+    LOGD("[Audio] %" PRIu32 " samples written to buffer", samples);
+#endif
+
+    uint32_t cap = sc_audiobuf_capacity(&ar->buf);
+    if (samples > cap) {
+        // Very very unlikely: a single resampled frame should never
+        // exceed the audio buffer size (or something is very wrong).
+        // Ignore the first bytes in data to avoid memory corruption anyway.
+        data += TO_BYTES(samples - cap);
+        samples = cap;
+    }
+
+    // The buffer is only full if the consumer has not read for more than 1
+    // second (the excess is dropped on the next push anyway)
+    sc_audio_regulator_begin_update(ar);
+    uint32_t written = sc_audiobuf_write(&ar->buf, data, samples);
+    sc_audio_regulator_end_update(ar, end_pts);
+
+    *skipped_samples += samples - written;
+    sc_audio_concealer_feed_const(&ar->gap_concealer, (const float *) data,
+                                  samples);
+    return samples;
+}
+
+// Resample (with compensation) to the audio buffer (or flush the resampler if
+// in is NULL)
+static bool
+sc_audio_regulator_resample(struct sc_audio_regulator *ar, const uint8_t **in,
+                            uint32_t in_samples, int64_t end_pts,
+                            uint32_t *written, uint32_t *skipped_samples) {
+    SwrContext *swr_ctx = ar->swr_ctx;
+
+    int64_t swr_delay = swr_get_delay(swr_ctx, ar->sample_rate);
+    // No need to av_rescale_rnd(), input and output sample rates are the same.
+    // Add more space (256) for clock compensation.
+    int dst_nb_samples = swr_delay + in_samples + 256;
+
+    uint8_t *swr_buf = sc_audio_regulator_get_swr_buf(ar, dst_nb_samples);
+    if (!swr_buf) {
+        return false;
+    }
+
+    int ret = swr_convert(swr_ctx, &swr_buf, dst_nb_samples, in, in_samples);
+    if (ret < 0) {
+        LOGE("Resampling failed: %d", ret);
+        return false;
+    }
+
+    // swr_convert() returns the number of samples which would have been
+    // written if the buffer was big enough.
+    uint32_t samples = MIN(ret, dst_nb_samples);
+    if (samples) {
+        *written += sc_audio_regulator_write(ar, swr_buf, samples, end_pts,
+                                             skipped_samples);
+    }
+
+    return true;
+}
+
 bool
 sc_audio_regulator_push(struct sc_audio_regulator *ar, const AVFrame *frame) {
     SwrContext *swr_ctx = ar->swr_ctx;
@@ -154,7 +303,24 @@ sc_audio_regulator_push(struct sc_audio_regulator *ar, const AVFrame *frame) {
         if (input_samples + can_read < ar->target_buffering) {
             // Adjust buffering to the target value directly
             uint32_t silence = ar->target_buffering - can_read - input_samples;
-            sc_audiobuf_write_silence(&ar->buf, silence);
+            if (can_read) {
+                // The last samples have not been played yet: fade them out
+                // rather than inserting pure silence just after them
+                uint8_t *buf = sc_audio_regulator_get_swr_buf(ar, silence);
+                if (!buf) {
+                    return false;
+                }
+                sc_audio_concealer_conceal(&ar->gap_concealer, (float *) buf,
+                                           silence);
+                sc_audio_regulator_begin_update(ar);
+                sc_audiobuf_write(&ar->buf, buf, silence);
+                sc_audio_regulator_end_update(ar, pts);
+            } else {
+                // The player has already concealed the missing samples
+                sc_audio_regulator_begin_update(ar);
+                sc_audiobuf_write_silence(&ar->buf, silence);
+                sc_audio_regulator_end_update(ar, pts);
+            }
         }
 
         // Reset state
@@ -171,70 +337,43 @@ sc_audio_regulator_push(struct sc_audio_regulator *ar, const AVFrame *frame) {
                             / ar->sample_rate;
     ar->next_expected_pts = pts + packet_duration;
 
-    int64_t swr_delay = swr_get_delay(swr_ctx, ar->sample_rate);
-    // No need to av_rescale_rnd(), input and output sample rates are the same.
-    // Add more space (256) for clock compensation.
-    int dst_nb_samples = swr_delay + frame->nb_samples + 256;
-
-    uint8_t *swr_buf = sc_audio_regulator_get_swr_buf(ar, dst_nb_samples);
-    if (!swr_buf) {
-        return false;
-    }
-
-    int ret = swr_convert(swr_ctx, &swr_buf, dst_nb_samples,
-                          (const uint8_t **) frame->data, frame->nb_samples);
-    if (ret < 0) {
-        LOGE("Resampling failed: %d", ret);
-        return false;
-    }
-
-    // swr_convert() returns the number of samples which would have been
-    // written if the buffer was big enough.
-    uint32_t samples = MIN(ret, dst_nb_samples);
-#ifdef SC_AUDIO_REGULATOR_DEBUG
-    LOGD("[Audio] %" PRIu32 " samples written to buffer", samples);
-#endif
-
-    uint32_t cap = sc_audiobuf_capacity(&ar->buf);
-    if (samples > cap) {
-        // Very very unlikely: a single resampled frame should never
-        // exceed the audio buffer size (or something is very wrong).
-        // Ignore the first bytes in swr_buf to avoid memory corruption anyway.
-        swr_buf += TO_BYTES(samples - cap);
-        samples = cap;
-    }
-
+    uint32_t written = 0;
     uint32_t skipped_samples = 0;
 
-    uint32_t written = sc_audiobuf_write(&ar->buf, swr_buf, samples);
-    if (written < samples) {
-        uint32_t remaining = samples - written;
-
-        // All samples that could be written without locking have been written,
-        // now we need to lock to drop/consume old samples
-        sc_mutex_lock(&ar->mutex);
-
-        // Retry with the lock
-        written += sc_audiobuf_write(&ar->buf,
-                                     swr_buf + TO_BYTES(written),
-                                     remaining);
-        if (written < samples) {
-            remaining = samples - written;
-            // Still insufficient, drop old samples to make space
-            skipped_samples = sc_audiobuf_read(&ar->buf, NULL, remaining);
-            assert(skipped_samples == remaining);
-        }
+    if (!ar->compensation_active
+            && sc_audio_regulator_can_bypass_swr(frame->format)) {
+        if (ar->swr_used) {
+            // The resampler may retain samples from the last compensation,
+            // flush them before bypassing it (they precede the frame)
+            bool ok = sc_audio_regulator_resample(ar, NULL, 0, pts, &written,
+                                                  &skipped_samples);
+            if (!ok) {
+                return false;
+            }
 
-        sc_mutex_unlock(&ar->mutex);
+            // Reset the resampler state after flushing
+            int ret = swr_init(swr_ctx);
+            if (ret < 0) {
+                LOGE("Failed to reset the resampling context");
+                return false;
+            }
+            ar->swr_used = false;
+        }
 
-        if (written < samples) {
-            // Now there is enough space
-            uint32_t w = sc_audiobuf_write(&ar->buf,
-                                           swr_buf + TO_BYTES(written),
-                                           remaining);
-            assert(w == remaining);
-            (void) w;
+        // No conversion needed, write the decoded samples directly
+        written += sc_audio_regulator_write(ar, frame->data[0], input_samples,
+                                            ar->next_expected_pts,
+                                            &skipped_samples);
+    } else {
+        bool ok = sc_audio_regulator_resample(ar,
+                                              (const uint8_t **) frame->data,
+                                              input_samples,
+                                              ar->next_expected_pts, &written,
+                                              &skipped_samples);
+        if (!ok) {
+            return false;
         }
+        ar->swr_used = true;
     }
 
     uint32_t underflow = 0;
@@ -244,6 +383,9 @@ sc_audio_regulator_push(struct sc_audio_regulator *ar, const AVFrame *frame) {
         underflow = atomic_exchange_explicit(&ar->underflow, 0,
                                              memory_order_relaxed);
         ar->underflow_report += underflow;
+        ar->concealments_report +=
+            atomic_exchange_explicit(&ar->concealments, 0,
+                                     memory_order_relaxed);
 
         max_buffered_samples = ar->target_buffering * 11 / 10
                              + 60 * ar->sample_rate / 1000 /* 60 ms */;
@@ -257,29 +399,22 @@ sc_audio_regulator_push(struct sc_audio_regulator *ar, const AVFrame *frame) {
 
     uint32_t can_read = sc_audiobuf_can_read(&ar->buf);
     if (can_read > max_buffered_samples) {
-        uint32_t skip_samples = 0;
-
-        sc_mutex_lock(&ar->mutex);
-        can_read = sc_audiobuf_can_read(&ar->buf);
-        if (can_read > max_buffered_samples) {
-            skip_samples = can_read - max_buffered_samples;
-            uint32_t r = sc_audiobuf_read(&ar->buf, NULL, skip_samples);
-            assert(r == skip_samples);
-            (void) r;
-            skipped_samples += skip_samples;
-        }
-        sc_mutex_unlock(&ar->mutex);
-
-        if (skip_samples) {
-            if (played) {
-                LOGD("[Audio] Buffering threshold exceeded, skipping %" PRIu32
-                     " samples", skip_samples);
+        // The samples are skipped by the consumer on its next read, the
+        // producer never advances the read cursor
+        uint32_t skip_samples = can_read - max_buffered_samples;
+        sc_audio_regulator_begin_update(ar);
+        sc_audiobuf_drop(&ar->buf, skip_samples);
+        sc_audio_regulator_end_update(ar, ar->next_expected_pts);
+        skipped_samples += skip_samples;
+
+        if (played) {
+            LOGD("[Audio] Buffering threshold exceeded, skipping %" PRIu32
+                 " samples", skip_samples);
 #ifdef SC_AUDIO_REGULATOR_DEBUG
-            } else {
-                LOGD("[Audio] Playback not started, skipping %" PRIu32
-                     " samples", skip_samples);
+        } else {
+            LOGD("[Audio] Playback not started, skipping %" PRIu32
+                 " samples", skip_samples);
 #endif
-            }
         }
     }
 
@@ -289,6 +424,11 @@ sc_audio_regulator_push(struct sc_audio_regulator *ar, const AVFrame *frame) {
         return true;
     }
 
+    if (ar->adaptive) {
+        sc_adaptive_buffering_push(&ar->adaptive_buffering, pts,
+                                   sc_tick_now());
+    }
+
     // Number of samples added (or removed, if negative) for compensation
     int32_t instant_compensation = (int32_t) written - input_samples;
     // Inserting silence instantly increases buffering
@@ -322,6 +462,20 @@ sc_audio_regulator_push(struct sc_audio_regulator *ar, const AVFrame *frame) {
         // Recompute compensation every second
         ar->samples_since_resync = 0;
 
+        if (ar->adaptive
+                && sc_adaptive_buffering_update(&ar->adaptive_buffering,
+                                                ar->underflow_report)) {
+            uint32_t target = ar->adaptive_buffering.target;
+            LOGI("[Audio] Buffering target adjusted: %" PRIu32 " ms -> %"
+                 PRIu32 " ms (jitter=%" PRItick " ms, underflow=%" PRIu32
+                 " ms)", TO_MS(ar->target_buffering), TO_MS(target),
+                 SC_TICK_TO_MS(ar->adaptive_buffering.jitter),
+                 TO_MS(ar->underflow_report));
+            // The playback has started, so the consumer does not read the
+            // target anymore
+            ar->target_buffering = target;
+        }
+
         float avg = sc_average_get(&ar->avg_buffering);
         int diff = ar->target_buffering - avg;
 
@@ -346,9 +500,11 @@ sc_audio_regulator_push(struct sc_audio_regulator *ar, const AVFrame *frame) {
         int abs_max_diff = distance / 50;
         diff = CLAMP(diff, -abs_max_diff, abs_max_diff);
         LOGV("[Audio] Buffering: target=%" PRIu32 " avg=%f cur=%" PRIu32
-             " compensation=%d (underflow=%" PRIu32 ")",
-             ar->target_buffering, avg, can_read, diff, ar->underflow_report);
+             " compensation=%d (underflow=%" PRIu32 " in %" PRIu32
+             " concealments)", ar->target_buffering, avg, can_read, diff,
+             ar->underflow_report, ar->concealments_report);
         ar->underflow_report = 0;
+        ar->concealments_report = 0;
 
         int ret = swr_set_compensation(swr_ctx, diff, distance);
         if (ret < 0) {
@@ -364,7 +520,9 @@ sc_audio_regulator_push(struct sc_audio_regulator *ar, const AVFrame *frame) {
 
 bool
 sc_audio_regulator_init(struct sc_audio_regulator *ar, size_t sample_size,
-                        const AVCodecContext *ctx, uint32_t target_buffering) {
+                        const AVCodecContext *ctx, uint32_t target_buffering,
+                        uint32_t min_target_buffering,
+                        uint32_t max_target_buffering) {
     SwrContext *swr_ctx = swr_alloc();
     if (!swr_ctx) {
         LOG_OOM();
@@ -394,24 +552,29 @@ sc_audio_regulator_init(struct sc_audio_regulator *ar, size_t sample_size,
         goto error_free_swr_ctx;
     }
 
-    bool ok = sc_mutex_init(&ar->mutex);
-    if (!ok) {
-        goto error_free_swr_ctx;
-    }
-
     ar->target_buffering = target_buffering;
     ar->sample_size = sample_size;
     ar->sample_rate = ctx->sample_rate;
+    ar->channels = sample_size / av_get_bytes_per_sample(SC_AV_SAMPLE_FMT);
+
+    // The target buffering is adapted to the jitter if a range is configured
+    assert(min_target_buffering <= target_buffering);
+    assert(target_buffering <= max_target_buffering);
+    ar->adaptive = min_target_buffering < max_target_buffering;
+    if (ar->adaptive) {
+        sc_adaptive_buffering_init(&ar->adaptive_buffering, ar->sample_rate,
+                                   target_buffering, min_target_buffering,
+                                   max_target_buffering);
+    }
 
-    // Use a ring-buffer of the target buffering size plus 1 second between the
-    // producer and the consumer. It's too big on purpose, to guarantee that
-    // the producer and the consumer will be able to access it in parallel
-    // without locking.
-    uint32_t audiobuf_samples = target_buffering + ar->sample_rate;
+    // Use a ring-buffer of the max target buffering size plus 1 second between
+    // the producer and the consumer. It's too big on purpose, so that the
+    // producer rarely needs to drop samples the consumer has not read yet.
+    uint32_t audiobuf_samples = max_target_buffering + ar->sample_rate;
 
-    ok = sc_audiobuf_init(&ar->buf, sample_size, audiobuf_samples);
+    bool ok = sc_audiobuf_init_mirror(&ar->buf, sample_size, audiobuf_samples);
     if (!ok) {
-        goto error_destroy_mutex;
+        goto error_free_swr_ctx;
     }
 
     size_t initial_swr_buf_size = TO_BYTES(4096);
@@ -422,6 +585,18 @@ sc_audio_regulator_init(struct sc_audio_regulator *ar, size_t sample_size,
     }
     ar->swr_buf_alloc_size = initial_swr_buf_size;
 
+    ok = sc_audio_concealer_init(&ar->concealer, ar->channels,
+                                 ar->sample_rate);
+    if (!ok) {
+        goto error_free_swr_buf;
+    }
+
+    ok = sc_audio_concealer_init(&ar->gap_concealer, ar->channels,
+                                 ar->sample_rate);
+    if (!ok) {
+        goto error_destroy_concealer;
+    }
+
     // Samples are produced and consumed by blocks, so the buffering must be
     // smoothed to get a relatively stable value.
     sc_average_init(&ar->avg_buffering, 128);
@@ -431,16 +606,24 @@ sc_audio_regulator_init(struct sc_audio_regulator *ar, size_t sample_size,
     atomic_init(&ar->played, false);
     atomic_init(&ar->received, false);
     atomic_init(&ar->underflow, 0);
+    atomic_init(&ar->concealments, 0);
     ar->underflow_report = 0;
+    ar->concealments_report = 0;
     ar->compensation_active = false;
+    ar->swr_used = false;
     ar->next_expected_pts = 0;
+    atomic_init(&ar->pts_seq, 0);
+    atomic_init(&ar->end_pts, 0);
+    ar->played_pts = -1;
 
     return true;
 
+error_destroy_concealer:
+    sc_audio_concealer_destroy(&ar->concealer);
+error_free_swr_buf:
+    free(ar->swr_buf);
 error_destroy_audiobuf:
     sc_audiobuf_destroy(&ar->buf);
-error_destroy_mutex:
-    sc_mutex_destroy(&ar->mutex);
 error_free_swr_ctx:
     swr_free(&ar->swr_ctx);
 
@@ -449,8 +632,15 @@ error_free_swr_ctx:
 
 void
 sc_audio_regulator_destroy(struct sc_audio_regulator *ar) {
+    if (ar->concealer.concealment_count) {
+        LOGI("[Audio] Buffer underflow concealed %" PRIu32 " times (%" PRIu64
+             " ms)", ar->concealer.concealment_count,
+             ar->concealer.concealed_samples * 1000 / ar->sample_rate);
+    }
+
+    sc_audio_concealer_destroy(&ar->gap_concealer);
+    sc_audio_concealer_destroy(&ar->concealer);
     free(ar->swr_buf);
     sc_audiobuf_destroy(&ar->buf);
-    sc_mutex_destroy(&ar->mutex);
     swr_free(&ar->swr_ctx);
 }
@@ -9,19 +9,24 @@
 #include <stdint.h>
 #include <libavcodec/avcodec.h>
 #include <libswresample/swresample.h>
+#include "adaptive_buffering.h"
+#include "audio_concealer.h"
 #include "util/audiobuf.h"
 #include "util/average.h"
-#include "util/thread.h"
 
 #define SC_AV_SAMPLE_FMT AV_SAMPLE_FMT_FLT
 
 struct sc_audio_regulator {
-    sc_mutex mutex;
-
     // Target buffering between the producer and the consumer (in samples)
     uint32_t target_buffering;
 
-    // Audio buffer to communicate between the receiver and the player
+    // Adapt the target buffering to the jitter (only used by the receiver
+    // thread)
+    bool adaptive;
+    struct sc_adaptive_buffering adaptive_buffering;
+
+    // Audio buffer to communicate between the receiver and the player (without
+    // locking)
     struct sc_audiobuf buf;
 
     // Resampler (only used from the receiver thread)
@@ -31,6 +36,7 @@ struct sc_audio_regulator {
     uint32_t sample_rate;
     // The number of bytes per sample (for all channels)
     size_t sample_size;
+    unsigned channels;
 
     // Target buffer for resampling (only used by the receiver thread)
     uint8_t *swr_buf;
@@ -49,9 +55,26 @@ struct sc_audio_regulator {
     // Number of silence samples inserted since the last log
     uint32_t underflow_report;
 
+    // Concealment of the missing samples on underflow (only used by the
+    // player thread)
+    struct sc_audio_concealer concealer;
+    // Number of concealments started since the last received packet
+    atomic_uint_least32_t concealments;
+    // Number of concealments since the last log
+    uint32_t concealments_report;
+
+    // Concealment of the samples before a discontinuity (only used by the
+    // receiver thread)
+    struct sc_audio_concealer gap_concealer;
+
     // Non-zero compensation applied (only used by the receiver thread)
     bool compensation_active;
 
+    // The resampler has been used since its last reset, so it may retain
+    // samples. Without compensation, the samples are converted without
+    // libswresample. (only used by the receiver thread)
+    bool swr_used;
+
     // Set to true the first time a sample is received
     atomic_bool received;
 
@@ -60,11 +83,23 @@ struct sc_audio_regulator {
 
     // PTS of the next expected packet (useful to detect discontinuities)
     int64_t next_expected_pts;
+
+    // PTS of the end of the audio buffer, published for the player thread,
+    // protected by a sequence counter (odd while the receiver thread updates
+    // the buffered samples)
+    atomic_uint_least32_t pts_seq;
+    atomic_int_least64_t end_pts;
+
+    // PTS of the first sample returned by the last pull, or -1 if unknown
+    // (only used by the player thread)
+    int64_t played_pts;
 };
 
 bool
 sc_audio_regulator_init(struct sc_audio_regulator *ar, size_t sample_size,
-                        const AVCodecContext *ctx, uint32_t target_buffering);
+                        const AVCodecContext *ctx, uint32_t target_buffering,
+                        uint32_t min_target_buffering,
+                        uint32_t max_target_buffering);
 
 void
 sc_audio_regulator_destroy(struct sc_audio_regulator *ar);
@@ -0,0 +1,97 @@
+#include "av_sync.h"
+
+#include <inttypes.h>
+
+#include "util/log.h"
+
+static void
+sc_av_sync_reset_report(struct sc_av_sync *sync, sc_tick date) {
+    sync->report_date = date;
+    sync->offset_sum = 0;
+    sync->offset_min = INT64_MAX;
+    sync->offset_max = INT64_MIN;
+    sync->offset_count = 0;
+}
+
+void
+sc_av_sync_init(struct sc_av_sync *sync) {
+    sc_clock_init(&sync->audio_clock);
+    atomic_init(&sync->audio_offset, 0);
+    atomic_init(&sync->audio_clock_valid, false);
+
+    sc_av_sync_reset_report(sync, 0);
+    sync->total_abs_offset_sum = 0;
+    sync->total_abs_offset_max = 0;
+    sync->total_offset_count = 0;
+}
+
+void
+sc_av_sync_update_audio(struct sc_av_sync *sync, sc_tick system, sc_tick pts) {
+    sc_clock_update(&sync->audio_clock, system, pts);
+
+    atomic_store_explicit(&sync->audio_offset, sync->audio_clock.offset,
+                          memory_order_relaxed);
+    atomic_store_explicit(&sync->audio_clock_valid, true,
+                          memory_order_release);
+}
+
+bool
+sc_av_sync_get_audio_offset(struct sc_av_sync *sync, sc_tick *offset) {
+    bool valid = atomic_load_explicit(&sync->audio_clock_valid,
+                                      memory_order_acquire);
+    if (!valid) {
+        return false;
+    }
+
+    *offset = atomic_load_explicit(&sync->audio_offset, memory_order_relaxed);
+    return true;
+}
+
+void
+sc_av_sync_report_video(struct sc_av_sync *sync, sc_tick pts, sc_tick date,
+                        sc_tick video_delay) {
+    sc_tick audio_offset;
+    if (!sc_av_sync_get_audio_offset(sync, &audio_offset)) {
+        // Nothing to compare to
+        return;
+    }
+
+    if (!sync->report_date) {
+        sync->report_date = date;
+    }
+
+    // Positive if the video is late
+    sc_tick offset = date - (pts + audio_offset);
+    sc_tick abs_offset = offset < 0 ? -offset : offset;
+
+    sync->offset_sum += offset;
+    sync->offset_min = MIN(sync->offset_min, offset);
+    sync->offset_max = MAX(sync->offset_max, offset);
+    ++sync->offset_count;
+
+    sync->total_abs_offset_sum += abs_offset;
+    sync->total_abs_offset_max = MAX(sync->total_abs_offset_max, abs_offset);
+    ++sync->total_offset_count;
+
+    if (date - sync->report_date >= SC_TICK_FROM_SEC(1)) {
+        LOGV("[AV] A/V offset: avg=%" PRItick " min=%" PRItick " max=%"
+             PRItick " ms (video delay=%" PRItick " ms)",
+             SC_TICK_TO_MS(sync->offset_sum / (sc_tick) sync->offset_count),
+             SC_TICK_TO_MS(sync->offset_min), SC_TICK_TO_MS(sync->offset_max),
+             SC_TICK_TO_MS(video_delay));
+        sc_av_sync_reset_report(sync, date);
+    }
+}
+
+void
+sc_av_sync_log_summary(struct sc_av_sync *sync) {
+    if (!sync->total_offset_count) {
+        return;
+    }
+
+    sc_tick avg = sync->total_abs_offset_sum
+                / (sc_tick) sync->total_offset_count;
+    LOGI("[AV] A/V offset: avg=%" PRItick " ms, max=%" PRItick " ms (%"
+         PRIu64 " frames)", SC_TICK_TO_MS(avg),
+         SC_TICK_TO_MS(sync->total_abs_offset_max), sync->total_offset_count);
+}
@@ -0,0 +1,92 @@
+#ifndef SC_AV_SYNC_H
+#define SC_AV_SYNC_H
+
+#include "common.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "clock.h"
+#include "util/tick.h"
+
+// Never delay the video frames by more than 1 second
+#define SC_AV_SYNC_MAX_DELAY SC_TICK_FROM_SEC(1)
+
+/**
+ * Audio/video synchronization (audio master)
+ *
+ * By default, video frames are presented as soon as they are decoded (or after
+ * a fixed --video-buffer delay), while audio samples are played after the
+ * audio buffering delay, so the audio is late.
+ *
+ * In audio master mode, the audio playback clock (the relation between the
+ * PTS of the samples being played and the system time) is estimated from the
+ * samples consumed by the audio player. The video frames are then presented
+ * when the audio samples having the same PTS are played: the video delay
+ * follows the audio latency dynamically.
+ *
+ * The audio clock is updated from the audio player thread, and read from the
+ * video buffering thread (without locking).
+ */
+struct sc_av_sync {
+    // Estimation of the audio clock (only used by the audio player thread)
+    struct sc_clock audio_clock;
+
+    // The audio clock offset (system time = PTS + offset), published for the
+    // video thread
+    atomic_int_least64_t audio_offset;
+    // Set to true once the audio clock offset has been estimated
+    atomic_bool audio_clock_valid;
+
+    // A/V offset statistics (only used by the video thread). The A/V offset
+    // is the difference between the presentation date of a video frame and
+    // the playback date of the audio samples having the same PTS (positive if
+    // the video is late).
+    sc_tick report_date;
+    sc_tick offset_sum;
+    sc_tick offset_min;
+    sc_tick offset_max;
+    unsigned offset_count;
+
+    sc_tick total_abs_offset_sum;
+    sc_tick total_abs_offset_max;
+    uint64_t total_offset_count;
+};
+
+void
+sc_av_sync_init(struct sc_av_sync *sync);
+
+/**
+ * Update the audio clock
+ *
+ * Called from the audio player thread, with the PTS (in microseconds) of the
+ * samples which will be played at the given system time.
+ */
+void
+sc_av_sync_update_audio(struct sc_av_sync *sync, sc_tick system, sc_tick pts);
+
+/**
+ * Get the audio clock offset (system time = PTS + offset)
+ *
+ * Return false if the audio clock is not known yet.
+ */
+bool
+sc_av_sync_get_audio_offset(struct sc_av_sync *sync, sc_tick *offset);
+
+/**
+ * Measure the A/V offset of a video frame presented at the given date
+ *
+ * The statistics are logged every second (in verbose mode).
+ */
+void
+sc_av_sync_report_video(struct sc_av_sync *sync, sc_tick pts, sc_tick date,
+                        sc_tick video_delay);
+
+/**
+ * Log the A/V offset statistics since the beginning
+ */
+void
+sc_av_sync_log_summary(struct sc_av_sync *sync);
+
+#endif
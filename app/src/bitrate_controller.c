@@ -0,0 +1,148 @@
+#include "bitrate_controller.h"
+
+#include <assert.h>
+
+#define SC_BITRATE_SAMPLE_INTERVAL SC_TICK_FROM_MS(500)
+// Congestion if the send queue holds more than this duration of video
+#define SC_BITRATE_QUEUE_HIGH SC_TICK_FROM_MS(400)
+// Step up only if the send queue holds less than this duration of video
+#define SC_BITRATE_QUEUE_LOW SC_TICK_FROM_MS(100)
+// Minimal delay between two steps down, to let the queue drain
+#define SC_BITRATE_DOWN_INTERVAL SC_TICK_FROM_SEC(1)
+#define SC_BITRATE_UP_DELAY_MIN SC_TICK_FROM_SEC(5)
+#define SC_BITRATE_UP_DELAY_MAX SC_TICK_FROM_SEC(60)
+// A step down less than this delay after a step up means that the step up
+// failed
+#define SC_BITRATE_UP_PROBE_DURATION SC_TICK_FROM_SEC(5)
+
+static const struct sc_bitrate_level {
+    uint8_t bit_rate_percent;
+    uint8_t size_percent;
+} levels[] = {
+    {100, 100},
+    { 70, 100},
+    { 50,  75},
+    { 35,  75},
+    { 25,  50},
+    { 15,  50},
+};
+
+static_assert(ARRAY_LEN(levels) == SC_BITRATE_CONTROLLER_LEVELS,
+              "Unexpected number of levels");
+
+static uint32_t
+get_level_bit_rate(const struct sc_bitrate_controller *bc, unsigned level) {
+    assert(level < ARRAY_LEN(levels));
+    return (uint64_t) bc->max_bit_rate * levels[level].bit_rate_percent / 100;
+}
+
+void
+sc_bitrate_controller_init(struct sc_bitrate_controller *bc,
+                           uint32_t max_bit_rate, uint16_t max_size,
+                           sc_tick now) {
+    assert(max_bit_rate);
+    bc->max_bit_rate = max_bit_rate;
+    bc->max_size = max_size;
+    bc->level = 0;
+    bc->sample_time = now;
+    bc->queue_bytes = 0;
+    bc->acked_bytes = 0;
+    bc->dropped_frames = 0;
+    bc->throughput = 0;
+    bc->stable_since = now;
+    bc->last_up_time = now - SC_BITRATE_UP_PROBE_DURATION;
+    bc->last_down_time = now - SC_BITRATE_DOWN_INTERVAL;
+    bc->up_delay = SC_BITRATE_UP_DELAY_MIN;
+}
+
+enum sc_bitrate_change
+sc_bitrate_controller_update(struct sc_bitrate_controller *bc, sc_tick now,
+                             const struct sc_bitrate_sample *sample) {
+    sc_tick elapsed = now - bc->sample_time;
+    if (elapsed < SC_BITRATE_SAMPLE_INTERVAL) {
+        return SC_BITRATE_KEEP;
+    }
+
+    // The acknowledged bytes may be underestimated (e.g. after a reconnection)
+    uint64_t acked = sample->acked_bytes > bc->acked_bytes
+                   ? sample->acked_bytes - bc->acked_bytes : 0;
+    uint64_t throughput = acked * 8 * SC_TICK_FREQ / elapsed;
+    bc->throughput = MIN(throughput, UINT32_MAX);
+    bool dropped = sample->dropped_frames != bc->dropped_frames;
+    // After a step down, the queue may still be high, but it is draining
+    bool growing = sample->queue_bytes >= bc->queue_bytes;
+
+    bc->sample_time = now;
+    bc->queue_bytes = sample->queue_bytes;
+    bc->acked_bytes = sample->acked_bytes;
+    bc->dropped_frames = sample->dropped_frames;
+
+    uint32_t bit_rate = get_level_bit_rate(bc, bc->level);
+    sc_tick queue_duration =
+        (sc_tick) sample->queue_bytes * 8 * SC_TICK_FREQ / bit_rate;
+
+    if (dropped || (growing && queue_duration > SC_BITRATE_QUEUE_HIGH)) {
+        // Congestion
+        bc->stable_since = now;
+
+        if (bc->level == ARRAY_LEN(levels) - 1
+                || now - bc->last_down_time < SC_BITRATE_DOWN_INTERVAL) {
+            return SC_BITRATE_KEEP;
+        }
+
+        if (now - bc->last_up_time < SC_BITRATE_UP_PROBE_DURATION) {
+            // The last step up failed, wait longer before the next one
+            bc->up_delay = MIN(bc->up_delay * 2, SC_BITRATE_UP_DELAY_MAX);
+        }
+
+        // One level at a time: a persistent congestion steps down again
+        // after SC_BITRATE_DOWN_INTERVAL (a single throughput sample is too
+        // noisy to jump directly to a lower level)
+        ++bc->level;
+        bc->last_down_time = now;
+        return SC_BITRATE_DOWN;
+    }
+
+    if (!bc->level || queue_duration > SC_BITRATE_QUEUE_LOW
+            || now - bc->stable_since < bc->up_delay) {
+        return SC_BITRATE_KEEP;
+    }
+
+    if (now - bc->last_down_time > SC_BITRATE_UP_DELAY_MAX) {
+        // No congestion for a long time, forget the failed steps up
+        bc->up_delay = SC_BITRATE_UP_DELAY_MIN;
+    }
+
+    --bc->level;
+    bc->last_up_time = now;
+    bc->stable_since = now;
+    return SC_BITRATE_UP;
+}
+
+uint32_t
+sc_bitrate_controller_get_bit_rate(const struct sc_bitrate_controller *bc) {
+    return get_level_bit_rate(bc, bc->level);
+}
+
+void
+sc_bitrate_controller_get_size(const struct sc_bitrate_controller *bc,
+                               uint16_t src_width, uint16_t src_height,
+                               uint16_t *width, uint16_t *height) {
+    uint32_t max_size = bc->max_size ? bc->max_size
+                                     : MAX(src_width, src_height);
+    max_size = max_size * levels[bc->level].size_percent / 100;
+
+    uint32_t w = src_width;
+    uint32_t h = src_height;
+    if (w >= h && w > max_size) {
+        h = h * max_size / w;
+        w = max_size;
+    } else if (h > w && h > max_size) {
+        w = w * max_size / h;
+        h = max_size;
+    }
+
+    // Even dimensions
+    *width = MAX(w & ~1u, 2);
+    *height = MAX(h & ~1u, 2);
+}
@@ -0,0 +1,96 @@
+#ifndef SC_BITRATE_CONTROLLER_H
+#define SC_BITRATE_CONTROLLER_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "util/tick.h"
+
+/**
+ * Adaptive bitrate and resolution of a re-encoded stream
+ *
+ * The quality is selected among a fixed ladder of levels (a bitrate and a
+ * maximum size, both relative to the configured maximum values), level 0
+ * being the best.
+ *
+ * It steps down one level when the network does not keep up (the send queue
+ * holds too much video and is still growing, or frames are dropped), then
+ * again at most once per second while the congestion persists. It steps up one
+ * level at a time, after a period without congestion. If a step up is quickly
+ * followed by a step down, the period before the next step up is doubled.
+ */
+
+#define SC_BITRATE_CONTROLLER_LEVELS 6
+
+struct sc_bitrate_controller {
+    uint32_t max_bit_rate;
+    // 0 for the source size
+    uint16_t max_size;
+
+    unsigned level;
+
+    sc_tick sample_time;
+    size_t queue_bytes;
+    uint64_t acked_bytes;
+    uint64_t dropped_frames;
+    // acknowledged throughput measured during the last sample interval, in
+    // bits per second (for the logs)
+    uint32_t throughput;
+
+    sc_tick stable_since; // no congestion since this time
+    sc_tick last_up_time;
+    sc_tick last_down_time;
+    sc_tick up_delay;
+};
+
+struct sc_bitrate_sample {
+    // bytes waiting to be sent
+    size_t queue_bytes;
+    // total bytes acknowledged by the peer (or at least written to the socket)
+    uint64_t acked_bytes;
+    // total frames dropped by the sender
+    uint64_t dropped_frames;
+};
+
+enum sc_bitrate_change {
+    SC_BITRATE_KEEP,
+    SC_BITRATE_DOWN,
+    SC_BITRATE_UP,
+};
+
+void
+sc_bitrate_controller_init(struct sc_bitrate_controller *bc,
+                           uint32_t max_bit_rate, uint16_t max_size,
+                           sc_tick now);
+
+/**
+ * Update the controller with the current state of the sender
+ *
+ * It may be called as often as needed, samples are only taken at a regular
+ * interval.
+ */
+enum sc_bitrate_change
+sc_bitrate_controller_update(struct sc_bitrate_controller *bc, sc_tick now,
+                             const struct sc_bitrate_sample *sample);
+
+/**
+ * Return the target bitrate of the current level, in bits per second
+ */
+uint32_t
+sc_bitrate_controller_get_bit_rate(const struct sc_bitrate_controller *bc);
+
+/**
+ * Compute the encoded frame size of the current level for a source size
+ *
+ * The aspect ratio is preserved, the dimensions are rounded to even values (as
+ * required by YUV 4:2:0) and never exceed the source size.
+ */
+void
+sc_bitrate_controller_get_size(const struct sc_bitrate_controller *bc,
+                               uint16_t src_width, uint16_t src_height,
+                               uint16_t *width, uint16_t *height);
+
+#endif
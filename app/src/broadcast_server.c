@@ -0,0 +1,876 @@
+#include "broadcast_server.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "util/log.h"
+#include "websocket.h"
+
+// Above this number of queued bytes, a client drops the media packets until
+// the next key packet (and above SC_WEBSOCKET_QUEUE_LIMIT_FACTOR times this
+// value, even the key packets)
+#define SC_BROADCAST_CLIENT_WATERMARK (4 * 1024 * 1024)
+#define SC_BROADCAST_CLIENT_MAX_PACKETS 1024
+// Max size of the packets cached since the last key packet for late joiners
+#define SC_BROADCAST_GOP_CACHE_MAX (4 * 1024 * 1024)
+// Max number of buffers written by one sendmsg() call (2 per packet)
+#define SC_BROADCAST_IOV_MAX 64
+
+#ifdef MSG_NOSIGNAL
+// Do not raise SIGPIPE if the peer closed the connection
+# define SC_BROADCAST_SEND_FLAGS (MSG_DONTWAIT | MSG_NOSIGNAL)
+#else
+# define SC_BROADCAST_SEND_FLAGS MSG_DONTWAIT
+#endif
+
+struct sc_broadcast_packet *
+sc_broadcast_packet_new(size_t size) {
+    struct sc_broadcast_packet *p = malloc(sizeof(*p) + size);
+    if (!p) {
+        LOG_OOM();
+        return NULL;
+    }
+
+    atomic_init(&p->refs, 1);
+    p->flags = 0;
+    p->header_len = 0;
+    p->payload = p->data;
+    p->payload_len = size;
+    p->packet = NULL;
+    return p;
+}
+
+struct sc_broadcast_packet *
+sc_broadcast_packet_new_ref(const AVPacket *packet) {
+    struct sc_broadcast_packet *p = malloc(sizeof(*p));
+    if (!p) {
+        LOG_OOM();
+        return NULL;
+    }
+
+    p->packet = av_packet_alloc();
+    if (!p->packet) {
+        LOG_OOM();
+        free(p);
+        return NULL;
+    }
+
+    if (av_packet_ref(p->packet, packet)) {
+        LOG_OOM();
+        av_packet_free(&p->packet);
+        free(p);
+        return NULL;
+    }
+
+    atomic_init(&p->refs, 1);
+    p->flags = 0;
+    p->header_len = 0;
+    p->payload = p->packet->data;
+    p->payload_len = p->packet->size;
+    return p;
+}
+
+void
+sc_broadcast_packet_unref(struct sc_broadcast_packet *p) {
+    unsigned refs =
+        atomic_fetch_sub_explicit(&p->refs, 1, memory_order_acq_rel);
+    assert(refs);
+    if (refs == 1) {
+        if (p->packet) {
+            av_packet_free(&p->packet);
+        }
+        free(p);
+    }
+}
+
+static bool
+set_non_blocking(struct sc_broadcast_server *server, int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        LOGE("%s server: could not set non-blocking mode: %s",
+             server->ops->name, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void
+sc_broadcast_server_wake(struct sc_broadcast_server *server) {
+    uint8_t b = 0;
+    // If the pipe is full, the server thread will be woken up anyway
+    ssize_t w = write(server->wake_fds[1], &b, 1);
+    (void) w;
+}
+
+static struct sc_broadcast_client *
+sc_broadcast_client_new(struct sc_broadcast_server *server, int fd,
+                        uint32_t id) {
+    assert(server->ops->client_size >= sizeof(struct sc_broadcast_client));
+
+    // The fields of the embedding structure are zeroed
+    struct sc_broadcast_client *client = calloc(1, server->ops->client_size);
+    if (!client) {
+        LOG_OOM();
+        return NULL;
+    }
+
+    client->fd = fd;
+    client->id = id;
+    client->connect_time = sc_tick_now();
+    client->request_len = 0;
+    client->requested = false;
+    client->closing = false;
+    sc_vecdeque_init(&client->queue);
+    client->offset = 0;
+    client->failed = false;
+    client->sent_bytes = 0;
+    client->sent_frames = 0;
+    client->released_packets = 0;
+    client->released_bytes = 0;
+
+    client->state = SC_BROADCAST_CLIENT_IDLE;
+    client->closed = false;
+    sc_vecdeque_init(&client->pending);
+    client->queue_packets = 0;
+    client->queue_bytes = 0;
+    client->wait_key_frame = false;
+    memset(&client->stats, 0, sizeof(client->stats));
+    client->stats.id = id;
+    return client;
+}
+
+// The caller must lock the mutex
+static void
+sc_broadcast_client_get_stats(struct sc_broadcast_client *client, sc_tick now,
+                              struct sc_broadcast_client_stats *stats) {
+    *stats = client->stats;
+    stats->duration = now - client->connect_time;
+    stats->queue_packets = client->queue_packets;
+    stats->queue_bytes = client->queue_bytes;
+}
+
+// The client must not be referenced by the server anymore
+static void
+sc_broadcast_client_destroy(struct sc_broadcast_server *server,
+                            struct sc_broadcast_client *client) {
+    if (client->state == SC_BROADCAST_CLIENT_STREAMING) {
+        struct sc_broadcast_client_stats stats;
+        sc_broadcast_client_get_stats(client, sc_tick_now(), &stats);
+        stats.bytes_sent += client->sent_bytes;
+        stats.frames += client->sent_frames;
+        LOGI("%s client %" PRIu32 " disconnected after %" PRItick " ms: %"
+             PRIu64 " frames sent (%" PRIu64 " KiB), %" PRIu64 " dropped, "
+             "max queue %zu KiB", server->ops->name, stats.id,
+             SC_TICK_TO_MS(stats.duration), stats.frames,
+             stats.bytes_sent / 1024, stats.dropped_frames,
+             stats.max_queue_bytes / 1024);
+    }
+
+    close(client->fd);
+    while (!sc_vecdeque_is_empty(&client->queue)) {
+        sc_broadcast_packet_unref(sc_vecdeque_pop(&client->queue));
+    }
+    while (!sc_vecdeque_is_empty(&client->pending)) {
+        sc_broadcast_packet_unref(sc_vecdeque_pop(&client->pending));
+    }
+    sc_vecdeque_destroy(&client->queue);
+    sc_vecdeque_destroy(&client->pending);
+    free(client);
+}
+
+// Return whether the client must send the packet (or drop it) (the caller
+// must lock the mutex)
+static bool
+sc_broadcast_client_accept(struct sc_broadcast_client *client,
+                           const struct sc_broadcast_packet *packet) {
+    if (!(packet->flags & SC_BROADCAST_PACKET_MEDIA)
+            || packet->flags & SC_BROADCAST_PACKET_CONFIG) {
+        // never dropped
+        return true;
+    }
+
+    bool full = client->queue_packets >= SC_BROADCAST_CLIENT_MAX_PACKETS;
+    if (packet->flags & SC_BROADCAST_PACKET_KEY) {
+        if (full || client->queue_bytes > SC_BROADCAST_CLIENT_WATERMARK
+                                        * SC_WEBSOCKET_QUEUE_LIMIT_FACTOR) {
+            client->wait_key_frame = true;
+            return false;
+        }
+        client->wait_key_frame = false;
+        return true;
+    }
+
+    if (full || client->wait_key_frame
+             || client->queue_bytes > SC_BROADCAST_CLIENT_WATERMARK) {
+        // The next packets depend on this one, drop until the next key packet
+        client->wait_key_frame = true;
+        return false;
+    }
+
+    return true;
+}
+
+bool
+sc_broadcast_client_push(struct sc_broadcast_client *client,
+                         struct sc_broadcast_packet *packet) {
+    if (!sc_vecdeque_push(&client->pending, packet)) {
+        LOG_OOM();
+        client->closed = true;
+        return false;
+    }
+
+    sc_broadcast_packet_ref(packet);
+    ++client->queue_packets;
+    client->queue_bytes += sc_broadcast_packet_size(packet);
+    if (client->queue_bytes > client->stats.max_queue_bytes) {
+        client->stats.max_queue_bytes = client->queue_bytes;
+    }
+    return true;
+}
+
+// Report what the server thread wrote since the last call, and take the
+// packets queued meanwhile (the caller must lock the mutex)
+static void
+sc_broadcast_client_sync(struct sc_broadcast_client *client) {
+    client->stats.bytes_sent += client->sent_bytes;
+    client->stats.frames += client->sent_frames;
+    assert(client->queue_packets >= client->released_packets);
+    assert(client->queue_bytes >= client->released_bytes);
+    client->queue_packets -= client->released_packets;
+    client->queue_bytes -= client->released_bytes;
+    client->sent_bytes = 0;
+    client->sent_frames = 0;
+    client->released_packets = 0;
+    client->released_bytes = 0;
+
+    while (!client->failed && !sc_vecdeque_is_empty(&client->pending)) {
+        struct sc_broadcast_packet *p = sc_vecdeque_peek(&client->pending);
+        if (!sc_vecdeque_push(&client->queue, p)) {
+            LOG_OOM();
+            client->failed = true;
+            break;
+        }
+        (void) sc_vecdeque_pop(&client->pending);
+    }
+
+    if (client->failed) {
+        client->closed = true;
+    }
+}
+
+size_t
+sc_broadcast_server_start_client(struct sc_broadcast_server *server,
+                                 struct sc_broadcast_client *client) {
+    client->state = SC_BROADCAST_CLIENT_STREAMING;
+
+    size_t count = server->gop.size;
+    if (server->gop_truncated) {
+        // Only the key packet is usable
+        count = MIN(count, 1);
+    }
+    // Without any cached key packet, wait for the next one
+    client->wait_key_frame = server->gop_truncated || !count;
+
+    for (size_t i = 0; i < count; ++i) {
+        sc_broadcast_client_push(client, server->gop.data[i]);
+    }
+
+    return count;
+}
+
+void
+sc_broadcast_server_respond(struct sc_broadcast_server *server,
+                            struct sc_broadcast_client *client,
+                            const char *status, const char *content_type,
+                            const char *body, size_t body_len) {
+    char header[256];
+    int len = snprintf(header, sizeof(header),
+                       "HTTP/1.1 %s\r\n"
+                       "Content-Type: %s\r\n"
+                       "Content-Length: %zu\r\n"
+                       "Access-Control-Allow-Origin: *\r\n"
+                       "Connection: close\r\n"
+                       "\r\n", status, content_type, body_len);
+    assert(len > 0 && (size_t) len < sizeof(header));
+
+    struct sc_broadcast_packet *p = sc_broadcast_packet_new(len + body_len);
+    if (!p) {
+        client->failed = true;
+        return;
+    }
+
+    memcpy(p->data, header, len);
+    memcpy(&p->data[len], body, body_len);
+
+    sc_mutex_lock(&server->mutex);
+    sc_broadcast_client_push(client, p);
+    client->state = SC_BROADCAST_CLIENT_IDLE;
+    sc_mutex_unlock(&server->mutex);
+
+    sc_broadcast_packet_unref(p);
+    client->closing = true;
+}
+
+void
+sc_broadcast_server_respond_error(struct sc_broadcast_server *server,
+                                  struct sc_broadcast_client *client,
+                                  const char *status) {
+    sc_broadcast_server_respond(server, client, status, "text/plain", status,
+                                strlen(status));
+}
+
+// Return false if the client must be closed
+static bool
+sc_broadcast_server_read_client(struct sc_broadcast_server *server,
+                                struct sc_broadcast_client *client) {
+    uint8_t buf[4096];
+    uint8_t *target;
+    size_t size;
+    if (!client->requested) {
+        // Keep space for the null byte
+        size = sizeof(client->request) - 1 - client->request_len;
+        if (!size) {
+            client->requested = true;
+            sc_broadcast_server_respond_error(server, client,
+                                              "431 Request Header Fields "
+                                              "Too Large");
+            return true;
+        }
+        target = (uint8_t *) &client->request[client->request_len];
+    } else {
+        target = buf;
+        size = sizeof(buf);
+    }
+
+    ssize_t r = recv(client->fd, target, size, 0);
+    if (r == -1) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    if (!r) {
+        // Connection closed
+        return false;
+    }
+
+    if (!client->requested) {
+        client->request_len += r;
+        client->request[client->request_len] = '\0';
+        if (strstr(client->request, "\r\n\r\n")) {
+            client->requested = true;
+            server->ops->on_request(server, client);
+        }
+        return true;
+    }
+
+    if (client->closing || !server->ops->on_input) {
+        // Ignored
+        return true;
+    }
+
+    return server->ops->on_input(server, client, buf, r);
+}
+
+// Write as many queued bytes as possible without blocking, return false if
+// the client must be closed (called without the mutex, the progress is
+// reported by sc_broadcast_client_sync())
+static bool
+sc_broadcast_client_write(struct sc_broadcast_client *client,
+                          const char *name) {
+    while (!sc_vecdeque_is_empty(&client->queue)) {
+        struct iovec iov[SC_BROADCAST_IOV_MAX];
+        int iovcnt = 0;
+        size_t total = 0;
+
+        size_t skip = client->offset;
+        size_t count = sc_vecdeque_size(&client->queue);
+        for (size_t i = 0; i < count && iovcnt + 2 <= SC_BROADCAST_IOV_MAX;
+                ++i) {
+            struct sc_broadcast_packet *p = sc_vecdeque_get(&client->queue, i);
+            if (skip < p->header_len) {
+                iov[iovcnt].iov_base = &p->header[skip];
+                iov[iovcnt].iov_len = p->header_len - skip;
+                total += iov[iovcnt++].iov_len;
+                skip = 0;
+            } else {
+                skip -= p->header_len;
+            }
+
+            if (skip < p->payload_len) {
+                iov[iovcnt].iov_base = (uint8_t *) p->payload + skip;
+                iov[iovcnt].iov_len = p->payload_len - skip;
+                total += iov[iovcnt++].iov_len;
+            }
+            skip = 0;
+        }
+
+        struct msghdr msg = {
+            .msg_iov = iov,
+            .msg_iovlen = iovcnt,
+        };
+        ssize_t w = sendmsg(client->fd, &msg, SC_BROADCAST_SEND_FLAGS);
+        if (w == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            LOGD("%s client %" PRIu32 ": could not write: %s", name,
+                 client->id, strerror(errno));
+            return false;
+        }
+
+        size_t written = w;
+        client->sent_bytes += written;
+
+        // Release the packets completely written
+        while (written) {
+            struct sc_broadcast_packet *p = sc_vecdeque_peek(&client->queue);
+            size_t remaining = sc_broadcast_packet_size(p) - client->offset;
+            if (written < remaining) {
+                client->offset += written;
+                break;
+            }
+
+            written -= remaining;
+            client->offset = 0;
+            (void) sc_vecdeque_pop(&client->queue);
+            ++client->released_packets;
+            client->released_bytes += sc_broadcast_packet_size(p);
+            if (p->flags & SC_BROADCAST_PACKET_MEDIA) {
+                ++client->sent_frames;
+            }
+            sc_broadcast_packet_unref(p);
+        }
+
+        if ((size_t) w < total) {
+            // The socket buffer is full
+            return true;
+        }
+    }
+
+    // Once the HTTP response is written, close the connection
+    return !client->closing;
+}
+
+// Accept the pending connections, `count` clients being connected
+static void
+sc_broadcast_server_accept(struct sc_broadcast_server *server, size_t count) {
+    const char *name = server->ops->name;
+
+    while (count < SC_BROADCAST_SERVER_MAX_CLIENTS) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOGW("%s server: could not accept: %s", name,
+                     strerror(errno));
+            }
+            return;
+        }
+
+        if (!set_non_blocking(server, fd)) {
+            close(fd);
+            continue;
+        }
+
+        // Send each packet as soon as possible
+        int nodelay = 1;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+                       sizeof(nodelay))) {
+            LOGW("%s server: could not set TCP_NODELAY", name);
+        }
+
+        uint32_t id = ++server->next_client_id;
+        struct sc_broadcast_client *client =
+            sc_broadcast_client_new(server, fd, id);
+        if (!client) {
+            close(fd);
+            continue;
+        }
+
+        sc_mutex_lock(&server->mutex);
+        bool ok = sc_vector_push(&server->clients, client);
+        sc_mutex_unlock(&server->mutex);
+
+        if (!ok) {
+            LOG_OOM();
+            sc_broadcast_client_destroy(server, client);
+            continue;
+        }
+
+        ++count;
+    }
+}
+
+// Read and write the clients sockets, without the mutex
+static void
+sc_broadcast_server_process(struct sc_broadcast_server *server,
+                            struct sc_broadcast_client *const *clients,
+                            size_t count, struct pollfd *pfds) {
+    for (size_t i = 0; i < count; ++i) {
+        struct sc_broadcast_client *client = clients[i];
+        short revents = pfds[i].revents;
+        if (client->failed || !revents) {
+            continue;
+        }
+
+        if (revents & POLLIN) {
+            bool requested = client->requested;
+            if (!sc_broadcast_server_read_client(server, client)) {
+                client->failed = true;
+                continue;
+            }
+
+            if (!requested && client->requested) {
+                // Take the response queued by the request handler, to write
+                // it immediately
+                sc_mutex_lock(&server->mutex);
+                sc_broadcast_client_sync(client);
+                sc_mutex_unlock(&server->mutex);
+            }
+        }
+
+        if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            client->failed = true;
+            continue;
+        }
+
+        if (!sc_broadcast_client_write(client, server->ops->name)) {
+            client->failed = true;
+        }
+    }
+}
+
+// Move the closed clients to `removed` (the caller must lock the mutex)
+static size_t
+sc_broadcast_server_remove_closed(struct sc_broadcast_server *server,
+                                  struct sc_broadcast_client **removed) {
+    size_t count = 0;
+    size_t i = 0;
+    while (i < server->clients.size) {
+        struct sc_broadcast_client *client = server->clients.data[i];
+        if (client->closed) {
+            sc_vector_remove(&server->clients, i);
+            removed[count++] = client;
+        } else {
+            ++i;
+        }
+    }
+    return count;
+}
+
+static int
+run_broadcast_server(void *data) {
+    struct sc_broadcast_server *server = data;
+
+    // wake pipe, listening socket, then clients
+    struct pollfd pfds[2 + SC_BROADCAST_SERVER_MAX_CLIENTS];
+    // the clients matching the polled fds
+    struct sc_broadcast_client *clients[SC_BROADCAST_SERVER_MAX_CLIENTS];
+    struct sc_broadcast_client *removed[SC_BROADCAST_SERVER_MAX_CLIENTS];
+
+    for (;;) {
+        // The mutex is only held to exchange the packets and the progress
+        // with the producer threads, never during the socket I/O
+        sc_mutex_lock(&server->mutex);
+        for (size_t i = 0; i < server->clients.size; ++i) {
+            sc_broadcast_client_sync(server->clients.data[i]);
+        }
+        size_t removed_count =
+            sc_broadcast_server_remove_closed(server, removed);
+        bool stopped = server->stopped;
+        size_t count = server->clients.size;
+        for (size_t i = 0; i < count; ++i) {
+            clients[i] = server->clients.data[i];
+        }
+        sc_mutex_unlock(&server->mutex);
+
+        for (size_t i = 0; i < removed_count; ++i) {
+            sc_broadcast_client_destroy(server, removed[i]);
+        }
+
+        if (stopped) {
+            break;
+        }
+
+        pfds[0].fd = server->wake_fds[0];
+        pfds[0].events = POLLIN;
+        pfds[1].fd = server->listen_fd;
+        // If the clients limit is reached, the connections remain pending
+        pfds[1].events = count < SC_BROADCAST_SERVER_MAX_CLIENTS ? POLLIN : 0;
+
+        for (size_t i = 0; i < count; ++i) {
+            struct sc_broadcast_client *client = clients[i];
+            pfds[2 + i].fd = client->fd;
+            pfds[2 + i].events = POLLIN;
+            if (!sc_vecdeque_is_empty(&client->queue)) {
+                pfds[2 + i].events |= POLLOUT;
+            }
+        }
+
+        int r = poll(pfds, 2 + count, -1);
+        if (r == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("%s server: could not poll: %s", server->ops->name,
+                 strerror(errno));
+            break;
+        }
+
+        if (pfds[0].revents) {
+            uint8_t buf[64];
+            while (read(server->wake_fds[0], buf, sizeof(buf)) > 0) {
+                // drain
+            }
+        }
+
+        sc_broadcast_server_process(server, clients, count, &pfds[2]);
+
+        if (pfds[1].revents & POLLIN) {
+            sc_broadcast_server_accept(server, count);
+        }
+    }
+
+    LOGD("%s server thread ended", server->ops->name);
+    return 0;
+}
+
+void
+sc_broadcast_server_clear_cache(struct sc_broadcast_server *server) {
+    for (size_t i = 0; i < server->gop.size; ++i) {
+        sc_broadcast_packet_unref(server->gop.data[i]);
+    }
+    server->gop.size = 0;
+    server->gop_bytes = 0;
+    server->gop_truncated = false;
+}
+
+bool
+sc_broadcast_server_cache(struct sc_broadcast_server *server,
+                          struct sc_broadcast_packet *packet) {
+    size_t size = sc_broadcast_packet_size(packet);
+
+    if (packet->flags & SC_BROADCAST_PACKET_KEY) {
+        sc_broadcast_server_clear_cache(server);
+    } else if (!server->gop.size || server->gop_truncated) {
+        // No usable key packet
+        return true;
+    } else if (server->gop_bytes + size > SC_BROADCAST_GOP_CACHE_MAX) {
+        // Late joiners will only receive the key packet, then wait for the
+        // next one
+        LOGD("%s server: packets cache full, truncated", server->ops->name);
+        server->gop_truncated = true;
+        return true;
+    }
+
+    if (!sc_vector_push(&server->gop, packet)) {
+        LOG_OOM();
+        return false;
+    }
+
+    sc_broadcast_packet_ref(packet);
+    server->gop_bytes += size;
+    return true;
+}
+
+void
+sc_broadcast_server_broadcast(struct sc_broadcast_server *server,
+                              struct sc_broadcast_packet *packet) {
+    bool wake = false;
+    for (size_t i = 0; i < server->clients.size; ++i) {
+        struct sc_broadcast_client *client = server->clients.data[i];
+        if (client->state != SC_BROADCAST_CLIENT_STREAMING || client->closed) {
+            continue;
+        }
+
+        if (!sc_broadcast_client_accept(client, packet)) {
+            ++client->stats.dropped_frames;
+            continue;
+        }
+
+        bool was_empty = sc_vecdeque_is_empty(&client->pending);
+        if (!sc_broadcast_client_push(client, packet) || was_empty) {
+            // The server thread must take the packet and poll POLLOUT for
+            // this client (or remove it on error)
+            wake = true;
+        }
+    }
+
+    if (wake) {
+        sc_broadcast_server_wake(server);
+    }
+}
+
+static bool
+sc_broadcast_server_listen(struct sc_broadcast_server *server) {
+    const char *name = server->ops->name;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        LOGE("%s server: could not create socket: %s", name, strerror(errno));
+        return false;
+    }
+
+    int reuse = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse))) {
+        LOGW("%s server: could not set SO_REUSEADDR", name);
+    }
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        .sin_port = htons(server->port),
+    };
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+        LOGE("%s server: could not bind port %" PRIu16 ": %s", name,
+             server->port, strerror(errno));
+        goto error;
+    }
+
+    if (listen(fd, SOMAXCONN)) {
+        LOGE("%s server: could not listen: %s", name, strerror(errno));
+        goto error;
+    }
+
+    socklen_t addrlen = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr *) &addr, &addrlen)) {
+        LOGE("%s server: could not get socket name: %s", name,
+             strerror(errno));
+        goto error;
+    }
+
+    if (!set_non_blocking(server, fd)) {
+        goto error;
+    }
+
+    server->listen_fd = fd;
+    server->port = ntohs(addr.sin_port);
+    return true;
+
+error:
+    close(fd);
+    return false;
+}
+
+bool
+sc_broadcast_server_init(struct sc_broadcast_server *server, uint16_t port,
+                         const struct sc_broadcast_server_ops *ops) {
+    assert(ops->name && ops->thread_name);
+    assert(ops->on_request);
+
+    server->ops = ops;
+
+    if (!sc_mutex_init(&server->mutex)) {
+        return false;
+    }
+
+    if (pipe(server->wake_fds)) {
+        LOGE("%s server: could not create pipe: %s", ops->name,
+             strerror(errno));
+        sc_mutex_destroy(&server->mutex);
+        return false;
+    }
+
+    if (!set_non_blocking(server, server->wake_fds[0])
+            || !set_non_blocking(server, server->wake_fds[1])) {
+        close(server->wake_fds[0]);
+        close(server->wake_fds[1]);
+        sc_mutex_destroy(&server->mutex);
+        return false;
+    }
+
+    server->port = port;
+    server->listen_fd = -1;
+    server->next_client_id = 0;
+    server->stopped = false;
+    sc_vector_init(&server->clients);
+    sc_vector_init(&server->gop);
+    server->gop_bytes = 0;
+    server->gop_truncated = false;
+
+    return true;
+}
+
+bool
+sc_broadcast_server_start(struct sc_broadcast_server *server) {
+    if (!sc_broadcast_server_listen(server)) {
+        return false;
+    }
+
+    bool ok = sc_thread_create(&server->thread, run_broadcast_server,
+                               server->ops->thread_name, server);
+    if (!ok) {
+        LOGE("Could not start %s server thread", server->ops->name);
+        close(server->listen_fd);
+        server->listen_fd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+void
+sc_broadcast_server_stop(struct sc_broadcast_server *server) {
+    sc_mutex_lock(&server->mutex);
+    server->stopped = true;
+    sc_broadcast_server_wake(server);
+    sc_mutex_unlock(&server->mutex);
+}
+
+void
+sc_broadcast_server_join(struct sc_broadcast_server *server) {
+    sc_thread_join(&server->thread, NULL);
+}
+
+void
+sc_broadcast_server_destroy(struct sc_broadcast_server *server) {
+    for (size_t i = 0; i < server->clients.size; ++i) {
+        sc_broadcast_client_destroy(server, server->clients.data[i]);
+    }
+    sc_vector_destroy(&server->clients);
+
+    sc_broadcast_server_clear_cache(server);
+    sc_vector_destroy(&server->gop);
+
+    if (server->listen_fd != -1) {
+        close(server->listen_fd);
+    }
+    close(server->wake_fds[0]);
+    close(server->wake_fds[1]);
+    sc_mutex_destroy(&server->mutex);
+}
+
+size_t
+sc_broadcast_server_get_stats(struct sc_broadcast_server *server,
+                              struct sc_broadcast_client_stats *stats,
+                              size_t max) {
+    sc_mutex_lock(&server->mutex);
+
+    sc_tick now = sc_tick_now();
+    size_t count = 0;
+    for (size_t i = 0; i < server->clients.size; ++i) {
+        struct sc_broadcast_client *client = server->clients.data[i];
+        if (client->state != SC_BROADCAST_CLIENT_STREAMING) {
+            continue;
+        }
+        if (count < max) {
+            sc_broadcast_client_get_stats(client, now, &stats[count]);
+        }
+        ++count;
+    }
+
+    sc_mutex_unlock(&server->mutex);
+    return count;
+}
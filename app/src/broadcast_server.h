@@ -0,0 +1,321 @@
+#ifndef SC_BROADCAST_SERVER_H
+#define SC_BROADCAST_SERVER_H
+
+#include "common.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <libavcodec/avcodec.h>
+
+#include "util/thread.h"
+#include "util/tick.h"
+#include "util/vecdeque.h"
+#include "util/vector.h"
+
+/**
+ * HTTP broadcast server
+ *
+ * Common part of the servers streaming the same bytes to several clients
+ * over HTTP (see ws_server.h and fmp4_server.h): listen on localhost, accept
+ * the clients, read their HTTP request, and write the shared packets to each
+ * one from a single thread, without blocking.
+ *
+ * The packets are shared between the clients (refcounted, never copied). Each
+ * client has its own bounded queue: a slow client drops media packets (until
+ * the next key packet) without impacting the others.
+ *
+ * The media packets since the last key packet are cached, so that a late
+ * joiner can start immediately.
+ *
+ * The packets are queued by the producer threads with the mutex locked. The
+ * server thread only holds the mutex to take them (and to report its
+ * progress), never during the socket I/O.
+ */
+
+#define SC_BROADCAST_SERVER_MAX_CLIENTS 128
+#define SC_BROADCAST_REQUEST_MAX_SIZE 4096
+#define SC_BROADCAST_PACKET_HEADER_MAX_SIZE 32
+
+// A media packet, counted in the stats and dropped if the client is too slow
+#define SC_BROADCAST_PACKET_MEDIA 0x1
+// A media packet which does not depend on the previous ones
+#define SC_BROADCAST_PACKET_KEY 0x2
+// A media packet which must never be dropped (e.g. a codec config)
+#define SC_BROADCAST_PACKET_CONFIG 0x4
+
+/**
+ * Bytes to send, shared by all the clients
+ *
+ * They are written as is (no copy into a send buffer): the header, then the
+ * payload.
+ */
+struct sc_broadcast_packet {
+    // The packet may be released by the server thread (once written) or by a
+    // producer thread (once removed from the cache), without the mutex
+    atomic_uint refs;
+    uint8_t flags; // SC_BROADCAST_PACKET_*
+
+    uint8_t header[SC_BROADCAST_PACKET_HEADER_MAX_SIZE];
+    size_t header_len;
+    const uint8_t *payload;
+    size_t payload_len;
+
+    // the owner of the payload, if it references a packet (the data is shared
+    // with the other packet sinks)
+    AVPacket *packet;
+    // the payload otherwise
+    uint8_t data[];
+};
+
+enum sc_broadcast_client_state {
+    // not receiving the stream (the request is not handled yet, or an HTTP
+    // response is being written before closing)
+    SC_BROADCAST_CLIENT_IDLE,
+    // the request is handled, waiting for the stream to start
+    SC_BROADCAST_CLIENT_WAITING,
+    SC_BROADCAST_CLIENT_STREAMING,
+};
+
+struct sc_broadcast_client_stats {
+    uint32_t id;
+    sc_tick duration; // since the connection
+    uint64_t frames; // media packets sent
+    uint64_t dropped_frames;
+    uint64_t bytes_sent;
+    size_t queue_packets;
+    size_t queue_bytes;
+    size_t max_queue_bytes;
+};
+
+/**
+ * A connected client
+ *
+ * It may be embedded in a larger structure (see
+ * sc_broadcast_server_ops.client_size).
+ */
+struct sc_broadcast_client {
+    // The fields below are only accessed by the server thread
+
+    int fd;
+    uint32_t id;
+    sc_tick connect_time;
+
+    char request[SC_BROADCAST_REQUEST_MAX_SIZE];
+    size_t request_len;
+    // the request has been handled, any further input is passed to
+    // on_input()
+    bool requested;
+    // an HTTP response is queued, close once it is written
+    bool closing;
+
+    // the packets being written, taken from `pending`
+    struct SC_VECDEQUE(struct sc_broadcast_packet *) queue;
+    // bytes of the front packet already written
+    size_t offset;
+    // the connection failed, reported to `closed` on the next sync
+    bool failed;
+    // written since the last sync, then reported to the fields below
+    uint64_t sent_bytes;
+    uint64_t sent_frames;
+    size_t released_packets;
+    size_t released_bytes;
+
+    // The fields below are protected by the server mutex
+
+    enum sc_broadcast_client_state state;
+    // set on error, the client is removed by the server thread
+    bool closed;
+    // the packets queued for the server thread
+    struct SC_VECDEQUE(struct sc_broadcast_packet *) pending;
+    // the packets (and their bytes) in `pending` and `queue`
+    size_t queue_packets;
+    size_t queue_bytes;
+    bool wait_key_frame;
+
+    struct sc_broadcast_client_stats stats;
+};
+
+struct sc_broadcast_server;
+
+struct sc_broadcast_server_ops {
+    // the prefix of the logs (e.g. "WebSocket")
+    const char *name;
+    const char *thread_name;
+    // the size of the structure embedding struct sc_broadcast_client (zeroed
+    // on connection)
+    size_t client_size;
+
+    /**
+     * Handle the HTTP request of a client (null-terminated in
+     * client->request)
+     *
+     * Called by the server thread, without the mutex. It must queue a
+     * response (see sc_broadcast_server_respond()), or start the client with
+     * the mutex locked.
+     */
+    void (*on_request)(struct sc_broadcast_server *server,
+                       struct sc_broadcast_client *client);
+
+    /**
+     * Handle the bytes received once the request is handled (optional,
+     * discarded otherwise)
+     *
+     * Called by the server thread, without the mutex. Return false to close
+     * the connection.
+     */
+    bool (*on_input)(struct sc_broadcast_server *server,
+                     struct sc_broadcast_client *client, const uint8_t *data,
+                     size_t len);
+};
+
+struct sc_broadcast_server {
+    const struct sc_broadcast_server_ops *ops;
+
+    // 0 to listen on any available port (then set by
+    // sc_broadcast_server_start())
+    uint16_t port;
+    int listen_fd;
+    // to wake up the server thread from poll()
+    int wake_fds[2];
+
+    sc_thread thread;
+    sc_mutex mutex;
+
+    // only accessed by the server thread
+    uint32_t next_client_id;
+
+    // All the fields below are protected by the mutex
+
+    bool stopped;
+
+    // only modified by the server thread
+    struct SC_VECTOR(struct sc_broadcast_client *) clients;
+
+    // the media packets since the last key packet (gop[0] is the key packet)
+    struct SC_VECTOR(struct sc_broadcast_packet *) gop;
+    size_t gop_bytes;
+    // the packets cache has been truncated since the last key packet
+    bool gop_truncated;
+};
+
+/**
+ * Allocate a packet with `size` bytes of payload, to be written by the caller
+ */
+struct sc_broadcast_packet *
+sc_broadcast_packet_new(size_t size);
+
+/**
+ * Create a packet whose payload references the data of `packet` (no copy)
+ */
+struct sc_broadcast_packet *
+sc_broadcast_packet_new_ref(const AVPacket *packet);
+
+static inline size_t
+sc_broadcast_packet_size(const struct sc_broadcast_packet *p) {
+    return p->header_len + p->payload_len;
+}
+
+static inline void
+sc_broadcast_packet_ref(struct sc_broadcast_packet *p) {
+    atomic_fetch_add_explicit(&p->refs, 1, memory_order_relaxed);
+}
+
+void
+sc_broadcast_packet_unref(struct sc_broadcast_packet *p);
+
+bool
+sc_broadcast_server_init(struct sc_broadcast_server *server, uint16_t port,
+                         const struct sc_broadcast_server_ops *ops);
+
+/**
+ * Listen on localhost and start the server thread
+ */
+bool
+sc_broadcast_server_start(struct sc_broadcast_server *server);
+
+void
+sc_broadcast_server_stop(struct sc_broadcast_server *server);
+
+void
+sc_broadcast_server_join(struct sc_broadcast_server *server);
+
+void
+sc_broadcast_server_destroy(struct sc_broadcast_server *server);
+
+/**
+ * Wake up the server thread, to write the packets queued
+ */
+void
+sc_broadcast_server_wake(struct sc_broadcast_server *server);
+
+/**
+ * Queue a packet for a client, whatever its state (the caller must lock the
+ * mutex)
+ *
+ * The server thread must be woken up.
+ */
+bool
+sc_broadcast_client_push(struct sc_broadcast_client *client,
+                         struct sc_broadcast_packet *packet);
+
+/**
+ * Queue the cached packets to a client, then the next broadcast packets
+ * (the caller must lock the mutex)
+ *
+ * Return the number of cached packets queued.
+ */
+size_t
+sc_broadcast_server_start_client(struct sc_broadcast_server *server,
+                                 struct sc_broadcast_client *client);
+
+/**
+ * Cache a media packet for late joiners (the caller must lock the mutex)
+ */
+bool
+sc_broadcast_server_cache(struct sc_broadcast_server *server,
+                          struct sc_broadcast_packet *packet);
+
+/**
+ * Clear the cached packets (the caller must lock the mutex)
+ */
+void
+sc_broadcast_server_clear_cache(struct sc_broadcast_server *server);
+
+/**
+ * Queue a packet to all the streaming clients, unless they are too slow (the
+ * caller must lock the mutex)
+ */
+void
+sc_broadcast_server_broadcast(struct sc_broadcast_server *server,
+                              struct sc_broadcast_packet *packet);
+
+/**
+ * Queue an HTTP response to a client, then close the connection
+ *
+ * Called from on_request(), without the mutex.
+ */
+void
+sc_broadcast_server_respond(struct sc_broadcast_server *server,
+                            struct sc_broadcast_client *client,
+                            const char *status, const char *content_type,
+                            const char *body, size_t body_len);
+
+void
+sc_broadcast_server_respond_error(struct sc_broadcast_server *server,
+                                  struct sc_broadcast_client *client,
+                                  const char *status);
+
+/**
+ * Get the stats of (at most `max`) streaming clients
+ *
+ * Return the number of streaming clients (which may be greater than `max`).
+ * The caller must NOT lock the mutex.
+ */
+size_t
+sc_broadcast_server_get_stats(struct sc_broadcast_server *server,
+                              struct sc_broadcast_client_stats *stats,
+                              size_t max);
+
+#endif
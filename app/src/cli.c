@@ -2,6 +2,7 @@
 
 #include <assert.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -75,6 +76,8 @@ enum {
     OPT_LIST_DISPLAYS,
     OPT_REQUIRE_AUDIO,
     OPT_AUDIO_BUFFER,
+    OPT_AUDIO_BUFFER_MAX,
+    OPT_AUDIO_BUFFER_MIN,
     OPT_AUDIO_OUTPUT_BUFFER,
     OPT_NO_DISPLAY,
     OPT_NO_VIDEO,
@@ -114,11 +117,28 @@ enum {
     OPT_NO_VD_SYSTEM_DECORATIONS,
     OPT_NO_VD_DESTROY_CONTENT,
     OPT_DISPLAY_IME_POLICY,
+    OPT_RECORD_INDEX,
+    OPT_V4L2_FORMAT,
+    OPT_V4L2_SIZE,
+    OPT_SHM_SINK,
+    OPT_SHM_SLOTS,
+    OPT_WS_SERVER_PORT,
+    OPT_RTP_HOST,
+    OPT_RTP_PORT,
+    OPT_RTP_SDP,
+    OPT_FMP4_SERVER_PORT,
+    OPT_AV_SYNC,
+    OPT_AUDIO_SAMPLE_RATE,
+    OPT_AUDIO_CHANNELS,
+    OPT_AUDIO_EXPORT,
+    OPT_AUDIO_EXPORT_FORMAT,
+    OPT_AUDIO_EXPORT_RATE,
 
     //新增参数信息
     OPT_ENABLE_WEBRTC,
     OPT_WEBSOCKET_URL,
     OPT_WEBRTC_SIGNAL_URL,
+    OPT_WEBRTC_MAX_SIZE,
     OPT_USER_ID,
 };
 
@@ -185,6 +205,31 @@ static const struct sc_option options[] = {
                 "likelihood of buffer underrun (causing audio glitches).\n"
                 "Default is 50.",
     },
+    {
+        .longopt_id = OPT_AUDIO_BUFFER_MAX,
+        .longopt = "audio-buffer-max",
+        .argdesc = "ms",
+        .text = "Adapt the audio buffering delay to the network jitter, up to "
+                "the given value (in milliseconds).\n"
+                "The buffering delay starts at the --audio-buffer value.\n"
+                "Default is the --audio-buffer value (disabled).",
+    },
+    {
+        .longopt_id = OPT_AUDIO_BUFFER_MIN,
+        .longopt = "audio-buffer-min",
+        .argdesc = "ms",
+        .text = "Adapt the audio buffering delay to the network jitter, down "
+                "to the given value (in milliseconds).\n"
+                "Default is the --audio-buffer value (disabled).",
+    },
+    {
+        .longopt_id = OPT_AUDIO_CHANNELS,
+        .longopt = "audio-channels",
+        .argdesc = "value",
+        .text = "Capture the audio with the given number of channels (1 for "
+                "mono, 2 for stereo).\n"
+                "Default is 2.",
+    },
     {
         .longopt_id = OPT_AUDIO_CODEC,
         .longopt = "audio-codec",
@@ -219,6 +264,53 @@ static const struct sc_option options[] = {
                 "codec provided by --audio-codec).\n"
                 "The available encoders can be listed by --list-encoders.",
     },
+    {
+        .longopt_id = OPT_AUDIO_EXPORT,
+        .longopt = "audio-export",
+        .argdesc = "target",
+        .text = "Export the decoded audio as raw PCM to a local consumer "
+                "(e.g. a speech-to-text pipeline). The target is one of:\n"
+                " - \"fifo:<path>\": a named pipe (created if it does not "
+                "exist).\n"
+                " - \"unix:<path>\": a UNIX stream socket (scrcpy listens, one "
+                "client at a time).\n"
+                " - \"shm:<name>\": a POSIX shared memory ring (see "
+                "--shm-sink).\n"
+                "The samples are interleaved, in host byte order, with the "
+                "channel count of the captured audio. If the consumer is too "
+                "slow, the oldest samples are dropped (the audio playback is "
+                "not affected).\n"
+                "It works with --no-audio-playback.\n"
+                "This option is not available on Windows.",
+    },
+    {
+        .longopt_id = OPT_AUDIO_EXPORT_FORMAT,
+        .longopt = "audio-export-format",
+        .argdesc = "format",
+        .text = "Select the sample format of the exported PCM (s16 or f32).\n"
+                "Default is s16.",
+    },
+    {
+        .longopt_id = OPT_AUDIO_EXPORT_RATE,
+        .longopt = "audio-export-rate",
+        .argdesc = "value",
+        .text = "Resample the exported PCM to the given sample rate (in Hz), "
+                "between 8000 and 48000.\n"
+                "Default is the captured audio sample rate (see "
+                "--audio-sample-rate).",
+    },
+    {
+        .longopt_id = OPT_AUDIO_SAMPLE_RATE,
+        .longopt = "audio-sample-rate",
+        .argdesc = "value",
+        .text = "Capture the audio at the given sample rate (in Hz), between "
+                "8000 and 48000.\n"
+                "With the opus codec, it must be 8000, 12000, 16000, 24000 or "
+                "48000.\n"
+                "A lower sample rate (typically 16000 with --audio-channels=1 "
+                "for voice) reduces the bandwidth and the CPU usage.\n"
+                "Default is 48000.",
+    },
     {
         .longopt_id = OPT_AUDIO_SOURCE,
         .longopt = "audio-source",
@@ -260,6 +352,18 @@ static const struct sc_option options[] = {
                 "a higher value (10). Do not change this setting otherwise.\n"
                 "Default is 5.",
     },
+    {
+        .longopt_id = OPT_AV_SYNC,
+        .longopt = "av-sync",
+        .text = "Synchronize the video with the audio playback: the video "
+                "frames are delayed dynamically so that they are displayed "
+                "when the audio samples captured at the same time are "
+                "played.\n"
+                "This increases the video latency (by the audio latency).\n"
+                "Until the audio playback starts, the video is delayed by "
+                "the --video-buffer value if set, or by the expected audio "
+                "latency.",
+    },
     {
         .shortopt = 'b',
         .longopt = "video-bit-rate",
@@ -427,6 +531,16 @@ static const struct sc_option options[] = {
         .longopt = "encoder",
         .argdesc = "name",
     },
+    {
+        .longopt_id = OPT_FMP4_SERVER_PORT,
+        .longopt = "fmp4-server-port",
+        .argdesc = "port",
+        .text = "Serve the video and audio streams (remuxed, not re-encoded) "
+                "as a live fragmented MP4 over HTTP on the given local port "
+                "(listening on localhost), at "
+                "http://localhost:port/stream.mp4.\n"
+                "The stream is playable by Media Source Extensions players.",
+    },
     {
         .shortopt = 'f',
         .longopt = "fullscreen",
@@ -807,7 +921,12 @@ static const struct sc_option options[] = {
         .argdesc = "file.mp4",
         .text = "Record screen to file.\n"
                 "The format is determined by the --record-format option if "
-                "set, or by the file extension.",
+                "set, or by the file extension.\n"
+                "If the file is \"-\", the recording is written to stdout. "
+                "On a non-seekable output (stdout or a FIFO), the recording "
+                "is written in order without any seek, and flushed after "
+                "every packet: MP4 is fragmented and Matroska is written in "
+                "live mode. MPEG-TS (--record-format=ts) is also supported.",
     },
     {
         .longopt_id = OPT_RAW_KEY_EVENTS,
@@ -818,8 +937,17 @@ static const struct sc_option options[] = {
         .longopt_id = OPT_RECORD_FORMAT,
         .longopt = "record-format",
         .argdesc = "format",
-        .text = "Force recording format (mp4, mkv, m4a, mka, opus, aac, flac "
-                "or wav).",
+        .text = "Force recording format (mp4, mkv, m4a, mka, opus, aac, flac, "
+                "wav or ts).",
+    },
+    {
+        .longopt_id = OPT_RECORD_INDEX,
+        .longopt = "record-index",
+        .text = "Write a keyframe index alongside an MPEG-TS recording, to "
+                "the record filename followed by \".idx\".\n"
+                "Each entry contains the PTS, the byte offset and the size of "
+                "a video keyframe. It allows to seek or extract a time range "
+                "without demuxing the whole file.",
     },
     {
         .longopt_id = OPT_RECORD_ORIENTATION,
@@ -853,6 +981,30 @@ static const struct sc_option options[] = {
         .longopt = "rotation",
         .argdesc = "value",
     },
+    {
+        .longopt_id = OPT_RTP_HOST,
+        .longopt = "rtp-host",
+        .argdesc = "host",
+        .text = "Set the destination host of the RTP stream (see "
+                "--rtp-port).\n"
+                "Default is 127.0.0.1.",
+    },
+    {
+        .longopt_id = OPT_RTP_PORT,
+        .longopt = "rtp-port",
+        .argdesc = "port",
+        .text = "Send the video (H.264 or H.265) and audio (Opus) streams "
+                "over RTP/UDP, as encoded by the device: the video to the "
+                "given port, the audio to port + 2 (the RTCP sender reports "
+                "are sent to port + 1 and port + 3).",
+    },
+    {
+        .longopt_id = OPT_RTP_SDP,
+        .longopt = "rtp-sdp",
+        .argdesc = "file",
+        .text = "Write the SDP description of the RTP streams (see "
+                "--rtp-port) to the given file, for the receivers.",
+    },
     {
         .shortopt = 's',
         .longopt = "serial",
@@ -872,6 +1024,22 @@ static const struct sc_option options[] = {
         .text = "Set the screen off timeout while scrcpy is running (restore "
                 "the initial value on exit).",
     },
+    {
+        .longopt_id = OPT_SHM_SINK,
+        .longopt = "shm-sink",
+        .argdesc = "name",
+        .text = "Publish the decoded video frames (YUV420P) to a POSIX shared "
+                "memory ring (e.g. \"/scrcpy\"), to be read by local "
+                "processes.\n"
+                "This option is not available on Windows.",
+    },
+    {
+        .longopt_id = OPT_SHM_SLOTS,
+        .longopt = "shm-slots",
+        .argdesc = "value",
+        .text = "Set the number of frames in the shared memory ring.\n"
+                "Default is 3.",
+    },
     {
         .longopt_id = OPT_SHORTCUT_MOD,
         .longopt = "shortcut-mod",
@@ -980,6 +1148,25 @@ static const struct sc_option options[] = {
                 "Default is 0 (no buffering).\n"
                 "This option is only available on Linux.",
     },
+    {
+        .longopt_id = OPT_V4L2_FORMAT,
+        .longopt = "v4l2-format",
+        .argdesc = "format",
+        .text = "Select the pixel format of the V4L2 sink.\n"
+                "Possible values are \"yuv420\", \"nv12\" and \"yuyv\".\n"
+                "Default is yuv420 (the decoded format, no conversion).\n"
+                "This option is only available on Linux.",
+    },
+    {
+        .longopt_id = OPT_V4L2_SIZE,
+        .longopt = "v4l2-size",
+        .argdesc = "<width>x<height>",
+        .text = "Scale the video sent to the V4L2 sink to the given size "
+                "(the aspect ratio is not preserved).\n"
+                "Both dimensions must be even.\n"
+                "Default is the video size.\n"
+                "This option is only available on Linux.",
+    },
     {
         .longopt_id = OPT_VIDEO_BUFFER,
         .longopt = "video-buffer",
@@ -1069,11 +1256,24 @@ static const struct sc_option options[] = {
         .text = "Set the initial window height.\n"
                 "Default is 0 (automatic).",
     },
+    {
+        .longopt_id = OPT_WS_SERVER_PORT,
+        .longopt = "ws-server-port",
+        .argdesc = "port",
+        .text = "Serve the encoded video stream to WebSocket viewers (e.g. "
+                "browsers) on the given local port (listening on "
+                "localhost).\n"
+                "The stats of the viewers are available at "
+                "http://localhost:port/stats.",
+    },
 
     {
         .longopt_id = OPT_ENABLE_WEBRTC,
         .longopt = "enable-webrtc",
-        .text = "Enable WebRTC streaming mode.",
+        .text = "Enable WebRTC streaming mode.\n"
+                "If the video codec is h264, the packets encoded by the "
+                "device are forwarded as is. Otherwise, the video is decoded "
+                "and re-encoded to H.264.",
     },
     {
         .longopt_id = OPT_WEBSOCKET_URL,
@@ -1087,6 +1287,18 @@ static const struct sc_option options[] = {
         .argdesc = "url",
         .text = "WebRTC signaling URL.",
     },
+    {
+        .longopt_id = OPT_WEBRTC_MAX_SIZE,
+        .longopt = "webrtc-max-size",
+        .argdesc = "value",
+        .text = "Limit both the width and height of the video re-encoded "
+                "for WebRTC to value (if the video codec is not h264). The "
+                "other dimension is computed so that the aspect ratio is "
+                "preserved. The video is re-encoded at the bit rate set by "
+                "--video-bit-rate, further reduced (with the resolution) on "
+                "network congestion.\n"
+                "Default is 0 (unlimited).",
+    },
     {
         .longopt_id = OPT_USER_ID,
         .longopt = "user-id",
@@ -1634,6 +1846,31 @@ parse_bit_rate(const char *s, uint32_t *bit_rate) {
     return true;
 }
 
+static bool
+parse_audio_sample_rate(const char *s, uint32_t *sample_rate) {
+    long value;
+    bool ok = parse_integer_arg(s, &value, true, 8000, 48000,
+                                "audio sample rate");
+    if (!ok) {
+        return false;
+    }
+
+    *sample_rate = (uint32_t) value;
+    return true;
+}
+
+static bool
+parse_audio_channels(const char *s, uint8_t *channels) {
+    long value;
+    bool ok = parse_integer_arg(s, &value, false, 1, 2, "audio channels");
+    if (!ok) {
+        return false;
+    }
+
+    *channels = (uint8_t) value;
+    return true;
+}
+
 static bool
 parse_max_size(const char *s, uint16_t *max_size) {
     long value;
@@ -1980,6 +2217,9 @@ get_record_format(const char *name) {
     if (!strcmp(name, "wav")) {
         return SC_RECORD_FORMAT_WAV;
     }
+    if (!strcmp(name, "ts")) {
+        return SC_RECORD_FORMAT_TS;
+    }
     return 0;
 }
 
@@ -1988,7 +2228,7 @@ parse_record_format(const char *optarg, enum sc_record_format *format) {
     enum sc_record_format fmt = get_record_format(optarg);
     if (!fmt) {
         LOGE("Unsupported record format: %s (expected mp4, mkv, m4a, mka, "
-             "opus, aac, flac or wav)", optarg);
+             "opus, aac, flac, wav or ts)", optarg);
         return false;
     }
 
@@ -1996,6 +2236,111 @@ parse_record_format(const char *optarg, enum sc_record_format *format) {
     return true;
 }
 
+#ifdef HAVE_V4L2
+static bool
+parse_v4l2_format(const char *optarg, enum sc_v4l2_format *format) {
+    if (!strcmp(optarg, "yuv420")) {
+        *format = SC_V4L2_FORMAT_YUV420;
+        return true;
+    }
+    if (!strcmp(optarg, "nv12")) {
+        *format = SC_V4L2_FORMAT_NV12;
+        return true;
+    }
+    if (!strcmp(optarg, "yuyv")) {
+        *format = SC_V4L2_FORMAT_YUYV;
+        return true;
+    }
+    LOGE("Unsupported v4l2 format: %s (expected yuv420, nv12 or yuyv)",
+         optarg);
+    return false;
+}
+
+static bool
+parse_v4l2_size(const char *s, uint16_t *width, uint16_t *height) {
+    long values[2];
+    size_t count = parse_integers_arg(s, 'x', 2, values, 2, 0xFFFF,
+                                      "v4l2 size");
+    if (!count) {
+        return false;
+    }
+
+    if (count != 2) {
+        LOGE("Invalid v4l2 size (expected <width>x<height>): %s", s);
+        return false;
+    }
+
+    if (values[0] % 2 || values[1] % 2) {
+        LOGE("Invalid v4l2 size (dimensions must be even): %s", s);
+        return false;
+    }
+
+    *width = values[0];
+    *height = values[1];
+    return true;
+}
+#endif
+
+#ifdef HAVE_SHM
+static bool
+parse_audio_export(const char *optarg, enum sc_audio_export_target *target,
+                   const char **path) {
+    static const struct {
+        const char *prefix;
+        enum sc_audio_export_target target;
+    } targets[] = {
+        {"fifo:", SC_AUDIO_EXPORT_TARGET_FIFO},
+        {"unix:", SC_AUDIO_EXPORT_TARGET_UNIX},
+        {"shm:", SC_AUDIO_EXPORT_TARGET_SHM},
+    };
+
+    for (size_t i = 0; i < ARRAY_LEN(targets); ++i) {
+        size_t len = strlen(targets[i].prefix);
+        if (!strncmp(optarg, targets[i].prefix, len)) {
+            if (!optarg[len]) {
+                LOGE("Missing audio export path: %s", optarg);
+                return false;
+            }
+
+            *target = targets[i].target;
+            *path = &optarg[len];
+            return true;
+        }
+    }
+
+    LOGE("Unsupported audio export target: %s (expected fifo:<path>, "
+         "unix:<path> or shm:<name>)", optarg);
+    return false;
+}
+
+static bool
+parse_audio_export_format(const char *optarg,
+                          enum sc_audio_export_format *format) {
+    if (!strcmp(optarg, "s16")) {
+        *format = SC_AUDIO_EXPORT_FORMAT_S16;
+        return true;
+    }
+    if (!strcmp(optarg, "f32")) {
+        *format = SC_AUDIO_EXPORT_FORMAT_F32;
+        return true;
+    }
+    LOGE("Unsupported audio export format: %s (expected s16 or f32)", optarg);
+    return false;
+}
+
+static bool
+parse_shm_slots(const char *s, uint32_t *slots) {
+    long value;
+    bool ok = parse_integer_arg(s, &value, false, 2, 64, "shm slots");
+    if (!ok) {
+        return false;
+    }
+
+    *slots = (uint32_t) value;
+    return true;
+}
+#endif
+
 static bool
 parse_ip(const char *optarg, uint32_t *ipv4) {
     return net_parse_ipv4(optarg, ipv4);
@@ -2444,6 +2789,9 @@ parse_args_with_getopt(struct scrcpy_cli_args *args, int argc, char *argv[],
                     return false;
                 }
                 break;
+            case OPT_RECORD_INDEX:
+                opts->record_index = true;
+                break;
             case 'h':
                 args->help = true;
                 break;
@@ -2715,6 +3063,17 @@ parse_args_with_getopt(struct scrcpy_cli_args *args, int argc, char *argv[],
                     return false;
                 }
                 break;
+            case OPT_AUDIO_SAMPLE_RATE:
+                if (!parse_audio_sample_rate(optarg,
+                                             &opts->audio_sample_rate)) {
+                    return false;
+                }
+                break;
+            case OPT_AUDIO_CHANNELS:
+                if (!parse_audio_channels(optarg, &opts->audio_channels)) {
+                    return false;
+                }
+                break;
             case OPT_AUDIO_CODEC:
                 if (!parse_audio_codec(optarg, &opts->audio_codec)) {
                     return false;
@@ -2747,6 +3106,85 @@ parse_args_with_getopt(struct scrcpy_cli_args *args, int argc, char *argv[],
                 LOGE("V4L2 (--v4l2-buffer) is disabled (or unsupported on this "
                      "platform).");
                 return false;
+#endif
+            case OPT_SHM_SINK:
+#ifdef HAVE_SHM
+                opts->shm_sink = optarg;
+                break;
+#else
+                LOGE("Shared memory sink (--shm-sink) is not supported on this "
+                     "platform.");
+                return false;
+#endif
+            case OPT_AUDIO_EXPORT:
+#ifdef HAVE_SHM
+                if (!parse_audio_export(optarg, &opts->audio_export_target,
+                                        &opts->audio_export_path)) {
+                    return false;
+                }
+                break;
+#else
+                LOGE("Audio export (--audio-export) is not supported on this "
+                     "platform.");
+                return false;
+#endif
+            case OPT_AUDIO_EXPORT_FORMAT:
+#ifdef HAVE_SHM
+                if (!parse_audio_export_format(optarg,
+                                               &opts->audio_export_format)) {
+                    return false;
+                }
+                break;
+#else
+                LOGE("Audio export (--audio-export-format) is not supported "
+                     "on this platform.");
+                return false;
+#endif
+            case OPT_AUDIO_EXPORT_RATE:
+#ifdef HAVE_SHM
+                if (!parse_audio_sample_rate(optarg,
+                                             &opts->audio_export_rate)) {
+                    return false;
+                }
+                break;
+#else
+                LOGE("Audio export (--audio-export-rate) is not supported on "
+                     "this platform.");
+                return false;
+#endif
+            case OPT_SHM_SLOTS:
+#ifdef HAVE_SHM
+                if (!parse_shm_slots(optarg, &opts->shm_slots)) {
+                    return false;
+                }
+                break;
+#else
+                LOGE("Shared memory sink (--shm-slots) is not supported on "
+                     "this platform.");
+                return false;
+#endif
+            case OPT_V4L2_FORMAT:
+#ifdef HAVE_V4L2
+                if (!parse_v4l2_format(optarg, &opts->v4l2_format)) {
+                    return false;
+                }
+                break;
+#else
+                LOGE("V4L2 (--v4l2-format) is disabled (or unsupported on this "
+                     "platform).");
+                return false;
+#endif
+            case OPT_V4L2_SIZE:
+#ifdef HAVE_V4L2
+                if (!parse_v4l2_size(optarg, &opts->v4l2_width,
+                                     &opts->v4l2_height)) {
+                    return false;
+                }
+                break;
+#else
+                LOGE("V4L2 (--v4l2-size) is disabled (or unsupported on this "
+                     "platform).");
+                return false;
 #endif
             case OPT_LIST_ENCODERS:
                 opts->list |= SC_OPTION_LIST_ENCODERS;
@@ -2771,6 +3209,19 @@ parse_args_with_getopt(struct scrcpy_cli_args *args, int argc, char *argv[],
                     return false;
                 }
                 break;
+            case OPT_AUDIO_BUFFER_MAX:
+                if (!parse_buffering_time(optarg, &opts->audio_buffer_max)) {
+                    return false;
+                }
+                break;
+            case OPT_AUDIO_BUFFER_MIN:
+                if (!parse_buffering_time(optarg, &opts->audio_buffer_min)) {
+                    return false;
+                }
+                break;
+            case OPT_AV_SYNC:
+                opts->av_sync = true;
+                break;
             case OPT_AUDIO_OUTPUT_BUFFER:
                 if (!parse_audio_output_buffer(optarg,
                                                &opts->audio_output_buffer)) {
@@ -2864,6 +3315,45 @@ parse_args_with_getopt(struct scrcpy_cli_args *args, int argc, char *argv[],
                 }
                 break;
 
+            case OPT_WS_SERVER_PORT:
+                if (!parse_port(optarg, &opts->ws_server_port)) {
+                    return false;
+                }
+                if (!opts->ws_server_port) {
+                    LOGE("Invalid WebSocket server port: 0");
+                    return false;
+                }
+                break;
+
+            case OPT_FMP4_SERVER_PORT:
+                if (!parse_port(optarg, &opts->fmp4_server_port)) {
+                    return false;
+                }
+                if (!opts->fmp4_server_port) {
+                    LOGE("Invalid fMP4 server port: 0");
+                    return false;
+                }
+                break;
+
+            case OPT_RTP_HOST:
+                opts->rtp_host = optarg;
+                break;
+
+            case OPT_RTP_PORT:
+                if (!parse_port(optarg, &opts->rtp_port)) {
+                    return false;
+                }
+                if (!opts->rtp_port || opts->rtp_port > 0xFFFF - 3) {
+                    // The audio RTCP port is rtp_port + 3
+                    LOGE("Invalid RTP port: %" PRIu16, opts->rtp_port);
+                    return false;
+                }
+                break;
+
+            case OPT_RTP_SDP:
+                opts->rtp_sdp = optarg;
+                break;
+
             case OPT_ENABLE_WEBRTC:
                 opts->enable_webrtc = true;
                 break;
@@ -2873,6 +3363,11 @@ parse_args_with_getopt(struct scrcpy_cli_args *args, int argc, char *argv[],
             case OPT_WEBRTC_SIGNAL_URL:
                 opts->webrtc_signal_url = optarg;
                 break;
+            case OPT_WEBRTC_MAX_SIZE:
+                if (!parse_max_size(optarg, &opts->webrtc_max_size)) {
+                    return false;
+                }
+                break;
             case OPT_USER_ID:
                 if (!parse_user_id(optarg, &opts->user_id)) {
                     return false;
@@ -2908,12 +3403,18 @@ parse_args_with_getopt(struct scrcpy_cli_args *args, int argc, char *argv[],
 
     bool otg = false;
     bool v4l2 = false;
+    bool shm = false;
+    bool audio_export = false;
 #ifdef HAVE_USB
     otg = opts->otg;
 #endif
 #ifdef HAVE_V4L2
     v4l2 = !!opts->v4l2_device;
 #endif
+#ifdef HAVE_SHM
+    shm = !!opts->shm_sink;
+    audio_export = opts->audio_export_target != SC_AUDIO_EXPORT_TARGET_NONE;
+#endif
 
     if (!opts->window) {
         // Without window, there cannot be any video playback
@@ -2933,13 +3434,16 @@ parse_args_with_getopt(struct scrcpy_cli_args *args, int argc, char *argv[],
     }
 
     if (opts->video && !opts->video_playback && !opts->record_filename
-            && !v4l2) {
+            && !v4l2 && !shm && !opts->ws_server_port && !opts->rtp_port
+            && !opts->fmp4_server_port) {
         LOGI("No video playback, no recording, no V4L2 sink: video disabled");
         opts->video = false;
     }
 
-    if (opts->audio && !opts->audio_playback && !opts->record_filename) {
-        LOGI("No audio playback, no recording: audio disabled");
+    if (opts->audio && !opts->audio_playback && !opts->record_filename
+            && !opts->rtp_port && !opts->fmp4_server_port && !audio_export) {
+        LOGI("No audio playback, no recording, no audio export: audio "
+             "disabled");
         opts->audio = false;
     }
 
@@ -2953,6 +3457,22 @@ parse_args_with_getopt(struct scrcpy_cli_args *args, int argc, char *argv[],
         opts->require_audio = true;
     }
 
+    if (opts->audio_buffer_min != -1 && opts->audio_buffer_max != -1
+            && opts->audio_buffer_min > opts->audio_buffer_max) {
+        LOGE("--audio-buffer-min must not exceed --audio-buffer-max");
+        return false;
+    }
+
+    if (opts->audio_buffer != -1
+            && ((opts->audio_buffer_min != -1
+                    && opts->audio_buffer < opts->audio_buffer_min)
+                || (opts->audio_buffer_max != -1
+                    && opts->audio_buffer > opts->audio_buffer_max))) {
+        LOGE("--audio-buffer must be between --audio-buffer-min and "
+             "--audio-buffer-max");
+        return false;
+    }
+
     if (opts->audio_playback && opts->audio_buffer == -1) {
         if (opts->audio_codec == SC_CODEC_FLAC) {
             // Use 50 ms audio buffer by default, but use a higher value for
@@ -2966,6 +3486,25 @@ parse_args_with_getopt(struct scrcpy_cli_args *args, int argc, char *argv[],
         }
     }
 
+    if (opts->audio_playback) {
+        // The default audio buffer must be within the configured range
+        if (opts->audio_buffer_min != -1) {
+            opts->audio_buffer = MAX(opts->audio_buffer, opts->audio_buffer_min);
+        } else {
+            opts->audio_buffer_min = opts->audio_buffer;
+        }
+        if (opts->audio_buffer_max != -1) {
+            opts->audio_buffer = MIN(opts->audio_buffer, opts->audio_buffer_max);
+        } else {
+            opts->audio_buffer_max = opts->audio_buffer;
+        }
+    }
+
+    if (opts->av_sync && (!opts->video_playback || !opts->audio_playback)) {
+        LOGE("--av-sync requires both video and audio playback");
+        return false;
+    }
+
 #ifdef HAVE_V4L2
     if (v4l2) {
         if (!opts->video) {
@@ -2983,8 +3522,66 @@ parse_args_with_getopt(struct scrcpy_cli_args *args, int argc, char *argv[],
         LOGE("V4L2 buffer value without V4L2 sink");
         return false;
     }
+
+    if ((opts->v4l2_format != SC_V4L2_FORMAT_YUV420 || opts->v4l2_width)
+            && !opts->v4l2_device) {
+        LOGE("V4L2 format or size without V4L2 sink");
+        return false;
+    }
+#endif
+
+#ifdef HAVE_SHM
+    if (shm && !opts->video) {
+        LOGE("Shared memory sink requires video capture, but --no-video was "
+             "set.");
+        return false;
+    }
+
+    if (audio_export && !opts->audio) {
+        LOGE("Audio export requires audio capture, but --no-audio was set.");
+        return false;
+    }
+
+    if ((opts->audio_export_format != SC_AUDIO_EXPORT_FORMAT_S16
+                || opts->audio_export_rate) && !audio_export) {
+        LOGE("Audio export format or rate without audio export");
+        return false;
+    }
 #endif
 
+    if (opts->ws_server_port && !opts->video) {
+        LOGE("WebSocket server requires video capture, but --no-video was "
+             "set.");
+        return false;
+    }
+
+    if (opts->rtp_port) {
+        if (opts->video && opts->video_codec != SC_CODEC_H264
+                && opts->video_codec != SC_CODEC_H265) {
+            LOGE("RTP output requires --video-codec=h264 or h265");
+            return false;
+        }
+        if (opts->audio && opts->audio_codec != SC_CODEC_OPUS) {
+            LOGE("RTP output requires --audio-codec=opus (or --no-audio)");
+            return false;
+        }
+    } else if (opts->rtp_host || opts->rtp_sdp) {
+        LOGE("--rtp-host and --rtp-sdp require --rtp-port");
+        return false;
+    }
+
+    if (opts->fmp4_server_port) {
+        if (!opts->video && !opts->audio) {
+            LOGE("Video and audio disabled, nothing to serve over fMP4");
+            return false;
+        }
+        if (opts->audio && opts->audio_codec == SC_CODEC_RAW) {
+            LOGE("fMP4 server does not support RAW audio (try with "
+                 "--audio-codec=opus or aac, or --no-audio)");
+            return false;
+        }
+    }
+
     if (opts->control) {
         if (opts->keyboard_input_mode == SC_KEYBOARD_INPUT_MODE_AUTO) {
             opts->keyboard_input_mode = otg ? SC_KEYBOARD_INPUT_MODE_AOA
@@ -3220,6 +3817,23 @@ parse_args_with_getopt(struct scrcpy_cli_args *args, int argc, char *argv[],
         return false;
     }
 
+    if (opts->record_index) {
+        if (!opts->record_filename) {
+            LOGE("Record index requested without recording");
+            return false;
+        }
+
+        if (!opts->video) {
+            LOGE("Record index requires video recording");
+            return false;
+        }
+
+        if (sc_record_is_stdout(opts->record_filename)) {
+            LOGE("Record index is not supported when recording to stdout");
+            return false;
+        }
+    }
+
     if (opts->record_filename) {
         if (!opts->video && !opts->audio) {
             LOGE("Video and audio disabled, nothing to record");
@@ -3227,6 +3841,12 @@ parse_args_with_getopt(struct scrcpy_cli_args *args, int argc, char *argv[],
         }
 
         if (!opts->record_format) {
+            if (sc_record_is_stdout(opts->record_filename)) {
+                LOGE("No format specified for recording to stdout "
+                     "(try with --record-format=ts)");
+                return false;
+            }
+
             opts->record_format = guess_record_format(opts->record_filename);
             if (!opts->record_format) {
                 LOGE("No format specified for \"%s\" "
@@ -3284,12 +3904,44 @@ parse_args_with_getopt(struct scrcpy_cli_args *args, int argc, char *argv[],
             LOGE("Recording to MP4 container does not support RAW audio");
             return false;
         }
+
+        if (opts->record_index
+                && opts->record_format != SC_RECORD_FORMAT_TS) {
+            // The byte offsets are only meaningful in an MPEG-TS stream
+            LOGE("Record index is only supported for MPEG-TS recordings "
+                 "(try with --record-format=ts)");
+            return false;
+        }
+
+        if (opts->record_format == SC_RECORD_FORMAT_TS) {
+            if (opts->video && opts->video_codec == SC_CODEC_AV1) {
+                LOGE("Recording to MPEG-TS does not support AV1 video");
+                return false;
+            }
+
+            if (opts->audio && (opts->audio_codec == SC_CODEC_FLAC
+                             || opts->audio_codec == SC_CODEC_RAW)) {
+                LOGE("Recording to MPEG-TS does not support FLAC or RAW "
+                     "audio (try with --audio-codec=opus or aac)");
+                return false;
+            }
+        }
     }
 
     if (opts->audio_codec == SC_CODEC_FLAC && opts->audio_bit_rate) {
         LOGW("--audio-bit-rate is ignored for FLAC audio codec");
     }
 
+    if (opts->audio_codec == SC_CODEC_OPUS && opts->audio_sample_rate) {
+        uint32_t rate = opts->audio_sample_rate;
+        if (rate != 8000 && rate != 12000 && rate != 16000 && rate != 24000
+                && rate != 48000) {
+            LOGE("Unsupported audio sample rate for opus: %" PRIu32
+                 " (expected 8000, 12000, 16000, 24000 or 48000)", rate);
+            return false;
+        }
+    }
+
     if (opts->enable_webrtc) {
         if (!opts->websocket_url || !opts->webrtc_signal_url) {
             LOGE("WebRTC enabled but no websocket URL provided (use --websocket-url or --webrtc-signal-url)");
@@ -3302,6 +3954,9 @@ parse_args_with_getopt(struct scrcpy_cli_args *args, int argc, char *argv[],
         // WebRTC 模式可能需要禁用某些其他选项
         // opts->video_playback = false; // 不在本地显示视频
         // opts->control = false; // 可能需要特殊处理控制逻辑
+    } else if (opts->webrtc_max_size) {
+        LOGE("--webrtc-max-size requires --enable-webrtc");
+        return false;
     }
 
     if (opts->audio_codec == SC_CODEC_RAW) {
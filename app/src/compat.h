@@ -61,6 +61,21 @@
 # define SCRCPY_LAVC_HAS_CODECPAR_CODEC_SIDEDATA
 #endif
 
+// In ffmpeg/doc/APIchanges:
+// 2017-09-01 - xxxxxxx - lavf 57.80.100 / 57.11.0 - avio.h
+//   Add avio_context_free(). From now on it must be used for freeing
+//   AVIOContext.
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(57, 80, 100)
+# define SCRCPY_LAVF_HAS_AVIO_CONTEXT_FREE
+#endif
+
+// Not documented in ffmpeg/doc/APIchanges, but the buffer of the
+// avio_alloc_context() write_packet callback is const since lavf 61
+// (FF_API_AVIO_WRITE_NONCONST).
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(61, 0, 100)
+# define SCRCPY_LAVF_HAS_AVIO_WRITE_CONST
+#endif
+
 #if SDL_VERSION_ATLEAST(2, 0, 6)
 // <https://github.com/libsdl-org/SDL/commit/d7a318de563125e5bb465b1000d6bc9576fbc6fc>
 # define SCRCPY_SDL_HAS_HINT_TOUCH_MOUSE_EVENTS
@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "hid/hid_gamepad.h"
+#include "hid/hid_mouse.h"
 #include "util/binary.h"
 #include "util/log.h"
 #include "util/str.h"
@@ -182,6 +184,9 @@ sc_control_msg_serialize(const struct sc_control_msg *msg, uint8_t *buf) {
             size_t len = write_string_tiny(&buf[1], msg->start_app.name, 255);
             return 1 + len;
         }
+        case SC_CONTROL_MSG_TYPE_PING:
+            sc_write64be(&buf[1], msg->ping.sequence);
+            return 9;
         case SC_CONTROL_MSG_TYPE_EXPAND_NOTIFICATION_PANEL:
         case SC_CONTROL_MSG_TYPE_EXPAND_SETTINGS_PANEL:
         case SC_CONTROL_MSG_TYPE_COLLAPSE_PANELS:
@@ -318,6 +323,9 @@ sc_control_msg_log(const struct sc_control_msg *msg) {
         case SC_CONTROL_MSG_TYPE_RESET_VIDEO:
             LOG_CMSG("reset video");
             break;
+        case SC_CONTROL_MSG_TYPE_PING:
+            LOG_CMSG("ping sequence=%" PRIu64_, msg->ping.sequence);
+            break;
         default:
             LOG_CMSG("unknown type: %u", (unsigned) msg->type);
             break;
@@ -334,6 +342,145 @@ sc_control_msg_is_droppable(const struct sc_control_msg *msg) {
         && msg->type != SC_CONTROL_MSG_TYPE_UHID_DESTROY;
 }
 
+static bool
+is_touch_move(const struct sc_control_msg *msg) {
+    return msg->type == SC_CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT
+        && msg->inject_touch_event.action == AMOTION_EVENT_ACTION_MOVE;
+}
+
+static bool
+is_motion(const struct sc_control_msg *msg) {
+    if (msg->type != SC_CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT) {
+        return false;
+    }
+
+    enum android_motionevent_action action = msg->inject_touch_event.action
+                                           & AMOTION_EVENT_ACTION_MASK;
+    return action == AMOTION_EVENT_ACTION_MOVE
+        || action == AMOTION_EVENT_ACTION_HOVER_MOVE;
+}
+
+static bool
+is_uhid(const struct sc_control_msg *msg) {
+    return msg->type == SC_CONTROL_MSG_TYPE_UHID_CREATE
+        || msg->type == SC_CONTROL_MSG_TYPE_UHID_INPUT
+        || msg->type == SC_CONTROL_MSG_TYPE_UHID_DESTROY;
+}
+
+static uint16_t
+get_uhid_id(const struct sc_control_msg *msg) {
+    switch (msg->type) {
+        case SC_CONTROL_MSG_TYPE_UHID_CREATE:
+            return msg->uhid_create.id;
+        case SC_CONTROL_MSG_TYPE_UHID_INPUT:
+            return msg->uhid_input.id;
+        default:
+            assert(msg->type == SC_CONTROL_MSG_TYPE_UHID_DESTROY);
+            return msg->uhid_destroy.id;
+    }
+}
+
+static bool
+is_low_priority_uhid_input(const struct sc_control_msg *msg) {
+    if (msg->type != SC_CONTROL_MSG_TYPE_UHID_INPUT) {
+        return false;
+    }
+
+    // The UHID device ids are fixed: keyboard reports (like key events) must
+    // not wait behind a flood of mouse or gamepad reports
+    uint16_t id = msg->uhid_input.id;
+    return id == SC_HID_ID_MOUSE
+        || (id >= SC_HID_ID_GAMEPAD_FIRST && id <= SC_HID_ID_GAMEPAD_LAST);
+}
+
+bool
+sc_control_msg_is_low_priority(const struct sc_control_msg *msg) {
+    return is_motion(msg)
+        || msg->type == SC_CONTROL_MSG_TYPE_INJECT_SCROLL_EVENT
+        || is_low_priority_uhid_input(msg);
+}
+
+bool
+sc_control_msg_must_follow(const struct sc_control_msg *prev,
+                           const struct sc_control_msg *msg) {
+    if (prev->type == SC_CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT
+            && msg->type == SC_CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT) {
+        // For example, an UP event must not overtake the previous MOVE
+        // events
+        return prev->inject_touch_event.pointer_id
+            == msg->inject_touch_event.pointer_id;
+    }
+
+    if (is_uhid(prev) && is_uhid(msg)) {
+        // A UHID_DESTROY must not overtake the previous UHID_INPUT
+        return get_uhid_id(prev) == get_uhid_id(msg);
+    }
+
+    return false;
+}
+
+bool
+sc_control_msg_coalesce(struct sc_control_msg *queued,
+                        const struct sc_control_msg *msg) {
+    if (is_touch_move(msg)) {
+        if (!is_touch_move(queued)) {
+            return false;
+        }
+
+        if (queued->inject_touch_event.pointer_id
+                    != msg->inject_touch_event.pointer_id
+                || queued->inject_touch_event.buttons
+                    != msg->inject_touch_event.buttons
+                || queued->inject_touch_event.action_button
+                    != msg->inject_touch_event.action_button) {
+            return false;
+        }
+
+        // Only the last position is relevant
+        queued->inject_touch_event.position =
+            msg->inject_touch_event.position;
+        queued->inject_touch_event.pressure =
+            msg->inject_touch_event.pressure;
+        return true;
+    }
+
+    if (msg->type == SC_CONTROL_MSG_TYPE_INJECT_SCROLL_EVENT) {
+        if (queued->type != SC_CONTROL_MSG_TYPE_INJECT_SCROLL_EVENT
+                || queued->inject_scroll_event.buttons
+                    != msg->inject_scroll_event.buttons) {
+            return false;
+        }
+
+        float hscroll = queued->inject_scroll_event.hscroll
+                      + msg->inject_scroll_event.hscroll;
+        float vscroll = queued->inject_scroll_event.vscroll
+                      + msg->inject_scroll_event.vscroll;
+        // The serialized scroll amount is clamped to [-16; 16], do not lose
+        // the excess
+        if (hscroll < -16 || hscroll > 16 || vscroll < -16 || vscroll > 16) {
+            return false;
+        }
+
+        queued->inject_scroll_event.position =
+            msg->inject_scroll_event.position;
+        queued->inject_scroll_event.hscroll = hscroll;
+        queued->inject_scroll_event.vscroll = vscroll;
+        return true;
+    }
+
+    return false;
+}
+
+bool
+sc_control_msg_can_overtake(const struct sc_control_msg *prev,
+                            const struct sc_control_msg *msg) {
+    // The MOVE events of different pointers are independent, but all other
+    // events (including DOWN and UP) must be kept in order
+    return is_touch_move(prev) && is_touch_move(msg)
+        && prev->inject_touch_event.pointer_id
+            != msg->inject_touch_event.pointer_id;
+}
+
 void
 sc_control_msg_destroy(struct sc_control_msg *msg) {
     switch (msg->type) {
@@ -43,6 +43,7 @@ enum sc_control_msg_type {
     SC_CONTROL_MSG_TYPE_OPEN_HARD_KEYBOARD_SETTINGS,
     SC_CONTROL_MSG_TYPE_START_APP,
     SC_CONTROL_MSG_TYPE_RESET_VIDEO,
+    SC_CONTROL_MSG_TYPE_PING,
 };
 
 enum sc_copy_key {
@@ -111,6 +112,9 @@ struct sc_control_msg {
         struct {
             char *name;
         } start_app;
+        struct {
+            uint64_t sequence;
+        } ping;
     };
 };
 
@@ -127,6 +131,35 @@ sc_control_msg_log(const struct sc_control_msg *msg);
 bool
 sc_control_msg_is_droppable(const struct sc_control_msg *msg);
 
+// Low-priority messages (motion, scroll, and UHID mouse and gamepad input) are
+// sent only when no high-priority message (keys, buttons, clipboard...) is
+// pending.
+bool
+sc_control_msg_is_low_priority(const struct sc_control_msg *msg);
+
+// Return true if msg must be sent after prev, even if msg has a higher
+// priority (events for the same pointer or the same UHID device).
+bool
+sc_control_msg_must_follow(const struct sc_control_msg *prev,
+                           const struct sc_control_msg *msg);
+
+// Merge msg into queued (a message not sent yet), so that only one message is
+// sent for both:
+//  - a touch MOVE event replaces a MOVE event for the same pointer with the
+//    same buttons;
+//  - scroll events with the same buttons are summed (as long as the sum does
+//    not exceed the max scroll amount of a single message).
+// Return true if msg has been merged (it must then not be sent).
+bool
+sc_control_msg_coalesce(struct sc_control_msg *queued,
+                        const struct sc_control_msg *msg);
+
+// Return true if msg may be coalesced with a message queued before prev, i.e.
+// if prev and msg may be reordered (touch MOVE events for different pointers).
+bool
+sc_control_msg_can_overtake(const struct sc_control_msg *prev,
+                            const struct sc_control_msg *msg);
+
 void
 sc_control_msg_destroy(struct sc_control_msg *msg);
 
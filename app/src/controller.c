@@ -1,12 +1,17 @@
 #include "controller.h"
 
 #include <assert.h>
+#include <inttypes.h>
+#include <string.h>
 
 #include "util/log.h"
 
 // Drop droppable events above this limit
 #define SC_CONTROL_MSG_QUEUE_LIMIT 60
 
+// Max number of messages popped from the queue to be sent at once
+#define SC_CONTROL_MSG_BATCH_LIMIT 64
+
 static void
 sc_controller_receiver_on_ended(struct sc_receiver *receiver, bool error,
                                 void *userdata) {
@@ -17,53 +22,91 @@ sc_controller_receiver_on_ended(struct sc_receiver *receiver, bool error,
     controller->cbs->on_ended(controller, error, controller->cbs_userdata);
 }
 
+static void
+sc_controller_receiver_on_ack_ping(struct sc_receiver *receiver,
+                                   uint64_t sequence, void *userdata) {
+    (void) receiver;
+
+    struct sc_controller *controller = userdata;
+
+    sc_mutex_lock(&controller->mutex);
+    if (controller->pending_ping.time
+            && controller->pending_ping.sequence == sequence) {
+        sc_tick rtt = sc_tick_now() - controller->pending_ping.time;
+        sc_latency_push(&controller->stats.rtt, rtt);
+        controller->pending_ping.time = 0;
+    } // else an ack for an older ping, ignore it
+    sc_mutex_unlock(&controller->mutex);
+}
+
 bool
 sc_controller_init(struct sc_controller *controller, sc_socket control_socket,
                    const struct sc_controller_callbacks *cbs,
                    void *cbs_userdata) {
     sc_vecdeque_init(&controller->queue);
+    sc_vecdeque_init(&controller->low_queue);
 
     // Add 4 to support 4 non-droppable events without re-allocation
     bool ok = sc_vecdeque_reserve(&controller->queue,
                                   SC_CONTROL_MSG_QUEUE_LIMIT + 4);
     if (!ok) {
-        return false;
+        goto error_destroy_queues;
+    }
+
+    ok = sc_vecdeque_reserve(&controller->low_queue,
+                             SC_CONTROL_MSG_QUEUE_LIMIT + 4);
+    if (!ok) {
+        goto error_destroy_queues;
     }
 
     static const struct sc_receiver_callbacks receiver_cbs = {
         .on_ended = sc_controller_receiver_on_ended,
+        .on_ack_ping = sc_controller_receiver_on_ack_ping,
     };
 
     ok = sc_receiver_init(&controller->receiver, control_socket, &receiver_cbs,
                           controller);
     if (!ok) {
-        sc_vecdeque_destroy(&controller->queue);
-        return false;
+        goto error_destroy_queues;
     }
 
     ok = sc_mutex_init(&controller->mutex);
     if (!ok) {
-        sc_receiver_destroy(&controller->receiver);
-        sc_vecdeque_destroy(&controller->queue);
-        return false;
+        goto error_destroy_receiver;
     }
 
     ok = sc_cond_init(&controller->msg_cond);
     if (!ok) {
-        sc_receiver_destroy(&controller->receiver);
-        sc_mutex_destroy(&controller->mutex);
-        sc_vecdeque_destroy(&controller->queue);
-        return false;
+        goto error_destroy_mutex;
     }
 
     controller->control_socket = control_socket;
     controller->stopped = false;
+    controller->ping_interval = SC_CONTROLLER_PING_INTERVAL;
+    controller->input_since_ping = false;
+    controller->next_ping = 0; // ping on the first input
+    controller->ping_sequence = 0;
+    controller->pending_ping.sequence = 0;
+    controller->pending_ping.time = 0;
+    memset(&controller->stats, 0, sizeof(controller->stats));
+    sc_latency_init(&controller->stats.rtt);
+    sc_latency_init(&controller->stats.queue_time);
 
     assert(cbs && cbs->on_ended);
     controller->cbs = cbs;
     controller->cbs_userdata = cbs_userdata;
 
     return true;
+
+error_destroy_mutex:
+    sc_mutex_destroy(&controller->mutex);
+error_destroy_receiver:
+    sc_receiver_destroy(&controller->receiver);
+error_destroy_queues:
+    sc_vecdeque_destroy(&controller->low_queue);
+    sc_vecdeque_destroy(&controller->queue);
+
+    return false;
 }
 
 void
@@ -74,21 +117,152 @@ sc_controller_configure(struct sc_controller *controller,
     controller->receiver.uhid_devices = uhid_devices;
 }
 
+static unsigned
+percent(uint64_t part, uint64_t total) {
+    return total ? (unsigned) (part * 100 / total) : 0;
+}
+
+static double
+to_ms(sc_tick tick) {
+    return (double) tick / SC_TICK_FROM_MS(1);
+}
+
+static void
+sc_controller_log_stats(struct sc_controller *controller) {
+    uint64_t touch_moves = controller->stats.touch_moves;
+    uint64_t touch_moves_coalesced = controller->stats.touch_moves_coalesced;
+    uint64_t scrolls = controller->stats.scrolls;
+    uint64_t scrolls_coalesced = controller->stats.scrolls_coalesced;
+
+    if (touch_moves) {
+        LOGI("Control: %" PRIu64 " touch moves, %" PRIu64 " coalesced (%u%%)",
+             touch_moves, touch_moves_coalesced,
+             percent(touch_moves_coalesced, touch_moves));
+    }
+    if (scrolls) {
+        LOGI("Control: %" PRIu64 " scrolls, %" PRIu64 " coalesced (%u%%)",
+             scrolls, scrolls_coalesced,
+             percent(scrolls_coalesced, scrolls));
+    }
+    if (controller->stats.sent) {
+        LOGD("Control: %" PRIu64 " messages sent in %" PRIu64 " writes",
+             controller->stats.sent, controller->stats.writes);
+    }
+    if (controller->stats.dropped) {
+        LOGW("Control: %" PRIu64 " events dropped",
+             controller->stats.dropped);
+    }
+
+    const struct sc_latency *rtt = &controller->stats.rtt;
+    if (rtt->count) {
+        LOGI("Control: RTT p50=%.1fms p90=%.1fms p99=%.1fms max=%.1fms"
+             " (%" PRIu64 " pings)",
+             to_ms(sc_latency_get_percentile(rtt, 50)),
+             to_ms(sc_latency_get_percentile(rtt, 90)),
+             to_ms(sc_latency_get_percentile(rtt, 99)),
+             to_ms(rtt->max), rtt->count);
+    }
+
+    const struct sc_latency *queue_time = &controller->stats.queue_time;
+    if (queue_time->count) {
+        LOGI("Control: queue time avg=%.1fms p50=%.1fms p99=%.1fms"
+             " max=%.1fms",
+             to_ms(sc_latency_get_avg(queue_time)),
+             to_ms(sc_latency_get_percentile(queue_time, 50)),
+             to_ms(sc_latency_get_percentile(queue_time, 99)),
+             to_ms(queue_time->max));
+    }
+}
+
+static void
+sc_controller_clear_queue(struct sc_control_msg_queue *queue) {
+    while (!sc_vecdeque_is_empty(queue)) {
+        struct sc_controller_msg *item = sc_vecdeque_popref(queue);
+        assert(item);
+        sc_control_msg_destroy(&item->msg);
+    }
+    sc_vecdeque_destroy(queue);
+}
+
 void
 sc_controller_destroy(struct sc_controller *controller) {
+    sc_controller_log_stats(controller);
+
     sc_cond_destroy(&controller->msg_cond);
     sc_mutex_destroy(&controller->mutex);
 
-    while (!sc_vecdeque_is_empty(&controller->queue)) {
-        struct sc_control_msg *msg = sc_vecdeque_popref(&controller->queue);
-        assert(msg);
-        sc_control_msg_destroy(msg);
-    }
-    sc_vecdeque_destroy(&controller->queue);
+    sc_controller_clear_queue(&controller->queue);
+    sc_controller_clear_queue(&controller->low_queue);
 
     sc_receiver_destroy(&controller->receiver);
 }
 
+// Merge msg into a queued message, if possible (the mutex must be locked)
+static bool
+sc_controller_coalesce(struct sc_controller *controller,
+                       const struct sc_control_msg *msg) {
+    uint64_t *coalesced;
+    if (msg->type == SC_CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT
+            && msg->inject_touch_event.action == AMOTION_EVENT_ACTION_MOVE) {
+        ++controller->stats.touch_moves;
+        coalesced = &controller->stats.touch_moves_coalesced;
+    } else if (msg->type == SC_CONTROL_MSG_TYPE_INJECT_SCROLL_EVENT) {
+        ++controller->stats.scrolls;
+        coalesced = &controller->stats.scrolls_coalesced;
+    } else {
+        return false;
+    }
+
+    // The queued messages have not been sent yet (the controller thread pops a
+    // message before sending it), so they may be modified.
+    // Touch moves and scrolls are low-priority messages, so search in the
+    // low-priority queue from the most recent one, and stop on the first
+    // message which must be kept in order.
+    assert(sc_control_msg_is_low_priority(msg));
+    size_t size = sc_vecdeque_size(&controller->low_queue);
+    for (size_t i = size; i > 0; --i) {
+        struct sc_control_msg *queued =
+            &sc_vecdeque_getref(&controller->low_queue, i - 1)->msg;
+        if (sc_control_msg_coalesce(queued, msg)) {
+            ++*coalesced;
+            return true;
+        }
+        if (!sc_control_msg_can_overtake(queued, msg)) {
+            break;
+        }
+    }
+
+    return false;
+}
+
+// Select the queue for msg (the mutex must be locked)
+static struct sc_control_msg_queue *
+sc_controller_select_queue(struct sc_controller *controller,
+                           const struct sc_control_msg *msg) {
+    if (sc_control_msg_is_low_priority(msg)) {
+        return &controller->low_queue;
+    }
+
+    // A high-priority message must not overtake a low-priority message for
+    // the same pointer or device
+    size_t size = sc_vecdeque_size(&controller->low_queue);
+    for (size_t i = 0; i < size; ++i) {
+        const struct sc_control_msg *queued =
+            &sc_vecdeque_getref(&controller->low_queue, i)->msg;
+        if (sc_control_msg_must_follow(queued, msg)) {
+            return &controller->low_queue;
+        }
+    }
+
+    return &controller->queue;
+}
+
+static bool
+sc_controller_is_empty(struct sc_controller *controller) {
+    return sc_vecdeque_is_empty(&controller->queue)
+        && sc_vecdeque_is_empty(&controller->low_queue);
+}
+
 bool
 sc_controller_push_msg(struct sc_controller *controller,
                        const struct sc_control_msg *msg) {
@@ -99,24 +273,43 @@ sc_controller_push_msg(struct sc_controller *controller,
     bool pushed = false;
 
     sc_mutex_lock(&controller->mutex);
-    size_t size = sc_vecdeque_size(&controller->queue);
+    controller->input_since_ping = true;
+
+    if (sc_controller_coalesce(controller, msg)) {
+        // Merged into a queued message, there is nothing to push
+        sc_mutex_unlock(&controller->mutex);
+        return true;
+    }
+
+    struct sc_control_msg_queue *queue =
+        sc_controller_select_queue(controller, msg);
+    bool was_empty = sc_controller_is_empty(controller);
+
+    struct sc_controller_msg item = {
+        .msg = *msg,
+        .push_time = sc_tick_now(),
+    };
+
+    size_t size = sc_vecdeque_size(queue);
     if (size < SC_CONTROL_MSG_QUEUE_LIMIT) {
-        bool was_empty = sc_vecdeque_is_empty(&controller->queue);
-        sc_vecdeque_push_noresize(&controller->queue, *msg);
+        sc_vecdeque_push_noresize(queue, item);
         pushed = true;
-        if (was_empty) {
-            sc_cond_signal(&controller->msg_cond);
-        }
     } else if (!sc_control_msg_is_droppable(msg)) {
-        bool ok = sc_vecdeque_push(&controller->queue, *msg);
+        bool ok = sc_vecdeque_push(queue, item);
         if (ok) {
             pushed = true;
         } else {
             // A non-droppable event must be dropped anyway
             LOG_OOM();
         }
+    } else {
+        // The msg is discarded
+        ++controller->stats.dropped;
+    }
+
+    if (pushed && was_empty) {
+        sc_cond_signal(&controller->msg_cond);
     }
-    // Otherwise, the msg is discarded
 
     sc_mutex_unlock(&controller->mutex);
 
@@ -124,18 +317,61 @@ sc_controller_push_msg(struct sc_controller *controller,
 }
 
 static bool
-process_msg(struct sc_controller *controller,
-            const struct sc_control_msg *msg, bool *eos) {
-    static uint8_t serialized_msg[SC_CONTROL_MSG_MAX_SIZE];
-    size_t length = sc_control_msg_serialize(msg, serialized_msg);
-    if (!length) {
-        *eos = false;
-        return false;
+sc_controller_send(struct sc_controller *controller, const uint8_t *buf,
+                   size_t len) {
+    ++controller->stats.writes;
+    ssize_t w = net_send_all(controller->control_socket, buf, len);
+    return (size_t) w == len;
+}
+
+static void
+sc_controller_on_ping_sent(struct sc_controller *controller,
+                           uint64_t sequence) {
+    sc_mutex_lock(&controller->mutex);
+    controller->pending_ping.sequence = sequence;
+    controller->pending_ping.time = sc_tick_now();
+    sc_mutex_unlock(&controller->mutex);
+}
+
+static bool
+process_msgs(struct sc_controller *controller,
+             const struct sc_controller_msg *items, size_t count, bool *eos) {
+    // Serialize the messages back to back, to send them at once. As long as
+    // less than SC_CONTROL_MSG_MAX_SIZE bytes are pending, there is enough
+    // space for any further message.
+    static uint8_t buf[2 * SC_CONTROL_MSG_MAX_SIZE];
+    size_t len = 0;
+
+    sc_tick now = sc_tick_now();
+
+    for (size_t i = 0; i < count; ++i) {
+        const struct sc_control_msg *msg = &items[i].msg;
+        size_t length = sc_control_msg_serialize(msg, &buf[len]);
+        if (!length) {
+            *eos = false;
+            return false;
+        }
+
+        len += length;
+        ++controller->stats.sent;
+        sc_latency_push(&controller->stats.queue_time,
+                        now - items[i].push_time);
+
+        if (msg->type == SC_CONTROL_MSG_TYPE_PING) {
+            // Sent with the current batch, just after
+            sc_controller_on_ping_sent(controller, msg->ping.sequence);
+        }
+
+        if (len >= SC_CONTROL_MSG_MAX_SIZE) {
+            if (!sc_controller_send(controller, buf, len)) {
+                *eos = true;
+                return false;
+            }
+            len = 0;
+        }
     }
 
-    ssize_t w =
-        net_send_all(controller->control_socket, serialized_msg, length);
-    if ((size_t) w != length) {
+    if (len && !sc_controller_send(controller, buf, len)) {
         *eos = true;
         return false;
     }
@@ -143,17 +379,72 @@ process_msg(struct sc_controller *controller,
     return true;
 }
 
+// Push a ping if input has been sent and it is time to do so (the mutex must
+// be locked)
+static void
+sc_controller_ping_if_needed(struct sc_controller *controller) {
+    assert(controller->ping_interval);
+
+    if (!controller->input_since_ping) {
+        return;
+    }
+
+    sc_tick now = sc_tick_now();
+    if (now < controller->next_ping) {
+        return;
+    }
+
+    controller->input_since_ping = false;
+    controller->next_ping = now + controller->ping_interval;
+
+    struct sc_controller_msg item = {
+        .msg = {
+            .type = SC_CONTROL_MSG_TYPE_PING,
+            .ping = {
+                .sequence = ++controller->ping_sequence,
+            },
+        },
+        .push_time = now,
+    };
+
+    // A ping is never dropped, and is sent with a high priority (so that
+    // the RTT does not include the queueing delay of low-priority messages)
+    bool ok = sc_vecdeque_push(&controller->queue, item);
+    if (!ok) {
+        LOG_OOM();
+    }
+}
+
 static int
 run_controller(void *data) {
     struct sc_controller *controller = data;
 
+    // The messages popped from the queue at once
+    struct sc_controller_msg items[SC_CONTROL_MSG_BATCH_LIMIT];
+
     bool error = false;
 
     for (;;) {
         sc_mutex_lock(&controller->mutex);
-        while (!controller->stopped
-                && sc_vecdeque_is_empty(&controller->queue)) {
-            sc_cond_wait(&controller->msg_cond, &controller->mutex);
+        for (;;) {
+            if (controller->stopped) {
+                break;
+            }
+            if (controller->ping_interval) {
+                sc_controller_ping_if_needed(controller);
+            }
+            if (!sc_controller_is_empty(controller)) {
+                break;
+            }
+            if (controller->ping_interval && controller->input_since_ping) {
+                // Input has been sent since the last ping, ping again once
+                // the interval has elapsed
+                sc_cond_timedwait(&controller->msg_cond, &controller->mutex,
+                                  controller->next_ping);
+            } else {
+                // Idle, until the next message
+                sc_cond_wait(&controller->msg_cond, &controller->mutex);
+            }
         }
         if (controller->stopped) {
             // stop immediately, do not process further msgs
@@ -162,13 +453,25 @@ run_controller(void *data) {
             break;
         }
 
-        assert(!sc_vecdeque_is_empty(&controller->queue));
-        struct sc_control_msg msg = sc_vecdeque_pop(&controller->queue);
+        assert(!sc_controller_is_empty(controller));
+        // Strict priority: the low-priority messages are sent only once all
+        // the high-priority messages are sent
+        size_t count = 0;
+        while (count < ARRAY_LEN(items)
+                && !sc_vecdeque_is_empty(&controller->queue)) {
+            items[count++] = sc_vecdeque_pop(&controller->queue);
+        }
+        while (count < ARRAY_LEN(items)
+                && !sc_vecdeque_is_empty(&controller->low_queue)) {
+            items[count++] = sc_vecdeque_pop(&controller->low_queue);
+        }
         sc_mutex_unlock(&controller->mutex);
 
         bool eos;
-        bool ok = process_msg(controller, &msg, &eos);
-        sc_control_msg_destroy(&msg);
+        bool ok = process_msgs(controller, items, count, &eos);
+        for (size_t i = 0; i < count; ++i) {
+            sc_control_msg_destroy(&items[i].msg);
+        }
         if (!ok) {
             if (eos) {
                 LOGD("Controller stopped (socket closed)");
@@ -4,15 +4,28 @@
 #include "common.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "control_msg.h"
 #include "receiver.h"
 #include "util/acksync.h"
+#include "util/latency.h"
 #include "util/net.h"
 #include "util/thread.h"
+#include "util/tick.h"
 #include "util/vecdeque.h"
 
-struct sc_control_msg_queue SC_VECDEQUE(struct sc_control_msg);
+// Interval between pings to measure the round-trip time (only while input is
+// being sent)
+#define SC_CONTROLLER_PING_INTERVAL SC_TICK_FROM_SEC(1)
+
+// A queued message, with the time it has been pushed
+struct sc_controller_msg {
+    struct sc_control_msg msg;
+    sc_tick push_time;
+};
+
+struct sc_control_msg_queue SC_VECDEQUE(struct sc_controller_msg);
 
 struct sc_controller {
     sc_socket control_socket;
@@ -20,9 +33,41 @@ struct sc_controller {
     sc_mutex mutex;
     sc_cond msg_cond;
     bool stopped;
+    // High-priority messages (keys, buttons, clipboard...) are sent before
+    // low-priority messages (motion, scroll, UHID mouse and gamepad input),
+    // see sc_control_msg_is_low_priority()
     struct sc_control_msg_queue queue;
+    struct sc_control_msg_queue low_queue;
     struct sc_receiver receiver;
 
+    // Interval between pings (0 to disable), to be changed before start
+    sc_tick ping_interval;
+    // The fields below are protected by the mutex
+    // A message has been pushed since the last ping: the pings are only sent
+    // while input is being sent, so that an idle controller is never woken up
+    bool input_since_ping;
+    sc_tick next_ping;
+    uint64_t ping_sequence;
+    // The last ping sent, waiting for its ack, protected by the mutex
+    struct {
+        uint64_t sequence;
+        sc_tick time; // 0 if none
+    } pending_ping;
+
+    // statistics, protected by the mutex (unless stated otherwise)
+    struct {
+        uint64_t touch_moves;
+        uint64_t touch_moves_coalesced;
+        uint64_t scrolls;
+        uint64_t scrolls_coalesced;
+        uint64_t dropped;
+        struct sc_latency rtt;
+        // only accessed by the controller thread
+        uint64_t sent;
+        uint64_t writes;
+        struct sc_latency queue_time;
+    } stats;
+
     const struct sc_controller_callbacks *cbs;
     void *cbs_userdata;
 };
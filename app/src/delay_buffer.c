@@ -32,6 +32,22 @@ sc_delayed_frame_destroy(struct sc_delayed_frame *dframe) {
     av_frame_free(&dframe->frame);
 }
 
+// Must be called with the mutex locked
+static sc_tick
+sc_delay_buffer_get_delay(struct sc_delay_buffer *db) {
+    if (db->av_sync) {
+        sc_tick audio_offset;
+        if (sc_av_sync_get_audio_offset(db->av_sync, &audio_offset)) {
+            // Present the frames when the audio samples having the same PTS
+            // are played
+            sc_tick delay = audio_offset - db->clock.offset;
+            return CLAMP(delay, 0, SC_AV_SYNC_MAX_DELAY);
+        }
+    }
+
+    return db->delay;
+}
+
 static int
 run_buffering(void *data) {
     struct sc_delay_buffer *db = data;
@@ -52,14 +68,16 @@ run_buffering(void *data) {
 
         struct sc_delayed_frame dframe = sc_vecdeque_pop(&db->queue);
 
-        sc_tick max_deadline = sc_tick_now() + db->delay;
+        sc_tick delay = sc_delay_buffer_get_delay(db);
+        sc_tick max_deadline = sc_tick_now() + delay;
         // PTS (written by the server) are expressed in microseconds
         sc_tick pts = SC_TICK_FROM_US(dframe.frame->pts);
 
         bool timed_out = false;
         while (!db->stopped && !timed_out) {
+            delay = sc_delay_buffer_get_delay(db);
             sc_tick deadline = sc_clock_to_system_time(&db->clock, pts)
-                             + db->delay;
+                             + delay;
             if (deadline > max_deadline) {
                 deadline = max_deadline;
             }
@@ -81,6 +99,10 @@ run_buffering(void *data) {
              pts, dframe.push_date, sc_tick_now());
 #endif
 
+        if (db->av_sync) {
+            sc_av_sync_report_video(db->av_sync, pts, sc_tick_now(), delay);
+        }
+
         bool ok = sc_frame_source_sinks_push(&db->frame_source, dframe.frame);
         sc_delayed_frame_destroy(&dframe);
         if (!ok) {
@@ -168,6 +190,10 @@ sc_delay_buffer_frame_sink_close(struct sc_frame_sink *sink) {
 
     sc_thread_join(&db->thread, NULL);
 
+    if (db->av_sync) {
+        sc_av_sync_log_summary(db->av_sync);
+    }
+
     sc_frame_source_sinks_close(&db->frame_source);
 
     sc_cond_destroy(&db->wait_cond);
@@ -223,11 +249,12 @@ sc_delay_buffer_frame_sink_push(struct sc_frame_sink *sink,
 
 void
 sc_delay_buffer_init(struct sc_delay_buffer *db, sc_tick delay,
-                     bool first_frame_asap) {
+                     bool first_frame_asap, struct sc_av_sync *av_sync) {
     assert(delay > 0);
 
     db->delay = delay;
     db->first_frame_asap = first_frame_asap;
+    db->av_sync = av_sync;
 
     sc_frame_source_init(&db->frame_source);
 
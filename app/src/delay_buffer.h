@@ -6,6 +6,7 @@
 #include <stdbool.h>
 #include <libavutil/frame.h>
 
+#include "av_sync.h"
 #include "clock.h"
 #include "trait/frame_source.h"
 #include "trait/frame_sink.h"
@@ -34,6 +35,11 @@ struct sc_delay_buffer {
     sc_tick delay;
     bool first_frame_asap;
 
+    // If set, the delay is adjusted dynamically to present the frames in sync
+    // with the audio playback (delay is then only used until the audio clock
+    // is known)
+    struct sc_av_sync *av_sync;
+
     sc_thread thread;
     sc_mutex mutex;
     sc_cond queue_cond;
@@ -55,9 +61,10 @@ struct sc_delay_buffer_callbacks {
  * \param delay a (strictly) positive delay
  * \param first_frame_asap if true, do not delay the first frame (useful for
                            a video stream).
+ * \param av_sync if not NULL, synchronize the frames with the audio playback
  */
 void
 sc_delay_buffer_init(struct sc_delay_buffer *db, sc_tick delay,
-                     bool first_frame_asap);
+                     bool first_frame_asap, struct sc_av_sync *av_sync);
 
 #endif
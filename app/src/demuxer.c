@@ -77,6 +77,20 @@ sc_demuxer_recv_video_size(struct sc_demuxer *demuxer, uint32_t *width,
     return true;
 }
 
+static bool
+sc_demuxer_recv_audio_config(struct sc_demuxer *demuxer, uint32_t *sample_rate,
+                             uint32_t *channels) {
+    uint8_t data[8];
+    ssize_t r = net_recv_all(demuxer->socket, data, 8);
+    if (r < 8) {
+        return false;
+    }
+
+    *sample_rate = sc_read32be(data);
+    *channels = sc_read32be(data + 4);
+    return true;
+}
+
 static bool
 sc_demuxer_recv_packet(struct sc_demuxer *demuxer, AVPacket *packet) {
     // The video and audio streams contain a sequence of raw packets (as
@@ -199,14 +213,31 @@ run_demuxer(void *data) {
         codec_ctx->height = height;
         codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
     } else {
-        // Hardcoded audio properties
+        uint32_t sample_rate;
+        uint32_t channels;
+        ok = sc_demuxer_recv_audio_config(demuxer, &sample_rate, &channels);
+        if (!ok) {
+            goto finally_free_context;
+        }
+
+        if (!sample_rate || sample_rate > 192000 || !channels
+                || channels > 8) {
+            LOGE("Demuxer '%s': unsupported audio configuration (%" PRIu32
+                 " Hz, %" PRIu32 " channels)", demuxer->name, sample_rate,
+                 channels);
+            goto finally_free_context;
+        }
+
+        LOGD("Demuxer '%s': audio %" PRIu32 " Hz, %" PRIu32 " channel(s)",
+             demuxer->name, sample_rate, channels);
+
 #ifdef SCRCPY_LAVU_HAS_CHLAYOUT
-        codec_ctx->ch_layout = (AVChannelLayout) AV_CHANNEL_LAYOUT_STEREO;
+        av_channel_layout_default(&codec_ctx->ch_layout, channels);
 #else
-        codec_ctx->channel_layout = AV_CH_LAYOUT_STEREO;
-        codec_ctx->channels = 2;
+        codec_ctx->channel_layout = av_get_default_channel_layout(channels);
+        codec_ctx->channels = channels;
 #endif
-        codec_ctx->sample_rate = 48000;
+        codec_ctx->sample_rate = sample_rate;
 
         if (raw_codec_id == SC_CODEC_ID_FLAC) {
             // The sample_fmt is not set by the FLAC decoder
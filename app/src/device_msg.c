@@ -71,6 +71,14 @@ sc_device_msg_deserialize(const uint8_t *buf, size_t len,
 
             return 5 + size;
         }
+        case DEVICE_MSG_TYPE_ACK_PING: {
+            if (len < 9) {
+                return 0; // no complete message
+            }
+            uint64_t sequence = sc_read64be(&buf[1]);
+            msg->ack_ping.sequence = sequence;
+            return 9;
+        }
         default:
             LOGW("Unknown device message type: %d", (int) msg->type);
             return -1; // error, we cannot recover
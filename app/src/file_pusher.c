@@ -16,7 +16,7 @@ sc_file_pusher_request_destroy(struct sc_file_pusher_request *req) {
 
 bool
 sc_file_pusher_init(struct sc_file_pusher *fp, const char *serial,
-                    const char *push_target) {
+                    const char *push_target, bool no_stdout) {
     assert(serial);
 
     sc_vecdeque_init(&fp->queue);
@@ -54,6 +54,7 @@ sc_file_pusher_init(struct sc_file_pusher *fp, const char *serial,
     fp->stopped = false;
 
     fp->push_target = push_target ? push_target : DEFAULT_PUSH_TARGET;
+    fp->no_stdout = no_stdout;
 
     return true;
 }
@@ -119,6 +120,8 @@ run_file_pusher(void *data) {
     const char *push_target = fp->push_target;
     assert(push_target);
 
+    unsigned adb_flags = fp->no_stdout ? SC_ADB_NO_STDOUT : 0;
+
     for (;;) {
         sc_mutex_lock(&fp->mutex);
         while (!fp->stopped && sc_vecdeque_is_empty(&fp->queue)) {
@@ -136,7 +139,7 @@ run_file_pusher(void *data) {
 
         if (req.action == SC_FILE_PUSHER_ACTION_INSTALL_APK) {
             LOGI("Installing %s...", req.file);
-            bool ok = sc_adb_install(intr, serial, req.file, 0);
+            bool ok = sc_adb_install(intr, serial, req.file, adb_flags);
             if (ok) {
                 LOGI("%s successfully installed", req.file);
             } else {
@@ -144,7 +147,8 @@ run_file_pusher(void *data) {
             }
         } else {
             LOGI("Pushing %s...", req.file);
-            bool ok = sc_adb_push(intr, serial, req.file, push_target, 0);
+            bool ok = sc_adb_push(intr, serial, req.file, push_target,
+                                  adb_flags);
             if (ok) {
                 LOGI("%s successfully pushed to %s", req.file, push_target);
             } else {
@@ -24,6 +24,9 @@ struct sc_file_pusher_request_queue SC_VECDEQUE(struct sc_file_pusher_request);
 struct sc_file_pusher {
     char *serial;
     const char *push_target;
+    // stdout is reserved (e.g. for recording to a pipe), adb must not write
+    // to it
+    bool no_stdout;
     sc_thread thread;
     sc_mutex mutex;
     sc_cond event_cond;
@@ -36,7 +39,7 @@ struct sc_file_pusher {
 
 bool
 sc_file_pusher_init(struct sc_file_pusher *fp, const char *serial,
-                    const char *push_target);
+                    const char *push_target, bool no_stdout);
 
 void
 sc_file_pusher_destroy(struct sc_file_pusher *fp);
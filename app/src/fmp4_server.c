@@ -0,0 +1,797 @@
+#include "fmp4_server.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/log.h"
+
+/** Downcast packet sinks to sc_fmp4_server */
+#define DOWNCAST_VIDEO(SINK) \
+    container_of(SINK, struct sc_fmp4_server, video_packet_sink)
+#define DOWNCAST_AUDIO(SINK) \
+    container_of(SINK, struct sc_fmp4_server, audio_packet_sink)
+/** Downcast broadcast server to sc_fmp4_server */
+#define DOWNCAST_BROADCAST(BS) \
+    container_of(BS, struct sc_fmp4_server, broadcast)
+
+#define SC_FMP4_AVIO_BUFFER_SIZE 4096
+// The duration of a video frame until it can be computed (in us)
+#define SC_FMP4_DEFAULT_FRAME_DURATION (1000000 / 60)
+
+/**
+ * Create a packet wrapped into an HTTP chunk (the data must not be empty, an
+ * empty HTTP chunk ends the response)
+ *
+ * The init segment and the fragments are stored with their chunked transfer
+ * encoding framing, so that they are written as is.
+ */
+static struct sc_broadcast_packet *
+sc_fmp4_chunk_new(const void *data, size_t len) {
+    assert(len);
+
+    struct sc_broadcast_packet *chunk = sc_broadcast_packet_new(len + 2);
+    if (!chunk) {
+        return NULL;
+    }
+
+    int prefix_len = snprintf((char *) chunk->header, sizeof(chunk->header),
+                              "%zx\r\n", len);
+    assert(prefix_len > 0 && (size_t) prefix_len < sizeof(chunk->header));
+    chunk->header_len = prefix_len;
+
+    memcpy(chunk->data, data, len);
+    memcpy(&chunk->data[len], "\r\n", 2);
+    return chunk;
+}
+
+// Start streaming to a client: send the response header, the init segment,
+// then the fragments since the last key frame, so that it can start
+// immediately (the caller must lock the mutex)
+static void
+sc_fmp4_server_start_client(struct sc_fmp4_server *server,
+                            struct sc_broadcast_client *client) {
+    assert(server->init);
+
+    char header[512];
+    int len = snprintf(header, sizeof(header),
+                       "HTTP/1.1 200 OK\r\n"
+                       "Content-Type: %s\r\n"
+                       "Transfer-Encoding: chunked\r\n"
+                       "Cache-Control: no-cache, no-store\r\n"
+                       "Access-Control-Allow-Origin: *\r\n"
+                       "\r\n", server->content_type);
+    assert(len > 0 && (size_t) len < sizeof(header));
+
+    struct sc_broadcast_packet *p = sc_broadcast_packet_new(len);
+    if (!p) {
+        client->closed = true;
+        return;
+    }
+
+    memcpy(p->data, header, len);
+
+    bool ok = sc_broadcast_client_push(client, p);
+    sc_broadcast_packet_unref(p);
+    if (!ok || !sc_broadcast_client_push(client, server->init)) {
+        return;
+    }
+
+    size_t count = sc_broadcast_server_start_client(&server->broadcast,
+                                                    client);
+
+    LOGI("fMP4 client %" PRIu32 " connected (%zu fragments cached)",
+         client->id, count);
+}
+
+static void
+sc_fmp4_server_on_request(struct sc_broadcast_server *bs,
+                          struct sc_broadcast_client *client) {
+    struct sc_fmp4_server *server = DOWNCAST_BROADCAST(bs);
+    const char *request = client->request;
+
+    if (strncmp(request, "GET ", 4)) {
+        sc_broadcast_server_respond_error(bs, client,
+                                          "405 Method Not Allowed");
+        return;
+    }
+
+    const char *path = &request[4];
+    size_t path_len = strcspn(path, "? \r\n");
+    bool stream = (path_len == 1 && path[0] == '/')
+               || (path_len == 11 && !strncmp(path, "/stream.mp4", 11));
+    if (!stream) {
+        sc_broadcast_server_respond_error(bs, client, "404 Not Found");
+        return;
+    }
+
+    sc_mutex_lock(&bs->mutex);
+    if (server->init) {
+        sc_fmp4_server_start_client(server, client);
+    } else {
+        // Started once the init segment is available
+        client->state = SC_BROADCAST_CLIENT_WAITING;
+    }
+    sc_mutex_unlock(&bs->mutex);
+}
+
+#ifdef SCRCPY_LAVF_HAS_AVIO_WRITE_CONST
+static int
+sc_fmp4_server_write_packet(void *opaque, const uint8_t *buf, int buf_size) {
+#else
+static int
+sc_fmp4_server_write_packet(void *opaque, uint8_t *buf, int buf_size) {
+#endif
+    struct sc_fmp4_server *server = opaque;
+
+    // Called by the muxer, the mutex is locked
+    if (!sc_vector_push_all(&server->pending, buf, buf_size)) {
+        LOG_OOM();
+        return AVERROR(ENOMEM);
+    }
+
+    return buf_size;
+}
+
+// Take the bytes written by the muxer as a new chunk (the caller must lock
+// the mutex)
+static struct sc_broadcast_packet *
+sc_fmp4_server_take_pending(struct sc_fmp4_server *server) {
+    assert(server->pending.size);
+
+    struct sc_broadcast_packet *chunk =
+        sc_fmp4_chunk_new(server->pending.data, server->pending.size);
+    // Keep the capacity for the next chunks
+    server->pending.size = 0;
+    return chunk;
+}
+
+static void
+sc_fmp4_server_set_content_type(struct sc_fmp4_server *server) {
+    AVFormatContext *ctx = server->ctx;
+
+    // The codecs, separated by ','
+    char codecs[2 * SC_MUXER_CODEC_STRING_MAX];
+    size_t len = 0;
+    bool known = true;
+    for (unsigned i = 0; i < ctx->nb_streams && known; ++i) {
+        AVCodecParameters *par = ctx->streams[i]->codecpar;
+        char codec[SC_MUXER_CODEC_STRING_MAX];
+        known = sc_muxer_get_codec_string(par->codec_id, par->extradata,
+                                          par->extradata_size, codec);
+        if (known) {
+            int r = snprintf(&codecs[len], sizeof(codecs) - len, "%s%s",
+                             i ? "," : "", codec);
+            assert(r > 0 && (size_t) r < sizeof(codecs) - len);
+            len += r;
+        }
+    }
+
+    const char *type = server->video ? "video/mp4" : "audio/mp4";
+    if (known) {
+        snprintf(server->content_type, sizeof(server->content_type),
+                 "%s; codecs=\"%s\"", type, codecs);
+    } else {
+        // Let the players guess
+        snprintf(server->content_type, sizeof(server->content_type), "%s",
+                 type);
+    }
+}
+
+// Publish a new init segment (the caller must lock the mutex)
+static bool
+sc_fmp4_server_publish_init(struct sc_fmp4_server *server) {
+    avio_flush(server->ctx->pb);
+    struct sc_broadcast_packet *init = sc_fmp4_server_take_pending(server);
+    if (!init) {
+        return false;
+    }
+
+    if (server->init) {
+        sc_broadcast_packet_unref(server->init);
+    }
+    server->init = init; // move the reference
+    sc_broadcast_server_clear_cache(&server->broadcast);
+    sc_fmp4_server_set_content_type(server);
+
+    struct sc_broadcast_server *bs = &server->broadcast;
+    for (size_t i = 0; i < bs->clients.size; ++i) {
+        struct sc_broadcast_client *client = bs->clients.data[i];
+        if (client->closed) {
+            continue;
+        }
+
+        if (client->state == SC_BROADCAST_CLIENT_WAITING) {
+            sc_fmp4_server_start_client(server, client);
+        } else if (client->state == SC_BROADCAST_CLIENT_STREAMING) {
+            // The stream has been reconfigured, the next fragments require
+            // the new init segment
+            sc_broadcast_client_push(client, init);
+            client->wait_key_frame = true;
+        }
+    }
+
+    sc_broadcast_server_wake(bs);
+    return true;
+}
+
+// Flush the current fragment and publish it (the caller must lock the mutex)
+static bool
+sc_fmp4_server_flush_fragment(struct sc_fmp4_server *server, bool key) {
+    // Flush the interleaving queue, then the fragment (frag_custom)
+    if (av_interleaved_write_frame(server->ctx, NULL) < 0
+            || av_write_frame(server->ctx, NULL) < 0) {
+        return false;
+    }
+
+    avio_flush(server->ctx->pb);
+    if (!server->pending.size) {
+        // Nothing to publish
+        return true;
+    }
+
+    struct sc_broadcast_packet *chunk = sc_fmp4_server_take_pending(server);
+    if (!chunk) {
+        return false;
+    }
+
+    chunk->flags = SC_BROADCAST_PACKET_MEDIA;
+    if (key) {
+        chunk->flags |= SC_BROADCAST_PACKET_KEY;
+    }
+
+    bool ok = sc_broadcast_server_cache(&server->broadcast, chunk);
+    if (ok) {
+        sc_broadcast_server_broadcast(&server->broadcast, chunk);
+    }
+
+    sc_broadcast_packet_unref(chunk);
+    return ok;
+}
+
+static void
+sc_fmp4_server_free_context(AVFormatContext *ctx) {
+    if (ctx->pb) {
+        av_freep(&ctx->pb->buffer);
+#ifdef SCRCPY_LAVF_HAS_AVIO_CONTEXT_FREE
+        avio_context_free(&ctx->pb);
+#else
+        av_freep(&ctx->pb);
+#endif
+    }
+    avformat_free_context(ctx);
+}
+
+static bool
+sc_fmp4_server_add_stream(AVFormatContext *ctx, const AVCodecParameters *par,
+                          const AVPacket *config,
+                          struct sc_muxer_stream *st) {
+    AVStream *stream = avformat_new_stream(ctx, NULL);
+    if (!stream) {
+        LOG_OOM();
+        return false;
+    }
+
+    if (avcodec_parameters_copy(stream->codecpar, par) < 0) {
+        LOG_OOM();
+        return false;
+    }
+
+    if (config && !sc_muxer_set_extradata(stream, config)) {
+        return false;
+    }
+
+    sc_muxer_stream_init(st);
+    st->index = stream->index;
+    return true;
+}
+
+// Create the muxer and publish the init segment (the caller must lock the
+// mutex)
+static bool
+sc_fmp4_server_open_muxer(struct sc_fmp4_server *server) {
+    assert(!server->ctx);
+    assert(server->video || server->audio);
+
+    const AVOutputFormat *format = sc_muxer_find_format("mp4");
+    if (!format) {
+        LOGE("fMP4 server: could not find muxer");
+        return false;
+    }
+
+    AVFormatContext *ctx = avformat_alloc_context();
+    if (!ctx) {
+        LOG_OOM();
+        return false;
+    }
+
+    // See sc_recorder_open_output_file()
+    ctx->oformat = (AVOutputFormat *) format;
+    ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    uint8_t *buffer = av_malloc(SC_FMP4_AVIO_BUFFER_SIZE);
+    if (!buffer) {
+        LOG_OOM();
+        goto error;
+    }
+
+    ctx->pb = avio_alloc_context(buffer, SC_FMP4_AVIO_BUFFER_SIZE, 1, server,
+                                 NULL, sc_fmp4_server_write_packet, NULL);
+    if (!ctx->pb) {
+        LOG_OOM();
+        av_free(buffer);
+        goto error;
+    }
+
+    if (server->video) {
+        bool ok = sc_fmp4_server_add_stream(ctx, server->video_par,
+                                            server->video_config,
+                                            &server->video_stream);
+        if (!ok) {
+            goto error;
+        }
+    }
+
+    if (server->audio) {
+        bool ok = sc_fmp4_server_add_stream(ctx, server->audio_par,
+                                            server->audio_config,
+                                            &server->audio_stream);
+        if (!ok) {
+            goto error;
+        }
+    }
+
+    AVDictionary *opts = NULL;
+    // The moov atom is written first (without samples), then the fragments
+    // are flushed explicitly, one per video frame
+    if (av_dict_set(&opts, "movflags",
+                    "empty_moov+default_base_moof+frag_custom", 0) < 0) {
+        LOG_OOM();
+        goto error;
+    }
+
+    server->ctx = ctx;
+    int ret = avformat_write_header(ctx, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        LOGE("fMP4 server: could not write header");
+        goto error;
+    }
+
+    if (!sc_fmp4_server_publish_init(server)) {
+        goto error;
+    }
+
+    server->pts_origin = AV_NOPTS_VALUE;
+    server->wait_key_frame = server->video;
+    server->last_video_duration = SC_FMP4_DEFAULT_FRAME_DURATION;
+
+    LOGD("fMP4 server: muxer started (%s)", server->content_type);
+    return true;
+
+error:
+    server->ctx = NULL;
+    server->pending.size = 0;
+    sc_fmp4_server_free_context(ctx);
+    return false;
+}
+
+// Write a video packet (owned) and flush its fragment
+static bool
+sc_fmp4_server_mux_video(struct sc_fmp4_server *server, AVPacket *packet) {
+    bool key = packet->flags & AV_PKT_FLAG_KEY;
+    bool ok = sc_muxer_write_stream(server->ctx, &server->video_stream,
+                                    packet);
+    av_packet_free(&packet);
+    return ok && sc_fmp4_server_flush_fragment(server, key);
+}
+
+static void
+sc_fmp4_server_close_muxer(struct sc_fmp4_server *server) {
+    assert(server->ctx);
+
+    AVPacket *last = server->video_pkt_previous;
+    if (last) {
+        server->video_pkt_previous = NULL;
+        // The next frame is unknown, assume the last frame duration
+        last->duration = server->last_video_duration;
+        if (!sc_fmp4_server_mux_video(server, last)) {
+            LOGW("fMP4 server: could not write the last video packet");
+        }
+    }
+
+    // Nothing to finalize, the fragments are self-contained
+    sc_fmp4_server_free_context(server->ctx);
+    server->ctx = NULL;
+    server->pending.size = 0;
+}
+
+// Stop muxing on error (the clients remain connected, without new fragments)
+static void
+sc_fmp4_server_fail(struct sc_fmp4_server *server) {
+    LOGE("fMP4 server: muxing failed, stream stopped");
+    server->failed = true;
+
+    if (server->video_pkt_previous) {
+        av_packet_free(&server->video_pkt_previous);
+    }
+    if (server->ctx) {
+        sc_fmp4_server_free_context(server->ctx);
+        server->ctx = NULL;
+    }
+}
+
+// Open the muxer once the config packets of all the streams are received
+static void
+sc_fmp4_server_try_open_muxer(struct sc_fmp4_server *server) {
+    if (server->ctx || server->failed) {
+        return;
+    }
+
+    if ((server->video && !server->video_config)
+            || (server->audio && !server->audio_config)) {
+        // Wait for the other streams
+        return;
+    }
+
+    if (!sc_fmp4_server_open_muxer(server)) {
+        sc_fmp4_server_fail(server);
+    }
+}
+
+static bool
+sc_fmp4_server_set_config(AVPacket **config, const AVPacket *packet) {
+    if (!*config) {
+        *config = av_packet_alloc();
+        if (!*config) {
+            LOG_OOM();
+            return false;
+        }
+    } else {
+        av_packet_unref(*config);
+    }
+
+    if (av_packet_ref(*config, packet)) {
+        LOG_OOM();
+        av_packet_free(config);
+        return false;
+    }
+
+    return true;
+}
+
+static AVPacket *
+sc_fmp4_server_packet_ref(const AVPacket *packet, int stream_index,
+                          int64_t pts_origin) {
+    AVPacket *p = av_packet_alloc();
+    if (!p) {
+        LOG_OOM();
+        return NULL;
+    }
+
+    if (av_packet_ref(p, packet)) {
+        LOG_OOM();
+        av_packet_free(&p);
+        return NULL;
+    }
+
+    p->stream_index = stream_index;
+    p->pts -= pts_origin;
+    p->dts = p->pts;
+    return p;
+}
+
+static bool
+sc_fmp4_server_push_video(struct sc_fmp4_server *server,
+                          const AVPacket *packet) {
+    if (packet->pts == AV_NOPTS_VALUE) {
+        if (server->ctx) {
+            // The stream is reconfigured, restart the muxer with the new
+            // config (a new init segment is sent to the clients)
+            LOGD("fMP4 server: video stream reconfigured");
+            sc_fmp4_server_close_muxer(server);
+        }
+
+        if (!sc_fmp4_server_set_config(&server->video_config, packet)) {
+            return false;
+        }
+
+        sc_fmp4_server_try_open_muxer(server);
+        return true;
+    }
+
+    if (!server->ctx) {
+        // Not started yet
+        return true;
+    }
+
+    if (server->wait_key_frame) {
+        if (!(packet->flags & AV_PKT_FLAG_KEY)) {
+            return true;
+        }
+        server->wait_key_frame = false;
+        // The stream starts on the first key frame
+        server->pts_origin = packet->pts;
+    }
+
+    AVPacket *pkt = sc_fmp4_server_packet_ref(packet,
+                                              server->video_stream.index,
+                                              server->pts_origin);
+    if (!pkt) {
+        return false;
+    }
+
+    // We can write a video packet only once we received the next one so that
+    // we can set its duration (next_pts - current_pts)
+    AVPacket *previous = server->video_pkt_previous;
+    server->video_pkt_previous = pkt;
+    if (!previous) {
+        return true;
+    }
+
+    int64_t duration = pkt->pts - previous->pts;
+    if (duration > 0) {
+        server->last_video_duration = duration;
+    }
+    previous->duration = server->last_video_duration;
+
+    return sc_fmp4_server_mux_video(server, previous);
+}
+
+static bool
+sc_fmp4_server_push_audio(struct sc_fmp4_server *server,
+                          const AVPacket *packet) {
+    if (packet->pts == AV_NOPTS_VALUE) {
+        if (!sc_fmp4_server_set_config(&server->audio_config, packet)) {
+            return false;
+        }
+
+        sc_fmp4_server_try_open_muxer(server);
+        return true;
+    }
+
+    if (!server->ctx) {
+        // Not started yet
+        return true;
+    }
+
+    if (server->pts_origin == AV_NOPTS_VALUE) {
+        if (server->video) {
+            // Wait for the first video key frame
+            return true;
+        }
+        server->pts_origin = packet->pts;
+    }
+
+    if (packet->pts < server->pts_origin) {
+        return true;
+    }
+
+    AVPacket *pkt = sc_fmp4_server_packet_ref(packet,
+                                              server->audio_stream.index,
+                                              server->pts_origin);
+    if (!pkt) {
+        return false;
+    }
+
+    bool ok = sc_muxer_write_stream(server->ctx, &server->audio_stream, pkt);
+    av_packet_free(&pkt);
+
+    if (ok && !server->video) {
+        // Audio only: one fragment per packet, each one is a random access
+        // point
+        ok = sc_fmp4_server_flush_fragment(server, true);
+    }
+
+    return ok;
+}
+
+static bool
+sc_fmp4_server_open_stream(AVCodecParameters **par, AVCodecContext *ctx) {
+    *par = avcodec_parameters_alloc();
+    if (!*par) {
+        LOG_OOM();
+        return false;
+    }
+
+    if (avcodec_parameters_from_context(*par, ctx) < 0) {
+        LOG_OOM();
+        avcodec_parameters_free(par);
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+sc_fmp4_server_video_packet_sink_open(struct sc_packet_sink *sink,
+                                      AVCodecContext *ctx) {
+    struct sc_fmp4_server *server = DOWNCAST_VIDEO(sink);
+
+    sc_mutex_lock(&server->broadcast.mutex);
+    assert(server->video && !server->video_par);
+    bool ok = sc_fmp4_server_open_stream(&server->video_par, ctx);
+    sc_mutex_unlock(&server->broadcast.mutex);
+
+    return ok;
+}
+
+static bool
+sc_fmp4_server_audio_packet_sink_open(struct sc_packet_sink *sink,
+                                      AVCodecContext *ctx) {
+    struct sc_fmp4_server *server = DOWNCAST_AUDIO(sink);
+
+    sc_mutex_lock(&server->broadcast.mutex);
+    assert(server->audio && !server->audio_par);
+    bool ok = sc_fmp4_server_open_stream(&server->audio_par, ctx);
+    sc_mutex_unlock(&server->broadcast.mutex);
+
+    return ok;
+}
+
+static void
+sc_fmp4_server_packet_sink_close(struct sc_packet_sink *sink) {
+    // Nothing to do, the clients remain connected until the server is stopped
+    (void) sink;
+}
+
+static bool
+sc_fmp4_server_video_packet_sink_push(struct sc_packet_sink *sink,
+                                      const AVPacket *packet) {
+    struct sc_fmp4_server *server = DOWNCAST_VIDEO(sink);
+
+    sc_mutex_lock(&server->broadcast.mutex);
+    if (!server->failed && !sc_fmp4_server_push_video(server, packet)) {
+        sc_fmp4_server_fail(server);
+    }
+    sc_mutex_unlock(&server->broadcast.mutex);
+
+    // A muxing failure must not stop the other packet sinks
+    return true;
+}
+
+static bool
+sc_fmp4_server_audio_packet_sink_push(struct sc_packet_sink *sink,
+                                      const AVPacket *packet) {
+    struct sc_fmp4_server *server = DOWNCAST_AUDIO(sink);
+
+    sc_mutex_lock(&server->broadcast.mutex);
+    if (!server->failed && !sc_fmp4_server_push_audio(server, packet)) {
+        sc_fmp4_server_fail(server);
+    }
+    sc_mutex_unlock(&server->broadcast.mutex);
+
+    // A muxing failure must not stop the other packet sinks
+    return true;
+}
+
+static void
+sc_fmp4_server_audio_packet_sink_disable(struct sc_packet_sink *sink) {
+    struct sc_fmp4_server *server = DOWNCAST_AUDIO(sink);
+
+    LOGW("fMP4 server: audio stream disabled");
+
+    sc_mutex_lock(&server->broadcast.mutex);
+    server->audio = false;
+    if (server->video) {
+        sc_fmp4_server_try_open_muxer(server);
+    } else {
+        // Nothing to stream
+        server->failed = true;
+    }
+    sc_mutex_unlock(&server->broadcast.mutex);
+}
+
+bool
+sc_fmp4_server_init(struct sc_fmp4_server *server, uint16_t port, bool video,
+                    bool audio) {
+    assert(video || audio);
+
+    static const struct sc_broadcast_server_ops broadcast_ops = {
+        .name = "fMP4",
+        .thread_name = "scrcpy-fmp4",
+        .client_size = sizeof(struct sc_broadcast_client),
+        .on_request = sc_fmp4_server_on_request,
+    };
+
+    if (!sc_broadcast_server_init(&server->broadcast, port, &broadcast_ops)) {
+        return false;
+    }
+
+    server->video = video;
+    server->audio = audio;
+    server->video_par = NULL;
+    server->audio_par = NULL;
+    server->video_config = NULL;
+    server->audio_config = NULL;
+
+    server->ctx = NULL;
+    server->failed = false;
+    sc_muxer_stream_init(&server->video_stream);
+    sc_muxer_stream_init(&server->audio_stream);
+    server->pts_origin = AV_NOPTS_VALUE;
+    server->wait_key_frame = video;
+    server->video_pkt_previous = NULL;
+    server->last_video_duration = SC_FMP4_DEFAULT_FRAME_DURATION;
+    sc_vector_init(&server->pending);
+
+    server->content_type[0] = '\0';
+    server->init = NULL;
+
+    if (video) {
+        static const struct sc_packet_sink_ops video_ops = {
+            .open = sc_fmp4_server_video_packet_sink_open,
+            .close = sc_fmp4_server_packet_sink_close,
+            .push = sc_fmp4_server_video_packet_sink_push,
+        };
+
+        server->video_packet_sink.ops = &video_ops;
+    }
+
+    if (audio) {
+        static const struct sc_packet_sink_ops audio_ops = {
+            .open = sc_fmp4_server_audio_packet_sink_open,
+            .close = sc_fmp4_server_packet_sink_close,
+            .push = sc_fmp4_server_audio_packet_sink_push,
+            .disable = sc_fmp4_server_audio_packet_sink_disable,
+        };
+
+        server->audio_packet_sink.ops = &audio_ops;
+    }
+
+    return true;
+}
+
+bool
+sc_fmp4_server_start(struct sc_fmp4_server *server) {
+    if (!sc_broadcast_server_start(&server->broadcast)) {
+        return false;
+    }
+
+    LOGI("fMP4 server listening on http://127.0.0.1:%" PRIu16 "/stream.mp4",
+         server->broadcast.port);
+    return true;
+}
+
+void
+sc_fmp4_server_stop(struct sc_fmp4_server *server) {
+    sc_broadcast_server_stop(&server->broadcast);
+}
+
+void
+sc_fmp4_server_join(struct sc_fmp4_server *server) {
+    sc_broadcast_server_join(&server->broadcast);
+}
+
+void
+sc_fmp4_server_destroy(struct sc_fmp4_server *server) {
+    sc_broadcast_server_destroy(&server->broadcast);
+
+    if (server->init) {
+        sc_broadcast_packet_unref(server->init);
+    }
+
+    if (server->video_pkt_previous) {
+        av_packet_free(&server->video_pkt_previous);
+    }
+    if (server->ctx) {
+        sc_fmp4_server_free_context(server->ctx);
+    }
+    sc_vector_destroy(&server->pending);
+
+    if (server->video_config) {
+        av_packet_free(&server->video_config);
+    }
+    if (server->audio_config) {
+        av_packet_free(&server->audio_config);
+    }
+    if (server->video_par) {
+        avcodec_parameters_free(&server->video_par);
+    }
+    if (server->audio_par) {
+        avcodec_parameters_free(&server->audio_par);
+    }
+}
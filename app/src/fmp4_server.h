@@ -0,0 +1,100 @@
+#ifndef SC_FMP4_SERVER_H
+#define SC_FMP4_SERVER_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "broadcast_server.h"
+#include "muxer.h"
+#include "trait/packet_sink.h"
+#include "util/vector.h"
+
+/**
+ * HTTP fragmented MP4 (CMAF) live server
+ *
+ * Remux the device packets (without decoding or re-encoding) into fragmented
+ * MP4, served over HTTP to several clients as a single progressive response
+ * (chunked transfer encoding), directly playable by a Media Source Extensions
+ * player.
+ *
+ * The response starts with the init segment (ftyp + moov), then one fragment
+ * (moof + mdat) is written per video frame (with the audio packets received
+ * meanwhile), so that the latency is at most one frame.
+ *
+ * The fragments are built once (with their chunked transfer encoding framing)
+ * and shared by all the clients (see broadcast_server.h). A late joiner
+ * receives the init segment and the fragments since the last key frame. A
+ * slow client drops fragments until the next key frame without impacting the
+ * others.
+ *
+ * If the video stream is reconfigured (e.g. on device rotation), the muxer is
+ * restarted: a new init segment is sent, and the timestamps restart from 0
+ * (players should use the "sequence" append mode).
+ */
+
+struct sc_fmp4_server {
+    struct sc_packet_sink video_packet_sink;
+    struct sc_packet_sink audio_packet_sink;
+
+    struct sc_broadcast_server broadcast;
+
+    // All the fields below are protected by broadcast.mutex
+
+    // The streams to mux (audio is reset if disabled by the device)
+    bool video;
+    bool audio;
+    // The parameters of the streams, once open
+    AVCodecParameters *video_par;
+    AVCodecParameters *audio_par;
+    // The last config packets
+    AVPacket *video_config;
+    AVPacket *audio_config;
+
+    // The muxer (written by the demuxer threads), NULL until all the config
+    // packets are received
+    AVFormatContext *ctx;
+    // The muxer failed, the stream is stopped
+    bool failed;
+    struct sc_muxer_stream video_stream;
+    struct sc_muxer_stream audio_stream;
+    int64_t pts_origin;
+    // The first fragment must start with a video key frame
+    bool wait_key_frame;
+    // A video packet is written once the next one is received, to know its
+    // duration
+    AVPacket *video_pkt_previous;
+    int64_t last_video_duration;
+    // The bytes written by the muxer since the last chunk
+    struct SC_VECTOR(uint8_t) pending;
+
+    // The Content-Type of the stream (with the codecs, if known)
+    char content_type[64 + 2 * SC_MUXER_CODEC_STRING_MAX];
+    // The current init segment
+    struct sc_broadcast_packet *init;
+};
+
+bool
+sc_fmp4_server_init(struct sc_fmp4_server *server, uint16_t port, bool video,
+                    bool audio);
+
+/**
+ * Listen on localhost and start the server thread
+ */
+bool
+sc_fmp4_server_start(struct sc_fmp4_server *server);
+
+void
+sc_fmp4_server_stop(struct sc_fmp4_server *server);
+
+void
+sc_fmp4_server_join(struct sc_fmp4_server *server);
+
+void
+sc_fmp4_server_destroy(struct sc_fmp4_server *server);
+
+#endif
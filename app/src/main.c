@@ -31,9 +31,6 @@ main_scrcpy(int argc, char *argv[]) {
     setbuf(stderr, NULL);
 #endif
 
-    printf("scrcpy " SCRCPY_VERSION
-           " <https://github.com/Genymobile/scrcpy>\n");
-
     struct scrcpy_cli_args args = {
         .opts = scrcpy_options_default,
         .help = false,
@@ -47,11 +44,22 @@ main_scrcpy(int argc, char *argv[]) {
 
     enum scrcpy_exit_code ret;
 
+    // Messages are printed to stdout, unless it is reserved for the recording
+    FILE *out = stdout;
+
     if (!scrcpy_parse_args(&args, argc, argv)) {
         ret = SCRCPY_EXIT_FAILURE;
         goto end;
     }
 
+    bool stdout_reserved = sc_record_is_stdout(args.opts.record_filename);
+    if (stdout_reserved) {
+        out = stderr;
+    }
+
+    fprintf(out, "scrcpy " SCRCPY_VERSION
+                 " <https://github.com/Genymobile/scrcpy>\n");
+
     sc_set_log_level(args.opts.log_level);
 
     if (args.help) {
@@ -84,7 +92,7 @@ main_scrcpy(int argc, char *argv[]) {
         goto end;
     }
 
-    sc_log_configure();
+    sc_log_configure(stdout_reserved);
 
 #ifdef HAVE_USB
     ret = args.opts.otg ? scrcpy_otg(&args.opts) : scrcpy(&args.opts);
@@ -96,7 +104,7 @@ end:
     if (args.pause_on_exit == SC_PAUSE_ON_EXIT_TRUE ||
             (args.pause_on_exit == SC_PAUSE_ON_EXIT_IF_ERROR &&
                 ret != SCRCPY_EXIT_SUCCESS)) {
-        printf("Press Enter to continue...\n");
+        fprintf(out, "Press Enter to continue...\n");
         getchar();
     }
 
@@ -0,0 +1,165 @@
+#include "muxer.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <libavutil/display.h>
+
+#include "util/log.h"
+#include "util/str.h"
+
+static const AVRational SCRCPY_TIME_BASE = {1, 1000000}; // timestamps in us
+
+void
+sc_muxer_stream_init(struct sc_muxer_stream *stream) {
+    stream->index = -1;
+    stream->last_pts = AV_NOPTS_VALUE;
+}
+
+const AVOutputFormat *
+sc_muxer_find_format(const char *name) {
+#ifdef SCRCPY_LAVF_HAS_NEW_MUXER_ITERATOR_API
+    void *opaque = NULL;
+#endif
+    const AVOutputFormat *oformat = NULL;
+    do {
+#ifdef SCRCPY_LAVF_HAS_NEW_MUXER_ITERATOR_API
+        oformat = av_muxer_iterate(&opaque);
+#else
+        oformat = av_oformat_next(oformat);
+#endif
+        // until null or containing the requested name
+    } while (oformat && !sc_str_list_contains(oformat->name, ',', name));
+    return oformat;
+}
+
+bool
+sc_muxer_set_extradata(AVStream *ostream, const AVPacket *packet) {
+    uint8_t *extradata = av_malloc(packet->size * sizeof(uint8_t));
+    if (!extradata) {
+        LOG_OOM();
+        return false;
+    }
+
+    // copy the first packet to the extra data
+    memcpy(extradata, packet->data, packet->size);
+
+    av_free(ostream->codecpar->extradata);
+    ostream->codecpar->extradata = extradata;
+    ostream->codecpar->extradata_size = packet->size;
+    return true;
+}
+
+bool
+sc_muxer_set_orientation(AVStream *stream, enum sc_orientation orientation) {
+    assert(!sc_orientation_is_mirror(orientation));
+
+    uint8_t *raw_data;
+#ifdef SCRCPY_LAVC_HAS_CODECPAR_CODEC_SIDEDATA
+    AVPacketSideData *sd =
+        av_packet_side_data_new(&stream->codecpar->coded_side_data,
+                                &stream->codecpar->nb_coded_side_data,
+                                AV_PKT_DATA_DISPLAYMATRIX,
+                                sizeof(int32_t) * 9, 0);
+    if (!sd) {
+        LOG_OOM();
+        return false;
+    }
+
+    raw_data = sd->data;
+#else
+    raw_data = av_stream_new_side_data(stream, AV_PKT_DATA_DISPLAYMATRIX,
+                                      sizeof(int32_t) * 9);
+    if (!raw_data) {
+        LOG_OOM();
+        return false;
+    }
+#endif
+
+    int32_t *matrix = (int32_t *) raw_data;
+
+    unsigned rotation = orientation;
+    unsigned angle = rotation * 90;
+
+    av_display_rotation_set(matrix, angle);
+
+    return true;
+}
+
+bool
+sc_muxer_write_stream(AVFormatContext *ctx, struct sc_muxer_stream *st,
+                      AVPacket *packet) {
+    AVStream *stream = ctx->streams[st->index];
+    av_packet_rescale_ts(packet, SCRCPY_TIME_BASE, stream->time_base);
+    if (st->last_pts != AV_NOPTS_VALUE && packet->pts <= st->last_pts) {
+        LOGD("Fixing PTS non monotonically increasing in stream %d "
+             "(%" PRIi64 " >= %" PRIi64 ")",
+             st->index, st->last_pts, packet->pts);
+        packet->pts = ++st->last_pts;
+        packet->dts = packet->pts;
+    } else {
+        st->last_pts = packet->pts;
+    }
+    return av_interleaved_write_frame(ctx, packet) >= 0;
+}
+
+// Find the H.264 SPS (profile_idc, constraint flags and level_idc)
+static const uint8_t *
+find_h264_sps(const uint8_t *data, size_t size) {
+    if (size >= 4 && data[0] == 1) {
+        // avcC (AVCDecoderConfigurationRecord)
+        return &data[1];
+    }
+
+    // Annex B: 00 00 01 or 00 00 00 01 start codes
+    for (size_t i = 0; i + 3 < size; ++i) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            uint8_t nal_type = data[i + 3] & 0x1F;
+            if (nal_type == 7 && i + 7 <= size) {
+                return &data[i + 4];
+            }
+        }
+    }
+
+    return NULL;
+}
+
+bool
+sc_muxer_get_codec_string(enum AVCodecID codec_id, const uint8_t *extradata,
+                          size_t extradata_size, char *out) {
+    const char *name;
+    switch (codec_id) {
+        case AV_CODEC_ID_H264: {
+            const uint8_t *sps = extradata
+                               ? find_h264_sps(extradata, extradata_size)
+                               : NULL;
+            if (!sps) {
+                return false;
+            }
+            int len = snprintf(out, SC_MUXER_CODEC_STRING_MAX,
+                               "avc1.%02x%02x%02x", sps[0], sps[1], sps[2]);
+            assert(len > 0 && len < SC_MUXER_CODEC_STRING_MAX);
+            (void) len;
+            return true;
+        }
+        case AV_CODEC_ID_OPUS:
+            name = "opus";
+            break;
+        case AV_CODEC_ID_AAC:
+            // AAC-LC
+            name = "mp4a.40.2";
+            break;
+        case AV_CODEC_ID_FLAC:
+            name = "flac";
+            break;
+        default:
+            // The H.265 and AV1 codec strings require to parse the whole
+            // sequence header, the players must guess
+            return false;
+    }
+
+    assert(strlen(name) < SC_MUXER_CODEC_STRING_MAX);
+    strcpy(out, name);
+    return true;
+}
@@ -0,0 +1,68 @@
+#ifndef SC_MUXER_H
+#define SC_MUXER_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "options.h"
+
+/**
+ * Muxing helpers shared by the recorder and the fMP4 server
+ *
+ * The device packets are remuxed as is (no transcoding). Their timestamps are
+ * in microseconds, config packets have no PTS.
+ */
+
+// Max length of a codec string for MIME types (RFC 6381), e.g. "avc1.64001f"
+#define SC_MUXER_CODEC_STRING_MAX 32
+
+struct sc_muxer_stream {
+    int index;
+    int64_t last_pts;
+};
+
+void
+sc_muxer_stream_init(struct sc_muxer_stream *stream);
+
+const AVOutputFormat *
+sc_muxer_find_format(const char *name);
+
+/**
+ * Set the content of a config packet as the stream extradata (replacing the
+ * previous one, if any)
+ */
+bool
+sc_muxer_set_extradata(AVStream *ostream, const AVPacket *packet);
+
+bool
+sc_muxer_set_orientation(AVStream *stream, enum sc_orientation orientation);
+
+/**
+ * Rescale the packet timestamps to the stream time base and write it
+ *
+ * The PTS are fixed to be strictly increasing (the device may produce
+ * duplicates).
+ */
+bool
+sc_muxer_write_stream(AVFormatContext *ctx, struct sc_muxer_stream *stream,
+                      AVPacket *packet);
+
+/**
+ * Write the codec string of a stream (as expected in the "codecs" parameter
+ * of an MP4 MIME type) to `out` (at least SC_MUXER_CODEC_STRING_MAX bytes)
+ *
+ * For H.264, the profile and level are read from the SPS in the (Annex B)
+ * extradata.
+ *
+ * Return false if the codec string is unknown.
+ */
+bool
+sc_muxer_get_codec_string(enum AVCodecID codec_id, const uint8_t *extradata,
+                          size_t extradata_size, char *out);
+
+#endif
@@ -51,10 +51,18 @@ const struct scrcpy_options scrcpy_options_default = {
     },
     .tunnel_host = 0,
     .tunnel_port = 0,
+    .ws_server_port = 0,
+    .webrtc_max_size = 0,
+    .rtp_host = NULL,
+    .rtp_port = 0,
+    .rtp_sdp = NULL,
+    .fmp4_server_port = 0,
     .shortcut_mods = SC_SHORTCUT_MOD_LALT | SC_SHORTCUT_MOD_LSUPER,
     .max_size = 0,
     .video_bit_rate = 0,
     .audio_bit_rate = 0,
+    .audio_sample_rate = 0,
+    .audio_channels = 0,
     .max_fps = NULL,
     .capture_orientation = SC_ORIENTATION_0,
     .capture_orientation_lock = SC_ORIENTATION_UNLOCKED,
@@ -68,12 +76,25 @@ const struct scrcpy_options scrcpy_options_default = {
     .display_id = 0,
     .video_buffer = 0,
     .audio_buffer = -1, // depends on the audio format,
+    .audio_buffer_min = -1, // audio_buffer by default
+    .audio_buffer_max = -1, // audio_buffer by default
     .audio_output_buffer = SC_TICK_FROM_MS(5),
     .time_limit = 0,
     .screen_off_timeout = -1,
 #ifdef HAVE_V4L2
     .v4l2_device = NULL,
     .v4l2_buffer = 0,
+    .v4l2_format = SC_V4L2_FORMAT_YUV420,
+    .v4l2_width = 0,
+    .v4l2_height = 0,
+#endif
+#ifdef HAVE_SHM
+    .shm_sink = NULL,
+    .shm_slots = 3,
+    .audio_export_target = SC_AUDIO_EXPORT_TARGET_NONE,
+    .audio_export_path = NULL,
+    .audio_export_format = SC_AUDIO_EXPORT_FORMAT_S16,
+    .audio_export_rate = 0,
 #endif
 #ifdef HAVE_USB
     .otg = false,
@@ -109,10 +130,12 @@ const struct scrcpy_options scrcpy_options_default = {
     .require_audio = false,
     .kill_adb_on_close = false,
     .camera_high_speed = false,
+    .record_index = false,
     .list = 0,
     .window = true,
     .mouse_hover = true,
     .audio_dup = false,
+    .av_sync = false,
     .new_display = NULL,
     .start_app = NULL,
     .angle = NULL,
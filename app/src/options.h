@@ -6,6 +6,7 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "util/tick.h"
 
@@ -27,8 +28,15 @@ enum sc_record_format {
     SC_RECORD_FORMAT_AAC,
     SC_RECORD_FORMAT_FLAC,
     SC_RECORD_FORMAT_WAV,
+    SC_RECORD_FORMAT_TS,
 };
 
+// "-" means stdout
+static inline bool
+sc_record_is_stdout(const char *record_filename) {
+    return record_filename && !strcmp(record_filename, "-");
+}
+
 static inline bool
 sc_record_format_is_audio_only(enum sc_record_format fmt) {
     return fmt == SC_RECORD_FORMAT_M4A
@@ -39,6 +47,24 @@ sc_record_format_is_audio_only(enum sc_record_format fmt) {
         || fmt == SC_RECORD_FORMAT_WAV;
 }
 
+enum sc_v4l2_format {
+    SC_V4L2_FORMAT_YUV420,
+    SC_V4L2_FORMAT_NV12,
+    SC_V4L2_FORMAT_YUYV,
+};
+
+enum sc_audio_export_target {
+    SC_AUDIO_EXPORT_TARGET_NONE,
+    SC_AUDIO_EXPORT_TARGET_FIFO,
+    SC_AUDIO_EXPORT_TARGET_UNIX,
+    SC_AUDIO_EXPORT_TARGET_SHM,
+};
+
+enum sc_audio_export_format {
+    SC_AUDIO_EXPORT_FORMAT_S16,
+    SC_AUDIO_EXPORT_FORMAT_F32,
+};
+
 enum sc_codec {
     SC_CODEC_H264,
     SC_CODEC_H265,
@@ -244,6 +270,8 @@ struct scrcpy_options {
     const char *webrtc_signal_url; // 新增参数
     const char *websocket_url; // 新增参数
 
+    const char *rtp_host;
+    const char *rtp_sdp;
     const char *camera_size;
     const char *camera_ar;
     uint16_t camera_fps;
@@ -261,10 +289,16 @@ struct scrcpy_options {
     struct sc_port_range port_range;
     uint32_t tunnel_host;
     uint16_t tunnel_port;
+    uint16_t ws_server_port; // 0 to disable
+    uint16_t webrtc_max_size; // 0 for the video size
+    uint16_t rtp_port; // 0 to disable
+    uint16_t fmp4_server_port; // 0 to disable
     uint8_t shortcut_mods; // OR of enum sc_shortcut_mod values
     uint16_t max_size;
     uint32_t video_bit_rate;
     uint32_t audio_bit_rate;
+    uint32_t audio_sample_rate; // 0 for the default (48000)
+    uint8_t audio_channels; // 0 for the default (2)
     const char *max_fps; // float to be parsed by the server
     const char *angle; // float to be parsed by the server
     enum sc_orientation capture_orientation;
@@ -279,12 +313,25 @@ struct scrcpy_options {
     uint32_t display_id;
     sc_tick video_buffer;
     sc_tick audio_buffer;
+    sc_tick audio_buffer_min; // the range to adapt audio_buffer to the jitter
+    sc_tick audio_buffer_max;
     sc_tick audio_output_buffer;
     sc_tick time_limit;
     sc_tick screen_off_timeout;
 #ifdef HAVE_V4L2
     const char *v4l2_device;
     sc_tick v4l2_buffer;
+    enum sc_v4l2_format v4l2_format;
+    uint16_t v4l2_width; // 0 for the video size
+    uint16_t v4l2_height;
+#endif
+#ifdef HAVE_SHM
+    const char *shm_sink;
+    uint32_t shm_slots;
+    enum sc_audio_export_target audio_export_target;
+    const char *audio_export_path; // FIFO path, socket path or shm name
+    enum sc_audio_export_format audio_export_format;
+    uint32_t audio_export_rate; // 0 for the audio sample rate
 #endif
 #ifdef HAVE_USB
     bool otg;
@@ -320,6 +367,7 @@ struct scrcpy_options {
     bool require_audio;
     bool kill_adb_on_close;
     bool camera_high_speed;
+    bool record_index;
 #define SC_OPTION_LIST_ENCODERS 0x1
 #define SC_OPTION_LIST_DISPLAYS 0x2
 #define SC_OPTION_LIST_CAMERAS 0x4
@@ -329,6 +377,7 @@ struct scrcpy_options {
     bool window;
     bool mouse_hover;
     bool audio_dup;
+    bool av_sync;
     const char *new_display; // [<width>x<height>][/<dpi>] parsed by the server
     const char *start_app;
     bool vd_destroy_content;
@@ -0,0 +1,607 @@
+#include "pcm_sink.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <libavutil/opt.h>
+
+#include "util/log.h"
+#include "util/tick.h"
+
+/** Downcast frame_sink to sc_pcm_sink */
+#define DOWNCAST(SINK) container_of(SINK, struct sc_pcm_sink, frame_sink)
+
+// While waiting for a slow consumer, check regularly if the sink is stopped
+#define SC_PCM_SINK_POLL_TIMEOUT_MS 100
+
+static const char *
+sc_pcm_sink_get_format_name(enum sc_audio_export_format format) {
+    return format == SC_AUDIO_EXPORT_FORMAT_F32 ? "f32" : "s16";
+}
+
+static bool
+sc_pcm_sink_is_stopped(struct sc_pcm_sink *ps) {
+    sc_mutex_lock(&ps->mutex);
+    bool stopped = ps->stopped;
+    sc_mutex_unlock(&ps->mutex);
+    return stopped;
+}
+
+static bool
+sc_pcm_sink_set_nonblock(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1) {
+        return false;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+static bool
+sc_pcm_sink_create_fifo(struct sc_pcm_sink *ps) {
+    struct stat st;
+    if (stat(ps->path, &st) == -1) {
+        if (errno != ENOENT) {
+            LOGE("Could not access %s: %s", ps->path, strerror(errno));
+            return false;
+        }
+
+        if (mkfifo(ps->path, 0600) == -1) {
+            LOGE("Could not create FIFO %s: %s", ps->path, strerror(errno));
+            return false;
+        }
+
+        // Only remove the FIFO on close if it has been created by scrcpy
+        ps->fifo_created = true;
+    } else if (!S_ISFIFO(st.st_mode)) {
+        LOGE("Not a FIFO: %s", ps->path);
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+sc_pcm_sink_listen_unix(struct sc_pcm_sink *ps) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    size_t len = strlen(ps->path);
+    if (len >= sizeof(addr.sun_path)) {
+        LOGE("UNIX socket path too long: %s", ps->path);
+        return false;
+    }
+    memcpy(addr.sun_path, ps->path, len + 1);
+
+    struct stat st;
+    if (stat(ps->path, &st) != -1) {
+        if (!S_ISSOCK(st.st_mode)) {
+            LOGE("Not a UNIX socket: %s", ps->path);
+            return false;
+        }
+
+        // Probably a stale socket from a previous run
+        unlink(ps->path);
+    }
+
+#ifdef HAVE_SOCK_CLOEXEC
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+#endif
+    if (fd == -1) {
+        LOGE("Could not create UNIX socket: %s", strerror(errno));
+        return false;
+    }
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        LOGE("Could not bind UNIX socket %s: %s", ps->path, strerror(errno));
+        goto error_close;
+    }
+
+    // The export thread must never block on accept()
+    if (listen(fd, 1) == -1 || !sc_pcm_sink_set_nonblock(fd)) {
+        LOGE("Could not listen on UNIX socket %s: %s", ps->path,
+             strerror(errno));
+        unlink(ps->path);
+        goto error_close;
+    }
+
+    ps->listen_fd = fd;
+    return true;
+
+error_close:
+    close(fd);
+    return false;
+}
+
+static bool
+sc_pcm_sink_open_target(struct sc_pcm_sink *ps) {
+    switch (ps->target) {
+        case SC_AUDIO_EXPORT_TARGET_FIFO:
+            return sc_pcm_sink_create_fifo(ps);
+        case SC_AUDIO_EXPORT_TARGET_UNIX:
+            return sc_pcm_sink_listen_unix(ps);
+        case SC_AUDIO_EXPORT_TARGET_SHM: {
+            // One chunk per slot, the ring contains the whole buffering
+            uint32_t slot_count = SC_PCM_SINK_BUFFER_DURATION
+                                / SC_PCM_SINK_CHUNK_DURATION;
+            size_t capacity = ps->chunk_samples * ps->sample_size;
+            if (!sc_shm_ring_create(&ps->ring, ps->path, slot_count,
+                                    capacity)) {
+                LOGE("Could not create shared memory %s: %s", ps->path,
+                     strerror(errno));
+                return false;
+            }
+            return true;
+        }
+        default:
+            assert(!"unexpected audio export target");
+            return false;
+    }
+}
+
+static void
+sc_pcm_sink_close_target(struct sc_pcm_sink *ps) {
+    if (ps->fd != -1) {
+        close(ps->fd);
+        ps->fd = -1;
+    }
+
+    switch (ps->target) {
+        case SC_AUDIO_EXPORT_TARGET_FIFO:
+            if (ps->fifo_created) {
+                unlink(ps->path);
+            }
+            break;
+        case SC_AUDIO_EXPORT_TARGET_UNIX:
+            close(ps->listen_fd);
+            ps->listen_fd = -1;
+            unlink(ps->path);
+            break;
+        case SC_AUDIO_EXPORT_TARGET_SHM:
+            sc_shm_ring_close(&ps->ring);
+            break;
+        default:
+            assert(!"unexpected audio export target");
+    }
+}
+
+// Connect to the consumer if it is available, without waiting
+static void
+sc_pcm_sink_try_connect(struct sc_pcm_sink *ps) {
+    assert(ps->fd == -1);
+
+    int fd;
+    if (ps->target == SC_AUDIO_EXPORT_TARGET_FIFO) {
+        // Fail with ENXIO if the FIFO is not open for reading
+        fd = open(ps->path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd == -1) {
+            if (errno != ENXIO) {
+                LOGD("PCM export: could not open %s: %s", ps->path,
+                     strerror(errno));
+            }
+            return;
+        }
+    } else {
+        assert(ps->target == SC_AUDIO_EXPORT_TARGET_UNIX);
+        fd = accept(ps->listen_fd, NULL, NULL);
+        if (fd == -1) {
+            // EAGAIN if there is no pending client
+            return;
+        }
+
+        if (!sc_pcm_sink_set_nonblock(fd)) {
+            LOGW("PCM export: could not configure the client socket");
+            close(fd);
+            return;
+        }
+    }
+
+    ps->fd = fd;
+    ++ps->consumer_count;
+    LOGI("PCM export: consumer connected");
+}
+
+// Return false if the consumer is disconnected
+static bool
+sc_pcm_sink_write_all(struct sc_pcm_sink *ps, const uint8_t *data,
+                      size_t len) {
+    while (len) {
+        ssize_t w = write(ps->fd, data, len);
+        if (w == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                // EPIPE if the consumer closed its end
+                return false;
+            }
+
+            // The consumer is slow. Meanwhile, the decoder thread continues
+            // to fill the buffer (dropping the oldest samples if necessary).
+            struct pollfd pfd = {
+                .fd = ps->fd,
+                .events = POLLOUT,
+            };
+            int r = poll(&pfd, 1, SC_PCM_SINK_POLL_TIMEOUT_MS);
+            if (r == -1 && errno != EINTR) {
+                return false;
+            }
+
+            if (sc_pcm_sink_is_stopped(ps)) {
+                // Not an error, the remaining samples are just not written
+                return true;
+            }
+
+            continue;
+        }
+
+        data += w;
+        len -= w;
+    }
+
+    return true;
+}
+
+static void
+sc_pcm_sink_publish(struct sc_pcm_sink *ps, uint32_t samples, int64_t pts) {
+    size_t size = samples * ps->sample_size;
+    assert(size <= ps->ring.header->data_capacity);
+
+    uint8_t *data;
+    struct sc_shm_ring_slot *slot = sc_shm_ring_begin_write(&ps->ring, &data);
+
+    slot->format = ps->format == SC_AUDIO_EXPORT_FORMAT_F32
+                 ? SC_SHM_RING_FORMAT_PCM_F32
+                 : SC_SHM_RING_FORMAT_PCM_S16;
+    slot->width = 0;
+    slot->height = 0;
+    slot->size = size;
+    slot->plane_count = 1;
+    for (unsigned i = 0; i < SC_SHM_RING_MAX_PLANES; ++i) {
+        slot->offsets[i] = 0;
+        slot->linesizes[i] = 0;
+    }
+    slot->linesizes[0] = size;
+    slot->pts = pts;
+    slot->sample_rate = ps->sample_rate;
+    slot->channels = ps->channels;
+
+    memcpy(data, ps->chunk, size);
+
+    slot->publish_time = sc_tick_now();
+
+    sc_shm_ring_end_write(&ps->ring, slot);
+}
+
+static void
+sc_pcm_sink_export(struct sc_pcm_sink *ps, uint32_t samples, int64_t pts) {
+    if (ps->target == SC_AUDIO_EXPORT_TARGET_SHM) {
+        sc_pcm_sink_publish(ps, samples, pts);
+        return;
+    }
+
+    if (ps->fd == -1) {
+        sc_pcm_sink_try_connect(ps);
+        if (ps->fd == -1) {
+            // No consumer, discard the samples
+            return;
+        }
+    }
+
+    size_t size = samples * ps->sample_size;
+    if (!sc_pcm_sink_write_all(ps, ps->chunk, size)) {
+        LOGI("PCM export: consumer disconnected");
+        close(ps->fd);
+        ps->fd = -1;
+    }
+}
+
+static int
+run_pcm_sink(void *data) {
+    struct sc_pcm_sink *ps = data;
+
+    // Writing to a FIFO or a socket closed by the consumer raises SIGPIPE:
+    // block it on this thread, so that write() just fails with EPIPE
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    for (;;) {
+        sc_mutex_lock(&ps->mutex);
+
+        while (!ps->stopped && !sc_audiobuf_can_read(&ps->buf)) {
+            sc_cond_wait(&ps->cond, &ps->mutex);
+        }
+
+        if (ps->stopped) {
+            sc_mutex_unlock(&ps->mutex);
+            break;
+        }
+
+        uint32_t available = sc_audiobuf_can_read(&ps->buf);
+        uint32_t samples = sc_audiobuf_read(&ps->buf, ps->chunk,
+                                            ps->chunk_samples);
+        // PTS of the first sample read
+        int64_t pts = ps->end_pts
+                    - (int64_t) available * 1000000 / ps->sample_rate;
+
+        sc_mutex_unlock(&ps->mutex);
+
+        // Write without holding the mutex, so that the decoder thread is
+        // never blocked by the consumer
+        sc_pcm_sink_export(ps, samples, pts);
+    }
+
+    LOGD("PCM export thread ended");
+
+    return 0;
+}
+
+static uint8_t *
+sc_pcm_sink_get_swr_buf(struct sc_pcm_sink *ps, uint32_t min_samples) {
+    if (min_samples > ps->swr_buf_alloc_samples) {
+        uint32_t new_samples = min_samples + 1024;
+        uint8_t *buf = realloc(ps->swr_buf, new_samples * ps->sample_size);
+        if (!buf) {
+            LOG_OOM();
+            return NULL;
+        }
+        ps->swr_buf = buf;
+        ps->swr_buf_alloc_samples = new_samples;
+    }
+
+    return ps->swr_buf;
+}
+
+static bool
+sc_pcm_sink_frame_sink_open(struct sc_frame_sink *sink,
+                            const AVCodecContext *ctx) {
+    struct sc_pcm_sink *ps = DOWNCAST(sink);
+
+#ifdef SCRCPY_LAVU_HAS_CHLAYOUT
+    assert(ctx->ch_layout.nb_channels > 0);
+    unsigned nb_channels = ctx->ch_layout.nb_channels;
+#else
+    int tmp = av_get_channel_layout_nb_channels(ctx->channel_layout);
+    assert(tmp > 0);
+    unsigned nb_channels = tmp;
+#endif
+
+    assert(ctx->sample_rate > 0);
+    ps->in_sample_rate = ctx->sample_rate;
+    ps->sample_rate = ps->requested_rate ? ps->requested_rate
+                                         : (uint32_t) ctx->sample_rate;
+    ps->channels = nb_channels;
+    ps->sample_fmt = ps->format == SC_AUDIO_EXPORT_FORMAT_F32
+                   ? AV_SAMPLE_FMT_FLT
+                   : AV_SAMPLE_FMT_S16;
+    ps->sample_size = nb_channels * av_get_bytes_per_sample(ps->sample_fmt);
+
+    SwrContext *swr_ctx = swr_alloc();
+    if (!swr_ctx) {
+        LOG_OOM();
+        return false;
+    }
+    ps->swr_ctx = swr_ctx;
+
+#ifdef SCRCPY_LAVU_HAS_CHLAYOUT
+    av_opt_set_chlayout(swr_ctx, "in_chlayout", &ctx->ch_layout, 0);
+    av_opt_set_chlayout(swr_ctx, "out_chlayout", &ctx->ch_layout, 0);
+#else
+    av_opt_set_channel_layout(swr_ctx, "in_channel_layout",
+                              ctx->channel_layout, 0);
+    av_opt_set_channel_layout(swr_ctx, "out_channel_layout",
+                              ctx->channel_layout, 0);
+#endif
+
+    av_opt_set_int(swr_ctx, "in_sample_rate", ctx->sample_rate, 0);
+    av_opt_set_int(swr_ctx, "out_sample_rate", ps->sample_rate, 0);
+
+    av_opt_set_sample_fmt(swr_ctx, "in_sample_fmt", ctx->sample_fmt, 0);
+    av_opt_set_sample_fmt(swr_ctx, "out_sample_fmt", ps->sample_fmt, 0);
+
+    int ret = swr_init(swr_ctx);
+    if (ret) {
+        LOGE("Failed to initialize the PCM export resampling context");
+        goto error_free_swr_ctx;
+    }
+
+    ps->swr_buf = NULL;
+    ps->swr_buf_alloc_samples = 0;
+
+    uint32_t buf_samples = SC_PCM_SINK_BUFFER_DURATION * ps->sample_rate
+                                                       / SC_TICK_FREQ;
+    bool ok = sc_audiobuf_init_mirror(&ps->buf, ps->sample_size, buf_samples);
+    if (!ok) {
+        goto error_free_swr_ctx;
+    }
+
+    ps->chunk_samples = SC_PCM_SINK_CHUNK_DURATION * ps->sample_rate
+                                                   / SC_TICK_FREQ;
+    ps->chunk = malloc(ps->chunk_samples * ps->sample_size);
+    if (!ps->chunk) {
+        LOG_OOM();
+        goto error_destroy_audiobuf;
+    }
+
+    ps->end_pts = 0;
+    ps->fd = -1;
+    ps->listen_fd = -1;
+    ps->fifo_created = false;
+    ps->dropped_samples = 0;
+    ps->consumer_count = 0;
+
+    ok = sc_pcm_sink_open_target(ps);
+    if (!ok) {
+        goto error_free_chunk;
+    }
+
+    ok = sc_mutex_init(&ps->mutex);
+    if (!ok) {
+        goto error_close_target;
+    }
+
+    ok = sc_cond_init(&ps->cond);
+    if (!ok) {
+        goto error_mutex_destroy;
+    }
+
+    ps->stopped = false;
+
+    LOGD("Starting PCM export thread");
+    ok = sc_thread_create(&ps->thread, run_pcm_sink, "scrcpy-pcm", ps);
+    if (!ok) {
+        LOGE("Could not start PCM export thread");
+        goto error_cond_destroy;
+    }
+
+    LOGI("PCM export started: %s (%s, %" PRIu32 " Hz, %u channel%s)",
+         ps->path, sc_pcm_sink_get_format_name(ps->format), ps->sample_rate,
+         ps->channels, ps->channels > 1 ? "s" : "");
+
+    return true;
+
+error_cond_destroy:
+    sc_cond_destroy(&ps->cond);
+error_mutex_destroy:
+    sc_mutex_destroy(&ps->mutex);
+error_close_target:
+    sc_pcm_sink_close_target(ps);
+error_free_chunk:
+    free(ps->chunk);
+error_destroy_audiobuf:
+    sc_audiobuf_destroy(&ps->buf);
+error_free_swr_ctx:
+    swr_free(&ps->swr_ctx);
+
+    return false;
+}
+
+static void
+sc_pcm_sink_frame_sink_close(struct sc_frame_sink *sink) {
+    struct sc_pcm_sink *ps = DOWNCAST(sink);
+
+    sc_mutex_lock(&ps->mutex);
+    ps->stopped = true;
+    sc_cond_signal(&ps->cond);
+    sc_mutex_unlock(&ps->mutex);
+
+    sc_thread_join(&ps->thread, NULL);
+
+    sc_pcm_sink_close_target(ps);
+
+    if (ps->dropped_samples) {
+        LOGW("PCM export: %" PRIu64 " samples dropped (consumer too slow)",
+             ps->dropped_samples);
+    }
+
+    sc_cond_destroy(&ps->cond);
+    sc_mutex_destroy(&ps->mutex);
+    free(ps->chunk);
+    sc_audiobuf_destroy(&ps->buf);
+    free(ps->swr_buf);
+    swr_free(&ps->swr_ctx);
+}
+
+static bool
+sc_pcm_sink_frame_sink_push(struct sc_frame_sink *sink, const AVFrame *frame) {
+    struct sc_pcm_sink *ps = DOWNCAST(sink);
+
+    SwrContext *swr_ctx = ps->swr_ctx;
+
+    int out_samples = swr_get_out_samples(swr_ctx, frame->nb_samples);
+    if (out_samples < 0) {
+        LOGE("PCM export: invalid resampling state: %d", out_samples);
+        return false;
+    }
+
+    uint8_t *swr_buf = sc_pcm_sink_get_swr_buf(ps, out_samples);
+    if (!swr_buf) {
+        return false;
+    }
+
+    int ret = swr_convert(swr_ctx, &swr_buf, out_samples,
+                          (const uint8_t **) frame->data, frame->nb_samples);
+    if (ret < 0) {
+        LOGE("PCM export: resampling failed: %d", ret);
+        return false;
+    }
+
+    uint32_t samples = MIN(ret, out_samples);
+
+    // The samples still buffered by the resampler are not output yet
+    int64_t end_pts = frame->pts
+                    + (int64_t) frame->nb_samples * 1000000 / ps->in_sample_rate
+                    - swr_get_delay(swr_ctx, 1000000);
+
+    uint32_t dropped = 0;
+    uint32_t capacity = sc_audiobuf_capacity(&ps->buf);
+    if (samples > capacity) {
+        // Only keep the most recent samples
+        dropped = samples - capacity;
+        swr_buf += dropped * ps->sample_size;
+        samples = capacity;
+    }
+
+    sc_mutex_lock(&ps->mutex);
+    // Never wait for the export thread: drop the oldest samples if the
+    // consumer is too slow (it only reads with the mutex locked, so the
+    // buffer may be overwritten)
+    dropped += sc_audiobuf_write_overwrite(&ps->buf, swr_buf, samples);
+    ps->end_pts = end_pts;
+    sc_cond_signal(&ps->cond);
+    sc_mutex_unlock(&ps->mutex);
+
+    if (dropped) {
+        if (!ps->dropped_samples) {
+            LOGW("PCM export: consumer too slow, dropping samples");
+        }
+        ps->dropped_samples += dropped;
+    }
+
+    return true;
+}
+
+bool
+sc_pcm_sink_init(struct sc_pcm_sink *ps, enum sc_audio_export_target target,
+                 const char *path, enum sc_audio_export_format format,
+                 uint32_t sample_rate) {
+    assert(target != SC_AUDIO_EXPORT_TARGET_NONE);
+
+    ps->path = strdup(path);
+    if (!ps->path) {
+        LOG_OOM();
+        return false;
+    }
+
+    ps->target = target;
+    ps->format = format;
+    ps->requested_rate = sample_rate;
+
+    static const struct sc_frame_sink_ops ops = {
+        .open = sc_pcm_sink_frame_sink_open,
+        .close = sc_pcm_sink_frame_sink_close,
+        .push = sc_pcm_sink_frame_sink_push,
+    };
+
+    ps->frame_sink.ops = &ops;
+
+    return true;
+}
+
+void
+sc_pcm_sink_destroy(struct sc_pcm_sink *ps) {
+    free(ps->path);
+}
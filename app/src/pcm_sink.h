@@ -0,0 +1,89 @@
+#ifndef SC_PCM_SINK_H
+#define SC_PCM_SINK_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <libavcodec/avcodec.h>
+#include <libswresample/swresample.h>
+
+#include "options.h"
+#include "shm_ring.h"
+#include "trait/frame_sink.h"
+#include "util/audiobuf.h"
+#include "util/thread.h"
+
+// Buffering between the decoder and the consumer, before dropping samples
+#define SC_PCM_SINK_BUFFER_DURATION SC_TICK_FROM_SEC(1)
+
+// Max duration of a chunk of samples written at once (or stored in a shared
+// memory slot)
+#define SC_PCM_SINK_CHUNK_DURATION SC_TICK_FROM_MS(20)
+
+/**
+ * Frame sink exporting the decoded audio as raw PCM (packed, in host byte
+ * order) to a local consumer, via a FIFO, a UNIX socket or a shared memory
+ * ring (see shm_ring.h)
+ *
+ * The samples are converted (and resampled if requested) on the decoder
+ * thread, then stored in a bounded buffer, written to the consumer by a
+ * separate thread. If the consumer is too slow, the oldest samples are dropped:
+ * the decoder (and the audio player) never wait for the consumer.
+ *
+ * Without any consumer connected (FIFO not opened for reading, or no client
+ * connected to the socket), the samples are discarded.
+ */
+struct sc_pcm_sink {
+    struct sc_frame_sink frame_sink; // frame sink trait
+
+    enum sc_audio_export_target target;
+    char *path;
+    enum sc_audio_export_format format;
+    uint32_t requested_rate; // 0 for the input sample rate
+
+    uint32_t in_sample_rate;
+
+    // output format
+    enum AVSampleFormat sample_fmt;
+    uint32_t sample_rate;
+    unsigned channels;
+    size_t sample_size; // for all channels
+
+    // only used by the decoder thread
+    SwrContext *swr_ctx;
+    uint8_t *swr_buf;
+    uint32_t swr_buf_alloc_samples;
+
+    sc_thread thread;
+    sc_mutex mutex;
+    sc_cond cond;
+    bool stopped;
+    // Both protected by the mutex: buf is written by the decoder thread and
+    // read by the export thread
+    struct sc_audiobuf buf;
+    // The PTS (in microseconds) after the last sample written to buf
+    int64_t end_pts;
+
+    // only used by the export thread
+    uint8_t *chunk;
+    uint32_t chunk_samples;
+    int fd; // the FIFO or the connected socket, -1 if no consumer
+    int listen_fd; // UNIX socket only
+    bool fifo_created; // if true, the FIFO is removed on close
+    struct sc_shm_ring ring; // shm only
+
+    // statistics
+    uint64_t dropped_samples; // decoder thread only
+    uint64_t consumer_count; // export thread only
+};
+
+bool
+sc_pcm_sink_init(struct sc_pcm_sink *ps, enum sc_audio_export_target target,
+                 const char *path, enum sc_audio_export_format format,
+                 uint32_t sample_rate);
+
+void
+sc_pcm_sink_destroy(struct sc_pcm_sink *ps);
+
+#endif
@@ -106,6 +106,18 @@ process_msg(struct sc_receiver *receiver, struct sc_device_msg *msg) {
             sc_acksync_ack(receiver->acksync, msg->ack_clipboard.sequence);
             // No allocation to free in the msg
             break;
+        case DEVICE_MSG_TYPE_ACK_PING:
+            LOGV("Ack ping sequence=%" PRIu64_, msg->ack_ping.sequence);
+
+            if (!receiver->cbs->on_ack_ping) {
+                LOGE("Received unexpected ping ack");
+                return;
+            }
+
+            receiver->cbs->on_ack_ping(receiver, msg->ack_ping.sequence,
+                                       receiver->cbs_userdata);
+            // No allocation to free in the msg
+            break;
         case DEVICE_MSG_TYPE_UHID_OUTPUT:
             if (sc_get_log_level() <= SC_LOG_LEVEL_VERBOSE) {
                 char *hex = sc_str_to_hex_string(msg->uhid_output.data,
@@ -4,6 +4,7 @@
 #include "common.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "uhid/uhid_output.h"
 #include "util/acksync.h"
@@ -26,6 +27,9 @@ struct sc_receiver {
 
 struct sc_receiver_callbacks {
     void (*on_ended)(struct sc_receiver *receiver, bool error, void *userdata);
+    // Called from the receiver thread
+    void (*on_ack_ping)(struct sc_receiver *receiver, uint64_t sequence,
+                        void *userdata);
 };
 
 bool
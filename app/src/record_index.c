@@ -0,0 +1,302 @@
+#include "record_index.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "util/binary.h"
+#include "util/log.h"
+#include "util/str.h"
+
+#define SC_RECORD_INDEX_MAGIC "scrcpyix"
+#define SC_RECORD_INDEX_VERSION 1
+#define SC_RECORD_INDEX_HEADER_SIZE 16
+#define SC_RECORD_INDEX_ENTRY_SIZE 20
+
+static const AVRational SCRCPY_TIME_BASE = {1, 1000000}; // timestamps in us
+
+char *
+sc_record_index_get_filename(const char *record_filename) {
+    return sc_str_concat(record_filename, SC_RECORD_INDEX_EXTENSION);
+}
+
+bool
+sc_record_index_writer_open(struct sc_record_index_writer *writer,
+                            const char *filename) {
+    writer->file = fopen(filename, "wb");
+    if (!writer->file) {
+        LOGE("Could not open index file: %s", filename);
+        return false;
+    }
+
+    uint8_t header[SC_RECORD_INDEX_HEADER_SIZE];
+    memcpy(header, SC_RECORD_INDEX_MAGIC, 8);
+    sc_write32be(&header[8], SC_RECORD_INDEX_VERSION);
+    sc_write32be(&header[12], 0); // reserved
+
+    if (fwrite(header, sizeof(header), 1, writer->file) != 1) {
+        LOGE("Could not write index header: %s", filename);
+        fclose(writer->file);
+        return false;
+    }
+
+    return true;
+}
+
+bool
+sc_record_index_writer_append(struct sc_record_index_writer *writer,
+                              const struct sc_record_index_entry *entry) {
+    uint8_t buf[SC_RECORD_INDEX_ENTRY_SIZE];
+    sc_write64be(buf, (uint64_t) entry->pts);
+    sc_write64be(&buf[8], entry->offset);
+    sc_write32be(&buf[16], entry->size);
+
+    return fwrite(buf, sizeof(buf), 1, writer->file) == 1;
+}
+
+bool
+sc_record_index_writer_close(struct sc_record_index_writer *writer) {
+    return !fclose(writer->file);
+}
+
+bool
+sc_record_index_load(struct sc_record_index *index, const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        LOGE("Could not open index file: %s", filename);
+        return false;
+    }
+
+    uint8_t header[SC_RECORD_INDEX_HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, file) != 1
+            || memcmp(header, SC_RECORD_INDEX_MAGIC, 8)) {
+        LOGE("Invalid index file: %s", filename);
+        fclose(file);
+        return false;
+    }
+
+    uint32_t version = sc_read32be(&header[8]);
+    if (version != SC_RECORD_INDEX_VERSION) {
+        LOGE("Unsupported index version %" PRIu32 ": %s", version, filename);
+        fclose(file);
+        return false;
+    }
+
+    sc_vector_init(&index->entries);
+
+    uint8_t buf[SC_RECORD_INDEX_ENTRY_SIZE];
+    // A truncated last entry (e.g. if scrcpy was killed) is ignored
+    while (fread(buf, sizeof(buf), 1, file) == 1) {
+        struct sc_record_index_entry entry = {
+            .pts = (int64_t) sc_read64be(buf),
+            .offset = sc_read64be(&buf[8]),
+            .size = sc_read32be(&buf[16]),
+        };
+
+        bool ok = sc_vector_push(&index->entries, entry);
+        if (!ok) {
+            LOG_OOM();
+            sc_vector_destroy(&index->entries);
+            fclose(file);
+            return false;
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+void
+sc_record_index_destroy(struct sc_record_index *index) {
+    sc_vector_destroy(&index->entries);
+}
+
+const struct sc_record_index_entry *
+sc_record_index_find(const struct sc_record_index *index, int64_t pts) {
+    size_t count = index->entries.size;
+    if (!count) {
+        return NULL;
+    }
+
+    const struct sc_record_index_entry *entries = index->entries.data;
+
+    // Find the first entry with entry.pts > pts
+    size_t low = 0;
+    size_t high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (entries[mid].pts <= pts) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low ? &entries[low - 1] : &entries[0];
+}
+
+static bool
+sc_record_index_seek(AVFormatContext *ctx,
+                     const struct sc_record_index_entry *keyframe) {
+    // The index is written for MPEG-TS recordings, in which reading may start
+    // at any byte offset (the demuxer resyncs on the next TS packet). If the
+    // recording has been remuxed, seek by timestamp using the container index
+    // instead.
+    if (!strcmp(ctx->iformat->name, "mpegts")) {
+        int r = av_seek_frame(ctx, -1, keyframe->offset, AVSEEK_FLAG_BYTE);
+        if (r >= 0) {
+            return true;
+        }
+        LOGD("Byte seek failed, fallback to timestamp seek");
+    }
+
+    // With stream_index == -1, the timestamp is in AV_TIME_BASE units, which
+    // are also microseconds
+    int r = av_seek_frame(ctx, -1, keyframe->pts, AVSEEK_FLAG_BACKWARD);
+    return r >= 0;
+}
+
+bool
+sc_record_index_extract(const struct sc_record_index *index,
+                        const char *input, const char *output,
+                        int64_t start, int64_t end) {
+    assert(start <= end);
+
+    const struct sc_record_index_entry *keyframe =
+        sc_record_index_find(index, start);
+    if (!keyframe) {
+        LOGE("Empty record index");
+        return false;
+    }
+
+    AVFormatContext *ictx = NULL;
+    if (avformat_open_input(&ictx, input, NULL, NULL) < 0) {
+        LOGE("Could not open recording: %s", input);
+        return false;
+    }
+
+    bool ret = false;
+
+    AVFormatContext *octx = NULL;
+    if (avformat_alloc_output_context2(&octx, NULL, NULL, output) < 0) {
+        LOGE("Could not find muxer for %s", output);
+        goto close_input;
+    }
+
+    for (unsigned i = 0; i < ictx->nb_streams; ++i) {
+        AVStream *istream = ictx->streams[i];
+        AVStream *ostream = avformat_new_stream(octx, NULL);
+        if (!ostream) {
+            LOG_OOM();
+            goto free_output;
+        }
+
+        if (avcodec_parameters_copy(ostream->codecpar, istream->codecpar) < 0) {
+            goto free_output;
+        }
+        ostream->codecpar->codec_tag = 0;
+        ostream->time_base = istream->time_base;
+    }
+
+    if (!sc_record_index_seek(ictx, keyframe)) {
+        LOGE("Could not seek to %" PRIi64 " in %s", keyframe->pts, input);
+        goto free_output;
+    }
+
+    if (avio_open(&octx->pb, output, AVIO_FLAG_WRITE) < 0) {
+        LOGE("Could not open output file: %s", output);
+        goto free_output;
+    }
+
+    if (avformat_write_header(octx, NULL) < 0) {
+        LOGE("Failed to write header to %s", output);
+        goto close_output;
+    }
+
+    AVPacket *packet = av_packet_alloc();
+    if (!packet) {
+        LOG_OOM();
+        goto close_output;
+    }
+
+    // The streams are interleaved, so a packet after `end` in one stream may
+    // precede packets before `end` in another one
+    bool *ended = calloc(ictx->nb_streams, sizeof(*ended));
+    if (!ended) {
+        LOG_OOM();
+        av_packet_free(&packet);
+        goto close_output;
+    }
+    unsigned remaining_streams = ictx->nb_streams;
+
+    bool error = false;
+    while (remaining_streams && av_read_frame(ictx, packet) >= 0) {
+        if (ended[packet->stream_index]) {
+            av_packet_unref(packet);
+            continue;
+        }
+
+        AVStream *istream = ictx->streams[packet->stream_index];
+        int64_t pts = packet->pts == AV_NOPTS_VALUE ? packet->dts : packet->pts;
+        int64_t pts_us = av_rescale_q(pts, istream->time_base,
+                                      SCRCPY_TIME_BASE);
+        // The decoding timestamps are monotonic (unlike the PTS if frames are
+        // reordered): once past `end`, no later packet of the stream is needed
+        int64_t dts = packet->dts == AV_NOPTS_VALUE ? pts : packet->dts;
+        int64_t dts_us = av_rescale_q(dts, istream->time_base,
+                                      SCRCPY_TIME_BASE);
+        if (dts_us > end) {
+            ended[packet->stream_index] = true;
+            --remaining_streams;
+            av_packet_unref(packet);
+            continue;
+        }
+        if (pts_us < keyframe->pts) {
+            // Packets before the keyframe (a byte seek may land earlier)
+            av_packet_unref(packet);
+            continue;
+        }
+
+        // The extracted file starts at 0
+        int64_t origin = av_rescale_q(keyframe->pts, SCRCPY_TIME_BASE,
+                                      istream->time_base);
+        if (packet->pts != AV_NOPTS_VALUE) {
+            packet->pts -= origin;
+        }
+        if (packet->dts != AV_NOPTS_VALUE) {
+            packet->dts -= origin;
+        }
+
+        AVStream *ostream = octx->streams[packet->stream_index];
+        av_packet_rescale_ts(packet, istream->time_base, ostream->time_base);
+        packet->pos = -1;
+
+        if (av_interleaved_write_frame(octx, packet) < 0) {
+            LOGE("Could not write packet to %s", output);
+            error = true;
+            break;
+        }
+    }
+
+    free(ended);
+    av_packet_free(&packet);
+
+    if (av_write_trailer(octx) < 0) {
+        LOGE("Failed to write trailer to %s", output);
+        error = true;
+    }
+
+    ret = !error;
+
+close_output:
+    avio_closep(&octx->pb);
+free_output:
+    avformat_free_context(octx);
+close_input:
+    avformat_close_input(&ictx);
+
+    return ret;
+}
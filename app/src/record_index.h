@@ -0,0 +1,102 @@
+#ifndef SC_RECORD_INDEX_H
+#define SC_RECORD_INDEX_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "util/vector.h"
+
+/**
+ * Keyframe index written alongside a recording (the "sidecar" file)
+ *
+ * The file is a 16-byte header followed by fixed-size entries, one per video
+ * keyframe, in the order they were muxed. All values are big-endian:
+ *
+ *     header: "scrcpyix" (8) | version (4) | reserved (4)
+ *     entry:  PTS (8) | byte offset (8) | size (4)
+ *
+ * The PTS is in microseconds, relative to the start of the recording (it is
+ * the timestamp written to the file, before conversion to the stream time
+ * base).
+ *
+ * The index is only written for MPEG-TS recordings (the only container in
+ * which reading may start at an arbitrary byte offset).
+ *
+ * The byte offset is the position of the muxer output when the keyframe was
+ * submitted. The interleaving queue is not flushed, so the packets it retains
+ * are written before the keyframe: the offset is at or before the keyframe
+ * data. The PTS is the reference.
+ *
+ * The size is the size of the encoded keyframe.
+ */
+
+#define SC_RECORD_INDEX_EXTENSION ".idx"
+
+struct sc_record_index_entry {
+    int64_t pts;
+    uint64_t offset;
+    uint32_t size;
+};
+
+struct sc_record_index_writer {
+    FILE *file;
+};
+
+struct sc_record_index {
+    struct SC_VECTOR(struct sc_record_index_entry) entries;
+};
+
+/**
+ * Return the sidecar filename for a recording filename
+ *
+ * The result must be freed by the caller using free(). It may return NULL on
+ * error.
+ */
+char *
+sc_record_index_get_filename(const char *record_filename);
+
+bool
+sc_record_index_writer_open(struct sc_record_index_writer *writer,
+                            const char *filename);
+
+bool
+sc_record_index_writer_append(struct sc_record_index_writer *writer,
+                              const struct sc_record_index_entry *entry);
+
+bool
+sc_record_index_writer_close(struct sc_record_index_writer *writer);
+
+bool
+sc_record_index_load(struct sc_record_index *index, const char *filename);
+
+void
+sc_record_index_destroy(struct sc_record_index *index);
+
+/**
+ * Return the last keyframe at or before `pts`
+ *
+ * If `pts` is before the first keyframe, return the first one. Return NULL
+ * only if the index is empty.
+ */
+const struct sc_record_index_entry *
+sc_record_index_find(const struct sc_record_index *index, int64_t pts);
+
+/**
+ * Extract the range [start, end] (in microseconds) of a recording into a new
+ * file, by stream copy
+ *
+ * The input is not demuxed from the beginning: reading starts at the keyframe
+ * found in the index for `start` (from its byte offset, or by seeking to its
+ * PTS if the byte seek fails). Reading stops once every stream has passed
+ * `end`. The output format is guessed from the output filename.
+ */
+bool
+sc_record_index_extract(const struct sc_record_index *index,
+                        const char *input, const char *output,
+                        int64_t start, int64_t end);
+
+#endif
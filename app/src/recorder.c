@@ -1,13 +1,11 @@
 #include "recorder.h"
 
 #include <assert.h>
-#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/time.h>
-#include <libavutil/display.h>
 
 #include "util/log.h"
 #include "util/str.h"
@@ -18,25 +16,6 @@
 #define DOWNCAST_AUDIO(SINK) \
     container_of(SINK, struct sc_recorder, audio_packet_sink)
 
-static const AVRational SCRCPY_TIME_BASE = {1, 1000000}; // timestamps in us
-
-static const AVOutputFormat *
-find_muxer(const char *name) {
-#ifdef SCRCPY_LAVF_HAS_NEW_MUXER_ITERATOR_API
-    void *opaque = NULL;
-#endif
-    const AVOutputFormat *oformat = NULL;
-    do {
-#ifdef SCRCPY_LAVF_HAS_NEW_MUXER_ITERATOR_API
-        oformat = av_muxer_iterate(&opaque);
-#else
-        oformat = av_oformat_next(oformat);
-#endif
-        // until null or containing the requested name
-    } while (oformat && !sc_str_list_contains(oformat->name, ',', name));
-    return oformat;
-}
-
 static AVPacket *
 sc_recorder_packet_ref(const AVPacket *packet) {
     AVPacket *p = av_packet_alloc();
@@ -77,64 +56,62 @@ sc_recorder_get_format_name(enum sc_record_format format) {
             return "flac";
         case SC_RECORD_FORMAT_WAV:
             return "wav";
+        case SC_RECORD_FORMAT_TS:
+            return "mpegts";
         default:
             return NULL;
     }
 }
 
 static bool
-sc_recorder_set_extradata(AVStream *ostream, const AVPacket *packet) {
-    uint8_t *extradata = av_malloc(packet->size * sizeof(uint8_t));
-    if (!extradata) {
-        LOG_OOM();
+sc_recorder_write_indexed_keyframe(struct sc_recorder *recorder,
+                                   AVPacket *packet) {
+    // The interleaving queue is not flushed (this would defeat interleaving):
+    // the packets it retains are written before the keyframe, so the output
+    // position is at or before the keyframe data
+    struct sc_record_index_entry entry = {
+        .pts = packet->pts, // in us, before rescaling
+        .offset = avio_tell(recorder->ctx->pb),
+        .size = packet->size,
+    };
+
+    bool ok = sc_muxer_write_stream(recorder->ctx, &recorder->video_stream,
+                                    packet);
+    if (!ok) {
         return false;
     }
 
-    // copy the first packet to the extra data
-    memcpy(extradata, packet->data, packet->size);
+    ok = sc_record_index_writer_append(&recorder->index_writer, &entry);
+    if (!ok) {
+        // The recording itself is still valid
+        LOGW("Could not write index entry, index disabled");
+        sc_record_index_writer_close(&recorder->index_writer);
+        recorder->index = false;
+    }
 
-    ostream->codecpar->extradata = extradata;
-    ostream->codecpar->extradata_size = packet->size;
     return true;
 }
 
-static inline void
-sc_recorder_rescale_packet(AVStream *stream, AVPacket *packet) {
-    av_packet_rescale_ts(packet, SCRCPY_TIME_BASE, stream->time_base);
-}
-
-static bool
-sc_recorder_write_stream(struct sc_recorder *recorder,
-                         struct sc_recorder_stream *st, AVPacket *packet) {
-    AVStream *stream = recorder->ctx->streams[st->index];
-    sc_recorder_rescale_packet(stream, packet);
-    if (st->last_pts != AV_NOPTS_VALUE && packet->pts <= st->last_pts) {
-        LOGD("Fixing PTS non monotonically increasing in stream %d "
-             "(%" PRIi64 " >= %" PRIi64 ")",
-             st->index, st->last_pts, packet->pts);
-        packet->pts = ++st->last_pts;
-        packet->dts = packet->pts;
-    } else {
-        st->last_pts = packet->pts;
-    }
-    return av_interleaved_write_frame(recorder->ctx, packet) >= 0;
-}
-
 static inline bool
 sc_recorder_write_video(struct sc_recorder *recorder, AVPacket *packet) {
-    return sc_recorder_write_stream(recorder, &recorder->video_stream, packet);
+    if (recorder->index && (packet->flags & AV_PKT_FLAG_KEY)) {
+        return sc_recorder_write_indexed_keyframe(recorder, packet);
+    }
+    return sc_muxer_write_stream(recorder->ctx, &recorder->video_stream,
+                                 packet);
 }
 
 static inline bool
 sc_recorder_write_audio(struct sc_recorder *recorder, AVPacket *packet) {
-    return sc_recorder_write_stream(recorder, &recorder->audio_stream, packet);
+    return sc_muxer_write_stream(recorder->ctx, &recorder->audio_stream,
+                                 packet);
 }
 
 static bool
 sc_recorder_open_output_file(struct sc_recorder *recorder) {
     const char *format_name = sc_recorder_get_format_name(recorder->format);
     assert(format_name);
-    const AVOutputFormat *format = find_muxer(format_name);
+    const AVOutputFormat *format = sc_muxer_find_format(format_name);
     if (!format) {
         LOGE("Could not find muxer");
         return false;
@@ -146,8 +123,11 @@ sc_recorder_open_output_file(struct sc_recorder *recorder) {
         return false;
     }
 
-    char *file_url = sc_str_concat("file:", recorder->filename);
+    char *file_url = sc_record_is_stdout(recorder->filename)
+                   ? strdup("pipe:1")
+                   : sc_str_concat("file:", recorder->filename);
     if (!file_url) {
+        LOG_OOM();
         avformat_free_context(recorder->ctx);
         return false;
     }
@@ -160,6 +140,15 @@ sc_recorder_open_output_file(struct sc_recorder *recorder) {
         return false;
     }
 
+    // stdout, a pipe or a FIFO
+    recorder->streamable =
+        !(recorder->ctx->pb->seekable & AVIO_SEEKABLE_NORMAL);
+    if (recorder->streamable) {
+        // Do not wait for the AVIOContext buffer to be full, so that the
+        // consumer receives each packet as soon as it is muxed
+        recorder->ctx->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+    }
+
     // contrary to the deprecated API (av_oformat_next()), av_muxer_iterate()
     // returns (on purpose) a pointer-to-const, but AVFormatContext.oformat
     // still expects a pointer-to-non-const (it has not be updated accordingly)
@@ -169,16 +158,73 @@ sc_recorder_open_output_file(struct sc_recorder *recorder) {
     av_dict_set(&recorder->ctx->metadata, "comment",
                 "Recorded by scrcpy " SCRCPY_VERSION, 0);
 
-    LOGI("Recording started to %s file: %s", format_name, recorder->filename);
+    if (recorder->index) {
+        char *index_filename = sc_record_index_get_filename(recorder->filename);
+        if (!index_filename) {
+            LOG_OOM();
+            avio_close(recorder->ctx->pb);
+            avformat_free_context(recorder->ctx);
+            return false;
+        }
+
+        bool ok = sc_record_index_writer_open(&recorder->index_writer,
+                                              index_filename);
+        if (!ok) {
+            free(index_filename);
+            avio_close(recorder->ctx->pb);
+            avformat_free_context(recorder->ctx);
+            return false;
+        }
+
+        LOGI("Recording keyframe index to %s", index_filename);
+        free(index_filename);
+    }
+
+    LOGI("Recording started to %s %s: %s", format_name,
+         recorder->streamable ? "stream" : "file", recorder->filename);
     return true;
 }
 
 static void
 sc_recorder_close_output_file(struct sc_recorder *recorder) {
+    if (recorder->index) {
+        if (!sc_record_index_writer_close(&recorder->index_writer)) {
+            LOGW("Could not close index file");
+        }
+    }
     avio_close(recorder->ctx->pb);
     avformat_free_context(recorder->ctx);
 }
 
+static bool
+sc_recorder_set_streamable_options(struct sc_recorder *recorder,
+                                   AVDictionary **opts) {
+    assert(recorder->streamable);
+
+    switch (recorder->format) {
+        case SC_RECORD_FORMAT_MP4:
+        case SC_RECORD_FORMAT_M4A:
+            // Fragmented MP4: the moov atom is written first (without
+            // samples), then one fragment is written per frame, so that
+            // nothing needs to be rewritten at the end
+            return av_dict_set(opts, "movflags",
+                               "empty_moov+default_base_moof+frag_every_frame",
+                               0) >= 0;
+        case SC_RECORD_FORMAT_MKV:
+        case SC_RECORD_FORMAT_MKA:
+            // No cues and no seek to update the header on close
+            return av_dict_set(opts, "live", "1", 0) >= 0;
+        case SC_RECORD_FORMAT_AAC:
+        case SC_RECORD_FORMAT_TS:
+            // Raw AAC (ADTS) and MPEG-TS are streamable by design
+            return true;
+        default:
+            LOGW("The %s format is not streamable, the file may be "
+                 "incomplete", sc_recorder_get_format_name(recorder->format));
+            return true;
+    }
+}
+
 static inline bool
 sc_recorder_must_wait_for_config_packets(struct sc_recorder *recorder) {
     if (recorder->video && sc_vecdeque_is_empty(&recorder->video_queue)) {
@@ -241,7 +287,7 @@ sc_recorder_process_header(struct sc_recorder *recorder) {
         assert(recorder->video_stream.index >= 0);
         AVStream *video_stream =
             recorder->ctx->streams[recorder->video_stream.index];
-        bool ok = sc_recorder_set_extradata(video_stream, video_pkt);
+        bool ok = sc_muxer_set_extradata(video_stream, video_pkt);
         if (!ok) {
             goto end;
         }
@@ -256,13 +302,24 @@ sc_recorder_process_header(struct sc_recorder *recorder) {
         assert(recorder->audio_stream.index >= 0);
         AVStream *audio_stream =
             recorder->ctx->streams[recorder->audio_stream.index];
-        bool ok = sc_recorder_set_extradata(audio_stream, audio_pkt);
+        bool ok = sc_muxer_set_extradata(audio_stream, audio_pkt);
+        if (!ok) {
+            goto end;
+        }
+    }
+
+    AVDictionary *opts = NULL;
+    if (recorder->streamable) {
+        bool ok = sc_recorder_set_streamable_options(recorder, &opts);
         if (!ok) {
+            LOG_OOM();
+            av_dict_free(&opts);
             goto end;
         }
     }
 
-    bool ok = avformat_write_header(recorder->ctx, NULL) >= 0;
+    bool ok = avformat_write_header(recorder->ctx, &opts) >= 0;
+    av_dict_free(&opts);
     if (!ok) {
         LOGE("Failed to write header to %s", recorder->filename);
         goto end;
@@ -297,6 +354,10 @@ sc_recorder_process_packets(struct sc_recorder *recorder) {
     // we can set its duration (next_pts - current_pts)
     AVPacket *video_pkt_previous = NULL;
 
+    // MPEG-TS does not store packet durations: write video packets as soon
+    // as they are received, to avoid one frame of latency
+    bool delay_video = recorder->format != SC_RECORD_FORMAT_TS;
+
     bool error = false;
 
     for (;;) {
@@ -392,7 +453,15 @@ sc_recorder_process_packets(struct sc_recorder *recorder) {
             video_pkt->pts -= pts_origin;
             video_pkt->dts = video_pkt->pts;
 
-            if (video_pkt_previous) {
+            if (!delay_video) {
+                bool ok = sc_recorder_write_video(recorder, video_pkt);
+                av_packet_free(&video_pkt);
+                if (!ok) {
+                    LOGE("Could not record video packet");
+                    error = true;
+                    goto end;
+                }
+            } else if (video_pkt_previous) {
                 // we now know the duration of the previous packet
                 video_pkt_previous->duration = video_pkt->pts
                                              - video_pkt_previous->pts;
@@ -406,6 +475,7 @@ sc_recorder_process_packets(struct sc_recorder *recorder) {
                 }
             }
 
+            // NULL if the packet has already been written
             video_pkt_previous = video_pkt;
             video_pkt = NULL;
         }
@@ -503,42 +573,6 @@ run_recorder(void *data) {
     return 0;
 }
 
-static bool
-sc_recorder_set_orientation(AVStream *stream, enum sc_orientation orientation) {
-    assert(!sc_orientation_is_mirror(orientation));
-
-    uint8_t *raw_data;
-#ifdef SCRCPY_LAVC_HAS_CODECPAR_CODEC_SIDEDATA
-    AVPacketSideData *sd =
-        av_packet_side_data_new(&stream->codecpar->coded_side_data,
-                                &stream->codecpar->nb_coded_side_data,
-                                AV_PKT_DATA_DISPLAYMATRIX,
-                                sizeof(int32_t) * 9, 0);
-    if (!sd) {
-        LOG_OOM();
-        return false;
-    }
-
-    raw_data = sd->data;
-#else
-    raw_data = av_stream_new_side_data(stream, AV_PKT_DATA_DISPLAYMATRIX,
-                                      sizeof(int32_t) * 9);
-    if (!raw_data) {
-        LOG_OOM();
-        return false;
-    }
-#endif
-
-    int32_t *matrix = (int32_t *) raw_data;
-
-    unsigned rotation = orientation;
-    unsigned angle = rotation * 90;
-
-    av_display_rotation_set(matrix, angle);
-
-    return true;
-}
-
 static bool
 sc_recorder_video_packet_sink_open(struct sc_packet_sink *sink,
                                    AVCodecContext *ctx) {
@@ -567,7 +601,7 @@ sc_recorder_video_packet_sink_open(struct sc_packet_sink *sink,
     recorder->video_stream.index = stream->index;
 
     if (recorder->orientation != SC_ORIENTATION_0) {
-        if (!sc_recorder_set_orientation(stream, recorder->orientation)) {
+        if (!sc_muxer_set_orientation(stream, recorder->orientation)) {
             sc_mutex_unlock(&recorder->mutex);
             return false;
         }
@@ -736,16 +770,10 @@ sc_recorder_audio_packet_sink_disable(struct sc_packet_sink *sink) {
     sc_mutex_unlock(&recorder->mutex);
 }
 
-static void
-sc_recorder_stream_init(struct sc_recorder_stream *stream) {
-    stream->index = -1;
-    stream->last_pts = AV_NOPTS_VALUE;
-}
-
 bool
 sc_recorder_init(struct sc_recorder *recorder, const char *filename,
                  enum sc_record_format format, bool video, bool audio,
-                 enum sc_orientation orientation,
+                 enum sc_orientation orientation, bool index,
                  const struct sc_recorder_callbacks *cbs, void *cbs_userdata) {
     assert(!sc_orientation_is_mirror(orientation));
 
@@ -770,6 +798,11 @@ sc_recorder_init(struct sc_recorder *recorder, const char *filename,
     recorder->audio = audio;
 
     recorder->orientation = orientation;
+    // The index references video keyframes, by byte offset in an MPEG-TS
+    // stream
+    assert(!index || format == SC_RECORD_FORMAT_TS);
+    recorder->index = index && video;
+    recorder->streamable = false;
 
     sc_vecdeque_init(&recorder->video_queue);
     sc_vecdeque_init(&recorder->audio_queue);
@@ -780,8 +813,8 @@ sc_recorder_init(struct sc_recorder *recorder, const char *filename,
 
     recorder->audio_expects_config_packet = false;
 
-    sc_recorder_stream_init(&recorder->video_stream);
-    sc_recorder_stream_init(&recorder->audio_stream);
+    sc_muxer_stream_init(&recorder->video_stream);
+    sc_muxer_stream_init(&recorder->audio_stream);
 
     recorder->format = format;
 
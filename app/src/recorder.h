@@ -8,18 +8,15 @@
 #include <libavcodec/packet.h>
 #include <libavformat/avformat.h>
 
+#include "muxer.h"
 #include "options.h"
+#include "record_index.h"
 #include "trait/packet_sink.h"
 #include "util/thread.h"
 #include "util/vecdeque.h"
 
 struct sc_recorder_queue SC_VECDEQUE(AVPacket *);
 
-struct sc_recorder_stream {
-    int index;
-    int64_t last_pts;
-};
-
 struct sc_recorder {
     struct sc_packet_sink video_packet_sink;
     struct sc_packet_sink audio_packet_sink;
@@ -40,6 +37,14 @@ struct sc_recorder {
     char *filename;
     enum sc_record_format format;
     AVFormatContext *ctx;
+    // the output is not seekable (stdout, pipe or FIFO), only accessed from
+    // the recorder thread
+    bool streamable;
+
+    // write a keyframe index sidecar file (only accessed from the recorder
+    // thread once started)
+    bool index;
+    struct sc_record_index_writer index_writer;
 
     sc_thread thread;
     sc_mutex mutex;
@@ -55,8 +60,8 @@ struct sc_recorder {
 
     bool audio_expects_config_packet;
 
-    struct sc_recorder_stream video_stream;
-    struct sc_recorder_stream audio_stream;
+    struct sc_muxer_stream video_stream;
+    struct sc_muxer_stream audio_stream;
 
     const struct sc_recorder_callbacks *cbs;
     void *cbs_userdata;
@@ -70,7 +75,7 @@ struct sc_recorder_callbacks {
 bool
 sc_recorder_init(struct sc_recorder *recorder, const char *filename,
                  enum sc_record_format format, bool video, bool audio,
-                 enum sc_orientation orientation,
+                 enum sc_orientation orientation, bool index,
                  const struct sc_recorder_callbacks *cbs, void *cbs_userdata);
 
 bool
@@ -0,0 +1,526 @@
+#include "rtp_sink.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
+
+#include "util/binary.h"
+#include "util/log.h"
+#include "util/rand.h"
+
+/** Downcast packet sinks to sc_rtp_sink */
+#define DOWNCAST_VIDEO(SINK) \
+    container_of(SINK, struct sc_rtp_sink, video_packet_sink)
+#define DOWNCAST_AUDIO(SINK) \
+    container_of(SINK, struct sc_rtp_sink, audio_packet_sink)
+
+#define SC_RTP_HEADER_SIZE 12
+#define SC_RTP_VERSION 2
+
+#define SC_RTP_PAYLOAD_TYPE_VIDEO 96
+#define SC_RTP_PAYLOAD_TYPE_AUDIO 97
+
+#define SC_RTP_VIDEO_CLOCK_RATE 90000
+// RFC 7587: the RTP clock rate is always 48000 for Opus
+#define SC_RTP_OPUS_CLOCK_RATE 48000
+
+// NAL unit types of the fragmentation units
+#define SC_RTP_H264_FU_A 28
+#define SC_RTP_H265_FU 49
+
+#define SC_RTCP_SR_SIZE 28
+#define SC_RTCP_PT_SR 200
+// Interval between two RTCP sender reports, in device time (microseconds)
+#define SC_RTCP_REPORT_INTERVAL 1000000
+
+static bool
+set_port(struct sockaddr_storage *addr, uint16_t port) {
+    if (addr->ss_family == AF_INET) {
+        ((struct sockaddr_in *) addr)->sin_port = htons(port);
+        return true;
+    }
+    if (addr->ss_family == AF_INET6) {
+        ((struct sockaddr_in6 *) addr)->sin6_port = htons(port);
+        return true;
+    }
+    return false;
+}
+
+static void
+sc_rtp_stream_init(struct sc_rtp_stream *stream, struct sc_rand *rand,
+                   const struct sockaddr_storage *addr, socklen_t addr_len,
+                   uint16_t port, enum AVCodecID codec_id,
+                   uint8_t payload_type, uint32_t clock_rate) {
+    stream->addr = *addr;
+    stream->rtcp_addr = *addr;
+    stream->addr_len = addr_len;
+    set_port(&stream->addr, port);
+    set_port(&stream->rtcp_addr, port + 1);
+
+    stream->codec_id = codec_id;
+    stream->payload_type = payload_type;
+    stream->clock_rate = clock_rate;
+
+    // RFC 3550: random initial values
+    stream->ssrc = sc_rand_u32(rand);
+    stream->seq = sc_rand_u32(rand);
+    stream->timestamp_offset = sc_rand_u32(rand);
+
+    stream->packets = 0;
+    stream->octets = 0;
+    stream->last_report_pts = AV_NOPTS_VALUE;
+    stream->errors = 0;
+}
+
+static uint32_t
+get_rtp_timestamp(const struct sc_rtp_stream *stream, int64_t pts) {
+    // The PTS is in microseconds, the RTP timestamp wraps around
+    uint64_t ts = (uint64_t) pts * stream->clock_rate / 1000000;
+    return stream->timestamp_offset + (uint32_t) ts;
+}
+
+static void
+send_iov(struct sc_rtp_sink *sink, struct sc_rtp_stream *stream,
+         const struct sockaddr_storage *addr, struct iovec *iov,
+         size_t iovcnt) {
+    struct msghdr msg = {
+        .msg_name = (void *) addr,
+        .msg_namelen = stream->addr_len,
+        .msg_iov = iov,
+        .msg_iovlen = iovcnt,
+    };
+
+    ssize_t w = sendmsg(sink->fd, &msg, 0);
+    if (w == -1) {
+        // Never stop the stream on a network error (the packets are lost, as
+        // any UDP packet may be), but log the first one
+        if (!stream->errors) {
+            LOGW("RTP: could not send packet: %s", strerror(errno));
+        }
+        ++stream->errors;
+    }
+}
+
+static void
+send_rtp_packet(struct sc_rtp_sink *sink, struct sc_rtp_stream *stream,
+                uint32_t timestamp, bool marker, const uint8_t *prefix,
+                size_t prefix_len, const uint8_t *payload,
+                size_t payload_len) {
+    uint8_t header[SC_RTP_HEADER_SIZE];
+    header[0] = SC_RTP_VERSION << 6;
+    header[1] = (marker ? 0x80 : 0) | stream->payload_type;
+    sc_write16be(&header[2], stream->seq++);
+    sc_write32be(&header[4], timestamp);
+    sc_write32be(&header[8], stream->ssrc);
+
+    struct iovec iov[3] = {
+        {.iov_base = header, .iov_len = sizeof(header)},
+        {.iov_base = (void *) prefix, .iov_len = prefix_len},
+        {.iov_base = (void *) payload, .iov_len = payload_len},
+    };
+    send_iov(sink, stream, &stream->addr, iov, ARRAY_LEN(iov));
+
+    ++stream->packets;
+    stream->octets += prefix_len + payload_len;
+}
+
+static void
+send_sender_report(struct sc_rtp_sink *sink, struct sc_rtp_stream *stream,
+                   int64_t pts, uint32_t timestamp) {
+    // The NTP timestamp is the device PTS (the same clock for both streams),
+    // so that the receivers can synchronize audio and video
+    uint64_t sec = (uint64_t) pts / 1000000;
+    uint64_t frac = ((uint64_t) pts % 1000000 << 32) / 1000000;
+
+    uint8_t sr[SC_RTCP_SR_SIZE];
+    sr[0] = SC_RTP_VERSION << 6; // no reception report
+    sr[1] = SC_RTCP_PT_SR;
+    sc_write16be(&sr[2], SC_RTCP_SR_SIZE / 4 - 1);
+    sc_write32be(&sr[4], stream->ssrc);
+    sc_write32be(&sr[8], sec);
+    sc_write32be(&sr[12], frac);
+    sc_write32be(&sr[16], timestamp);
+    sc_write32be(&sr[20], stream->packets);
+    sc_write32be(&sr[24], stream->octets);
+
+    struct iovec iov = {.iov_base = sr, .iov_len = sizeof(sr)};
+    send_iov(sink, stream, &stream->rtcp_addr, &iov, 1);
+
+    stream->last_report_pts = pts;
+}
+
+static void
+maybe_send_sender_report(struct sc_rtp_sink *sink,
+                         struct sc_rtp_stream *stream, int64_t pts,
+                         uint32_t timestamp) {
+    if (stream->last_report_pts == AV_NOPTS_VALUE
+            || pts - stream->last_report_pts >= SC_RTCP_REPORT_INTERVAL) {
+        send_sender_report(sink, stream, pts, timestamp);
+    }
+}
+
+static void
+send_nal_unit(struct sc_rtp_sink *sink, struct sc_rtp_stream *stream,
+              const uint8_t *nal, size_t len, uint32_t timestamp,
+              bool last) {
+    if (len <= SC_RTP_MAX_PAYLOAD_SIZE) {
+        // Single NAL unit packet
+        send_rtp_packet(sink, stream, timestamp, last, NULL, 0, nal, len);
+        return;
+    }
+
+    // Fragmentation units: the NAL unit header is replaced by the FU headers
+    uint8_t fu[3];
+    size_t nal_header_size;
+    size_t fu_header_size;
+    if (stream->codec_id == AV_CODEC_ID_H264) {
+        // RFC 6184 5.8: FU indicator + FU header
+        nal_header_size = 1;
+        fu_header_size = 2;
+        fu[0] = (nal[0] & 0xE0) | SC_RTP_H264_FU_A;
+        fu[1] = nal[0] & 0x1F;
+    } else {
+        assert(stream->codec_id == AV_CODEC_ID_HEVC);
+        // RFC 7798 4.4.3: payload header (2 bytes) + FU header
+        nal_header_size = 2;
+        fu_header_size = 3;
+        fu[0] = (nal[0] & 0x81) | (SC_RTP_H265_FU << 1);
+        fu[1] = nal[1];
+        fu[2] = (nal[0] >> 1) & 0x3F;
+    }
+
+    uint8_t *fu_header = &fu[fu_header_size - 1];
+    uint8_t nal_type = *fu_header;
+
+    const uint8_t *p = nal + nal_header_size;
+    size_t remaining = len - nal_header_size;
+    size_t max_size = SC_RTP_MAX_PAYLOAD_SIZE - fu_header_size;
+    bool start = true;
+    while (remaining) {
+        size_t size = MIN(remaining, max_size);
+        bool end = size == remaining;
+        *fu_header = nal_type | (start ? 0x80 : 0) | (end ? 0x40 : 0);
+        send_rtp_packet(sink, stream, timestamp, last && end, fu,
+                        fu_header_size, p, size);
+        p += size;
+        remaining -= size;
+        start = false;
+    }
+}
+
+// Return a pointer to the next Annex B start code (00 00 01) in [p, end), or
+// end if there is none
+static const uint8_t *
+find_start_code(const uint8_t *p, const uint8_t *end) {
+    while (end - p >= 3) {
+        if (!p[0] && !p[1] && p[2] == 1) {
+            return p;
+        }
+        ++p;
+    }
+    return end;
+}
+
+static bool
+sc_rtp_sink_video_packet_sink_open(struct sc_packet_sink *sink,
+                                   AVCodecContext *ctx) {
+    struct sc_rtp_sink *rtp = DOWNCAST_VIDEO(sink);
+
+    if (ctx->codec_id != rtp->video.codec_id) {
+        LOGE("RTP: unexpected video codec");
+        return false;
+    }
+
+    return true;
+}
+
+static void
+sc_rtp_sink_video_packet_sink_close(struct sc_packet_sink *sink) {
+    (void) sink;
+}
+
+// Send the NAL units of an Annex B buffer
+static void
+send_annexb(struct sc_rtp_sink *rtp, struct sc_rtp_stream *stream,
+            const uint8_t *data, size_t size, uint32_t timestamp,
+            bool end_of_access_unit) {
+    const uint8_t *end = data + size;
+    const uint8_t *p = find_start_code(data, end);
+    while (p < end) {
+        const uint8_t *nal = p + 3;
+        p = find_start_code(nal, end);
+
+        // The leading zero byte of a 4-byte start code (or trailing zero
+        // bytes) does not belong to the NAL unit
+        const uint8_t *nal_end = p;
+        while (nal_end > nal && !nal_end[-1]) {
+            --nal_end;
+        }
+
+        size_t len = nal_end - nal;
+        if (len) {
+            // The marker bit is set on the last packet of the access unit
+            send_nal_unit(rtp, stream, nal, len, timestamp,
+                          end_of_access_unit && p == end);
+        }
+    }
+}
+
+static bool
+sc_rtp_sink_video_packet_sink_push(struct sc_packet_sink *sink,
+                                   const AVPacket *packet) {
+    struct sc_rtp_sink *rtp = DOWNCAST_VIDEO(sink);
+    struct sc_rtp_stream *stream = &rtp->video;
+
+    if (packet->pts == AV_NOPTS_VALUE) {
+        // The config packet is merged into the next media packet by the
+        // demuxer, but the device does not repeat it on the next key frames:
+        // keep a copy to send it before each key frame
+        uint8_t *config = realloc(rtp->config, packet->size);
+        if (!config) {
+            LOG_OOM();
+            return false;
+        }
+        memcpy(config, packet->data, packet->size);
+        rtp->config = config;
+        rtp->config_size = packet->size;
+        return true;
+    }
+
+    uint32_t timestamp = get_rtp_timestamp(stream, packet->pts);
+    maybe_send_sender_report(rtp, stream, packet->pts, timestamp);
+
+    bool key = packet->flags & AV_PKT_FLAG_KEY;
+    bool has_config = rtp->config_size
+                   && (size_t) packet->size >= rtp->config_size
+                   && !memcmp(packet->data, rtp->config, rtp->config_size);
+    if (key && rtp->config_size && !has_config) {
+        // Same timestamp: the parameter sets belong to the access unit
+        send_annexb(rtp, stream, rtp->config, rtp->config_size, timestamp,
+                    false);
+    }
+
+    // A packet contains one access unit, in Annex B format
+    send_annexb(rtp, stream, packet->data, packet->size, timestamp, true);
+
+    return true;
+}
+
+static bool
+sc_rtp_sink_audio_packet_sink_open(struct sc_packet_sink *sink,
+                                   AVCodecContext *ctx) {
+    struct sc_rtp_sink *rtp = DOWNCAST_AUDIO(sink);
+
+    if (ctx->codec_id != rtp->audio.codec_id) {
+        LOGE("RTP: unexpected audio codec");
+        return false;
+    }
+
+#ifdef SCRCPY_LAVU_HAS_CHLAYOUT
+    int channels = ctx->ch_layout.nb_channels;
+#else
+    int channels = ctx->channels;
+#endif
+    if (channels != rtp->audio_channels) {
+        // The SDP has already been written
+        LOGE("RTP: unexpected audio channel count: %d", channels);
+        return false;
+    }
+
+    return true;
+}
+
+static void
+sc_rtp_sink_audio_packet_sink_close(struct sc_packet_sink *sink) {
+    (void) sink;
+}
+
+static bool
+sc_rtp_sink_audio_packet_sink_push(struct sc_packet_sink *sink,
+                                   const AVPacket *packet) {
+    struct sc_rtp_sink *rtp = DOWNCAST_AUDIO(sink);
+    struct sc_rtp_stream *stream = &rtp->audio;
+
+    if (packet->pts == AV_NOPTS_VALUE) {
+        // The Opus config (OpusHead) is described by the SDP
+        return true;
+    }
+
+    uint32_t timestamp = get_rtp_timestamp(stream, packet->pts);
+    maybe_send_sender_report(rtp, stream, packet->pts, timestamp);
+
+    // RFC 7587: one Opus packet per RTP packet
+    send_rtp_packet(rtp, stream, timestamp, false, NULL, 0, packet->data,
+                    packet->size);
+    return true;
+}
+
+static bool
+write_sdp(struct sc_rtp_sink *sink, const char *filename, uint16_t port,
+          bool video, bool audio, uint32_t audio_sample_rate) {
+    const struct sc_rtp_stream *stream = &sink->video;
+
+    char host[NI_MAXHOST];
+    int r = getnameinfo((const struct sockaddr *) &stream->addr,
+                        stream->addr_len, host, sizeof(host), NULL, 0,
+                        NI_NUMERICHOST);
+    if (r) {
+        LOGE("RTP: could not get the address: %s", gai_strerror(r));
+        return false;
+    }
+
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        LOGE("Could not open SDP file: %s", filename);
+        return false;
+    }
+
+    const char *ip_version =
+        stream->addr.ss_family == AF_INET6 ? "IP6" : "IP4";
+    const char *encoding =
+        stream->codec_id == AV_CODEC_ID_H264 ? "H264" : "H265";
+
+    // RFC 4566 5: the lines are terminated by CRLF
+    fprintf(file,
+            "v=0\r\n"
+            "o=- 0 0 IN %s %s\r\n"
+            "s=scrcpy\r\n"
+            "c=IN %s %s\r\n"
+            "t=0 0\r\n",
+            ip_version, host, ip_version, host);
+
+    if (video) {
+        fprintf(file,
+                "m=video %" PRIu16 " RTP/AVP %d\r\n"
+                "a=rtpmap:%d %s/%d\r\n",
+                port, SC_RTP_PAYLOAD_TYPE_VIDEO, SC_RTP_PAYLOAD_TYPE_VIDEO,
+                encoding, SC_RTP_VIDEO_CLOCK_RATE);
+        if (stream->codec_id == AV_CODEC_ID_H264) {
+            // Fragmentation units are used
+            fprintf(file, "a=fmtp:%d packetization-mode=1\r\n",
+                    SC_RTP_PAYLOAD_TYPE_VIDEO);
+        }
+    }
+
+    if (audio) {
+        // RFC 7587 7: the encoding name is always "opus/48000/2", the actual
+        // channel count and sample rate are signaled by the parameters
+        fprintf(file,
+                "m=audio %d RTP/AVP %d\r\n"
+                "a=rtpmap:%d opus/%d/2\r\n"
+                "a=fmtp:%d sprop-stereo=%d; sprop-maxcapturerate=%" PRIu32
+                "\r\n",
+                port + 2, SC_RTP_PAYLOAD_TYPE_AUDIO,
+                SC_RTP_PAYLOAD_TYPE_AUDIO, SC_RTP_OPUS_CLOCK_RATE,
+                SC_RTP_PAYLOAD_TYPE_AUDIO, sink->audio_channels == 2,
+                audio_sample_rate);
+    }
+
+    bool ok = !ferror(file);
+    if (fclose(file)) {
+        ok = false;
+    }
+    if (!ok) {
+        LOGE("Could not write SDP file: %s", filename);
+        return false;
+    }
+
+    LOGI("RTP: SDP written to %s", filename);
+    return true;
+}
+
+bool
+sc_rtp_sink_init(struct sc_rtp_sink *sink, const char *host, uint16_t port,
+                 bool video, enum sc_codec video_codec, bool audio,
+                 uint32_t audio_sample_rate, uint8_t audio_channels,
+                 const char *sdp_filename) {
+    assert(!video || video_codec == SC_CODEC_H264
+                  || video_codec == SC_CODEC_H265);
+    assert(!audio || audio_channels == 1 || audio_channels == 2);
+
+    // The last port is the audio RTCP port
+    if (port > UINT16_MAX - 3) {
+        LOGE("RTP: invalid port: %" PRIu16, port);
+        return false;
+    }
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_DGRAM,
+    };
+    struct addrinfo *result;
+    int r = getaddrinfo(host, NULL, &hints, &result);
+    if (r) {
+        LOGE("RTP: could not resolve %s: %s", host, gai_strerror(r));
+        return false;
+    }
+
+    sink->fd = socket(result->ai_family, SOCK_DGRAM, 0);
+    if (sink->fd == -1) {
+        LOGE("RTP: could not create socket: %s", strerror(errno));
+        freeaddrinfo(result);
+        return false;
+    }
+
+    struct sockaddr_storage addr;
+    assert(result->ai_addrlen <= sizeof(addr));
+    memcpy(&addr, result->ai_addr, result->ai_addrlen);
+    socklen_t addr_len = result->ai_addrlen;
+    freeaddrinfo(result);
+
+    struct sc_rand rand;
+    sc_rand_init(&rand);
+
+    enum AVCodecID video_codec_id = video_codec == SC_CODEC_H264
+                                  ? AV_CODEC_ID_H264 : AV_CODEC_ID_HEVC;
+    sc_rtp_stream_init(&sink->video, &rand, &addr, addr_len, port,
+                       video_codec_id, SC_RTP_PAYLOAD_TYPE_VIDEO,
+                       SC_RTP_VIDEO_CLOCK_RATE);
+    sc_rtp_stream_init(&sink->audio, &rand, &addr, addr_len, port + 2,
+                       AV_CODEC_ID_OPUS, SC_RTP_PAYLOAD_TYPE_AUDIO,
+                       SC_RTP_OPUS_CLOCK_RATE);
+    sink->audio_channels = audio_channels;
+
+    sink->config = NULL;
+    sink->config_size = 0;
+
+    if (sdp_filename && !write_sdp(sink, sdp_filename, port, video, audio,
+                                   audio_sample_rate)) {
+        close(sink->fd);
+        return false;
+    }
+
+    static const struct sc_packet_sink_ops video_ops = {
+        .open = sc_rtp_sink_video_packet_sink_open,
+        .close = sc_rtp_sink_video_packet_sink_close,
+        .push = sc_rtp_sink_video_packet_sink_push,
+    };
+    sink->video_packet_sink.ops = &video_ops;
+
+    static const struct sc_packet_sink_ops audio_ops = {
+        .open = sc_rtp_sink_audio_packet_sink_open,
+        .close = sc_rtp_sink_audio_packet_sink_close,
+        .push = sc_rtp_sink_audio_packet_sink_push,
+    };
+    sink->audio_packet_sink.ops = &audio_ops;
+
+    LOGI("RTP: streaming to %s:%" PRIu16, host, port);
+    return true;
+}
+
+void
+sc_rtp_sink_destroy(struct sc_rtp_sink *sink) {
+    LOGD("RTP: %" PRIu64 " video packets (%" PRIu64 " errors), %" PRIu64
+         " audio packets (%" PRIu64 " errors)",
+         sink->video.packets, sink->video.errors, sink->audio.packets,
+         sink->audio.errors);
+    free(sink->config);
+    close(sink->fd);
+}
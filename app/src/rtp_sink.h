@@ -0,0 +1,97 @@
+#ifndef SC_RTP_SINK_H
+#define SC_RTP_SINK_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <libavcodec/avcodec.h>
+
+#include "options.h"
+#include "trait/packet_sink.h"
+#include "util/tick.h"
+
+/**
+ * RTP/UDP output
+ *
+ * Send the encoded video and audio streams (as received from the device,
+ * without decoding or re-encoding) over RTP:
+ *  - H.264 (RFC 6184) and H.265 (RFC 7798): one RTP packet per NAL unit, or
+ *    fragmentation units for NAL units larger than the maximal payload size;
+ *  - Opus (RFC 7587): one RTP packet per Opus packet.
+ *
+ * The video is sent to the configured port, the audio to port + 2 (the RTCP
+ * sender reports are sent to port + 1 and port + 3).
+ *
+ * The RTP timestamps are computed from the device PTS, so that a receiver can
+ * synchronize the streams. An SDP file describing the streams may be written
+ * for the receivers (e.g. `ffplay -protocol_whitelist file,udp,rtp x.sdp`).
+ *
+ * The packets are sent from the demuxer threads (sending UDP datagrams never
+ * waits for the receiver).
+ */
+
+#define SC_RTP_MAX_PAYLOAD_SIZE 1200
+
+struct sc_rtp_stream {
+    struct sockaddr_storage addr;
+    struct sockaddr_storage rtcp_addr;
+    socklen_t addr_len;
+
+    enum AVCodecID codec_id;
+    uint8_t payload_type;
+    uint32_t clock_rate;
+
+    uint32_t ssrc;
+    uint16_t seq;
+    uint32_t timestamp_offset;
+
+    // for the RTCP sender reports
+    uint64_t packets;
+    uint64_t octets;
+    int64_t last_report_pts;
+
+    uint64_t errors;
+};
+
+struct sc_rtp_sink {
+    struct sc_packet_sink video_packet_sink;
+    struct sc_packet_sink audio_packet_sink;
+
+    // shared by both streams (datagrams are sent atomically)
+    int fd;
+
+    // only accessed from the video demuxer thread
+    struct sc_rtp_stream video;
+    // only accessed from the audio demuxer thread
+    struct sc_rtp_stream audio;
+    int audio_channels;
+
+    // last video config packet (SPS/PPS, or VPS/SPS/PPS for H.265), sent
+    // again before each key frame which does not contain it (only accessed
+    // from the video demuxer thread)
+    uint8_t *config;
+    size_t config_size;
+};
+
+/**
+ * Initialize the RTP sink, sending to host:port (video) and host:port+2
+ * (audio)
+ *
+ * The video codec must be H.264 or H.265 (ignored if video is false), the
+ * audio codec must be Opus, with the given sample rate and channel count (1
+ * or 2, as negotiated with the device).
+ *
+ * If sdp_filename is not NULL, an SDP file describing the streams is written.
+ */
+bool
+sc_rtp_sink_init(struct sc_rtp_sink *sink, const char *host, uint16_t port,
+                 bool video, enum sc_codec video_codec, bool audio,
+                 uint32_t audio_sample_rate, uint8_t audio_channels,
+                 const char *sdp_filename);
+
+void
+sc_rtp_sink_destroy(struct sc_rtp_sink *sink);
+
+#endif
@@ -15,15 +15,18 @@
 #endif
 
 #include "audio_player.h"
+#include "av_sync.h"
 #include "controller.h"
 #include "decoder.h"
 #include "delay_buffer.h"
 #include "demuxer.h"
 #include "events.h"
 #include "file_pusher.h"
+#include "fmp4_server.h"
 #include "keyboard_sdk.h"
 #include "mouse_sdk.h"
 #include "recorder.h"
+#include "rtp_sink.h"
 #include "screen.h"
 #include "server.h"
 #include "uhid/gamepad_uhid.h"
@@ -44,12 +47,18 @@
 #ifdef HAVE_V4L2
 # include "v4l2_sink.h"
 #endif
+#ifdef HAVE_SHM
+# include "pcm_sink.h"
+# include "shm_sink.h"
+#endif
 #include "webrtc_streamer.h"
+#include "ws_server.h"
 
 struct scrcpy {
     struct sc_server server;
     struct sc_screen screen;
     struct sc_audio_player audio_player;
+    struct sc_av_sync av_sync;
     struct sc_demuxer video_demuxer;
     struct sc_demuxer audio_demuxer;
     struct sc_decoder video_decoder;
@@ -57,9 +66,16 @@ struct scrcpy {
     struct sc_recorder recorder;
     struct sc_delay_buffer video_buffer;
     struct sc_webrtc_streamer webrtc_streamer;
+    struct sc_ws_server ws_server;
+    struct sc_rtp_sink rtp_sink;
+    struct sc_fmp4_server fmp4_server;
 #ifdef HAVE_V4L2
     struct sc_v4l2_sink v4l2_sink;
     struct sc_delay_buffer v4l2_buffer;
+#endif
+#ifdef HAVE_SHM
+    struct sc_shm_sink shm_sink;
+    struct sc_pcm_sink pcm_sink;
 #endif
     struct sc_controller controller;
     struct sc_file_pusher file_pusher;
@@ -306,6 +322,26 @@ sc_audio_demuxer_on_ended(struct sc_demuxer *demuxer,
     }
 }
 
+static void
+sc_webrtc_streamer_on_key_frame_request(struct sc_webrtc_streamer *streamer,
+                                        void *userdata) {
+    (void) streamer;
+
+    struct sc_controller *controller = userdata;
+    if (!controller) {
+        // No control, the viewer will wait for the next key frame
+        return;
+    }
+
+    // Restart the encoding on the device, which starts with a key frame
+    struct sc_control_msg msg;
+    msg.type = SC_CONTROL_MSG_TYPE_RESET_VIDEO;
+
+    if (!sc_controller_push_msg(controller, &msg)) {
+        LOGW("Could not request reset video");
+    }
+}
+
 static void
 sc_controller_on_ended(struct sc_controller *controller, bool error,
                        void *userdata) {
@@ -404,8 +440,17 @@ scrcpy(struct scrcpy_options *options) {
     bool recorder_started = false;
     bool webrtc_streamer_initialized = false;
     bool webrtc_streamer_started = false;
+    bool ws_server_initialized = false;
+    bool ws_server_started = false;
+    bool rtp_sink_initialized = false;
+    bool fmp4_server_initialized = false;
+    bool fmp4_server_started = false;
 #ifdef HAVE_V4L2
     bool v4l2_sink_initialized = false;
+#endif
+#ifdef HAVE_SHM
+    bool shm_sink_initialized = false;
+    bool pcm_sink_initialized = false;
 #endif
     bool video_demuxer_started = false;
     bool audio_demuxer_started = false;
@@ -447,6 +492,8 @@ scrcpy(struct scrcpy_options *options) {
         .max_size = options->max_size,
         .video_bit_rate = options->video_bit_rate,
         .audio_bit_rate = options->audio_bit_rate,
+        .audio_sample_rate = options->audio_sample_rate,
+        .audio_channels = options->audio_channels,
         .max_fps = options->max_fps,
         .angle = options->angle,
         .screen_off_timeout = options->screen_off_timeout,
@@ -481,6 +528,7 @@ scrcpy(struct scrcpy_options *options) {
         .camera_high_speed = options->camera_high_speed,
         .vd_destroy_content = options->vd_destroy_content,
         .vd_system_decorations = options->vd_system_decorations,
+        .no_stdout = sc_record_is_stdout(options->record_filename),
         .list = options->list,
     };
 
@@ -573,8 +621,9 @@ scrcpy(struct scrcpy_options *options) {
     struct sc_file_pusher *fp = NULL;
 
     if (options->video_playback && options->control) {
+        bool no_stdout = sc_record_is_stdout(options->record_filename);
         if (!sc_file_pusher_init(&s->file_pusher, serial,
-                                 options->push_target)) {
+                                 options->push_target, no_stdout)) {
             goto end;
         }
         fp = &s->file_pusher;
@@ -602,6 +651,13 @@ scrcpy(struct scrcpy_options *options) {
 #ifdef HAVE_V4L2
     needs_video_decoder |= !!options->v4l2_device;
 #endif
+#ifdef HAVE_SHM
+    needs_video_decoder |= !!options->shm_sink;
+    needs_audio_decoder |=
+        options->audio_export_target != SC_AUDIO_EXPORT_TARGET_NONE;
+#endif
+    needs_video_decoder |= options->enable_webrtc && options->video
+                        && !sc_webrtc_streamer_can_forward(options->video_codec);
     if (needs_video_decoder) {
         sc_decoder_init(&s->video_decoder, "video");
         sc_packet_source_add_sink(&s->video_demuxer.packet_source,
@@ -620,7 +676,7 @@ scrcpy(struct scrcpy_options *options) {
         if (!sc_recorder_init(&s->recorder, options->record_filename,
                               options->record_format, options->video,
                               options->audio, options->record_orientation,
-                              &recorder_cbs, NULL)) {
+                              options->record_index, &recorder_cbs, NULL)) {
             goto end;
         }
         recorder_initialized = true;
@@ -841,9 +897,22 @@ aoa_complete:
 
         if (options->video_playback) {
             struct sc_frame_source *src = &s->video_decoder.frame_source;
-            if (options->video_buffer) {
+            if (options->av_sync) {
+                sc_av_sync_init(&s->av_sync);
+
+                // Until the audio clock is known, delay the video by the
+                // expected audio latency
+                sc_tick delay = options->video_buffer
+                              ? options->video_buffer
+                              : options->audio_buffer
+                                    + options->audio_output_buffer;
+                sc_delay_buffer_init(&s->video_buffer, delay, true,
+                                     &s->av_sync);
+                sc_frame_source_add_sink(src, &s->video_buffer.frame_sink);
+                src = &s->video_buffer.frame_source;
+            } else if (options->video_buffer) {
                 sc_delay_buffer_init(&s->video_buffer,
-                                     options->video_buffer, true);
+                                     options->video_buffer, true, NULL);
                 sc_frame_source_add_sink(src, &s->video_buffer.frame_sink);
                 src = &s->video_buffer.frame_source;
             }
@@ -854,20 +923,26 @@ aoa_complete:
 
     if (options->audio_playback) {
         sc_audio_player_init(&s->audio_player, options->audio_buffer,
-                             options->audio_output_buffer);
+                             options->audio_buffer_min,
+                             options->audio_buffer_max,
+                             options->audio_output_buffer,
+                             options->av_sync ? &s->av_sync : NULL);
         sc_frame_source_add_sink(&s->audio_decoder.frame_source,
                                  &s->audio_player.frame_sink);
     }
 
 #ifdef HAVE_V4L2
     if (options->v4l2_device) {
-        if (!sc_v4l2_sink_init(&s->v4l2_sink, options->v4l2_device)) {
+        if (!sc_v4l2_sink_init(&s->v4l2_sink, options->v4l2_device,
+                               options->v4l2_format, options->v4l2_width,
+                               options->v4l2_height)) {
             goto end;
         }
 
         struct sc_frame_source *src = &s->video_decoder.frame_source;
         if (options->v4l2_buffer) {
-            sc_delay_buffer_init(&s->v4l2_buffer, options->v4l2_buffer, true);
+            sc_delay_buffer_init(&s->v4l2_buffer, options->v4l2_buffer, true,
+                                 NULL);
             sc_frame_source_add_sink(src, &s->v4l2_buffer.frame_sink);
             src = &s->v4l2_buffer.frame_source;
         }
@@ -878,22 +953,65 @@ aoa_complete:
     }
 #endif
 
+#ifdef HAVE_SHM
+    if (options->shm_sink) {
+        if (!sc_shm_sink_init(&s->shm_sink, options->shm_sink,
+                              options->shm_slots)) {
+            goto end;
+        }
+
+        sc_frame_source_add_sink(&s->video_decoder.frame_source,
+                                 &s->shm_sink.frame_sink);
+
+        shm_sink_initialized = true;
+    }
+
+    if (options->audio_export_target != SC_AUDIO_EXPORT_TARGET_NONE) {
+        if (!sc_pcm_sink_init(&s->pcm_sink, options->audio_export_target,
+                              options->audio_export_path,
+                              options->audio_export_format,
+                              options->audio_export_rate)) {
+            goto end;
+        }
+
+        sc_frame_source_add_sink(&s->audio_decoder.frame_source,
+                                 &s->pcm_sink.frame_sink);
+
+        pcm_sink_initialized = true;
+    }
+#endif
+
     // Initialize WebRTC streamer if enabled
     if (options->enable_webrtc && options->video) {
         LOGI("Initializing WebRTC streamer");
         
+        bool forward = sc_webrtc_streamer_can_forward(options->video_codec);
+        static const struct sc_webrtc_streamer_callbacks webrtc_streamer_cbs = {
+            .on_key_frame_request = sc_webrtc_streamer_on_key_frame_request,
+        };
         if (!sc_webrtc_streamer_init(&s->webrtc_streamer, 
                                      options->websocket_url,
                                      options->webrtc_signal_url,
-                                     options->user_id)) {
+                                     options->user_id,
+                                     forward,
+                                     options->video_bit_rate,
+                                     options->webrtc_max_size,
+                                     &webrtc_streamer_cbs,
+                                     controller)) {
             LOGE("Failed to initialize WebRTC streamer");
             goto end;
         }
         webrtc_streamer_initialized = true;
 
-        // Add WebRTC streamer as a sink to the video decoder
-        sc_frame_source_add_sink(&s->video_decoder.frame_source, 
-                                 &s->webrtc_streamer.frame_sink);
+        if (forward) {
+            // Forward the device packets (no decoding, no re-encoding)
+            sc_packet_source_add_sink(&s->video_demuxer.packet_source,
+                                      &s->webrtc_streamer.packet_sink);
+        } else {
+            // Add WebRTC streamer as a sink to the video decoder
+            sc_frame_source_add_sink(&s->video_decoder.frame_source,
+                                     &s->webrtc_streamer.frame_sink);
+        }
 
         // Start the WebRTC streamer thread
         if (!sc_webrtc_streamer_start(&s->webrtc_streamer)) {
@@ -905,6 +1023,73 @@ aoa_complete:
         LOGI("WebRTC streamer started successfully");
     }
 
+    if (options->ws_server_port) {
+        assert(options->video);
+        if (!sc_ws_server_init(&s->ws_server, options->ws_server_port)) {
+            goto end;
+        }
+        ws_server_initialized = true;
+
+        // Serve the device packets (no decoding, no re-encoding)
+        sc_packet_source_add_sink(&s->video_demuxer.packet_source,
+                                  &s->ws_server.packet_sink);
+
+        if (!sc_ws_server_start(&s->ws_server)) {
+            goto end;
+        }
+        ws_server_started = true;
+    }
+
+    if (options->rtp_port) {
+        const char *host = options->rtp_host ? options->rtp_host
+                                             : "127.0.0.1";
+        // The device captures with the requested configuration
+        uint32_t sample_rate = options->audio_sample_rate
+                             ? options->audio_sample_rate : 48000;
+        uint8_t channels = options->audio_channels
+                         ? options->audio_channels : 2;
+        if (!sc_rtp_sink_init(&s->rtp_sink, host, options->rtp_port,
+                              options->video, options->video_codec,
+                              options->audio, sample_rate, channels,
+                              options->rtp_sdp)) {
+            goto end;
+        }
+        rtp_sink_initialized = true;
+
+        // Send the device packets (no decoding, no re-encoding)
+        if (options->video) {
+            sc_packet_source_add_sink(&s->video_demuxer.packet_source,
+                                      &s->rtp_sink.video_packet_sink);
+        }
+        if (options->audio) {
+            sc_packet_source_add_sink(&s->audio_demuxer.packet_source,
+                                      &s->rtp_sink.audio_packet_sink);
+        }
+    }
+
+    if (options->fmp4_server_port) {
+        if (!sc_fmp4_server_init(&s->fmp4_server, options->fmp4_server_port,
+                                 options->video, options->audio)) {
+            goto end;
+        }
+        fmp4_server_initialized = true;
+
+        // Remux the device packets (no decoding, no re-encoding)
+        if (options->video) {
+            sc_packet_source_add_sink(&s->video_demuxer.packet_source,
+                                      &s->fmp4_server.video_packet_sink);
+        }
+        if (options->audio) {
+            sc_packet_source_add_sink(&s->audio_demuxer.packet_source,
+                                      &s->fmp4_server.audio_packet_sink);
+        }
+
+        if (!sc_fmp4_server_start(&s->fmp4_server)) {
+            goto end;
+        }
+        fmp4_server_started = true;
+    }
+
     // Now that the header values have been consumed, the socket(s) will
     // receive the stream(s). Start the demuxer(s).
 
@@ -1027,6 +1212,12 @@ end:
     if (webrtc_streamer_started) {
         sc_webrtc_streamer_stop(&s->webrtc_streamer);
     }
+    if (ws_server_started) {
+        sc_ws_server_stop(&s->ws_server);
+    }
+    if (fmp4_server_started) {
+        sc_fmp4_server_stop(&s->fmp4_server);
+    }
     if (screen_initialized) {
         sc_screen_interrupt(&s->screen);
     }
@@ -1059,6 +1250,15 @@ end:
     }
 #endif
 
+#ifdef HAVE_SHM
+    if (shm_sink_initialized) {
+        sc_shm_sink_destroy(&s->shm_sink);
+    }
+    if (pcm_sink_initialized) {
+        sc_pcm_sink_destroy(&s->pcm_sink);
+    }
+#endif
+
     if (webrtc_streamer_started) {
         sc_webrtc_streamer_join(&s->webrtc_streamer);
     }
@@ -1066,6 +1266,24 @@ end:
         sc_webrtc_streamer_destroy(&s->webrtc_streamer);
     }
 
+    if (ws_server_started) {
+        sc_ws_server_join(&s->ws_server);
+    }
+    if (ws_server_initialized) {
+        sc_ws_server_destroy(&s->ws_server);
+    }
+
+    if (rtp_sink_initialized) {
+        sc_rtp_sink_destroy(&s->rtp_sink);
+    }
+
+    if (fmp4_server_started) {
+        sc_fmp4_server_join(&s->fmp4_server);
+    }
+    if (fmp4_server_initialized) {
+        sc_fmp4_server_destroy(&s->fmp4_server);
+    }
+
 #ifdef HAVE_USB
     if (aoa_hid_initialized) {
         sc_aoa_join(&s->aoa);
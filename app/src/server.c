@@ -53,8 +53,14 @@ get_server_path(void) {
     return server_path;
 }
 
+static unsigned
+get_adb_flags(const struct sc_server_params *params) {
+    // stdout may be reserved (e.g. for recording to a pipe)
+    return params->no_stdout ? SC_ADB_NO_STDOUT : 0;
+}
+
 static bool
-push_server(struct sc_intr *intr, const char *serial) {
+push_server(struct sc_intr *intr, const char *serial, unsigned flags) {
     char *server_path = get_server_path();
     if (!server_path) {
         return false;
@@ -64,7 +70,8 @@ push_server(struct sc_intr *intr, const char *serial) {
         free(server_path);
         return false;
     }
-    bool ok = sc_adb_push(intr, serial, server_path, SC_DEVICE_SERVER_PATH, 0);
+    bool ok = sc_adb_push(intr, serial, server_path, SC_DEVICE_SERVER_PATH,
+                          flags);
     free(server_path);
     return ok;
 }
@@ -277,6 +284,12 @@ execute_server(struct sc_server *server,
     if (params->audio_bit_rate) {
         ADD_PARAM("audio_bit_rate=%" PRIu32, params->audio_bit_rate);
     }
+    if (params->audio_sample_rate) {
+        ADD_PARAM("audio_sample_rate=%" PRIu32, params->audio_sample_rate);
+    }
+    if (params->audio_channels) {
+        ADD_PARAM("audio_channels=%" PRIu8, params->audio_channels);
+    }
     if (params->video_codec != SC_CODEC_H264) {
         ADD_PARAM("video_codec=%s",
                   sc_server_get_codec_name(params->video_codec));
@@ -475,8 +488,9 @@ execute_server(struct sc_server *server,
     //     Port: 5005
     // Then click on "Debug"
 #endif
-    // Inherit both stdout and stderr (all server logs are printed to stdout)
-    pid = sc_adb_execute(cmd, 0);
+    // Inherit both stdout and stderr (all server logs are printed to stdout),
+    // unless stdout is reserved
+    pid = sc_adb_execute(cmd, get_adb_flags(params));
 
 end:
     for (unsigned i = dyn_idx; i < count; ++i) {
@@ -850,7 +864,8 @@ sc_server_switch_to_tcpip(struct sc_server *server, const char *serial) {
 
     LOGI("Switching device %s to TCP/IP...", serial);
 
-    char *ip = sc_adb_get_device_ip(intr, serial, 0);
+    char *ip = sc_adb_get_device_ip(intr, serial,
+                                    get_adb_flags(&server->params));
     if (!ip) {
         LOGE("Device IP not found");
         return NULL;
@@ -900,7 +915,7 @@ sc_server_connect_to_tcpip(struct sc_server *server, const char *ip_port,
 
     LOGI("Connecting to %s...", ip_port);
 
-    bool ok = sc_adb_connect(intr, ip_port, 0);
+    bool ok = sc_adb_connect(intr, ip_port, get_adb_flags(&server->params));
     if (!ok) {
         LOGE("Could not connect to %s", ip_port);
         return false;
@@ -969,7 +984,7 @@ run_server(void *data) {
     // Execute "adb start-server" before "adb devices" so that daemon starting
     // output/errors is correctly printed in the console ("adb devices" output
     // is parsed, so it is not output)
-    bool ok = sc_adb_start_server(&server->intr, 0);
+    bool ok = sc_adb_start_server(&server->intr, get_adb_flags(params));
     if (!ok) {
         LOGE("Could not start adb server");
         goto error_connection_failed;
@@ -1013,7 +1028,8 @@ run_server(void *data) {
             }
         }
         struct sc_adb_device device;
-        ok = sc_adb_select_device(&server->intr, &selector, 0, &device);
+        ok = sc_adb_select_device(&server->intr, &selector,
+                                  get_adb_flags(params), &device);
         if (!ok) {
             goto error_connection_failed;
         }
@@ -1051,7 +1067,7 @@ run_server(void *data) {
     assert(serial);
     LOGD("Device serial: %s", serial);
 
-    ok = push_server(&server->intr, serial);
+    ok = push_server(&server->intr, serial, get_adb_flags(params));
     if (!ok) {
         goto error_connection_failed;
     }
@@ -42,6 +42,8 @@ struct sc_server_params {
     uint16_t max_size;
     uint32_t video_bit_rate;
     uint32_t audio_bit_rate;
+    uint32_t audio_sample_rate;
+    uint8_t audio_channels;
     const char *max_fps; // float to be parsed by the server
     const char *angle; // float to be parsed by the server
     sc_tick screen_off_timeout;
@@ -76,6 +78,9 @@ struct sc_server_params {
     bool camera_high_speed;
     bool vd_destroy_content;
     bool vd_system_decorations;
+    // stdout is reserved (e.g. for recording to a pipe), adb must not write
+    // to it
+    bool no_stdout;
     uint8_t list;
 };
 
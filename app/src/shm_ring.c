@@ -0,0 +1,277 @@
+// shm_open(), ftruncate()... (when embedded in a reader, see shm_ring.h)
+#ifndef _POSIX_C_SOURCE
+# define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "shm_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SC_SHM_RING_ALIGN 64
+
+static inline struct sc_shm_ring_slot *
+sc_shm_ring_get_slot(struct sc_shm_ring *ring, uint64_t number) {
+    assert(number);
+    struct sc_shm_ring_header *header = ring->header;
+    size_t index = (number - 1) % header->slot_count;
+    return (struct sc_shm_ring_slot *)
+        (ring->mem + SC_SHM_RING_HEADER_SIZE + index * header->slot_size);
+}
+
+static inline uint8_t *
+sc_shm_ring_get_slot_data(struct sc_shm_ring_slot *slot) {
+    return (uint8_t *) slot + SC_SHM_RING_SLOT_HEADER_SIZE;
+}
+
+bool
+sc_shm_ring_create(struct sc_shm_ring *ring, const char *name,
+                   uint32_t slot_count, size_t data_capacity) {
+    assert(slot_count);
+
+    ring->name = strdup(name);
+    if (!ring->name) {
+        return false;
+    }
+
+    // errno of the failed call, restored after the cleanup
+    int err;
+
+    size_t slot_size = SC_SHM_RING_SLOT_HEADER_SIZE + data_capacity;
+    // Align each slot on a cache line
+    slot_size = (slot_size + SC_SHM_RING_ALIGN - 1)
+              & ~(size_t) (SC_SHM_RING_ALIGN - 1);
+    ring->size = SC_SHM_RING_HEADER_SIZE + slot_count * slot_size;
+
+    // Remove any stale shared memory from a previous session
+    shm_unlink(name);
+
+    ring->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (ring->fd == -1) {
+        err = errno;
+        goto error_free_name;
+    }
+
+    if (ftruncate(ring->fd, ring->size) == -1) {
+        err = errno;
+        goto error_unlink;
+    }
+
+    ring->mem = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     ring->fd, 0);
+    if (ring->mem == MAP_FAILED) {
+        err = errno;
+        goto error_unlink;
+    }
+
+    // The memory is initialized to 0 by ftruncate(), so all the slots are
+    // initially empty (seq == 0, number == 0)
+    struct sc_shm_ring_header *header = (void *) ring->mem;
+    header->version = SC_SHM_RING_VERSION;
+    header->slot_count = slot_count;
+    header->slot_size = slot_size;
+    header->data_capacity = data_capacity;
+    atomic_init(&header->latest, 0);
+    // Write the magic last, readers check it to detect an initialized ring
+    memcpy(header->magic, SC_SHM_RING_MAGIC, sizeof(header->magic));
+
+    ring->header = header;
+    ring->writer = true;
+    ring->next = 1;
+
+    return true;
+
+error_unlink:
+    close(ring->fd);
+    shm_unlink(name);
+error_free_name:
+    free(ring->name);
+    errno = err;
+
+    return false;
+}
+
+bool
+sc_shm_ring_open(struct sc_shm_ring *ring, const char *name) {
+    ring->name = strdup(name);
+    if (!ring->name) {
+        return false;
+    }
+
+    // errno of the failed call, restored after the cleanup
+    int err;
+
+    ring->fd = shm_open(name, O_RDONLY, 0);
+    if (ring->fd == -1) {
+        err = errno;
+        goto error_free_name;
+    }
+
+    struct stat st;
+    if (fstat(ring->fd, &st) == -1) {
+        err = errno;
+        goto error_close;
+    }
+
+    if ((size_t) st.st_size < SC_SHM_RING_HEADER_SIZE) {
+        err = EINVAL;
+        goto error_close;
+    }
+
+    ring->size = st.st_size;
+    ring->mem = mmap(NULL, ring->size, PROT_READ, MAP_SHARED, ring->fd, 0);
+    if (ring->mem == MAP_FAILED) {
+        err = errno;
+        goto error_close;
+    }
+
+    struct sc_shm_ring_header *header = (void *) ring->mem;
+    if (memcmp(header->magic, SC_SHM_RING_MAGIC, sizeof(header->magic))
+            || header->version != SC_SHM_RING_VERSION
+            || !header->slot_count
+            || header->slot_size < SC_SHM_RING_SLOT_HEADER_SIZE
+                                 + header->data_capacity
+            || SC_SHM_RING_HEADER_SIZE
+                + header->slot_count * header->slot_size > ring->size) {
+        err = EINVAL;
+        goto error_unmap;
+    }
+
+    ring->header = header;
+    ring->writer = false;
+
+    return true;
+
+error_unmap:
+    munmap(ring->mem, ring->size);
+error_close:
+    close(ring->fd);
+error_free_name:
+    free(ring->name);
+    errno = err;
+
+    return false;
+}
+
+void
+sc_shm_ring_close(struct sc_shm_ring *ring) {
+    munmap(ring->mem, ring->size);
+    close(ring->fd);
+    if (ring->writer) {
+        // The readers which have mapped the memory keep it alive
+        shm_unlink(ring->name);
+    }
+    free(ring->name);
+}
+
+struct sc_shm_ring_slot *
+sc_shm_ring_begin_write(struct sc_shm_ring *ring, uint8_t **data) {
+    assert(ring->writer);
+
+    struct sc_shm_ring_slot *slot = sc_shm_ring_get_slot(ring, ring->next);
+
+    uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    assert(!(seq & 1));
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    // The slot must be marked as being written before its content changes
+    atomic_thread_fence(memory_order_release);
+
+    slot->number = ring->next;
+    *data = sc_shm_ring_get_slot_data(slot);
+    return slot;
+}
+
+void
+sc_shm_ring_end_write(struct sc_shm_ring *ring, struct sc_shm_ring_slot *slot) {
+    assert(ring->writer);
+    assert(slot->number == ring->next);
+    assert(slot->size <= ring->header->data_capacity);
+
+    uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    assert(seq & 1);
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_release);
+    atomic_store_explicit(&ring->header->latest, ring->next,
+                          memory_order_release);
+    ++ring->next;
+}
+
+uint64_t
+sc_shm_ring_latest(struct sc_shm_ring *ring) {
+    return atomic_load_explicit(&ring->header->latest, memory_order_acquire);
+}
+
+bool
+sc_shm_ring_acquire(struct sc_shm_ring *ring, uint64_t number,
+                    struct sc_shm_frame *frame) {
+    if (!number) {
+        return false;
+    }
+
+    struct sc_shm_ring_slot *slot = sc_shm_ring_get_slot(ring, number);
+
+    uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (seq & 1) {
+        // Being written
+        return false;
+    }
+
+    frame->number = slot->number;
+    frame->format = slot->format;
+    frame->width = slot->width;
+    frame->height = slot->height;
+    frame->size = slot->size;
+    frame->plane_count = slot->plane_count;
+    frame->pts = slot->pts;
+    frame->publish_time = slot->publish_time;
+    frame->sample_rate = slot->sample_rate;
+    frame->channels = slot->channels;
+
+    const uint8_t *data = sc_shm_ring_get_slot_data(slot);
+    for (unsigned i = 0; i < SC_SHM_RING_MAX_PLANES; ++i) {
+        uint32_t offset = slot->offsets[i];
+        frame->linesizes[i] = slot->linesizes[i];
+        frame->data[i] = i < frame->plane_count ? data + offset : NULL;
+    }
+
+    frame->seq = seq;
+    frame->slot = slot;
+
+    if (!sc_shm_ring_validate(ring, frame)) {
+        // The header has been overwritten while it was read
+        return false;
+    }
+
+    if (frame->number != number
+            || frame->size > ring->header->data_capacity
+            || frame->plane_count > SC_SHM_RING_MAX_PLANES) {
+        // Not published yet or already overwritten
+        return false;
+    }
+
+    for (unsigned i = 0; i < frame->plane_count; ++i) {
+        if (frame->data[i] < data || frame->data[i] >= data + frame->size) {
+            // Inconsistent offsets, do not let the reader access out of
+            // bounds
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+sc_shm_ring_validate(struct sc_shm_ring *ring,
+                     const struct sc_shm_frame *frame) {
+    (void) ring;
+
+    // The frame content must be read before the seq is read again
+    atomic_thread_fence(memory_order_acquire);
+    uint32_t seq = atomic_load_explicit(&frame->slot->seq,
+                                        memory_order_relaxed);
+    return seq == frame->seq;
+}
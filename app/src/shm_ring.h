@@ -0,0 +1,174 @@
+#ifndef SC_SHM_RING_H
+#define SC_SHM_RING_H
+
+// This file and shm_ring.c only depend on the C standard library and POSIX
+// (no scrcpy header, no logging), so that they can be embedded as is in a
+// reader program
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Ring of decoded frames in POSIX shared memory
+ *
+ * A frame is either a video frame or a chunk of audio samples (PCM, packed,
+ * in a single plane).
+ *
+ * It is written by a single writer (scrcpy) and may be read concurrently by
+ * any number of local readers (other processes), without locks and without
+ * copy: a reader maps the shared memory and reads the frame data in place.
+ *
+ * The memory contains a header followed by `slot_count` slots. Each slot
+ * contains a slot header followed by the frame data (the planes, packed).
+ * Frames are numbered from 1; frame n is stored in slot (n - 1) % slot_count.
+ *
+ * Each slot is protected by a seqlock: its `seq` is odd while the slot is
+ * being written. A reader must check that `seq` did not change after reading
+ * the frame data, otherwise the data may be torn (the writer never waits for
+ * the readers).
+ *
+ * All values are in host byte order (the memory is only shared locally).
+ *
+ * The functions do not log anything: on error, they return false with errno
+ * set (EINVAL if the shared memory is not a valid ring).
+ */
+
+#define SC_SHM_RING_MAGIC "scrcpysh"
+#define SC_SHM_RING_VERSION 1
+#define SC_SHM_RING_HEADER_SIZE 64
+#define SC_SHM_RING_SLOT_HEADER_SIZE 128
+#define SC_SHM_RING_MAX_PLANES 4
+
+enum sc_shm_ring_format {
+    SC_SHM_RING_FORMAT_YUV420P = 1, // 3 planes: Y, U, V
+    SC_SHM_RING_FORMAT_PCM_S16 = 2, // 1 plane: interleaved signed 16-bit
+    SC_SHM_RING_FORMAT_PCM_F32 = 3, // 1 plane: interleaved 32-bit float
+};
+
+struct sc_shm_ring_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_count;
+    uint64_t slot_size; // including the slot header
+    uint64_t data_capacity; // max size of the frame data in a slot
+    // number of the last published frame (0 if none)
+    atomic_uint_least64_t latest;
+};
+
+struct sc_shm_ring_slot {
+    atomic_uint_least32_t seq; // odd while the slot is being written
+    uint32_t format; // enum sc_shm_ring_format
+    uint32_t width;
+    uint32_t height;
+    uint32_t size; // size of the frame data
+    uint32_t plane_count;
+    uint32_t offsets[SC_SHM_RING_MAX_PLANES]; // relative to the frame data
+    uint32_t linesizes[SC_SHM_RING_MAX_PLANES];
+    uint64_t number; // frame number
+    int64_t pts; // in microseconds
+    // CLOCK_MONOTONIC time when the frame was published, in microseconds
+    int64_t publish_time;
+    // audio formats only (the width and height are 0)
+    uint32_t sample_rate;
+    uint32_t channels;
+};
+
+static_assert(sizeof(struct sc_shm_ring_header) <= SC_SHM_RING_HEADER_SIZE,
+              "Invalid shm ring header size");
+static_assert(sizeof(struct sc_shm_ring_slot) <= SC_SHM_RING_SLOT_HEADER_SIZE,
+              "Invalid shm ring slot header size");
+
+struct sc_shm_ring {
+    char *name;
+    bool writer; // if true, the shared memory is unlinked on close
+    int fd;
+    uint8_t *mem;
+    size_t size;
+    struct sc_shm_ring_header *header;
+    uint64_t next; // writer only: number of the next frame to write
+};
+
+/**
+ * Read-only view of a frame, valid (not torn) as long as
+ * sc_shm_ring_validate() returns true
+ */
+struct sc_shm_frame {
+    uint64_t number;
+    uint32_t seq;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t size;
+    uint32_t plane_count;
+    const uint8_t *data[SC_SHM_RING_MAX_PLANES];
+    uint32_t linesizes[SC_SHM_RING_MAX_PLANES];
+    int64_t pts;
+    int64_t publish_time;
+    uint32_t sample_rate;
+    uint32_t channels;
+
+    const struct sc_shm_ring_slot *slot;
+};
+
+/**
+ * Create the shared memory (writer side)
+ *
+ * If the name already exists, it is replaced.
+ */
+bool
+sc_shm_ring_create(struct sc_shm_ring *ring, const char *name,
+                   uint32_t slot_count, size_t data_capacity);
+
+/**
+ * Open an existing shared memory (reader side)
+ */
+bool
+sc_shm_ring_open(struct sc_shm_ring *ring, const char *name);
+
+void
+sc_shm_ring_close(struct sc_shm_ring *ring);
+
+/**
+ * Start writing the next frame (writer side)
+ *
+ * Return the slot header, to be filled by the caller, and the frame data
+ * (of size data_capacity) in `data`.
+ */
+struct sc_shm_ring_slot *
+sc_shm_ring_begin_write(struct sc_shm_ring *ring, uint8_t **data);
+
+/**
+ * Publish the frame started by sc_shm_ring_begin_write()
+ */
+void
+sc_shm_ring_end_write(struct sc_shm_ring *ring, struct sc_shm_ring_slot *slot);
+
+/**
+ * Return the number of the last published frame (0 if none)
+ */
+uint64_t
+sc_shm_ring_latest(struct sc_shm_ring *ring);
+
+/**
+ * Get a view of the frame `number` (reader side)
+ *
+ * Return false if the frame is not available (not published yet, being
+ * written, or already overwritten).
+ */
+bool
+sc_shm_ring_acquire(struct sc_shm_ring *ring, uint64_t number,
+                    struct sc_shm_frame *frame);
+
+/**
+ * Check that the frame has not been overwritten since it was acquired
+ *
+ * This must be called after reading the frame data, to detect torn reads.
+ */
+bool
+sc_shm_ring_validate(struct sc_shm_ring *ring,
+                     const struct sc_shm_frame *frame);
+
+#endif
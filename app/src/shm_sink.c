@@ -0,0 +1,147 @@
+#include "shm_sink.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavutil/imgutils.h>
+
+#include "util/log.h"
+#include "util/tick.h"
+
+/** Downcast frame_sink to sc_shm_sink */
+#define DOWNCAST(SINK) container_of(SINK, struct sc_shm_sink, frame_sink)
+
+static size_t
+sc_shm_sink_get_frame_size(uint32_t width, uint32_t height) {
+    // YUV420P, planes packed without padding
+    size_t chroma_w = (width + 1) / 2;
+    size_t chroma_h = (height + 1) / 2;
+    return (size_t) width * height + 2 * chroma_w * chroma_h;
+}
+
+static bool
+sc_shm_sink_frame_sink_open(struct sc_frame_sink *sink,
+                            const AVCodecContext *ctx) {
+    struct sc_shm_sink *ss = DOWNCAST(sink);
+
+    assert(ctx->pix_fmt == AV_PIX_FMT_YUV420P);
+
+    // The frame size may change (e.g. on device rotation): allocate slots
+    // large enough for both orientations
+    uint32_t max_dim = MAX(ctx->width, ctx->height);
+    size_t capacity = sc_shm_sink_get_frame_size(max_dim, max_dim);
+
+    bool ok = sc_shm_ring_create(&ss->ring, ss->name, ss->slot_count,
+                                 capacity);
+    if (!ok) {
+        LOGE("Could not create shared memory %s: %s", ss->name,
+             strerror(errno));
+        return false;
+    }
+
+    ss->dropped_frames = 0;
+
+    LOGI("Shared memory sink started: %s (%" PRIu32 " slots of %" PRIu64
+         " bytes)", ss->name, ss->slot_count,
+         (uint64_t) ss->ring.header->slot_size);
+
+    return true;
+}
+
+static void
+sc_shm_sink_frame_sink_close(struct sc_frame_sink *sink) {
+    struct sc_shm_sink *ss = DOWNCAST(sink);
+
+    if (ss->dropped_frames) {
+        LOGD("Shared memory sink: %" PRIu64 " frames dropped",
+             ss->dropped_frames);
+    }
+
+    sc_shm_ring_close(&ss->ring);
+}
+
+static bool
+sc_shm_sink_frame_sink_push(struct sc_frame_sink *sink, const AVFrame *frame) {
+    struct sc_shm_sink *ss = DOWNCAST(sink);
+
+    assert(frame->format == AV_PIX_FMT_YUV420P);
+
+    uint32_t w = frame->width;
+    uint32_t h = frame->height;
+    size_t size = sc_shm_sink_get_frame_size(w, h);
+    if (size > ss->ring.header->data_capacity) {
+        if (!ss->dropped_frames) {
+            LOGW("Frames too large for the shared memory sink (%" PRIu32 "x%"
+                 PRIu32 "), dropping them", w, h);
+        }
+        ++ss->dropped_frames;
+        // Not fatal, other frames may fit
+        return true;
+    }
+
+    uint32_t chroma_w = (w + 1) / 2;
+    uint32_t chroma_h = (h + 1) / 2;
+
+    uint8_t *data;
+    struct sc_shm_ring_slot *slot = sc_shm_ring_begin_write(&ss->ring, &data);
+
+    slot->format = SC_SHM_RING_FORMAT_YUV420P;
+    slot->width = w;
+    slot->height = h;
+    slot->size = size;
+    slot->plane_count = 3;
+    slot->offsets[0] = 0;
+    slot->offsets[1] = w * h;
+    slot->offsets[2] = w * h + chroma_w * chroma_h;
+    slot->offsets[3] = 0;
+    slot->linesizes[0] = w;
+    slot->linesizes[1] = chroma_w;
+    slot->linesizes[2] = chroma_w;
+    slot->linesizes[3] = 0;
+    slot->pts = frame->pts;
+    slot->sample_rate = 0;
+    slot->channels = 0;
+
+    av_image_copy_plane(data, w, frame->data[0], frame->linesize[0], w, h);
+    av_image_copy_plane(data + slot->offsets[1], chroma_w, frame->data[1],
+                        frame->linesize[1], chroma_w, chroma_h);
+    av_image_copy_plane(data + slot->offsets[2], chroma_w, frame->data[2],
+                        frame->linesize[2], chroma_w, chroma_h);
+
+    slot->publish_time = sc_tick_now();
+
+    sc_shm_ring_end_write(&ss->ring, slot);
+
+    return true;
+}
+
+bool
+sc_shm_sink_init(struct sc_shm_sink *ss, const char *name,
+                 uint32_t slot_count) {
+    assert(slot_count);
+
+    ss->name = strdup(name);
+    if (!ss->name) {
+        LOG_OOM();
+        return false;
+    }
+
+    ss->slot_count = slot_count;
+
+    static const struct sc_frame_sink_ops ops = {
+        .open = sc_shm_sink_frame_sink_open,
+        .close = sc_shm_sink_frame_sink_close,
+        .push = sc_shm_sink_frame_sink_push,
+    };
+
+    ss->frame_sink.ops = &ops;
+
+    return true;
+}
+
+void
+sc_shm_sink_destroy(struct sc_shm_sink *ss) {
+    free(ss->name);
+}
@@ -0,0 +1,34 @@
+#ifndef SC_SHM_SINK_H
+#define SC_SHM_SINK_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "shm_ring.h"
+#include "trait/frame_sink.h"
+
+/**
+ * Frame sink publishing the decoded frames to a shared memory ring, to be
+ * read by local processes (see shm_ring.h)
+ */
+struct sc_shm_sink {
+    struct sc_frame_sink frame_sink; // frame sink trait
+
+    char *name;
+    uint32_t slot_count;
+
+    struct sc_shm_ring ring;
+    // frames too large for the slots (the video size increased)
+    uint64_t dropped_frames;
+};
+
+bool
+sc_shm_sink_init(struct sc_shm_sink *ss, const char *name,
+                 uint32_t slot_count);
+
+void
+sc_shm_sink_destroy(struct sc_shm_sink *ss);
+
+#endif
@@ -2,6 +2,11 @@
 
 #include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_MEMFD_CREATE
+# include <errno.h>
+# include <unistd.h>
+# include <sys/mman.h>
+#endif
 #include <util/log.h>
 #include <util/memory.h>
 
@@ -21,14 +26,111 @@ sc_audiobuf_init(struct sc_audiobuf *buf, size_t sample_size,
     }
 
     buf->sample_size = sample_size;
+    buf->mirror_size = 0;
     atomic_init(&buf->head, 0);
     atomic_init(&buf->tail, 0);
+    atomic_init(&buf->drop, 0);
 
     return true;
 }
 
+#ifdef HAVE_MEMFD_CREATE
+static size_t
+sc_gcd(size_t a, size_t b) {
+    while (b) {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Map the same size bytes twice, back to back
+static uint8_t *
+sc_audiobuf_map_mirror(size_t size) {
+    int fd = memfd_create("scrcpy-audiobuf", MFD_CLOEXEC);
+    if (fd == -1) {
+        LOGD("memfd_create() failed: %s", strerror(errno));
+        return NULL;
+    }
+
+    uint8_t *addr = NULL;
+
+    if (ftruncate(fd, size)) {
+        LOGD("ftruncate() failed: %s", strerror(errno));
+        goto end;
+    }
+
+    // Reserve a contiguous address range for both mappings
+    uint8_t *range = mmap(NULL, 2 * size, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (range == MAP_FAILED) {
+        LOGD("mmap() failed: %s", strerror(errno));
+        goto end;
+    }
+
+    for (unsigned i = 0; i < 2; ++i) {
+        void *p = mmap(range + i * size, size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_FIXED, fd, 0);
+        if (p == MAP_FAILED) {
+            LOGD("mmap() failed: %s", strerror(errno));
+            munmap(range, 2 * size);
+            goto end;
+        }
+    }
+
+    addr = range;
+
+end:
+    // The mappings keep a reference to the memory
+    close(fd);
+    return addr;
+}
+#endif
+
+bool
+sc_audiobuf_init_mirror(struct sc_audiobuf *buf, size_t sample_size,
+                        uint32_t capacity) {
+#ifdef HAVE_MEMFD_CREATE
+    assert(sample_size);
+    assert(capacity);
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size > 0) {
+        // The mapping size must be a multiple of both the page size and the
+        // sample size, so that the second mapping starts on a sample boundary
+        size_t unit = page_size / sc_gcd(page_size, sample_size) * sample_size;
+        size_t min_size = ((size_t) capacity + 1) * sample_size;
+        size_t size = (min_size + unit - 1) / unit * unit;
+
+        uint8_t *data = sc_audiobuf_map_mirror(size);
+        if (data) {
+            buf->data = data;
+            buf->alloc_size = size / sample_size;
+            buf->sample_size = sample_size;
+            buf->mirror_size = size;
+            atomic_init(&buf->head, 0);
+            atomic_init(&buf->tail, 0);
+            atomic_init(&buf->drop, 0);
+            return true;
+        }
+    }
+
+    LOGD("Mirrored audio buffer not available, fallback");
+#endif
+
+    return sc_audiobuf_init(buf, sample_size, capacity);
+}
+
 void
 sc_audiobuf_destroy(struct sc_audiobuf *buf) {
+#ifdef HAVE_MEMFD_CREATE
+    if (buf->mirror_size) {
+        munmap(buf->data, 2 * buf->mirror_size);
+        return;
+    }
+#endif
+
     free(buf->data);
 }
 
@@ -38,42 +140,57 @@ sc_audiobuf_read(struct sc_audiobuf *buf, void *to_, uint32_t samples_count) {
 
     uint8_t *to = to_;
 
-    // Only the reader thread can write tail without synchronization, so
-    // memory_order_relaxed is sufficient
+    // Only the reader thread can write tail (see sc_audiobuf_write_overwrite()
+    // for the exception), so memory_order_relaxed is sufficient
     uint32_t tail = atomic_load_explicit(&buf->tail, memory_order_relaxed);
 
     // The head cursor is updated after the data is written to the array
     uint32_t head = atomic_load_explicit(&buf->head, memory_order_acquire);
 
-    uint32_t can_read = (buf->alloc_size + head - tail) % buf->alloc_size;
-    if (!can_read) {
-        return 0;
-    }
-    if (samples_count > can_read) {
-        samples_count = can_read;
-    }
+    uint32_t can_read = sc_audiobuf_wrap(buf, buf->alloc_size + head - tail);
+
+    // Skip the samples the writer requested to drop (if they are not written
+    // yet, they will be skipped by the next reads)
+    uint32_t drop = atomic_load_explicit(&buf->drop, memory_order_relaxed);
+    uint32_t dropped = MIN(drop, can_read);
+    tail = sc_audiobuf_wrap(buf, tail + dropped);
+    can_read -= dropped;
 
-    if (to) {
+    uint32_t count = MIN(samples_count, can_read);
+
+    if (to && buf->mirror_size) {
+        // Contiguous, even across the end of the buffer
+        memcpy(to,
+               buf->data + (tail * buf->sample_size),
+               count * buf->sample_size);
+    } else if (to) {
         uint32_t right_count = buf->alloc_size - tail;
-        if (right_count > samples_count) {
-            right_count = samples_count;
+        if (right_count > count) {
+            right_count = count;
         }
         memcpy(to,
                buf->data + (tail * buf->sample_size),
                right_count * buf->sample_size);
 
-        if (samples_count > right_count) {
-            uint32_t left_count = samples_count - right_count;
+        if (count > right_count) {
+            uint32_t left_count = count - right_count;
             memcpy(to + (right_count * buf->sample_size),
                    buf->data,
                    left_count * buf->sample_size);
         }
     }
 
-    uint32_t new_tail = (tail + samples_count) % buf->alloc_size;
-    atomic_store_explicit(&buf->tail, new_tail, memory_order_release);
+    if (count || dropped) {
+        uint32_t new_tail = sc_audiobuf_wrap(buf, tail + count);
+        atomic_store_explicit(&buf->tail, new_tail, memory_order_release);
+    }
 
-    return samples_count;
+    if (dropped) {
+        // After the tail update (see sc_audiobuf_can_read())
+        atomic_fetch_sub_explicit(&buf->drop, dropped, memory_order_release);
+    }
+
+    return count;
 }
 
 uint32_t
@@ -88,7 +205,8 @@ sc_audiobuf_write(struct sc_audiobuf *buf, const void *from_,
     // The tail cursor is updated after the data is consumed by the reader
     uint32_t tail = atomic_load_explicit(&buf->tail, memory_order_acquire);
 
-    uint32_t can_write = (buf->alloc_size + tail - head - 1) % buf->alloc_size;
+    uint32_t can_write =
+        sc_audiobuf_wrap(buf, buf->alloc_size + tail - head - 1);
     if (!can_write) {
         return 0;
     }
@@ -96,27 +214,71 @@ sc_audiobuf_write(struct sc_audiobuf *buf, const void *from_,
         samples_count = can_write;
     }
 
-    uint32_t right_count = buf->alloc_size - head;
-    if (right_count > samples_count) {
-        right_count = samples_count;
-    }
-    memcpy(buf->data + (head * buf->sample_size),
-           from,
-           right_count * buf->sample_size);
+    if (buf->mirror_size) {
+        // Contiguous, even across the end of the buffer
+        memcpy(buf->data + (head * buf->sample_size),
+               from,
+               samples_count * buf->sample_size);
+    } else {
+        uint32_t right_count = buf->alloc_size - head;
+        if (right_count > samples_count) {
+            right_count = samples_count;
+        }
+        memcpy(buf->data + (head * buf->sample_size),
+               from,
+               right_count * buf->sample_size);
 
-    if (samples_count > right_count) {
-        uint32_t left_count = samples_count - right_count;
-        memcpy(buf->data,
-               from + (right_count * buf->sample_size),
-               left_count * buf->sample_size);
+        if (samples_count > right_count) {
+            uint32_t left_count = samples_count - right_count;
+            memcpy(buf->data,
+                   from + (right_count * buf->sample_size),
+                   left_count * buf->sample_size);
+        }
     }
 
-    uint32_t new_head = (head + samples_count) % buf->alloc_size;
+    uint32_t new_head = sc_audiobuf_wrap(buf, head + samples_count);
     atomic_store_explicit(&buf->head, new_head, memory_order_release);
 
     return samples_count;
 }
 
+void
+sc_audiobuf_drop(struct sc_audiobuf *buf, uint32_t samples) {
+    assert(samples <= sc_audiobuf_can_read(buf));
+
+    // The writer never advances the tail cursor itself, so the reader never
+    // copies samples being overwritten
+    atomic_fetch_add_explicit(&buf->drop, samples, memory_order_relaxed);
+}
+
+uint32_t
+sc_audiobuf_write_overwrite(struct sc_audiobuf *buf, const void *from,
+                            uint32_t samples_count) {
+    assert(samples_count <= sc_audiobuf_capacity(buf));
+
+    // The reader does not run concurrently, so the relaxed loads and stores
+    // are sufficient
+    uint32_t head = atomic_load_explicit(&buf->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&buf->tail, memory_order_relaxed);
+
+    uint32_t can_write =
+        sc_audiobuf_wrap(buf, buf->alloc_size + tail - head - 1);
+
+    uint32_t dropped = 0;
+    if (samples_count > can_write) {
+        // Drop the oldest samples to make space
+        dropped = samples_count - can_write;
+        uint32_t new_tail = sc_audiobuf_wrap(buf, tail + dropped);
+        atomic_store_explicit(&buf->tail, new_tail, memory_order_relaxed);
+    }
+
+    uint32_t written = sc_audiobuf_write(buf, from, samples_count);
+    assert(written == samples_count);
+    (void) written;
+
+    return dropped;
+}
+
 uint32_t
 sc_audiobuf_write_silence(struct sc_audiobuf *buf, uint32_t samples_count) {
     // Only the writer thread can write head, so memory_order_relaxed is
@@ -126,7 +288,8 @@ sc_audiobuf_write_silence(struct sc_audiobuf *buf, uint32_t samples_count) {
     // The tail cursor is updated after the data is consumed by the reader
     uint32_t tail = atomic_load_explicit(&buf->tail, memory_order_acquire);
 
-    uint32_t can_write = (buf->alloc_size + tail - head - 1) % buf->alloc_size;
+    uint32_t can_write =
+        sc_audiobuf_wrap(buf, buf->alloc_size + tail - head - 1);
     if (!can_write) {
         return 0;
     }
@@ -134,19 +297,24 @@ sc_audiobuf_write_silence(struct sc_audiobuf *buf, uint32_t samples_count) {
         samples_count = can_write;
     }
 
-    uint32_t right_count = buf->alloc_size - head;
-    if (right_count > samples_count) {
-        right_count = samples_count;
-    }
-    memset(buf->data + (head * buf->sample_size), 0,
-           right_count * buf->sample_size);
+    if (buf->mirror_size) {
+        memset(buf->data + (head * buf->sample_size), 0,
+               samples_count * buf->sample_size);
+    } else {
+        uint32_t right_count = buf->alloc_size - head;
+        if (right_count > samples_count) {
+            right_count = samples_count;
+        }
+        memset(buf->data + (head * buf->sample_size), 0,
+               right_count * buf->sample_size);
 
-    if (samples_count > right_count) {
-        uint32_t left_count = samples_count - right_count;
-        memset(buf->data, 0, left_count * buf->sample_size);
+        if (samples_count > right_count) {
+            uint32_t left_count = samples_count - right_count;
+            memset(buf->data, 0, left_count * buf->sample_size);
+        }
     }
 
-    uint32_t new_head = (head + samples_count) % buf->alloc_size;
+    uint32_t new_head = sc_audiobuf_wrap(buf, head + samples_count);
     atomic_store_explicit(&buf->head, new_head, memory_order_release);
 
     return samples_count;
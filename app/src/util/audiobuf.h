@@ -13,14 +13,33 @@
  * Wrapper around bytebuf to read and write samples
  *
  * Each sample takes sample_size bytes.
+ *
+ * There is a single writer thread and a single reader thread, and neither side
+ * ever blocks. Only the writer advances the head cursor, and only the reader
+ * advances the tail cursor: a range of samples is never written while it is
+ * read.
+ *
+ * To drop the oldest samples (e.g. to limit the latency), the writer requests
+ * the reader to skip them on its next reads (see sc_audiobuf_drop()).
+ *
+ * If initialized by sc_audiobuf_init_mirror() (on Linux), the same memory
+ * pages are mapped twice, back to back: the samples after the end of the
+ * buffer are the samples at its beginning, so that any range of samples
+ * (starting in the first mapping) is contiguous in memory. Reads and writes
+ * are then a single copy, without splitting at the wrap-around point.
  */
 struct sc_audiobuf {
     uint8_t *data;
     uint32_t alloc_size; // in samples
     size_t sample_size;
+    // If non-zero, data is mapped twice (mirror_size bytes each)
+    size_t mirror_size;
 
     atomic_uint_least32_t head; // writer cursor, in samples
     atomic_uint_least32_t tail; // reader cursor, in samples
+    // Number of samples to skip, requested by the writer and applied (then
+    // subtracted) by the reader
+    atomic_uint_least32_t drop;
     // empty: tail == head
     // full: ((tail + 1) % alloc_size) == head
 };
@@ -40,6 +59,18 @@ bool
 sc_audiobuf_init(struct sc_audiobuf *buf, size_t sample_size,
                  uint32_t capacity);
 
+/**
+ * Initialize a buffer backed by a mirrored mapping if possible
+ *
+ * The capacity is rounded up so that the buffer size is a multiple of the
+ * page size (so sc_audiobuf_capacity() may be greater than requested).
+ *
+ * If the mirrored mapping is not supported, fallback to sc_audiobuf_init().
+ */
+bool
+sc_audiobuf_init_mirror(struct sc_audiobuf *buf, size_t sample_size,
+                        uint32_t capacity);
+
 void
 sc_audiobuf_destroy(struct sc_audiobuf *buf);
 
@@ -50,6 +81,33 @@ uint32_t
 sc_audiobuf_write(struct sc_audiobuf *buf, const void *from,
                   uint32_t samples_count);
 
+/**
+ * Request the reader to drop the `samples` oldest samples
+ *
+ * Must only be called from the writer thread, with samples not greater than
+ * sc_audiobuf_can_read().
+ *
+ * The samples are skipped by the next reads, so they may not be the ones
+ * buffered at the time of the call if the reader consumes them concurrently,
+ * but exactly `samples` samples are dropped (possibly some of the next
+ * written samples).
+ */
+void
+sc_audiobuf_drop(struct sc_audiobuf *buf, uint32_t samples);
+
+/**
+ * Write samples, dropping the oldest ones if there is not enough space
+ *
+ * This advances the tail cursor from the writer thread, so it must not be
+ * called concurrently with sc_audiobuf_read() (the caller must synchronize
+ * both sides). samples_count must not be greater than the capacity.
+ *
+ * Return the number of samples dropped.
+ */
+uint32_t
+sc_audiobuf_write_overwrite(struct sc_audiobuf *buf, const void *from,
+                            uint32_t samples_count);
+
 uint32_t
 sc_audiobuf_write_silence(struct sc_audiobuf *buf, uint32_t samples);
 
@@ -59,11 +117,27 @@ sc_audiobuf_capacity(struct sc_audiobuf *buf) {
     return buf->alloc_size - 1;
 }
 
+// Equivalent to (index % alloc_size) for any index lower than 2 * alloc_size,
+// without division
+static inline uint32_t
+sc_audiobuf_wrap(struct sc_audiobuf *buf, uint32_t index) {
+    assert(index < 2 * buf->alloc_size);
+    return index >= buf->alloc_size ? index - buf->alloc_size : index;
+}
+
+/**
+ * Return the number of samples which can be read (excluding the samples to
+ * drop)
+ */
 static inline uint32_t
 sc_audiobuf_can_read(struct sc_audiobuf *buf) {
+    // The reader advances the tail before decrementing drop: load drop first,
+    // so that the result is never over-estimated
+    uint32_t drop = atomic_load_explicit(&buf->drop, memory_order_acquire);
     uint32_t head = atomic_load_explicit(&buf->head, memory_order_acquire);
     uint32_t tail = atomic_load_explicit(&buf->tail, memory_order_acquire);
-    return (buf->alloc_size + head - tail) % buf->alloc_size;
+    uint32_t can_read = sc_audiobuf_wrap(buf, buf->alloc_size + head - tail);
+    return can_read > drop ? can_read - drop : 0;
 }
 
 #endif
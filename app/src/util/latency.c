@@ -0,0 +1,52 @@
+#include "latency.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+void
+sc_latency_init(struct sc_latency *latency) {
+    latency->count = 0;
+    latency->sum = 0;
+    latency->max = 0;
+}
+
+void
+sc_latency_push(struct sc_latency *latency, sc_tick value) {
+    latency->values[latency->count % SC_LATENCY_WINDOW] = value;
+    ++latency->count;
+    latency->sum += value;
+    if (value > latency->max) {
+        latency->max = value;
+    }
+}
+
+sc_tick
+sc_latency_get_avg(const struct sc_latency *latency) {
+    assert(latency->count);
+    return latency->sum / (sc_tick) latency->count;
+}
+
+static int
+compare_ticks(const void *a, const void *b) {
+    sc_tick ta = *(const sc_tick *) a;
+    sc_tick tb = *(const sc_tick *) b;
+    return (ta > tb) - (ta < tb);
+}
+
+sc_tick
+sc_latency_get_percentile(const struct sc_latency *latency, unsigned percent) {
+    assert(latency->count);
+    assert(percent <= 100);
+
+    size_t count = latency->count < SC_LATENCY_WINDOW ? latency->count
+                                                      : SC_LATENCY_WINDOW;
+
+    sc_tick sorted[SC_LATENCY_WINDOW];
+    memcpy(sorted, latency->values, count * sizeof(*sorted));
+    qsort(sorted, count, sizeof(*sorted), compare_ticks);
+
+    // nearest-rank method
+    size_t rank = (count * percent + 99) / 100;
+    return sorted[rank ? rank - 1 : 0];
+}
@@ -0,0 +1,50 @@
+#ifndef SC_LATENCY_H
+#define SC_LATENCY_H
+
+#include "common.h"
+
+#include <stdint.h>
+
+#include "util/tick.h"
+
+// Number of most recent values used to compute the percentiles
+#define SC_LATENCY_WINDOW 256
+
+/**
+ * Latency statistics
+ *
+ * The average and max are computed over all the values pushed, the percentiles
+ * over the SC_LATENCY_WINDOW most recent ones.
+ */
+struct sc_latency {
+    sc_tick values[SC_LATENCY_WINDOW]; // circular buffer
+    uint64_t count; // total number of values pushed
+    sc_tick sum;
+    sc_tick max;
+};
+
+void
+sc_latency_init(struct sc_latency *latency);
+
+void
+sc_latency_push(struct sc_latency *latency, sc_tick value);
+
+/**
+ * Get the average value
+ *
+ * It is an error to call this function if sc_latency_push() has not been
+ * called at least once.
+ */
+sc_tick
+sc_latency_get_avg(const struct sc_latency *latency);
+
+/**
+ * Get the given percentile (in [0; 100]) of the most recent values
+ *
+ * It is an error to call this function if sc_latency_push() has not been
+ * called at least once.
+ */
+sc_tick
+sc_latency_get_percentile(const struct sc_latency *latency, unsigned percent);
+
+#endif
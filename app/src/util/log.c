@@ -9,6 +9,9 @@
 #include <stdlib.h>
 #include <libavutil/log.h>
 
+// Set when stdout is reserved for another usage (e.g. recording to stdout)
+static bool sc_log_stdout_reserved;
+
 static SDL_LogPriority
 log_level_sc_to_sdl(enum sc_log_level level) {
     switch (level) {
@@ -143,14 +146,16 @@ sc_sdl_log_print(void *userdata, int category, SDL_LogPriority priority,
     (void) userdata;
     (void) category;
 
-    FILE *out = priority < SDL_LOG_PRIORITY_WARN ? stdout : stderr;
+    FILE *out = priority < SDL_LOG_PRIORITY_WARN && !sc_log_stdout_reserved
+              ? stdout : stderr;
     assert(priority < SDL_NUM_LOG_PRIORITIES);
     const char *prio_name = sc_sdl_log_priority_names[priority];
     fprintf(out, "%s: %s\n", prio_name, message);
 }
 
 void
-sc_log_configure(void) {
+sc_log_configure(bool stdout_reserved) {
+    sc_log_stdout_reserved = stdout_reserved;
     SDL_LogSetOutputFunction(sc_sdl_log_print, NULL);
     // Redirect FFmpeg logs to SDL logs
     av_log_set_callback(sc_av_log_callback);
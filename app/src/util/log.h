@@ -35,7 +35,13 @@ bool
 sc_log_windows_error(const char *prefix, int error);
 #endif
 
+/**
+ * Configure the log output
+ *
+ * If stdout_reserved is true (e.g. when recording to stdout), all logs are
+ * written to stderr, so that they do not corrupt the stdout content.
+ */
 void
-sc_log_configure(void);
+sc_log_configure(bool stdout_reserved);
 
 #endif
@@ -378,4 +378,32 @@ sc_vecdeque_growsize_(size_t value)
 #define sc_vecdeque_pop(pv) \
     (*sc_vecdeque_popref(pv))
 
+/**
+ * Return a pointer to the item at index `i` (0 is the front), without removing
+ * it
+ *
+ * It is an error to call this function if `i` is not lower than the size.
+ */
+#define sc_vecdeque_getref(pv, i) \
+({ \
+    assert((size_t) (i) < (pv)->size); \
+    &(pv)->data[((pv)->origin + (i)) % (pv)->cap]; \
+})
+
+/**
+ * Return the item at index `i` (0 is the front), without removing it
+ *
+ * It is an error to call this function if `i` is not lower than the size.
+ */
+#define sc_vecdeque_get(pv, i) \
+    (*sc_vecdeque_getref(pv, i))
+
+/**
+ * Return the item at the front, without removing it
+ *
+ * It is an error to call this function if the VecDeque is empty.
+ */
+#define sc_vecdeque_peek(pv) \
+    sc_vecdeque_get(pv, 0)
+
 #endif
@@ -0,0 +1,347 @@
+#include "v4l2_output.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixfmt.h>
+
+#include "util/log.h"
+
+static int
+sc_v4l2_ioctl(int fd, unsigned long request, void *arg) {
+    int r;
+    do {
+        r = ioctl(fd, request, arg);
+    } while (r == -1 && errno == EINTR);
+    return r;
+}
+
+static bool
+sc_v4l2_output_set_format(struct sc_v4l2_output *out, uint32_t width,
+                          uint32_t height, uint32_t pixelformat) {
+    struct v4l2_format fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    fmt.fmt.pix.width = width;
+    fmt.fmt.pix.height = height;
+    fmt.fmt.pix.pixelformat = pixelformat;
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+    fmt.fmt.pix.colorspace = V4L2_COLORSPACE_REC709;
+
+    if (sc_v4l2_ioctl(out->fd, VIDIOC_S_FMT, &fmt) == -1) {
+        LOGD("v4l2: VIDIOC_S_FMT failed: %s", strerror(errno));
+        return false;
+    }
+
+    if (fmt.fmt.pix.width != width || fmt.fmt.pix.height != height
+            || fmt.fmt.pix.pixelformat != pixelformat) {
+        LOGD("v4l2: format not accepted by the device");
+        return false;
+    }
+
+    out->width = width;
+    out->height = height;
+    out->pixelformat = pixelformat;
+    out->sizeimage = fmt.fmt.pix.sizeimage;
+
+    // The driver may pad the lines
+    uint32_t bpl = fmt.fmt.pix.bytesperline;
+    size_t chroma_h = (height + 1) / 2;
+    size_t size;
+    switch (pixelformat) {
+        case V4L2_PIX_FMT_YUV420:
+            if (!bpl) {
+                bpl = width;
+            }
+            out->plane_count = 3;
+            out->plane_linesizes[0] = bpl;
+            out->plane_linesizes[1] = bpl / 2;
+            out->plane_linesizes[2] = bpl / 2;
+            out->plane_offsets[0] = 0;
+            out->plane_offsets[1] = (size_t) bpl * height;
+            out->plane_offsets[2] = out->plane_offsets[1]
+                                  + (size_t) (bpl / 2) * chroma_h;
+            size = out->plane_offsets[2] + (size_t) (bpl / 2) * chroma_h;
+            break;
+        case V4L2_PIX_FMT_NV12:
+            if (!bpl) {
+                bpl = width;
+            }
+            out->plane_count = 2;
+            out->plane_linesizes[0] = bpl;
+            out->plane_linesizes[1] = bpl;
+            out->plane_offsets[0] = 0;
+            out->plane_offsets[1] = (size_t) bpl * height;
+            size = out->plane_offsets[1] + (size_t) bpl * chroma_h;
+            break;
+        default:
+            assert(pixelformat == V4L2_PIX_FMT_YUYV);
+            if (!bpl) {
+                bpl = width * 2;
+            }
+            out->plane_count = 1;
+            out->plane_linesizes[0] = bpl;
+            out->plane_offsets[0] = 0;
+            size = (size_t) bpl * height;
+            break;
+    }
+
+    if (size > out->sizeimage) {
+        LOGD("v4l2: unexpected image size: %" PRIu32, out->sizeimage);
+        return false;
+    }
+
+    return true;
+}
+
+int
+sc_v4l2_output_get_pix_fmt(uint32_t pixelformat) {
+    switch (pixelformat) {
+        case V4L2_PIX_FMT_YUV420:
+            return AV_PIX_FMT_YUV420P;
+        case V4L2_PIX_FMT_NV12:
+            return AV_PIX_FMT_NV12;
+        case V4L2_PIX_FMT_YUYV:
+            return AV_PIX_FMT_YUYV422;
+        default:
+            assert(!"Unsupported v4l2 pixelformat");
+            return AV_PIX_FMT_NONE;
+    }
+}
+
+static void
+sc_v4l2_output_unmap_buffers(struct sc_v4l2_output *out) {
+    for (unsigned i = 0; i < out->buffer_count; ++i) {
+        munmap(out->buffers[i].data, out->buffers[i].length);
+    }
+    out->buffer_count = 0;
+}
+
+static bool
+sc_v4l2_output_map_buffers(struct sc_v4l2_output *out) {
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = SC_V4L2_OUTPUT_BUFFER_COUNT;
+    req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    req.memory = V4L2_MEMORY_MMAP;
+
+    if (sc_v4l2_ioctl(out->fd, VIDIOC_REQBUFS, &req) == -1) {
+        LOGD("v4l2: VIDIOC_REQBUFS failed: %s", strerror(errno));
+        return false;
+    }
+
+    if (!req.count) {
+        LOGD("v4l2: no buffer allocated by the device");
+        return false;
+    }
+
+    // The driver may allocate fewer or more buffers than requested
+    unsigned count = MIN(req.count, SC_V4L2_OUTPUT_BUFFER_COUNT);
+
+    out->buffer_count = 0;
+    for (unsigned i = 0; i < count; ++i) {
+        struct v4l2_buffer buf;
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+
+        if (sc_v4l2_ioctl(out->fd, VIDIOC_QUERYBUF, &buf) == -1) {
+            LOGD("v4l2: VIDIOC_QUERYBUF failed: %s", strerror(errno));
+            goto error;
+        }
+
+        void *data = mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, out->fd, buf.m.offset);
+        if (data == MAP_FAILED) {
+            LOGD("v4l2: mmap failed: %s", strerror(errno));
+            goto error;
+        }
+
+        out->buffers[i].data = data;
+        out->buffers[i].length = buf.length;
+        ++out->buffer_count;
+    }
+
+    return true;
+
+error:
+    sc_v4l2_output_unmap_buffers(out);
+    return false;
+}
+
+bool
+sc_v4l2_output_open(struct sc_v4l2_output *out, const char *device,
+                    uint32_t width, uint32_t height, uint32_t pixelformat) {
+    assert(pixelformat == V4L2_PIX_FMT_YUV420
+            || pixelformat == V4L2_PIX_FMT_NV12
+            || pixelformat == V4L2_PIX_FMT_YUYV);
+
+    // Non-blocking, so that VIDIOC_DQBUF never waits for the consumer
+    out->fd = open(device, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (out->fd == -1) {
+        LOGE("Could not open v4l2 device %s: %s", device, strerror(errno));
+        return false;
+    }
+
+    struct v4l2_capability cap;
+    memset(&cap, 0, sizeof(cap));
+    if (sc_v4l2_ioctl(out->fd, VIDIOC_QUERYCAP, &cap) == -1) {
+        LOGD("v4l2: VIDIOC_QUERYCAP failed: %s", strerror(errno));
+        goto error_close;
+    }
+
+    uint32_t caps = cap.capabilities & V4L2_CAP_DEVICE_CAPS ? cap.device_caps
+                                                            : cap.capabilities;
+    if (!(caps & V4L2_CAP_VIDEO_OUTPUT) || !(caps & V4L2_CAP_STREAMING)) {
+        LOGD("v4l2: %s does not support streaming video output", device);
+        goto error_close;
+    }
+
+    if (!sc_v4l2_output_set_format(out, width, height, pixelformat)) {
+        goto error_close;
+    }
+
+    if (!sc_v4l2_output_map_buffers(out)) {
+        goto error_close;
+    }
+
+    out->buffers_used = 0;
+    out->streaming = false;
+
+    return true;
+
+error_close:
+    close(out->fd);
+    return false;
+}
+
+void
+sc_v4l2_output_close(struct sc_v4l2_output *out) {
+    if (out->streaming) {
+        int type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        if (sc_v4l2_ioctl(out->fd, VIDIOC_STREAMOFF, &type) == -1) {
+            LOGW("v4l2: VIDIOC_STREAMOFF failed: %s", strerror(errno));
+        }
+    }
+
+    sc_v4l2_output_unmap_buffers(out);
+
+    // Release the buffers
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = 0;
+    req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    req.memory = V4L2_MEMORY_MMAP;
+    sc_v4l2_ioctl(out->fd, VIDIOC_REQBUFS, &req);
+
+    close(out->fd);
+}
+
+enum sc_v4l2_output_result
+sc_v4l2_output_dequeue(struct sc_v4l2_output *out,
+                       struct sc_v4l2_output_image *image) {
+    unsigned index;
+    if (out->buffers_used < out->buffer_count) {
+        // This buffer has never been queued
+        index = out->buffers_used++;
+    } else {
+        struct v4l2_buffer buf;
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        buf.memory = V4L2_MEMORY_MMAP;
+
+        if (sc_v4l2_ioctl(out->fd, VIDIOC_DQBUF, &buf) == -1) {
+            if (errno == EAGAIN) {
+                // All the buffers are still used by the consumer
+                return SC_V4L2_OUTPUT_RESULT_DROPPED;
+            }
+            LOGE("v4l2: VIDIOC_DQBUF failed: %s", strerror(errno));
+            return SC_V4L2_OUTPUT_RESULT_ERROR;
+        }
+
+        assert(buf.index < out->buffer_count);
+        index = buf.index;
+    }
+
+    uint8_t *data = out->buffers[index].data;
+    image->index = index;
+    for (unsigned i = 0; i < SC_V4L2_OUTPUT_MAX_PLANES; ++i) {
+        if (i < out->plane_count) {
+            image->data[i] = data + out->plane_offsets[i];
+            image->linesize[i] = out->plane_linesizes[i];
+        } else {
+            image->data[i] = NULL;
+            image->linesize[i] = 0;
+        }
+    }
+
+    return SC_V4L2_OUTPUT_RESULT_OK;
+}
+
+bool
+sc_v4l2_output_queue(struct sc_v4l2_output *out,
+                     const struct sc_v4l2_output_image *image, int64_t pts) {
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = image->index;
+    buf.bytesused = out->sizeimage;
+    buf.field = V4L2_FIELD_NONE;
+    if (pts >= 0) {
+        // in microseconds
+        buf.timestamp.tv_sec = pts / 1000000;
+        buf.timestamp.tv_usec = pts % 1000000;
+    }
+
+    if (sc_v4l2_ioctl(out->fd, VIDIOC_QBUF, &buf) == -1) {
+        LOGE("v4l2: VIDIOC_QBUF failed: %s", strerror(errno));
+        return false;
+    }
+
+    if (!out->streaming) {
+        int type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        if (sc_v4l2_ioctl(out->fd, VIDIOC_STREAMON, &type) == -1) {
+            LOGE("v4l2: VIDIOC_STREAMON failed: %s", strerror(errno));
+            return false;
+        }
+        out->streaming = true;
+    }
+
+    return true;
+}
+
+enum sc_v4l2_output_result
+sc_v4l2_output_write(struct sc_v4l2_output *out, const AVFrame *frame) {
+    if ((uint32_t) frame->width != out->width
+            || (uint32_t) frame->height != out->height) {
+        // The caller must scale the frame to the device format
+        LOGE("v4l2: unexpected frame size %dx%d", frame->width,
+             frame->height);
+        return SC_V4L2_OUTPUT_RESULT_ERROR;
+    }
+
+    assert(frame->format == sc_v4l2_output_get_pix_fmt(out->pixelformat));
+
+    struct sc_v4l2_output_image image;
+    enum sc_v4l2_output_result result = sc_v4l2_output_dequeue(out, &image);
+    if (result != SC_V4L2_OUTPUT_RESULT_OK) {
+        return result;
+    }
+
+    av_image_copy(image.data, image.linesize,
+                  (const uint8_t **) frame->data, frame->linesize,
+                  frame->format, frame->width, frame->height);
+
+    bool ok = sc_v4l2_output_queue(out, &image, frame->pts);
+    return ok ? SC_V4L2_OUTPUT_RESULT_OK : SC_V4L2_OUTPUT_RESULT_ERROR;
+}
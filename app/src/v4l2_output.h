@@ -0,0 +1,124 @@
+#ifndef SC_V4L2_OUTPUT_H
+#define SC_V4L2_OUTPUT_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// forward declarations
+typedef struct AVFrame AVFrame;
+
+#define SC_V4L2_OUTPUT_BUFFER_COUNT 4
+#define SC_V4L2_OUTPUT_MAX_PLANES 4 // as expected by av_image_copy()
+
+/**
+ * Native V4L2 video output device (typically a v4l2loopback device)
+ *
+ * The format is negotiated with VIDIOC_S_FMT, and frames are written into
+ * buffers allocated by the driver (VIDIOC_REQBUFS) and mapped into memory, so
+ * that each frame is copied exactly once, from the decoded planes to the
+ * queued buffer.
+ *
+ * The device is opened in non-blocking mode: if all the buffers are still
+ * queued (the consumer is too slow), the frame is dropped rather than blocking
+ * the caller.
+ */
+struct sc_v4l2_output {
+    int fd;
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelformat; // V4L2 fourcc
+    uint32_t sizeimage;
+
+    // Layout of the planes within a buffer, derived from the negotiated
+    // bytesperline (the driver may pad the lines)
+    unsigned plane_count;
+    size_t plane_offsets[SC_V4L2_OUTPUT_MAX_PLANES];
+    int plane_linesizes[SC_V4L2_OUTPUT_MAX_PLANES];
+
+    struct {
+        void *data;
+        size_t length;
+    } buffers[SC_V4L2_OUTPUT_BUFFER_COUNT];
+    unsigned buffer_count;
+    // number of buffers queued at least once (the next ones are available
+    // without dequeuing)
+    unsigned buffers_used;
+
+    bool streaming;
+};
+
+enum sc_v4l2_output_result {
+    SC_V4L2_OUTPUT_RESULT_OK,
+    // no buffer available, the frame must be dropped
+    SC_V4L2_OUTPUT_RESULT_DROPPED,
+    SC_V4L2_OUTPUT_RESULT_ERROR,
+};
+
+/**
+ * A buffer owned by the caller between sc_v4l2_output_dequeue() and
+ * sc_v4l2_output_queue()
+ */
+struct sc_v4l2_output_image {
+    unsigned index;
+    uint8_t *data[SC_V4L2_OUTPUT_MAX_PLANES];
+    int linesize[SC_V4L2_OUTPUT_MAX_PLANES];
+};
+
+/**
+ * Open the device and negotiate the format
+ *
+ * The supported formats are V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_NV12 and
+ * V4L2_PIX_FMT_YUYV.
+ */
+bool
+sc_v4l2_output_open(struct sc_v4l2_output *out, const char *device,
+                    uint32_t width, uint32_t height, uint32_t pixelformat);
+
+void
+sc_v4l2_output_close(struct sc_v4l2_output *out);
+
+/**
+ * Get the next available buffer, to be filled by the caller
+ *
+ * This allows to write the result of a conversion directly to the device
+ * memory.
+ *
+ * Never block: return SC_V4L2_OUTPUT_RESULT_DROPPED if no buffer is available
+ * yet.
+ */
+enum sc_v4l2_output_result
+sc_v4l2_output_dequeue(struct sc_v4l2_output *out,
+                       struct sc_v4l2_output_image *image);
+
+/**
+ * Queue a buffer filled by the caller
+ *
+ * The pts is in microseconds (it is ignored if negative).
+ */
+bool
+sc_v4l2_output_queue(struct sc_v4l2_output *out,
+                     const struct sc_v4l2_output_image *image, int64_t pts);
+
+/**
+ * Copy a frame into the next available buffer and queue it
+ *
+ * The frame must have the output size, and the pixel format corresponding to
+ * the output pixelformat.
+ *
+ * Return SC_V4L2_OUTPUT_RESULT_DROPPED if no buffer is available yet.
+ */
+enum sc_v4l2_output_result
+sc_v4l2_output_write(struct sc_v4l2_output *out, const AVFrame *frame);
+
+/**
+ * Return the FFmpeg pixel format (enum AVPixelFormat) corresponding to a
+ * supported V4L2 pixelformat
+ */
+int
+sc_v4l2_output_get_pix_fmt(uint32_t pixelformat);
+
+#endif
@@ -2,12 +2,17 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <linux/videodev2.h>
+#include <libavutil/pixdesc.h>
 
+#include "util/env.h"
 #include "util/log.h"
 #include "util/str.h"
+#include "util/tick.h"
 
 /** Downcast frame_sink to sc_v4l2_sink */
 #define DOWNCAST(SINK) container_of(SINK, struct sc_v4l2_sink, frame_sink)
@@ -111,6 +116,109 @@ encode_and_write_frame(struct sc_v4l2_sink *vs, const AVFrame *frame) {
     return true;
 }
 
+static bool
+alloc_converted_frame(struct sc_v4l2_sink *vs) {
+    vs->converted = av_frame_alloc();
+    if (!vs->converted) {
+        LOG_OOM();
+        return false;
+    }
+
+    vs->converted->format = vs->out_pix_fmt;
+    vs->converted->width = vs->out_width;
+    vs->converted->height = vs->out_height;
+    if (av_frame_get_buffer(vs->converted, 0) < 0) {
+        LOG_OOM();
+        av_frame_free(&vs->converted);
+        return false;
+    }
+
+    return true;
+}
+
+// A frame dropped by the native output (the consumer is too slow) is not an
+// error
+static bool
+handle_native_result(struct sc_v4l2_sink *vs,
+                     enum sc_v4l2_output_result result) {
+    if (result == SC_V4L2_OUTPUT_RESULT_DROPPED) {
+        if (!vs->dropped_frames) {
+            LOGW("v4l2: consumer too slow, dropping frames");
+        }
+        ++vs->dropped_frames;
+        return true;
+    }
+
+    return result == SC_V4L2_OUTPUT_RESULT_OK;
+}
+
+static bool
+convert_and_write_frame(struct sc_v4l2_sink *vs, const AVFrame *frame) {
+    // The context is recreated only if the input size or format changes
+    vs->sws_ctx = sws_getCachedContext(vs->sws_ctx, frame->width,
+                                       frame->height, frame->format,
+                                       vs->out_width, vs->out_height,
+                                       vs->out_pix_fmt, SWS_BILINEAR,
+                                       NULL, NULL, NULL);
+    if (!vs->sws_ctx) {
+        LOGE("Could not initialize v4l2 conversion context");
+        return false;
+    }
+
+    const uint8_t *const *src = (const uint8_t *const *) frame->data;
+
+    if (vs->native) {
+        // Convert directly into the device buffer
+        struct sc_v4l2_output_image image;
+        enum sc_v4l2_output_result result =
+            sc_v4l2_output_dequeue(&vs->output, &image);
+        if (result != SC_V4L2_OUTPUT_RESULT_OK) {
+            // Do not even convert the frame
+            return handle_native_result(vs, result);
+        }
+
+        sws_scale(vs->sws_ctx, src, frame->linesize, 0, frame->height,
+                  image.data, image.linesize);
+
+        return sc_v4l2_output_queue(&vs->output, &image, frame->pts);
+    }
+
+    if (!vs->converted && !alloc_converted_frame(vs)) {
+        return false;
+    }
+
+    // The previous frame may still be referenced by the encoder
+    if (av_frame_make_writable(vs->converted) < 0) {
+        LOG_OOM();
+        return false;
+    }
+
+    sws_scale(vs->sws_ctx, src, frame->linesize, 0, frame->height,
+              vs->converted->data, vs->converted->linesize);
+    vs->converted->pts = frame->pts;
+
+    return encode_and_write_frame(vs, vs->converted);
+}
+
+static bool
+write_frame(struct sc_v4l2_sink *vs, const AVFrame *frame) {
+    // The device format is negotiated once on open, so if the frame size
+    // changes (e.g. on device rotation), the frames are scaled to the initial
+    // size
+    if (vs->convert || frame->width != vs->out_width
+                    || frame->height != vs->out_height) {
+        return convert_and_write_frame(vs, frame);
+    }
+
+    if (vs->native) {
+        enum sc_v4l2_output_result result =
+            sc_v4l2_output_write(&vs->output, frame);
+        return handle_native_result(vs, result);
+    }
+
+    return encode_and_write_frame(vs, frame);
+}
+
 static int
 run_v4l2_sink(void *data) {
     struct sc_v4l2_sink *vs = data;
@@ -132,7 +240,9 @@ run_v4l2_sink(void *data) {
 
         sc_frame_buffer_consume(&vs->fb, vs->frame);
 
-        bool ok = encode_and_write_frame(vs, vs->frame);
+        sc_tick start = sc_tick_now();
+        bool ok = write_frame(vs, vs->frame);
+        sc_average_push(&vs->frame_cost, SC_TICK_TO_US(sc_tick_now() - start));
         av_frame_unref(vs->frame);
         if (!ok) {
             LOGE("Could not send frame to v4l2 sink");
@@ -146,25 +256,22 @@ run_v4l2_sink(void *data) {
 }
 
 static bool
-sc_v4l2_sink_open(struct sc_v4l2_sink *vs, const AVCodecContext *ctx) {
-    assert(ctx->pix_fmt == AV_PIX_FMT_YUV420P);
-    (void) ctx;
-
-    bool ok = sc_frame_buffer_init(&vs->fb);
-    if (!ok) {
+sc_v4l2_sink_must_use_libavdevice(void) {
+    // Allow to force the libavdevice implementation (e.g. to compare
+    // performance)
+    char *value = sc_get_env("SCRCPY_V4L2_LIBAVDEVICE");
+    if (!value) {
         return false;
     }
 
-    ok = sc_mutex_init(&vs->mutex);
-    if (!ok) {
-        goto error_frame_buffer_destroy;
-    }
-
-    ok = sc_cond_init(&vs->cond);
-    if (!ok) {
-        goto error_mutex_destroy;
-    }
+    bool ret = value[0] && strcmp(value, "0");
+    free(value);
+    return ret;
+}
 
+static bool
+sc_v4l2_sink_open_libavdevice(struct sc_v4l2_sink *vs,
+                              const AVCodecContext *ctx) {
     const AVOutputFormat *format = find_muxer("v4l2");
     if (!format) {
         // Alternative name
@@ -172,7 +279,7 @@ sc_v4l2_sink_open(struct sc_v4l2_sink *vs, const AVCodecContext *ctx) {
     }
     if (!format) {
         LOGE("Could not find v4l2 muxer");
-        goto error_cond_destroy;
+        return false;
     }
 
     const AVCodec *encoder = avcodec_find_encoder(AV_CODEC_ID_RAWVIDEO);
@@ -216,6 +323,9 @@ sc_v4l2_sink_open(struct sc_v4l2_sink *vs, const AVCodecContext *ctx) {
 
     // The codec is from the v4l2 encoder, not from the decoder
     ostream->codecpar->codec_id = encoder->id;
+    ostream->codecpar->format = vs->out_pix_fmt;
+    ostream->codecpar->width = vs->out_width;
+    ostream->codecpar->height = vs->out_height;
 
     int ret = avio_open(&vs->format_ctx->pb, vs->device_name, AVIO_FLAG_WRITE);
     if (ret < 0) {
@@ -230,9 +340,9 @@ sc_v4l2_sink_open(struct sc_v4l2_sink *vs, const AVCodecContext *ctx) {
         goto error_avio_close;
     }
 
-    vs->encoder_ctx->width = ctx->width;
-    vs->encoder_ctx->height = ctx->height;
-    vs->encoder_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    vs->encoder_ctx->width = vs->out_width;
+    vs->encoder_ctx->height = vs->out_height;
+    vs->encoder_ctx->pix_fmt = vs->out_pix_fmt;
     vs->encoder_ctx->time_base.num = 1;
     vs->encoder_ctx->time_base.den = 1;
 
@@ -241,43 +351,135 @@ sc_v4l2_sink_open(struct sc_v4l2_sink *vs, const AVCodecContext *ctx) {
         goto error_avcodec_free_context;
     }
 
-    vs->frame = av_frame_alloc();
-    if (!vs->frame) {
+    vs->packet = av_packet_alloc();
+    if (!vs->packet) {
         LOG_OOM();
         goto error_avcodec_free_context;
     }
 
-    vs->packet = av_packet_alloc();
-    if (!vs->packet) {
+    // If not converted from the start, the frame is allocated on the first
+    // frame size change
+    vs->converted = NULL;
+    if (vs->convert && !alloc_converted_frame(vs)) {
+        goto error_av_packet_free;
+    }
+
+    vs->header_written = false;
+
+    return true;
+
+error_av_packet_free:
+    av_packet_free(&vs->packet);
+error_avcodec_free_context:
+    avcodec_free_context(&vs->encoder_ctx);
+error_avio_close:
+    avio_close(vs->format_ctx->pb);
+error_avformat_free_context:
+    avformat_free_context(vs->format_ctx);
+
+    return false;
+}
+
+static void
+sc_v4l2_sink_close_libavdevice(struct sc_v4l2_sink *vs) {
+    av_frame_free(&vs->converted);
+    av_packet_free(&vs->packet);
+    avcodec_free_context(&vs->encoder_ctx);
+    avio_close(vs->format_ctx->pb);
+    avformat_free_context(vs->format_ctx);
+}
+
+static uint32_t
+sc_v4l2_sink_get_pixelformat(enum sc_v4l2_format format) {
+    switch (format) {
+        case SC_V4L2_FORMAT_NV12:
+            return V4L2_PIX_FMT_NV12;
+        case SC_V4L2_FORMAT_YUYV:
+            return V4L2_PIX_FMT_YUYV;
+        default:
+            assert(format == SC_V4L2_FORMAT_YUV420);
+            return V4L2_PIX_FMT_YUV420;
+    }
+}
+
+static bool
+sc_v4l2_sink_open(struct sc_v4l2_sink *vs, const AVCodecContext *ctx) {
+    assert(ctx->pix_fmt == AV_PIX_FMT_YUV420P);
+
+    uint32_t pixelformat = sc_v4l2_sink_get_pixelformat(vs->format);
+    vs->out_pix_fmt = sc_v4l2_output_get_pix_fmt(pixelformat);
+    vs->out_width = vs->width ? vs->width : ctx->width;
+    vs->out_height = vs->height ? vs->height : ctx->height;
+    vs->convert = vs->out_pix_fmt != ctx->pix_fmt
+               || vs->out_width != ctx->width
+               || vs->out_height != ctx->height;
+    vs->sws_ctx = NULL;
+
+    bool ok = sc_frame_buffer_init(&vs->fb);
+    if (!ok) {
+        return false;
+    }
+
+    ok = sc_mutex_init(&vs->mutex);
+    if (!ok) {
+        goto error_frame_buffer_destroy;
+    }
+
+    ok = sc_cond_init(&vs->cond);
+    if (!ok) {
+        goto error_mutex_destroy;
+    }
+
+    vs->native = false;
+    if (!sc_v4l2_sink_must_use_libavdevice()) {
+        vs->native = sc_v4l2_output_open(&vs->output, vs->device_name,
+                                         vs->out_width, vs->out_height,
+                                         pixelformat);
+        if (!vs->native) {
+            LOGW("Could not use native v4l2 output, fallback to libavdevice");
+        }
+    }
+
+    if (!vs->native) {
+        ok = sc_v4l2_sink_open_libavdevice(vs, ctx);
+        if (!ok) {
+            goto error_cond_destroy;
+        }
+    }
+
+    vs->frame = av_frame_alloc();
+    if (!vs->frame) {
         LOG_OOM();
-        goto error_av_frame_free;
+        goto error_close_output;
     }
 
+    sc_average_init(&vs->frame_cost, 32);
+    vs->dropped_frames = 0;
+
     vs->has_frame = false;
-    vs->header_written = false;
     vs->stopped = false;
 
     LOGD("Starting v4l2 thread");
     ok = sc_thread_create(&vs->thread, run_v4l2_sink, "scrcpy-v4l2", vs);
     if (!ok) {
         LOGE("Could not start v4l2 thread");
-        goto error_av_packet_free;
+        goto error_av_frame_free;
     }
 
-    LOGI("v4l2 sink started to device: %s", vs->device_name);
+    LOGI("v4l2 sink started to device: %s (%s, %dx%d %s)", vs->device_name,
+         vs->native ? "native" : "libavdevice", vs->out_width,
+         vs->out_height, av_get_pix_fmt_name(vs->out_pix_fmt));
 
     return true;
 
-error_av_packet_free:
-    av_packet_free(&vs->packet);
 error_av_frame_free:
     av_frame_free(&vs->frame);
-error_avcodec_free_context:
-    avcodec_free_context(&vs->encoder_ctx);
-error_avio_close:
-    avio_close(vs->format_ctx->pb);
-error_avformat_free_context:
-    avformat_free_context(vs->format_ctx);
+error_close_output:
+    if (vs->native) {
+        sc_v4l2_output_close(&vs->output);
+    } else {
+        sc_v4l2_sink_close_libavdevice(vs);
+    }
 error_cond_destroy:
     sc_cond_destroy(&vs->cond);
 error_mutex_destroy:
@@ -297,11 +499,22 @@ sc_v4l2_sink_close(struct sc_v4l2_sink *vs) {
 
     sc_thread_join(&vs->thread, NULL);
 
-    av_packet_free(&vs->packet);
+    if (vs->frame_cost.count) {
+        LOGD("v4l2: average frame write cost: %.1f us (%s)",
+             sc_average_get(&vs->frame_cost),
+             vs->native ? "native" : "libavdevice");
+    }
+    if (vs->dropped_frames) {
+        LOGD("v4l2: %" PRIu64 " frames dropped", vs->dropped_frames);
+    }
+
+    sws_freeContext(vs->sws_ctx);
     av_frame_free(&vs->frame);
-    avcodec_free_context(&vs->encoder_ctx);
-    avio_close(vs->format_ctx->pb);
-    avformat_free_context(vs->format_ctx);
+    if (vs->native) {
+        sc_v4l2_output_close(&vs->output);
+    } else {
+        sc_v4l2_sink_close_libavdevice(vs);
+    }
     sc_cond_destroy(&vs->cond);
     sc_mutex_destroy(&vs->mutex);
     sc_frame_buffer_destroy(&vs->fb);
@@ -344,13 +557,18 @@ sc_v4l2_frame_sink_push(struct sc_frame_sink *sink, const AVFrame *frame) {
 }
 
 bool
-sc_v4l2_sink_init(struct sc_v4l2_sink *vs, const char *device_name) {
+sc_v4l2_sink_init(struct sc_v4l2_sink *vs, const char *device_name,
+                  enum sc_v4l2_format format, uint16_t width, uint16_t height) {
     vs->device_name = strdup(device_name);
     if (!vs->device_name) {
         LOGE("Could not strdup v4l2 device name");
         return false;
     }
 
+    vs->format = format;
+    vs->width = width;
+    vs->height = height;
+
     static const struct sc_frame_sink_ops ops = {
         .open = sc_v4l2_frame_sink_open,
         .close = sc_v4l2_frame_sink_close,
@@ -6,18 +6,50 @@
 #include <stdbool.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
 
 #include "frame_buffer.h"
+#include "options.h"
 #include "trait/frame_sink.h"
+#include "util/average.h"
 #include "util/thread.h"
+#include "v4l2_output.h"
 
 struct sc_v4l2_sink {
     struct sc_frame_sink frame_sink; // frame sink trait
 
     struct sc_frame_buffer fb;
+
+    // requested output format and size (0 for the source size)
+    enum sc_v4l2_format format;
+    uint16_t width;
+    uint16_t height;
+
+    // actual output format and size
+    enum AVPixelFormat out_pix_fmt;
+    int out_width;
+    int out_height;
+
+    // If convert, the frames are converted (pixel format and/or size) by
+    // libswscale on the v4l2 thread. Frames are also scaled if their size
+    // changes after the device format has been set.
+    bool convert;
+    struct SwsContext *sws_ctx;
+    AVFrame *converted; // only used by the libavdevice backend (may be NULL)
+
+    // If native, frames are written directly to the device buffers.
+    // Otherwise (fallback), they are encoded to rawvideo packets and written
+    // via the libavdevice v4l2 muxer.
+    bool native;
+    struct sc_v4l2_output output;
     AVFormatContext *format_ctx;
     AVCodecContext *encoder_ctx;
 
+    // average CPU time to write one frame to the device, in microseconds
+    struct sc_average frame_cost;
+    // frames dropped by the native output (the consumer was too slow)
+    uint64_t dropped_frames;
+
     char *device_name;
 
     sc_thread thread;
@@ -32,7 +64,8 @@ struct sc_v4l2_sink {
 };
 
 bool
-sc_v4l2_sink_init(struct sc_v4l2_sink *vs, const char *device_name);
+sc_v4l2_sink_init(struct sc_v4l2_sink *vs, const char *device_name,
+                  enum sc_v4l2_format format, uint16_t width, uint16_t height);
 
 void
 sc_v4l2_sink_destroy(struct sc_v4l2_sink *vs);
@@ -2,6 +2,9 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,87 +13,67 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+# include <linux/sockios.h>
+#endif
 #include <libavutil/time.h>
 #include <libavutil/opt.h>
 #include <libavutil/base64.h>
 
 #include "util/log.h"
 #include "util/net.h"
+#include "websocket.h"
 
 /** Downcast frame_sink to sc_webrtc_streamer */
 #define DOWNCAST(SINK) container_of(SINK, struct sc_webrtc_streamer, frame_sink)
-
-// WebSocket协议相关常量
-#define WS_MAGIC_STRING "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
-#define WS_FRAME_OPCODE_TEXT 0x1
-#define WS_FRAME_OPCODE_BINARY 0x2
-#define WS_FRAME_OPCODE_CLOSE 0x8
-
-// JSON消息模板
-static const char *MESSAGE_TEMPLATE = 
+/** Downcast packet_sink to sc_webrtc_streamer */
+#define DOWNCAST_PACKET(SINK) \
+    container_of(SINK, struct sc_webrtc_streamer, packet_sink)
+
+// 发送队列的水位线：超过后丢弃非关键帧，直到下一个关键帧
+#define SC_WEBRTC_QUEUE_WATERMARK (512 * 1024)
+// poll()超时，以便检查停止信号
+#define SC_WEBRTC_POLL_TIMEOUT_MS 100
+#define SC_WEBRTC_STATS_INTERVAL SC_TICK_FROM_SEC(10)
+// 连接和WebSocket握手的超时
+#define SC_WEBRTC_CONNECT_TIMEOUT SC_TICK_FROM_SEC(5)
+// 重新连接的延迟（指数退避）
+#define SC_WEBRTC_RECONNECT_DELAY_MIN SC_TICK_FROM_MS(100)
+#define SC_WEBRTC_RECONNECT_DELAY_MAX SC_TICK_FROM_SEC(10)
+// 连接保持这么久之后，重新连接的延迟被重置
+#define SC_WEBRTC_RECONNECT_STABLE SC_TICK_FROM_SEC(10)
+// 未指定--video-bit-rate时重新编码的最大码率（与设备编码器的默认值相同），
+// 网络拥塞时分级降低
+#define SC_WEBRTC_DEFAULT_BIT_RATE 8000000
+// 帧率未知时（第一次打开编码器）假设的帧率
+#define SC_WEBRTC_DEFAULT_FPS 60
+#define SC_WEBRTC_MIN_FPS 10
+#define SC_WEBRTC_MAX_FPS 120
+#define SC_WEBRTC_FPS_INTERVAL SC_TICK_FROM_SEC(2)
+// 关键帧间隔（秒）
+#define SC_WEBRTC_GOP_DURATION_SEC 2
+
+// 帧的pts以微秒为单位
+static const AVRational SC_WEBRTC_TIME_BASE = {1, 1000000};
+
+#ifdef MSG_NOSIGNAL
+// 对端关闭连接时不触发SIGPIPE
+# define SC_WEBRTC_SEND_FLAGS MSG_NOSIGNAL
+#else
+# define SC_WEBRTC_SEND_FLAGS 0
+#endif
+
+// 流信息（JSON），在发送第一个包之前发送一次
+static const char *STREAM_INFO_TEMPLATE =
     "{"
-    "\"type\":\"video_frame\","
+    "\"type\":\"stream_info\","
     "\"user_id\":%u,"
-    "\"timestamp\":%lld,"
+    "\"codec\":\"%s\","
     "\"width\":%d,"
-    "\"height\":%d,"
-    "\"format\":\"%s\","
-    "\"data_size\":%zu"
+    "\"height\":%d"
     "}";
 
-static bool
-send_websocket_message(struct sc_webrtc_streamer *streamer, 
-                       const char *message, size_t length) {
-    if (!streamer->connected || streamer->websocket_fd < 0) {
-        return false;
-    }
-
-    // 构建WebSocket帧头
-    uint8_t frame_header[10];
-    size_t header_len = 0;
-    
-    // 第一个字节：FIN=1, RSV=000, Opcode=0001 (text frame)
-    frame_header[0] = 0x81;
-    
-    // 负载长度
-    if (length < 126) {
-        frame_header[1] = (uint8_t)length;
-        header_len = 2;
-    } else if (length < 65536) {
-        frame_header[1] = 126;
-        frame_header[2] = (length >> 8) & 0xFF;
-        frame_header[3] = length & 0xFF;
-        header_len = 4;
-    } else {
-        frame_header[1] = 127;
-        frame_header[2] = 0;
-        frame_header[3] = 0;
-        frame_header[4] = 0;
-        frame_header[5] = 0;
-        frame_header[6] = (length >> 24) & 0xFF;
-        frame_header[7] = (length >> 16) & 0xFF;
-        frame_header[8] = (length >> 8) & 0xFF;
-        frame_header[9] = length & 0xFF;
-        header_len = 10;
-    }
-
-    // 发送帧头
-    ssize_t written = send(streamer->websocket_fd, frame_header, header_len, 0);
-    if (written != (ssize_t)header_len) {
-        LOGE("Failed to send WebSocket frame header");
-        return false;
-    }
-
-    // 发送消息内容
-    written = send(streamer->websocket_fd, message, length, 0);
-    if (written != (ssize_t)length) {
-        LOGE("Failed to send WebSocket message content");
-        return false;
-    }
-
-    return true;
-}
-
 // 解析WebSocket URL
 static bool
 parse_websocket_url(const char *url, char **host, int *port, char **path) {
@@ -161,6 +144,190 @@ generate_websocket_key(char *key, size_t key_size) {
     key[24] = '\0';
 }
 
+static bool
+is_stopped(struct sc_webrtc_streamer *streamer) {
+    sc_mutex_lock(&streamer->mutex);
+    bool stopped = streamer->stopped;
+    sc_mutex_unlock(&streamer->mutex);
+    return stopped;
+}
+
+// 等待socket就绪，定期检查停止信号（停止或超时时返回false）
+static bool
+wait_socket(struct sc_webrtc_streamer *streamer, int fd, short events,
+            sc_tick deadline) {
+    for (;;) {
+        if (is_stopped(streamer)) {
+            return false;
+        }
+
+        if (sc_tick_now() >= deadline) {
+            LOGE("WebSocket connection timed out");
+            return false;
+        }
+
+        struct pollfd pfd = {
+            .fd = fd,
+            .events = events,
+        };
+        int r = poll(&pfd, 1, SC_WEBRTC_POLL_TIMEOUT_MS);
+        if (r == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("Failed to poll WebSocket: %s", strerror(errno));
+            return false;
+        }
+
+        if (r) {
+            // 包括错误（由下一次系统调用报告）
+            return true;
+        }
+    }
+}
+
+// 非阻塞连接到一个地址
+static int
+connect_address(struct sc_webrtc_streamer *streamer,
+                const struct addrinfo *ai, sc_tick deadline) {
+    int sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (sockfd < 0) {
+        LOGE("Failed to create socket: %s", strerror(errno));
+        return -1;
+    }
+
+    // 连接和握手都不阻塞，以便随时可以停止推流器
+    int flags = fcntl(sockfd, F_GETFL);
+    if (flags == -1 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        LOGE("Failed to set non-blocking socket: %s", strerror(errno));
+        close(sockfd);
+        return -1;
+    }
+
+    if (connect(sockfd, ai->ai_addr, ai->ai_addrlen) < 0) {
+        if (errno != EINPROGRESS) {
+            LOGE("Failed to connect to server: %s", strerror(errno));
+            close(sockfd);
+            return -1;
+        }
+
+        if (!wait_socket(streamer, sockfd, POLLOUT, deadline)) {
+            close(sockfd);
+            return -1;
+        }
+
+        int error;
+        socklen_t len = sizeof(error);
+        if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &len) < 0
+                || error) {
+            LOGE("Failed to connect to server: %s",
+                 strerror(error ? error : errno));
+            close(sockfd);
+            return -1;
+        }
+    }
+
+    return sockfd;
+}
+
+static int
+connect_host(struct sc_webrtc_streamer *streamer, const char *host, int port,
+             sc_tick deadline) {
+    char service[8];
+    snprintf(service, sizeof(service), "%d", port);
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *result;
+    // 注意：DNS解析本身无法中断（受系统解析器的超时限制）
+    int r = getaddrinfo(host, service, &hints, &result);
+    if (r) {
+        LOGE("Failed to resolve hostname %s: %s", host, gai_strerror(r));
+        return -1;
+    }
+
+    int sockfd = -1;
+    for (struct addrinfo *ai = result; ai; ai = ai->ai_next) {
+        sockfd = connect_address(streamer, ai, deadline);
+        if (sockfd >= 0 || is_stopped(streamer)) {
+            break;
+        }
+    }
+
+    freeaddrinfo(result);
+    return sockfd;
+}
+
+// 在非阻塞socket上发送全部数据
+static bool
+send_handshake(struct sc_webrtc_streamer *streamer, int sockfd,
+               const char *data, size_t len, sc_tick deadline) {
+    while (len) {
+        ssize_t w = send(sockfd, data, len, SC_WEBRTC_SEND_FLAGS);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOGE("Failed to send WebSocket upgrade request: %s",
+                     strerror(errno));
+                return false;
+            }
+            if (!wait_socket(streamer, sockfd, POLLOUT, deadline)) {
+                return false;
+            }
+            continue;
+        }
+        data += w;
+        len -= w;
+    }
+
+    return true;
+}
+
+// 接收HTTP响应头（直到空行）
+static bool
+recv_handshake(struct sc_webrtc_streamer *streamer, int sockfd,
+               char *response, size_t size, sc_tick deadline) {
+    size_t len = 0;
+    for (;;) {
+        if (len == size - 1) {
+            LOGE("WebSocket upgrade response too long");
+            return false;
+        }
+
+        ssize_t r = recv(sockfd, &response[len], size - 1 - len, 0);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOGE("Failed to receive WebSocket upgrade response: %s",
+                     strerror(errno));
+                return false;
+            }
+            if (!wait_socket(streamer, sockfd, POLLIN, deadline)) {
+                return false;
+            }
+            continue;
+        }
+
+        if (!r) {
+            LOGE("Failed to receive WebSocket upgrade response: "
+                 "connection closed");
+            return false;
+        }
+
+        len += r;
+        response[len] = '\0';
+        if (strstr(response, "\r\n\r\n")) {
+            return true;
+        }
+    }
+}
+
 static bool
 connect_websocket(struct sc_webrtc_streamer *streamer) {
     LOGI("Connecting to WebSocket: %s", streamer->websocket_url);
@@ -176,36 +343,13 @@ connect_websocket(struct sc_webrtc_streamer *streamer) {
     }
     
     LOGI("Parsed WebSocket URL - Host: %s, Port: %d, Path: %s", host, port, path);
-    
-    // 创建socket
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        LOGE("Failed to create socket: %s", strerror(errno));
-        free(host);
-        free(path);
-        return false;
-    }
-    
-    // 解析主机名
-    struct hostent *server = gethostbyname(host);
-    if (!server) {
-        LOGE("Failed to resolve hostname: %s", host);
-        close(sockfd);
-        free(host);
-        free(path);
-        return false;
-    }
-    
+
+    // 连接和握手的总超时
+    sc_tick deadline = sc_tick_now() + SC_WEBRTC_CONNECT_TIMEOUT;
+
     // 连接到服务器
-    struct sockaddr_in serv_addr;
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(port);
-    memcpy(&serv_addr.sin_addr.s_addr, server->h_addr_list[0], server->h_length);
-    
-    if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-        LOGE("Failed to connect to server: %s", strerror(errno));
-        close(sockfd);
+    int sockfd = connect_host(streamer, host, port, deadline);
+    if (sockfd < 0) {
         free(host);
         free(path);
         return false;
@@ -231,57 +375,338 @@ connect_websocket(struct sc_webrtc_streamer *streamer) {
         "\r\n",
         path, host, port, websocket_key, host);
     
+    free(host);
+    free(path);
+
+    if (request_len <= 0 || request_len >= (int) sizeof(request)) {
+        LOGE("Could not format WebSocket upgrade request");
+        close(sockfd);
+        return false;
+    }
+
     // 发送升级请求
-    ssize_t sent = send(sockfd, request, request_len, 0);
-    if (sent != request_len) {
-        LOGE("Failed to send WebSocket upgrade request: %s", strerror(errno));
+    if (!send_handshake(streamer, sockfd, request, request_len, deadline)) {
         close(sockfd);
-        free(host);
-        free(path);
         return false;
     }
     
     // 接收服务器响应
     char response[1024];
-    ssize_t received = recv(sockfd, response, sizeof(response) - 1, 0);
-    if (received <= 0) {
-        LOGE("Failed to receive WebSocket upgrade response: %s", strerror(errno));
+    if (!recv_handshake(streamer, sockfd, response, sizeof(response),
+                        deadline)) {
         close(sockfd);
-        free(host);
-        free(path);
         return false;
     }
     
-    response[received] = '\0';
     LOGI("WebSocket upgrade response: %s", response);
     
     // 简单验证响应（实际项目中需要更严格的验证）
     if (strstr(response, "101 Switching Protocols") == NULL) {
         LOGE("WebSocket upgrade failed: invalid response");
         close(sockfd);
-        free(host);
-        free(path);
         return false;
     }
-    
-    // 连接成功
+
+    // 连接成功（socket保持非阻塞，推流线程在socket可写时发送）
     streamer->websocket_fd = sockfd;
-    streamer->connected = true;
-    
-    free(host);
-    free(path);
     
     LOGI("WebSocket connection established successfully");
     return true;
 }
 
+static const char *
+get_codec_name(enum AVCodecID codec_id) {
+    switch (codec_id) {
+        case AV_CODEC_ID_H264:
+            return "h264";
+        case AV_CODEC_ID_HEVC:
+            return "h265";
+        case AV_CODEC_ID_AV1:
+            return "av1";
+        default:
+            return "unknown";
+    }
+}
+
+// 将流信息写入发送队列（调用者必须持有mutex）
+static bool
+push_stream_info(struct sc_webrtc_streamer *streamer) {
+    char message[256];
+    int msg_len = snprintf(message, sizeof(message), STREAM_INFO_TEMPLATE,
+                           streamer->user_id,
+                           get_codec_name(streamer->codec_id),
+                           streamer->width,
+                           streamer->height);
+    if (msg_len <= 0 || msg_len >= (int) sizeof(message)) {
+        LOGE("Could not format WebSocket message");
+        return false;
+    }
+
+    if (!sc_websocket_sender_push_text(&streamer->ws_sender, message,
+                                       msg_len)) {
+        return false;
+    }
+
+    sc_cond_signal(&streamer->cond);
+    return true;
+}
+
+// 将一个包写入发送队列：一个二进制WebSocket消息（媒体头 + 负载），
+// 发送时只需一次系统调用（调用者必须持有mutex）
 static bool
-encode_and_send_frame(struct sc_webrtc_streamer *streamer, const AVFrame *frame) {
-    if (!streamer->encoder_ctx) {
-        LOGE("Encoder context not initialized");
+queue_packet(struct sc_webrtc_streamer *streamer, const uint8_t *data,
+             size_t size, int64_t pts, uint8_t flags) {
+    struct sc_media_header header = {
+        .stream_id = SC_MEDIA_STREAM_VIDEO,
+        .flags = flags,
+        .pts = pts == AV_NOPTS_VALUE ? -1 : pts,
+        .size = size,
+    };
+
+    enum sc_websocket_push_result result =
+        sc_websocket_sender_push_media(&streamer->ws_sender, &header, data);
+    if (result == SC_WEBSOCKET_PUSH_ERROR) {
         return false;
     }
 
+    if (result == SC_WEBSOCKET_PUSH_DROPPED) {
+        // 网络拥塞（或等待关键帧）
+        LOGV("Dropped frame (pts=%" PRIi64 "), %zu bytes queued", header.pts,
+             sc_websocket_sender_pending(&streamer->ws_sender));
+        return true;
+    }
+
+    sc_cond_signal(&streamer->cond);
+    return true;
+}
+
+// 发送一个编码后的包（调用者必须持有mutex）
+static bool
+push_media_packet(struct sc_webrtc_streamer *streamer,
+                  const AVPacket *packet) {
+    bool key_frame = packet->flags & AV_PKT_FLAG_KEY;
+    if (key_frame) {
+        // 保存最后一个关键帧（引用，不复制）
+        if (!streamer->last_key_frame) {
+            streamer->last_key_frame = av_packet_alloc();
+            if (!streamer->last_key_frame) {
+                LOG_OOM();
+                return false;
+            }
+        } else {
+            av_packet_unref(streamer->last_key_frame);
+        }
+
+        if (av_packet_ref(streamer->last_key_frame, packet)) {
+            LOG_OOM();
+            return false;
+        }
+    }
+
+    if (!streamer->connected) {
+        // 未连接：重新连接后从最后一个关键帧开始发送
+        return true;
+    }
+
+    return queue_packet(streamer, packet->data, packet->size, packet->pts,
+                        key_frame ? SC_MEDIA_FLAG_KEY_FRAME : 0);
+}
+
+// 开始发送视频流（连接成功且视频流已打开后，调用者必须持有mutex）：
+// 发送流信息，然后是配置包和最后一个关键帧，观看者可以立即显示画面
+static bool
+start_stream(struct sc_webrtc_streamer *streamer) {
+    assert(streamer->connected && streamer->initialized);
+
+    if (!push_stream_info(streamer)) {
+        return false;
+    }
+
+    AVPacket *key_frame = streamer->last_key_frame;
+    if (!key_frame) {
+        // 视频流刚开始，第一个包就是关键帧
+        return true;
+    }
+
+    if (streamer->config && !queue_packet(streamer, streamer->config,
+                                          streamer->config_size,
+                                          AV_NOPTS_VALUE,
+                                          SC_MEDIA_FLAG_CONFIG)) {
+        return false;
+    }
+
+    if (!queue_packet(streamer, key_frame->data, key_frame->size,
+                      key_frame->pts, SC_MEDIA_FLAG_KEY_FRAME)) {
+        return false;
+    }
+
+    // 之后的非关键帧依赖于观看者没有收到的帧，等待新的关键帧
+    streamer->ws_sender.wait_key_frame = true;
+    return true;
+}
+
+static void
+set_encoder_bit_rate(AVCodecContext *ctx, uint32_t bit_rate) {
+    // 码率控制受限于VBV（缓冲500ms），避免突发的大帧堵塞网络。libx264在下
+    // 一帧编码时应用新的码率（x264_encoder_reconfig）
+    ctx->bit_rate = bit_rate;
+    ctx->rc_max_rate = bit_rate;
+    ctx->rc_buffer_size = bit_rate / 2;
+}
+
+// 打开（或以新的尺寸重新打开）编码器，新的编码器从IDR帧开始
+static bool
+open_encoder(struct sc_webrtc_streamer *streamer, int width, int height) {
+    const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+    if (!codec) {
+        LOGE("H264 encoder not found");
+        return false;
+    }
+
+    AVCodecContext *ctx = avcodec_alloc_context3(codec);
+    if (!ctx) {
+        LOG_OOM();
+        return false;
+    }
+
+    ctx->width = width;
+    ctx->height = height;
+    // 可变帧率：pts直接使用源帧的时间戳，码率控制基于实际的时间戳
+    ctx->time_base = SC_WEBRTC_TIME_BASE;
+    ctx->framerate = (AVRational) {streamer->fps, 1};
+    ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    ctx->gop_size = streamer->fps * SC_WEBRTC_GOP_DURATION_SEC;
+    ctx->max_b_frames = 0;
+    // 切片线程（不增加延迟），线程数自动选择
+    ctx->thread_count = 0;
+    ctx->thread_type = FF_THREAD_SLICE;
+    set_encoder_bit_rate(ctx,
+        sc_bitrate_controller_get_bit_rate(&streamer->bitrate_controller));
+
+    av_opt_set(ctx->priv_data, "preset", "ultrafast", 0);
+    av_opt_set(ctx->priv_data, "tune", "zerolatency", 0);
+    // 强制的关键帧（重新连接或降级后）必须是IDR帧
+    av_opt_set(ctx->priv_data, "forced-idr", "1", 0);
+
+    int ret = avcodec_open2(ctx, codec, NULL);
+    if (ret < 0) {
+        LOGE("Could not open encoder: %d", ret);
+        avcodec_free_context(&ctx);
+        return false;
+    }
+
+    if (streamer->encoder_ctx) {
+        avcodec_free_context(&streamer->encoder_ctx);
+    }
+    streamer->encoder_ctx = ctx;
+
+    LOGI("WebRTC encoder: %dx%d, %" PRIi64 " bps, %u fps", width, height,
+         (int64_t) ctx->bit_rate, streamer->fps);
+    return true;
+}
+
+// 估计源帧率（只在重新打开编码器时使用，不需要精确）
+static void
+update_fps(struct sc_webrtc_streamer *streamer) {
+    sc_tick now = sc_tick_now();
+    if (!streamer->fps_frames++) {
+        streamer->fps_time = now;
+        return;
+    }
+
+    sc_tick elapsed = now - streamer->fps_time;
+    if (elapsed >= SC_WEBRTC_FPS_INTERVAL) {
+        unsigned fps = (streamer->fps_frames - 1) * SC_TICK_FREQ / elapsed;
+        streamer->fps = CLAMP(fps, SC_WEBRTC_MIN_FPS, SC_WEBRTC_MAX_FPS);
+        streamer->fps_frames = 0;
+    }
+}
+
+// 将帧缩放（并转换）为编码器的尺寸和格式，如果不需要则返回源帧
+static AVFrame *
+scale_frame(struct sc_webrtc_streamer *streamer, AVFrame *frame) {
+    AVCodecContext *ctx = streamer->encoder_ctx;
+    if (frame->width == ctx->width && frame->height == ctx->height
+            && frame->format == ctx->pix_fmt) {
+        return frame;
+    }
+
+    AVFrame *scaled = streamer->scaled_frame;
+    if (scaled->width != ctx->width || scaled->height != ctx->height) {
+        av_frame_unref(scaled);
+        scaled->format = ctx->pix_fmt;
+        scaled->width = ctx->width;
+        scaled->height = ctx->height;
+        if (av_frame_get_buffer(scaled, 0) < 0) {
+            LOG_OOM();
+            // 下次重新分配
+            scaled->width = 0;
+            return NULL;
+        }
+    } else if (av_frame_make_writable(scaled) < 0) {
+        // 上一帧可能仍被编码器引用
+        LOG_OOM();
+        return NULL;
+    }
+
+    // 只有源尺寸或格式变化时才重新创建
+    streamer->sws_ctx = sws_getCachedContext(streamer->sws_ctx, frame->width,
+                                             frame->height, frame->format,
+                                             ctx->width, ctx->height,
+                                             ctx->pix_fmt, SWS_BILINEAR,
+                                             NULL, NULL, NULL);
+    if (!streamer->sws_ctx) {
+        LOGE("Could not initialize WebRTC scaling context");
+        return NULL;
+    }
+
+    sws_scale(streamer->sws_ctx, (const uint8_t *const *) frame->data,
+              frame->linesize, 0, frame->height, scaled->data,
+              scaled->linesize);
+    scaled->pts = frame->pts;
+    return scaled;
+}
+
+static bool
+encode_and_send_frame(struct sc_webrtc_streamer *streamer, AVFrame *frame) {
+    update_fps(streamer);
+
+    // 编码尺寸取决于当前的质量级别和源尺寸（设备旋转时可能变化）
+    uint16_t width;
+    uint16_t height;
+    sc_bitrate_controller_get_size(&streamer->bitrate_controller,
+                                   frame->width, frame->height,
+                                   &width, &height);
+    if (width != streamer->encoder_ctx->width
+            || height != streamer->encoder_ctx->height) {
+        if (!open_encoder(streamer, width, height)) {
+            return false;
+        }
+
+        sc_mutex_lock(&streamer->mutex);
+        streamer->width = width;
+        streamer->height = height;
+        // 观看者需要新的尺寸，新的编码器从IDR帧（带SPS/PPS）开始
+        bool ok = !streamer->connected || push_stream_info(streamer);
+        sc_mutex_unlock(&streamer->mutex);
+        if (!ok) {
+            return false;
+        }
+    }
+
+    frame = scale_frame(streamer, frame);
+    if (!frame) {
+        return false;
+    }
+
+    if (streamer->force_key_frame) {
+        // 重新连接或降级后，观看者需要一个新的关键帧
+        frame->pict_type = AV_PICTURE_TYPE_I;
+        streamer->force_key_frame = false;
+    } else {
+        frame->pict_type = AV_PICTURE_TYPE_NONE;
+    }
+
     // 发送帧到编码器
     int ret = avcodec_send_frame(streamer->encoder_ctx, frame);
     if (ret < 0) {
@@ -300,99 +725,319 @@ encode_and_send_frame(struct sc_webrtc_streamer *streamer, const AVFrame *frame)
             return false;
         }
 
-        // 创建JSON消息
-        char message[1024];
-        int64_t timestamp = av_gettime();
-        
-        int msg_len = snprintf(message, sizeof(message), MESSAGE_TEMPLATE,
-                               streamer->user_id,
-                               timestamp,
-                               frame->width,
-                               frame->height,
-                               "h264", // 假设使用H264编码
-                               (size_t)packet->size);
-
-        if (msg_len > 0 && msg_len < (int)sizeof(message)) {
-            // 发送JSON消息
-            bool ok = send_websocket_message(streamer, message, msg_len);
-            if (ok) {
-                streamer->frame_count++;
-                streamer->bytes_sent += packet->size;
-                LOGV("Sent frame %llu, size: %d bytes", 
-                     (unsigned long long)streamer->frame_count, packet->size);
-            } else {
-                LOGE("Failed to send WebSocket message");
-                av_packet_unref(packet);
-                return false;
-            }
-        }
-
+        sc_mutex_lock(&streamer->mutex);
+        bool ok = push_media_packet(streamer, packet);
+        sc_mutex_unlock(&streamer->mutex);
         av_packet_unref(packet);
+        if (!ok) {
+            return false;
+        }
     }
 
     return true;
 }
 
-static int
-run_webrtc_streamer(void *data) {
-    struct sc_webrtc_streamer *streamer = data;
+static void
+mark_stopped(struct sc_webrtc_streamer *streamer) {
+    sc_mutex_lock(&streamer->mutex);
+    streamer->stopped = true;
+    sc_mutex_unlock(&streamer->mutex);
+}
 
-    LOGI("WebRTC streamer thread started");
+static void
+log_stats(struct sc_webrtc_streamer *streamer, sc_tick now) {
+    const struct sc_websocket_stats *stats = &streamer->ws_sender.stats;
+    sc_tick elapsed = now - streamer->stats_time;
+    uint64_t bytes = stats->bytes_sent - streamer->stats_bytes;
+    LOGD("WebRTC: %.1f kB/s, %zu bytes queued (max %zu), %" PRIu64
+         " frames, %" PRIu64 " dropped, %" PRIu64 " skipped",
+         (double) bytes * SC_TICK_FREQ / elapsed / 1000,
+         sc_websocket_sender_pending(&streamer->ws_sender),
+         stats->max_queue_bytes, stats->frames, stats->dropped_frames,
+         streamer->skipped_frames);
+
+    streamer->stats_time = now;
+    streamer->stats_bytes = stats->bytes_sent;
+}
 
-    // 尝试连接WebSocket
-    int retry_count = 0;
-    const int max_retries = 3;
-    
-    while (!streamer->stopped && retry_count < max_retries) {
-        if (connect_websocket(streamer)) {
-            LOGI("WebSocket connected successfully");
-            break;
-        }
-        
-        retry_count++;
-        if (retry_count < max_retries) {
-            LOGW("WebSocket connection failed, retrying in 2 seconds... (%d/%d)", 
-                 retry_count, max_retries);
-            
-            // 等待2秒后重试
-            for (int i = 0; i < 20 && !streamer->stopped; i++) {
-                usleep(100000); // 100ms
-            }
+// 发送队列中尽可能多的数据，不阻塞
+static bool
+flush_queue(struct sc_webrtc_streamer *streamer) {
+    sc_mutex_lock(&streamer->mutex);
+
+    bool ok = sc_websocket_sender_flush(&streamer->ws_sender,
+                                        streamer->websocket_fd);
+
+    sc_tick now = sc_tick_now();
+    if (now - streamer->stats_time >= SC_WEBRTC_STATS_INTERVAL) {
+        log_stats(streamer, now);
+    }
+
+    sc_mutex_unlock(&streamer->mutex);
+    return ok;
+}
+
+// 根据发送队列和网络吞吐量调整码率和分辨率（仅重新编码模式）
+static void
+adapt_quality(struct sc_webrtc_streamer *streamer) {
+    struct sc_bitrate_sample sample;
+
+    sc_mutex_lock(&streamer->mutex);
+    bool initialized = streamer->initialized;
+    const struct sc_websocket_stats *stats = &streamer->ws_sender.stats;
+    sample.queue_bytes = sc_websocket_sender_pending(&streamer->ws_sender);
+    sample.acked_bytes = stats->bytes_sent;
+    sample.dropped_frames = stats->dropped_frames;
+    sc_mutex_unlock(&streamer->mutex);
+
+    if (!initialized) {
+        return;
+    }
+
+#ifdef SIOCOUTQ
+    // 已写入socket但对端尚未确认的数据也在排队
+    int unacked;
+    if (!ioctl(streamer->websocket_fd, SIOCOUTQ, &unacked) && unacked > 0) {
+        sample.queue_bytes += unacked;
+        sample.acked_bytes -= MIN((uint64_t) unacked, sample.acked_bytes);
+    }
+#endif
+
+    struct sc_bitrate_controller *bc = &streamer->bitrate_controller;
+    enum sc_bitrate_change change =
+        sc_bitrate_controller_update(bc, sc_tick_now(), &sample);
+    if (change == SC_BITRATE_KEEP) {
+        return;
+    }
+
+    uint32_t bit_rate = sc_bitrate_controller_get_bit_rate(bc);
+    LOGI("WebRTC: %s to %" PRIu32 " kbps (level %u, throughput %" PRIu32
+         " kbps, %zu bytes queued)",
+         change == SC_BITRATE_DOWN ? "network congestion, step down"
+                                   : "step up",
+         bit_rate / 1000, bc->level, bc->throughput / 1000,
+         sample.queue_bytes);
+
+    // 如果尺寸也变化，下一帧重新打开编码器
+    set_encoder_bit_rate(streamer->encoder_ctx, bit_rate);
+
+    if (change == SC_BITRATE_DOWN) {
+        // 拥塞时发送队列可能已丢弃帧，观看者尽快从新的关键帧恢复
+        streamer->force_key_frame = true;
+    }
+}
+
+// 等待socket可写（超时后返回，以便检查停止信号）
+static bool
+wait_writable(struct sc_webrtc_streamer *streamer) {
+    struct pollfd pfd = {
+        .fd = streamer->websocket_fd,
+        .events = POLLOUT,
+    };
+
+    int r = poll(&pfd, 1, SC_WEBRTC_POLL_TIMEOUT_MS);
+    if (r == -1) {
+        if (errno == EINTR) {
+            return true;
         }
+        LOGE("Failed to poll WebSocket: %s", strerror(errno));
+        return false;
     }
-    
-    if (!streamer->connected) {
-        LOGE("Failed to connect to WebSocket server after %d attempts", max_retries);
-        return -1;
+
+    if (r && pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        LOGE("WebSocket connection closed");
+        return false;
     }
 
+    return true;
+}
+
+// 连接成功后调用
+static bool
+on_connected(struct sc_webrtc_streamer *streamer) {
+    sc_mutex_lock(&streamer->mutex);
+
+    // 丢弃上一个连接未发送的数据
+    sc_websocket_sender_reset(&streamer->ws_sender);
+    streamer->connected = true;
+    streamer->force_key_frame = true;
+
+    bool ok = !streamer->initialized || start_stream(streamer);
+    // 如果视频流已经开始，最后一个关键帧可能很旧，请求一个新的关键帧
+    bool request_key_frame = ok && streamer->forward
+                          && streamer->last_key_frame;
+
+    sc_mutex_unlock(&streamer->mutex);
+
+    if (request_key_frame && streamer->cbs
+            && streamer->cbs->on_key_frame_request) {
+        streamer->cbs->on_key_frame_request(streamer, streamer->cbs_userdata);
+    }
+
+    return ok;
+}
+
+static void
+close_websocket(struct sc_webrtc_streamer *streamer) {
+    sc_mutex_lock(&streamer->mutex);
+    streamer->connected = false;
+    sc_websocket_sender_reset(&streamer->ws_sender);
+    sc_mutex_unlock(&streamer->mutex);
+
+    if (streamer->websocket_fd >= 0) {
+        close(streamer->websocket_fd);
+        streamer->websocket_fd = -1;
+    }
+}
+
+// 等待重新连接的延迟，如果推流器被停止则返回false
+static bool
+wait_reconnect_delay(struct sc_webrtc_streamer *streamer, sc_tick delay) {
+    sc_tick deadline = sc_tick_now() + delay;
+
+    sc_mutex_lock(&streamer->mutex);
+    bool timed_out = false;
+    while (!streamer->stopped && !timed_out) {
+        timed_out = !sc_cond_timedwait(&streamer->cond, &streamer->mutex,
+                                       deadline);
+    }
+    bool stopped = streamer->stopped;
+    sc_mutex_unlock(&streamer->mutex);
+
+    return !stopped;
+}
+
+enum sc_webrtc_connection_status {
+    SC_WEBRTC_CONNECTION_STOPPED,
+    SC_WEBRTC_CONNECTION_LOST,
+    SC_WEBRTC_CONNECTION_ERROR, // 不可恢复的错误（例如编码错误）
+};
+
+// 在一个连接上发送视频，直到停止或连接断开
+static enum sc_webrtc_connection_status
+stream_connection(struct sc_webrtc_streamer *streamer) {
     for (;;) {
         sc_mutex_lock(&streamer->mutex);
 
-        // 等待新帧或停止信号
-        while (!streamer->stopped && !streamer->has_pending_frame) {
+        // 等待新帧、待发送的数据或停止信号
+        while (!streamer->stopped && !streamer->has_pending_frame
+                && !sc_websocket_sender_pending(&streamer->ws_sender)) {
             sc_cond_wait(&streamer->cond, &streamer->mutex);
         }
 
         if (streamer->stopped) {
             sc_mutex_unlock(&streamer->mutex);
-            break;
+            return SC_WEBRTC_CONNECTION_STOPPED;
+        }
+
+        // 获取待处理的帧（推流线程拥有它，decoder可以继续推新帧）
+        bool has_frame = streamer->has_pending_frame;
+        if (has_frame) {
+            av_frame_move_ref(streamer->frame, streamer->pending_frame);
+            streamer->has_pending_frame = false;
         }
 
-        // 获取待处理的帧
-        AVFrame *frame = streamer->pending_frame;
-        streamer->has_pending_frame = false;
         sc_mutex_unlock(&streamer->mutex);
 
-        // 编码并发送帧
-        bool ok = encode_and_send_frame(streamer, frame);
-        if (!ok) {
-            LOGE("Failed to encode and send frame, will try to reconnect");
-            // 在实际项目中，这里可以尝试重新连接
+        // 先发送已排队的数据（编码时不会阻塞发送）
+        if (!flush_queue(streamer)) {
+            if (has_frame) {
+                av_frame_unref(streamer->frame);
+            }
+            return SC_WEBRTC_CONNECTION_LOST;
+        }
+
+        if (!streamer->forward) {
+            adapt_quality(streamer);
+        }
+
+        if (has_frame) {
+            // 编码，编码后的包写入发送队列
+            bool ok = encode_and_send_frame(streamer, streamer->frame);
+            av_frame_unref(streamer->frame);
+            if (!ok) {
+                return SC_WEBRTC_CONNECTION_ERROR;
+            }
+        } else {
+            sc_mutex_lock(&streamer->mutex);
+            bool pending = sc_websocket_sender_pending(&streamer->ws_sender);
+            sc_mutex_unlock(&streamer->mutex);
+
+            if (pending && !wait_writable(streamer)) {
+                return SC_WEBRTC_CONNECTION_LOST;
+            }
+        }
+    }
+}
+
+static int
+run_webrtc_streamer(void *data) {
+    struct sc_webrtc_streamer *streamer = data;
+
+    LOGI("WebRTC streamer thread started");
+
+    sc_tick start_time = sc_tick_now();
+    streamer->stats_time = start_time;
+    streamer->stats_bytes = 0;
+
+    sc_tick delay = SC_WEBRTC_RECONNECT_DELAY_MIN;
+    for (;;) {
+        if (!connect_websocket(streamer)) {
+            LOGW("WebSocket connection failed, retrying in %" PRItick " ms",
+                 SC_TICK_TO_MS(delay));
+            if (!wait_reconnect_delay(streamer, delay)) {
+                break;
+            }
+            delay = MIN(delay * 2, SC_WEBRTC_RECONNECT_DELAY_MAX);
+            continue;
+        }
+
+        sc_tick connect_time = sc_tick_now();
+        LOGI("WebSocket connected successfully");
+
+        enum sc_webrtc_connection_status status;
+        if (on_connected(streamer)) {
+            status = stream_connection(streamer);
+        } else {
+            status = SC_WEBRTC_CONNECTION_ERROR;
+        }
+
+        close_websocket(streamer);
+
+        if (status != SC_WEBRTC_CONNECTION_LOST) {
+            break;
+        }
+
+        if (sc_tick_now() - connect_time >= SC_WEBRTC_RECONNECT_STABLE) {
+            // 连接是稳定的，立即重新开始退避
+            delay = SC_WEBRTC_RECONNECT_DELAY_MIN;
+        }
+
+        ++streamer->reconnect_count;
+        LOGW("WebSocket connection lost, reconnecting in %" PRItick " ms",
+             SC_TICK_TO_MS(delay));
+        if (!wait_reconnect_delay(streamer, delay)) {
             break;
         }
+        delay = MIN(delay * 2, SC_WEBRTC_RECONNECT_DELAY_MAX);
     }
 
+    sc_mutex_lock(&streamer->mutex);
+    const struct sc_websocket_stats *stats = &streamer->ws_sender.stats;
+    sc_tick elapsed = sc_tick_now() - start_time;
+    LOGI("WebRTC: %" PRIu64 " frames sent (%.1f kB/s), %" PRIu64 " dropped, "
+         "%" PRIu64 " skipped (encoder), max queue %zu bytes, "
+         "%u reconnections",
+         stats->frames,
+         elapsed ? (double) stats->bytes_sent * SC_TICK_FREQ / elapsed / 1000
+                 : 0,
+         stats->dropped_frames, streamer->skipped_frames,
+         stats->max_queue_bytes, streamer->reconnect_count);
+    sc_mutex_unlock(&streamer->mutex);
+
+    // 不再接收新的包
+    mark_stopped(streamer);
+
     LOGI("WebRTC streamer thread ended");
     return 0;
 }
@@ -404,52 +1049,71 @@ sc_webrtc_streamer_frame_sink_open(struct sc_frame_sink *sink,
     
     LOGI("Opening WebRTC streamer");
 
-    // 初始化编码器
-    const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_H264);
-    if (!codec) {
-        LOGE("H264 encoder not found");
-        return false;
-    }
-
-    streamer->encoder_ctx = avcodec_alloc_context3(codec);
-    if (!streamer->encoder_ctx) {
-        LOGE("Could not allocate encoder context");
-        return false;
-    }
-
-    // 配置编码器参数
-    streamer->encoder_ctx->width = ctx->width;
-    streamer->encoder_ctx->height = ctx->height;
-    streamer->encoder_ctx->time_base = (AVRational){1, 30}; // 30 FPS
-    streamer->encoder_ctx->framerate = (AVRational){30, 1};
-    streamer->encoder_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
-    streamer->encoder_ctx->bit_rate = 2000000; // 2Mbps
-    streamer->encoder_ctx->gop_size = 30;
-    streamer->encoder_ctx->max_b_frames = 0;
+    sc_bitrate_controller_init(&streamer->bitrate_controller,
+                               streamer->max_bit_rate, streamer->max_size,
+                               sc_tick_now());
 
-    // 设置编码器选项
-    av_opt_set(streamer->encoder_ctx->priv_data, "preset", "ultrafast", 0);
-    av_opt_set(streamer->encoder_ctx->priv_data, "tune", "zerolatency", 0);
+    uint16_t width;
+    uint16_t height;
+    sc_bitrate_controller_get_size(&streamer->bitrate_controller,
+                                   ctx->width, ctx->height, &width, &height);
 
-    // 打开编码器
-    int ret = avcodec_open2(streamer->encoder_ctx, codec, NULL);
-    if (ret < 0) {
-        LOGE("Could not open encoder: %d", ret);
-        avcodec_free_context(&streamer->encoder_ctx);
+    streamer->fps = SC_WEBRTC_DEFAULT_FPS;
+    streamer->fps_frames = 0;
+    if (!open_encoder(streamer, width, height)) {
         return false;
     }
 
     // 分配包
     streamer->packet = av_packet_alloc();
     if (!streamer->packet) {
-        LOGE("Could not allocate packet");
-        avcodec_free_context(&streamer->encoder_ctx);
-        return false;
+        LOG_OOM();
+        goto error;
+    }
+
+    streamer->frame = av_frame_alloc();
+    if (!streamer->frame) {
+        LOG_OOM();
+        goto error;
+    }
+
+    streamer->scaled_frame = av_frame_alloc();
+    if (!streamer->scaled_frame) {
+        LOG_OOM();
+        goto error;
     }
 
+    streamer->codec_id = AV_CODEC_ID_H264;
+    streamer->width = width;
+    streamer->height = height;
+
+    sc_mutex_lock(&streamer->mutex);
     streamer->initialized = true;
+    // 如果已经连接，开始发送视频流（否则在连接后开始）
+    bool ok = !streamer->connected || start_stream(streamer);
+    if (!ok) {
+        streamer->initialized = false;
+    }
+    sc_mutex_unlock(&streamer->mutex);
+    if (!ok) {
+        goto error;
+    }
+
     LOGI("WebRTC streamer opened successfully");
     return true;
+
+error:
+    if (streamer->scaled_frame) {
+        av_frame_free(&streamer->scaled_frame);
+    }
+    if (streamer->frame) {
+        av_frame_free(&streamer->frame);
+    }
+    if (streamer->packet) {
+        av_packet_free(&streamer->packet);
+    }
+    avcodec_free_context(&streamer->encoder_ctx);
+    return false;
 }
 
 static void
@@ -458,22 +1122,11 @@ sc_webrtc_streamer_frame_sink_close(struct sc_frame_sink *sink) {
     
     LOGI("Closing WebRTC streamer");
 
+    sc_mutex_lock(&streamer->mutex);
+    // 推流线程可能仍在使用编码器，编码器在sc_webrtc_streamer_destroy()中
+    // 释放（推流线程结束后）
     streamer->initialized = false;
-
-    if (streamer->encoder_ctx) {
-        avcodec_free_context(&streamer->encoder_ctx);
-    }
-
-    if (streamer->packet) {
-        av_packet_free(&streamer->packet);
-    }
-
-    if (streamer->websocket_fd >= 0) {
-        close(streamer->websocket_fd);
-        streamer->websocket_fd = -1;
-    }
-
-    streamer->connected = false;
+    sc_mutex_unlock(&streamer->mutex);
 }
 
 static bool
@@ -487,10 +1140,12 @@ sc_webrtc_streamer_frame_sink_push(struct sc_frame_sink *sink,
 
     sc_mutex_lock(&streamer->mutex);
 
-    // 如果已有待处理帧，跳过当前帧（避免积压）
+    // 如果推流线程还没有取走上一帧，用新帧替换它（避免积压，原始帧之间
+    // 没有依赖）
     if (streamer->has_pending_frame) {
-        sc_mutex_unlock(&streamer->mutex);
-        return true; // 不返回false，避免停止整个流水线
+        av_frame_unref(streamer->pending_frame);
+        streamer->has_pending_frame = false;
+        ++streamer->skipped_frames;
     }
 
     // 复制帧数据
@@ -515,11 +1170,101 @@ sc_webrtc_streamer_frame_sink_push(struct sc_frame_sink *sink,
     return true;
 }
 
+static bool
+sc_webrtc_streamer_packet_sink_open(struct sc_packet_sink *sink,
+                                    AVCodecContext *ctx) {
+    struct sc_webrtc_streamer *streamer = DOWNCAST_PACKET(sink);
+
+    LOGI("Opening WebRTC streamer (forwarding %s packets)",
+         get_codec_name(ctx->codec_id));
+
+    streamer->codec_id = ctx->codec_id;
+    streamer->width = ctx->width;
+    streamer->height = ctx->height;
+
+    sc_mutex_lock(&streamer->mutex);
+    streamer->initialized = true;
+    // 如果已经连接，开始发送视频流（否则在连接后开始）
+    bool ok = !streamer->connected || start_stream(streamer);
+    if (!ok) {
+        streamer->initialized = false;
+    }
+    sc_mutex_unlock(&streamer->mutex);
+
+    return ok;
+}
+
+static void
+sc_webrtc_streamer_packet_sink_close(struct sc_packet_sink *sink) {
+    struct sc_webrtc_streamer *streamer = DOWNCAST_PACKET(sink);
+
+    LOGI("Closing WebRTC streamer");
+
+    // 推流线程在持有mutex时读取initialized
+    sc_mutex_lock(&streamer->mutex);
+    streamer->initialized = false;
+    sc_mutex_unlock(&streamer->mutex);
+}
+
+static bool
+sc_webrtc_streamer_packet_sink_push(struct sc_packet_sink *sink,
+                                    const AVPacket *packet) {
+    struct sc_webrtc_streamer *streamer = DOWNCAST_PACKET(sink);
+
+    if (!streamer->initialized) {
+        return false;
+    }
+
+    bool is_config = packet->pts == AV_NOPTS_VALUE;
+    if (is_config) {
+        // 配置包已被demuxer合并到下一个媒体包（类似sc_packet_merger），
+        // 不单独发送，只保存最后一个
+        uint8_t *config = malloc(packet->size);
+        if (!config) {
+            LOG_OOM();
+            return false;
+        }
+        memcpy(config, packet->data, packet->size);
+
+        sc_mutex_lock(&streamer->mutex);
+        free(streamer->config);
+        streamer->config = config;
+        streamer->config_size = packet->size;
+        sc_mutex_unlock(&streamer->mutex);
+        return true;
+    }
+
+    sc_mutex_lock(&streamer->mutex);
+
+    if (streamer->stopped) {
+        sc_mutex_unlock(&streamer->mutex);
+        return true;
+    }
+
+    // 包数据在写入发送队列时被掩码（复制），不修改共享的包
+    bool ok = push_media_packet(streamer, packet);
+    sc_mutex_unlock(&streamer->mutex);
+
+    return ok;
+}
+
+bool
+sc_webrtc_streamer_can_forward(enum sc_codec codec) {
+    // WebRTC客户端普遍支持H.264，其他格式需要重新编码。
+    // H.265不转发：浏览器的WebRTC H.265支持依赖硬件解码，并不普遍
+    return codec == SC_CODEC_H264;
+}
+
 bool
 sc_webrtc_streamer_init(struct sc_webrtc_streamer *streamer,
                         const char *websocket_url,
                         const char *webrtc_signal_url,
-                        uint32_t user_id) {
+                        uint32_t user_id,
+                        bool forward,
+                        uint32_t max_bit_rate,
+                        uint16_t max_size,
+                        const struct sc_webrtc_streamer_callbacks *cbs,
+                        void *cbs_userdata) {
     
     memset(streamer, 0, sizeof(*streamer));
 
@@ -538,14 +1283,26 @@ sc_webrtc_streamer_init(struct sc_webrtc_streamer *streamer,
     }
 
     streamer->user_id = user_id;
+    // 客户端发送的帧必须被掩码（RFC 6455）
+    sc_websocket_sender_init(&streamer->ws_sender, true,
+                             SC_WEBRTC_QUEUE_WATERMARK);
+    streamer->forward = forward;
+    streamer->max_bit_rate = max_bit_rate ? max_bit_rate
+                                          : SC_WEBRTC_DEFAULT_BIT_RATE;
+    streamer->max_size = max_size;
+    streamer->cbs = cbs;
+    streamer->cbs_userdata = cbs_userdata;
+    streamer->config = NULL;
+    streamer->config_size = 0;
+    streamer->last_key_frame = NULL;
     streamer->websocket_fd = -1;
     streamer->connected = false;
     streamer->stopped = false;
     streamer->initialized = false;
-    streamer->header_sent = false;
     streamer->has_pending_frame = false;
-    streamer->frame_count = 0;
-    streamer->bytes_sent = 0;
+    streamer->force_key_frame = false;
+    streamer->skipped_frames = 0;
+    streamer->reconnect_count = 0;
 
     // 初始化同步原语
     if (!sc_mutex_init(&streamer->mutex)) {
@@ -568,7 +1325,17 @@ sc_webrtc_streamer_init(struct sc_webrtc_streamer *streamer,
 
     streamer->frame_sink.ops = &ops;
 
-    LOGI("WebRTC streamer initialized for user %u", user_id);
+    // 设置packet sink操作
+    static const struct sc_packet_sink_ops packet_ops = {
+        .open = sc_webrtc_streamer_packet_sink_open,
+        .close = sc_webrtc_streamer_packet_sink_close,
+        .push = sc_webrtc_streamer_packet_sink_push,
+    };
+
+    streamer->packet_sink.ops = &packet_ops;
+
+    LOGI("WebRTC streamer initialized for user %u (%s)", user_id,
+         forward ? "forward device packets" : "re-encode");
     return true;
 
 error:
@@ -583,6 +1350,27 @@ sc_webrtc_streamer_destroy(struct sc_webrtc_streamer *streamer) {
         av_frame_free(&streamer->pending_frame);
     }
 
+    // 重新编码模式
+    if (streamer->encoder_ctx) {
+        avcodec_free_context(&streamer->encoder_ctx);
+    }
+    if (streamer->packet) {
+        av_packet_free(&streamer->packet);
+    }
+    if (streamer->frame) {
+        av_frame_free(&streamer->frame);
+    }
+    if (streamer->scaled_frame) {
+        av_frame_free(&streamer->scaled_frame);
+    }
+    sws_freeContext(streamer->sws_ctx);
+
+    free(streamer->config);
+    if (streamer->last_key_frame) {
+        av_packet_free(&streamer->last_key_frame);
+    }
+    sc_websocket_sender_destroy(&streamer->ws_sender);
+
     sc_cond_destroy(&streamer->cond);
     sc_mutex_destroy(&streamer->mutex);
 
@@ -6,35 +6,93 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <libavcodec/avcodec.h>
-#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
 
+#include "bitrate_controller.h"
+#include "options.h"
 #include "trait/frame_sink.h"
+#include "trait/packet_sink.h"
 #include "util/thread.h"
+#include "util/tick.h"
+#include "websocket.h"
 
 /**
  * WebRTC视频推流器
  * 
- * 该模块实现了将scrcpy接收到的视频帧推送到WebRTC服务器的功能。
- * 它作为一个frame_sink，接收来自decoder的视频帧，并通过WebSocket
- * 连接将这些帧发送到指定的WebRTC信令服务器。
+ * 该模块实现了将scrcpy接收到的视频推送到WebRTC服务器的功能。
+ *
+ * 如果设备的编码格式可以直接发送（H.264），它作为一个packet_sink，
+ * 接收来自demuxer的视频包并直接转发（不解码，不重新编码）。
+ * 否则，它作为一个frame_sink，接收来自decoder的视频帧并重新编码。
+ * 两种情况下，编码后的包都通过WebSocket连接发送到指定的服务器。
+ *
+ * 编码后的包被写入发送队列，推流线程在socket可写时（非阻塞）发送。
+ * 如果网络太慢，队列超过水位线后丢弃非关键帧，直到下一个关键帧。
+ *
+ * 重新编码模式下，码率和分辨率根据发送队列和网络吞吐量分级调整（见
+ * sc_bitrate_controller），降级后立即编码一个关键帧。
+ *
+ * 连接断开后自动重新连接（指数退避）。重新连接后立即发送配置包和最后一个
+ * 关键帧，并请求一个新的关键帧（转发模式通过回调，例如RESET_VIDEO；
+ * 重新编码模式强制编码器输出关键帧）。
  */
 
+struct sc_webrtc_streamer;
+
+struct sc_webrtc_streamer_callbacks {
+    // 请求设备尽快发送一个新的关键帧（转发模式，重新连接后调用）
+    void (*on_key_frame_request)(struct sc_webrtc_streamer *streamer,
+                                 void *userdata);
+};
+
 struct sc_webrtc_streamer {
     struct sc_frame_sink frame_sink; // frame sink trait
+    struct sc_packet_sink packet_sink; // packet sink trait
+
+    // 转发模式：直接转发设备编码的包
+    bool forward;
 
     // WebRTC配置参数
     char *websocket_url;
     char *webrtc_signal_url;
     uint32_t user_id;
 
-    // 网络连接
+    const struct sc_webrtc_streamer_callbacks *cbs;
+    void *cbs_userdata;
+
+    // 网络连接（websocket_fd由推流线程拥有，connected受mutex保护）
     int websocket_fd;
     bool connected;
-
-    // 编码器相关
+    // 发送队列（受mutex保护）
+    struct sc_websocket_sender ws_sender;
+
+    // 发送的视频流参数
+    enum AVCodecID codec_id;
+    int width;
+    int height;
+
+    // 最后一个配置包（SPS/PPS），配置包已被demuxer合并到下一个媒体包，
+    // 保存它以便重新同步
+    uint8_t *config;
+    size_t config_size;
+    // 最后一个关键帧（引用，不复制），重新连接后立即发送
+    AVPacket *last_key_frame;
+
+    // 编码器相关（仅重新编码模式）
+    // 编码的最大码率（网络拥塞时降低）
+    uint32_t max_bit_rate;
+    // 编码的最大尺寸（0表示源尺寸）
+    uint16_t max_size;
     AVCodecContext *encoder_ctx;
-    AVFormatContext *format_ctx;
-    AVStream *stream;
+    // 缩放到编码尺寸（推流线程拥有）
+    struct SwsContext *sws_ctx;
+    AVFrame *scaled_frame;
+    // 自适应码率和分辨率（推流线程拥有）
+    struct sc_bitrate_controller bitrate_controller;
+    // 源帧率估计（重新打开编码器时使用）
+    unsigned fps;
+    sc_tick fps_time;
+    unsigned fps_frames;
     AVPacket *packet;
 
     // 线程和同步
@@ -42,18 +100,22 @@ struct sc_webrtc_streamer {
     sc_mutex mutex;
     sc_cond cond;
     
-    // 状态管理
+    // 状态管理（受mutex保护，initialized由sink线程写入，sink线程读取时
+    // 不需要加锁）
     bool stopped;
     bool initialized;
-    bool header_sent;
 
     // 帧缓冲
     AVFrame *pending_frame;
     bool has_pending_frame;
+    AVFrame *frame; // 推流线程正在编码的帧
+    bool force_key_frame; // 下一帧编码为关键帧（重新连接后）
 
     // 统计信息
-    uint64_t frame_count;
-    uint64_t bytes_sent;
+    uint64_t skipped_frames; // 编码前跳过的帧（重新编码模式）
+    sc_tick stats_time;
+    uint64_t stats_bytes;
+    unsigned reconnect_count;
 };
 
 /**
@@ -63,13 +125,33 @@ struct sc_webrtc_streamer {
  * @param websocket_url WebSocket服务器URL
  * @param webrtc_signal_url WebRTC信令服务器URL  
  * @param user_id 用户ID
+ * @param forward 转发设备编码的包（packet_sink），否则重新编码解码后的帧
+ *                （frame_sink）
+ * @param max_bit_rate 重新编码的最大码率（0表示默认值，与设备编码器相同）
+ * @param max_size 重新编码的最大尺寸（0表示源尺寸）
+ * @param cbs 回调（在推流线程中调用）
+ * @param cbs_userdata 回调的用户数据
  * @return 成功返回true，失败返回false
  */
 bool
 sc_webrtc_streamer_init(struct sc_webrtc_streamer *streamer,
                         const char *websocket_url,
                         const char *webrtc_signal_url,
-                        uint32_t user_id);
+                        uint32_t user_id,
+                        bool forward,
+                        uint32_t max_bit_rate,
+                        uint16_t max_size,
+                        const struct sc_webrtc_streamer_callbacks *cbs,
+                        void *cbs_userdata);
+
+/**
+ * 判断设备编码的视频是否可以直接转发（无需重新编码）
+ *
+ * @param codec 设备视频编码格式
+ * @return 可以直接转发返回true
+ */
+bool
+sc_webrtc_streamer_can_forward(enum sc_codec codec);
 
 /**
  * 销毁WebRTC推流器
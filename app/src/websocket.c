@@ -0,0 +1,334 @@
+#include "websocket.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <libavutil/base64.h>
+#include <libavutil/mem.h>
+#include <libavutil/sha.h>
+
+#include "util/binary.h"
+#include "util/log.h"
+
+#ifdef MSG_NOSIGNAL
+// Do not raise SIGPIPE if the peer closed the connection
+# define SC_WEBSOCKET_SEND_FLAGS MSG_NOSIGNAL
+#else
+# define SC_WEBSOCKET_SEND_FLAGS 0
+#endif
+
+void
+sc_media_header_write(uint8_t *buf, const struct sc_media_header *header) {
+    buf[0] = header->stream_id;
+    buf[1] = header->flags;
+    sc_write16be(&buf[2], 0); // reserved
+    sc_write64be(&buf[4], (uint64_t) header->pts);
+    sc_write32be(&buf[12], header->size);
+}
+
+void
+sc_media_header_read(const uint8_t *buf, struct sc_media_header *header) {
+    header->stream_id = buf[0];
+    header->flags = buf[1];
+    header->pts = (int64_t) sc_read64be(&buf[4]);
+    header->size = sc_read32be(&buf[12]);
+}
+
+size_t
+sc_websocket_write_frame_header(uint8_t *buf, bool fin, uint8_t opcode,
+                                uint64_t payload_length, const uint8_t *mask) {
+    assert(!(opcode & ~0xF));
+
+    buf[0] = (fin ? 0x80 : 0) | opcode;
+    uint8_t mask_bit = mask ? 0x80 : 0;
+
+    size_t len;
+    if (payload_length < 126) {
+        buf[1] = mask_bit | payload_length;
+        len = 2;
+    } else if (payload_length <= 0xFFFF) {
+        buf[1] = mask_bit | 126;
+        sc_write16be(&buf[2], payload_length);
+        len = 4;
+    } else {
+        buf[1] = mask_bit | 127;
+        sc_write64be(&buf[2], payload_length);
+        len = 10;
+    }
+
+    if (mask) {
+        memcpy(&buf[len], mask, 4);
+        len += 4;
+    }
+
+    return len;
+}
+
+size_t
+sc_websocket_parse_frame_header(const uint8_t *buf, size_t len,
+                                struct sc_websocket_frame_info *info) {
+    if (len < 2) {
+        return 0;
+    }
+
+    info->fin = buf[0] & 0x80;
+    info->opcode = buf[0] & 0xF;
+    info->masked = buf[1] & 0x80;
+
+    uint8_t length7 = buf[1] & 0x7F;
+    size_t header_len = 2;
+    if (length7 == 126) {
+        if (len < 4) {
+            return 0;
+        }
+        info->payload_length = sc_read16be(&buf[2]);
+        header_len = 4;
+    } else if (length7 == 127) {
+        if (len < 10) {
+            return 0;
+        }
+        info->payload_length = sc_read64be(&buf[2]);
+        header_len = 10;
+    } else {
+        info->payload_length = length7;
+    }
+
+    if (info->masked) {
+        if (len < header_len + 4) {
+            return 0;
+        }
+        memcpy(info->mask, &buf[header_len], 4);
+        header_len += 4;
+    }
+
+    return header_len;
+}
+
+void
+sc_websocket_mask_copy(uint8_t *dst, const uint8_t *src, size_t len,
+                       const uint8_t mask[4], size_t offset) {
+    // Rotate the key so that key[0] applies to src[0]
+    uint8_t key[8];
+    for (unsigned i = 0; i < 8; ++i) {
+        key[i] = mask[(offset + i) % 4];
+    }
+
+    uint64_t key64;
+    memcpy(&key64, key, 8);
+
+    // 8 bytes at a time (the key is periodic with period 4, so it is
+    // unaffected by the byte order)
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, &src[i], 8);
+        v ^= key64;
+        memcpy(&dst[i], &v, 8);
+    }
+
+    for (; i < len; ++i) {
+        dst[i] = src[i] ^ key[i % 4];
+    }
+}
+
+bool
+sc_websocket_compute_accept(const char *key, size_t key_len, char *accept) {
+    static const char GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    struct AVSHA *sha = av_sha_alloc();
+    if (!sha) {
+        LOG_OOM();
+        return false;
+    }
+
+    uint8_t digest[20];
+    av_sha_init(sha, 160);
+    av_sha_update(sha, (const uint8_t *) key, key_len);
+    av_sha_update(sha, (const uint8_t *) GUID, sizeof(GUID) - 1);
+    av_sha_final(sha, digest);
+    av_free(sha);
+
+    static_assert(SC_WEBSOCKET_ACCEPT_SIZE == AV_BASE64_SIZE(20),
+                  "Unexpected accept size");
+    return av_base64_encode(accept, SC_WEBSOCKET_ACCEPT_SIZE, digest,
+                            sizeof(digest)) != NULL;
+}
+
+void
+sc_websocket_sender_init(struct sc_websocket_sender *sender, bool mask,
+                         size_t watermark) {
+    sender->mask = mask;
+    sc_rand_init(&sender->rand);
+    sender->buf = NULL;
+    sender->buf_size = 0;
+    sender->head = 0;
+    sender->tail = 0;
+    sender->watermark = watermark;
+    sender->wait_key_frame = false;
+    memset(&sender->stats, 0, sizeof(sender->stats));
+}
+
+void
+sc_websocket_sender_destroy(struct sc_websocket_sender *sender) {
+    free(sender->buf);
+}
+
+void
+sc_websocket_sender_reset(struct sc_websocket_sender *sender) {
+    sender->head = 0;
+    sender->tail = 0;
+    sender->wait_key_frame = true;
+}
+
+// Return a pointer to `size` free bytes at the tail of the queue
+static uint8_t *
+sc_websocket_sender_reserve(struct sc_websocket_sender *sender, size_t size) {
+    if (sender->tail + size <= sender->buf_size) {
+        return &sender->buf[sender->tail];
+    }
+
+    size_t pending = sc_websocket_sender_pending(sender);
+    if (pending + size <= sender->buf_size) {
+        // Enough space if the pending bytes are moved to the front
+        memmove(sender->buf, &sender->buf[sender->head], pending);
+    } else {
+        // Grow exponentially to avoid reallocations on every larger packet
+        size_t new_size = MAX(pending + size, sender->buf_size * 3 / 2);
+        uint8_t *buf = malloc(new_size);
+        if (!buf) {
+            LOG_OOM();
+            return NULL;
+        }
+        if (pending) {
+            memcpy(buf, &sender->buf[sender->head], pending);
+        }
+        free(sender->buf);
+        sender->buf = buf;
+        sender->buf_size = new_size;
+    }
+
+    sender->head = 0;
+    sender->tail = pending;
+    return &sender->buf[sender->tail];
+}
+
+// Serialize a whole frame (masked if necessary) to the tail of the queue
+static bool
+sc_websocket_sender_push(struct sc_websocket_sender *sender, uint8_t opcode,
+                         const uint8_t *prefix, size_t prefix_len,
+                         const uint8_t *payload, size_t payload_len) {
+    uint64_t total = prefix_len + payload_len;
+
+    uint8_t mask[4];
+    if (sender->mask) {
+        sc_write32be(mask, sc_rand_u32(&sender->rand));
+    }
+
+    uint8_t header[SC_WEBSOCKET_FRAME_HEADER_MAX_SIZE];
+    size_t header_len =
+        sc_websocket_write_frame_header(header, true, opcode, total,
+                                        sender->mask ? mask : NULL);
+
+    uint8_t *buf = sc_websocket_sender_reserve(sender, header_len + total);
+    if (!buf) {
+        return false;
+    }
+
+    memcpy(buf, header, header_len);
+    buf += header_len;
+    if (sender->mask) {
+        sc_websocket_mask_copy(buf, prefix, prefix_len, mask, 0);
+        sc_websocket_mask_copy(&buf[prefix_len], payload, payload_len, mask,
+                               prefix_len);
+    } else {
+        if (prefix_len) {
+            memcpy(buf, prefix, prefix_len);
+        }
+        if (payload_len) {
+            memcpy(&buf[prefix_len], payload, payload_len);
+        }
+    }
+
+    sender->tail += header_len + total;
+
+    size_t pending = sc_websocket_sender_pending(sender);
+    sender->stats.max_queue_bytes = MAX(sender->stats.max_queue_bytes,
+                                        pending);
+    return true;
+}
+
+enum sc_websocket_push_result
+sc_websocket_sender_push_media(struct sc_websocket_sender *sender,
+                               const struct sc_media_header *header,
+                               const uint8_t *payload) {
+    bool key_frame = header->flags & SC_MEDIA_FLAG_KEY_FRAME;
+    bool config = header->flags & SC_MEDIA_FLAG_CONFIG;
+
+    if (sender->watermark) {
+        size_t pending = sc_websocket_sender_pending(sender);
+        if (key_frame) {
+            // Even a key frame is dropped if the peer is totally stuck, to
+            // bound the memory
+            if (pending > sender->watermark * SC_WEBSOCKET_QUEUE_LIMIT_FACTOR) {
+                sender->wait_key_frame = true;
+                ++sender->stats.dropped_frames;
+                return SC_WEBSOCKET_PUSH_DROPPED;
+            }
+            sender->wait_key_frame = false;
+        } else if (!config) {
+            if (sender->wait_key_frame || pending > sender->watermark) {
+                // The following frames cannot be decoded without this one
+                sender->wait_key_frame = true;
+                ++sender->stats.dropped_frames;
+                return SC_WEBSOCKET_PUSH_DROPPED;
+            }
+        }
+    }
+
+    uint8_t media_header[SC_MEDIA_HEADER_SIZE];
+    sc_media_header_write(media_header, header);
+    if (!sc_websocket_sender_push(sender, SC_WEBSOCKET_OPCODE_BINARY,
+                                  media_header, sizeof(media_header), payload,
+                                  header->size)) {
+        return SC_WEBSOCKET_PUSH_ERROR;
+    }
+
+    ++sender->stats.frames;
+    return SC_WEBSOCKET_PUSH_OK;
+}
+
+bool
+sc_websocket_sender_push_text(struct sc_websocket_sender *sender,
+                              const char *text, size_t len) {
+    return sc_websocket_sender_push(sender, SC_WEBSOCKET_OPCODE_TEXT, NULL, 0,
+                                    (const uint8_t *) text, len);
+}
+
+bool
+sc_websocket_sender_flush(struct sc_websocket_sender *sender, int fd) {
+    while (sender->head < sender->tail) {
+        ssize_t w = send(fd, &sender->buf[sender->head],
+                         sender->tail - sender->head, SC_WEBSOCKET_SEND_FLAGS);
+        if (w == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Retry on the next flush
+                return true;
+            }
+            LOGE("WebSocket: could not write: %s", strerror(errno));
+            return false;
+        }
+
+        sender->head += w;
+        sender->stats.bytes_sent += w;
+    }
+
+    // Empty, restart from the beginning of the buffer
+    sender->head = 0;
+    sender->tail = 0;
+    return true;
+}
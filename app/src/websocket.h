@@ -0,0 +1,211 @@
+#ifndef SC_WEBSOCKET_H
+#define SC_WEBSOCKET_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "util/rand.h"
+
+/**
+ * WebSocket framing (RFC 6455) and binary media frames
+ *
+ * Each media packet is sent as a single binary WebSocket message, whose
+ * payload is a fixed 16-byte media header followed by the packet data. The
+ * header values are big-endian:
+ *
+ *     stream id (1) | flags (1) | reserved (2) | PTS (8) | size (4)
+ *
+ * The PTS is in microseconds (or -1 if unknown, e.g. for a config packet).
+ */
+
+#define SC_WEBSOCKET_OPCODE_CONTINUATION 0x0
+#define SC_WEBSOCKET_OPCODE_TEXT 0x1
+#define SC_WEBSOCKET_OPCODE_BINARY 0x2
+#define SC_WEBSOCKET_OPCODE_CLOSE 0x8
+#define SC_WEBSOCKET_OPCODE_PING 0x9
+#define SC_WEBSOCKET_OPCODE_PONG 0xA
+
+// 2 bytes + 8 bytes extended payload length + 4 bytes masking key
+#define SC_WEBSOCKET_FRAME_HEADER_MAX_SIZE 14
+
+#define SC_MEDIA_HEADER_SIZE 16
+
+// base64 of a 20-byte SHA-1 digest, including the null byte
+#define SC_WEBSOCKET_ACCEPT_SIZE 29
+
+// Above this multiple of the watermark, even key frames are dropped
+#define SC_WEBSOCKET_QUEUE_LIMIT_FACTOR 4
+
+#define SC_MEDIA_STREAM_VIDEO 0
+#define SC_MEDIA_STREAM_AUDIO 1
+
+#define SC_MEDIA_FLAG_KEY_FRAME 0x01
+#define SC_MEDIA_FLAG_CONFIG 0x02
+
+struct sc_media_header {
+    uint8_t stream_id;
+    uint8_t flags;
+    int64_t pts;
+    uint32_t size; // payload size, excluding the media header
+};
+
+struct sc_websocket_frame_info {
+    bool fin;
+    uint8_t opcode;
+    bool masked;
+    uint8_t mask[4];
+    uint64_t payload_length;
+};
+
+/**
+ * Sender of WebSocket frames
+ *
+ * The client must mask all the frames it sends (RFC 6455, section 5.3). Since
+ * the packet data may be shared with other components, it is never masked in
+ * place: it is masked while copied to the outbound queue.
+ *
+ * Frames may be pushed to the outbound queue, to be written later to a
+ * non-blocking socket by sc_websocket_sender_flush(). If the peer does not
+ * read fast enough, the queue grows: above the watermark, non-key media
+ * frames are dropped. Since the following frames depend on a dropped frame,
+ * all the non-key frames are then dropped until the next key frame.
+ */
+struct sc_websocket_sender {
+    // if false, frames are not masked (server to client)
+    bool mask;
+    struct sc_rand rand;
+
+    // outbound queue, the pending bytes are in [head, tail)
+    uint8_t *buf;
+    size_t buf_size;
+    size_t head;
+    size_t tail;
+
+    // 0 for no limit
+    size_t watermark;
+    bool wait_key_frame;
+
+    struct sc_websocket_stats {
+        uint64_t frames; // media frames pushed to the queue
+        uint64_t dropped_frames;
+        uint64_t bytes_sent;
+        size_t max_queue_bytes;
+    } stats;
+};
+
+enum sc_websocket_push_result {
+    SC_WEBSOCKET_PUSH_OK,
+    SC_WEBSOCKET_PUSH_DROPPED,
+    SC_WEBSOCKET_PUSH_ERROR,
+};
+
+void
+sc_media_header_write(uint8_t *buf, const struct sc_media_header *header);
+
+void
+sc_media_header_read(const uint8_t *buf, struct sc_media_header *header);
+
+/**
+ * Write a WebSocket frame header into `buf` (of at least
+ * SC_WEBSOCKET_FRAME_HEADER_MAX_SIZE bytes)
+ *
+ * If `mask` is NULL, the frame is not masked.
+ *
+ * Return the header length.
+ */
+size_t
+sc_websocket_write_frame_header(uint8_t *buf, bool fin, uint8_t opcode,
+                                uint64_t payload_length, const uint8_t *mask);
+
+/**
+ * Parse a WebSocket frame header
+ *
+ * Return the header length, or 0 if `len` bytes are not sufficient to parse
+ * the whole header.
+ */
+size_t
+sc_websocket_parse_frame_header(const uint8_t *buf, size_t len,
+                                struct sc_websocket_frame_info *info);
+
+/**
+ * Copy `len` bytes from `src` to `dst`, masked with `mask`
+ *
+ * The `offset` is the position of `src` in the frame payload (the masking key
+ * is applied cyclically from the start of the payload).
+ *
+ * It also unmasks, since masking is an involution. `dst` may be equal to
+ * `src`.
+ */
+void
+sc_websocket_mask_copy(uint8_t *dst, const uint8_t *src, size_t len,
+                       const uint8_t mask[4], size_t offset);
+
+/**
+ * Compute the Sec-WebSocket-Accept value of a server handshake response from
+ * the Sec-WebSocket-Key of the client request (RFC 6455, section 4.2.2)
+ *
+ * The result is written (null-terminated) into `accept` (of at least
+ * SC_WEBSOCKET_ACCEPT_SIZE bytes).
+ */
+bool
+sc_websocket_compute_accept(const char *key, size_t key_len, char *accept);
+
+/**
+ * Initialize a sender
+ *
+ * Above `watermark` queued bytes, non-key media frames are dropped (0 for no
+ * limit).
+ */
+void
+sc_websocket_sender_init(struct sc_websocket_sender *sender, bool mask,
+                         size_t watermark);
+
+void
+sc_websocket_sender_destroy(struct sc_websocket_sender *sender);
+
+/**
+ * Push a media packet to the outbound queue, as a single binary WebSocket
+ * message
+ *
+ * Return SC_WEBSOCKET_PUSH_DROPPED if the frame has been dropped due to
+ * congestion.
+ */
+enum sc_websocket_push_result
+sc_websocket_sender_push_media(struct sc_websocket_sender *sender,
+                               const struct sc_media_header *header,
+                               const uint8_t *payload);
+
+/**
+ * Push a text message (e.g. metadata in JSON) to the outbound queue
+ *
+ * A text message is never dropped.
+ */
+bool
+sc_websocket_sender_push_text(struct sc_websocket_sender *sender,
+                              const char *text, size_t len);
+
+/**
+ * Write as many queued bytes as possible to `fd` without blocking
+ *
+ * Return false on error (e.g. connection closed).
+ */
+bool
+sc_websocket_sender_flush(struct sc_websocket_sender *sender, int fd);
+
+/**
+ * Drop all the queued bytes (e.g. on disconnection)
+ *
+ * The next media frame must be a key frame.
+ */
+void
+sc_websocket_sender_reset(struct sc_websocket_sender *sender);
+
+static inline size_t
+sc_websocket_sender_pending(const struct sc_websocket_sender *sender) {
+    return sender->tail - sender->head;
+}
+
+#endif
@@ -0,0 +1,455 @@
+#include "ws_server.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "util/log.h"
+#include "util/strbuf.h"
+#include "websocket.h"
+
+/** Downcast packet_sink to sc_ws_server */
+#define DOWNCAST(SINK) container_of(SINK, struct sc_ws_server, packet_sink)
+/** Downcast broadcast server to sc_ws_server */
+#define DOWNCAST_BROADCAST(BS) container_of(BS, struct sc_ws_server, broadcast)
+/** Downcast broadcast client to sc_ws_viewer */
+#define DOWNCAST_CLIENT(CLIENT) \
+    container_of(CLIENT, struct sc_ws_viewer, client)
+
+static const char *STREAM_INFO_TEMPLATE =
+    "{"
+    "\"type\":\"stream_info\","
+    "\"codec\":\"%s\","
+    "\"width\":%d,"
+    "\"height\":%d"
+    "}";
+
+static_assert(SC_WEBSOCKET_FRAME_HEADER_MAX_SIZE + SC_MEDIA_HEADER_SIZE
+                <= SC_BROADCAST_PACKET_HEADER_MAX_SIZE,
+              "WebSocket media header too large");
+
+struct sc_ws_viewer {
+    struct sc_broadcast_client client;
+
+    // Only accessed by the server thread
+
+    // incoming frames are discarded, but their headers must be parsed to
+    // detect a close frame
+    uint8_t rx_header[SC_WEBSOCKET_FRAME_HEADER_MAX_SIZE];
+    size_t rx_header_len;
+    uint64_t rx_skip; // payload bytes to discard
+};
+
+static struct sc_broadcast_packet *
+sc_ws_packet_new_media(const AVPacket *packet, uint8_t flags) {
+    struct sc_broadcast_packet *p = sc_broadcast_packet_new_ref(packet);
+    if (!p) {
+        return NULL;
+    }
+
+    struct sc_media_header header = {
+        .stream_id = SC_MEDIA_STREAM_VIDEO,
+        .flags = flags,
+        .pts = packet->pts == AV_NOPTS_VALUE ? -1 : packet->pts,
+        .size = packet->size,
+    };
+
+    size_t len =
+        sc_websocket_write_frame_header(p->header, true,
+                                        SC_WEBSOCKET_OPCODE_BINARY,
+                                        SC_MEDIA_HEADER_SIZE + packet->size,
+                                        NULL);
+    sc_media_header_write(&p->header[len], &header);
+    p->header_len = len + SC_MEDIA_HEADER_SIZE;
+
+    p->flags = SC_BROADCAST_PACKET_MEDIA;
+    if (flags & SC_MEDIA_FLAG_KEY_FRAME) {
+        p->flags |= SC_BROADCAST_PACKET_KEY;
+    }
+    if (flags & SC_MEDIA_FLAG_CONFIG) {
+        p->flags |= SC_BROADCAST_PACKET_CONFIG;
+    }
+    return p;
+}
+
+/**
+ * Create a message, sent as a WebSocket text message if `text` is true, or
+ * as raw bytes (e.g. an HTTP response) otherwise
+ */
+static struct sc_broadcast_packet *
+sc_ws_packet_new_message(const char *data, size_t len, bool text) {
+    struct sc_broadcast_packet *p = sc_broadcast_packet_new(len);
+    if (!p) {
+        return NULL;
+    }
+
+    memcpy(p->data, data, len);
+    if (text) {
+        p->header_len =
+            sc_websocket_write_frame_header(p->header, true,
+                                            SC_WEBSOCKET_OPCODE_TEXT, len,
+                                            NULL);
+    }
+    return p;
+}
+
+static const char *
+get_codec_name(enum AVCodecID codec_id) {
+    switch (codec_id) {
+        case AV_CODEC_ID_H264:
+            return "h264";
+        case AV_CODEC_ID_HEVC:
+            return "h265";
+        case AV_CODEC_ID_AV1:
+            return "av1";
+        default:
+            return "unknown";
+    }
+}
+
+static bool
+sc_ws_server_format_stats(struct sc_ws_server *server, struct sc_strbuf *buf) {
+    struct sc_broadcast_client_stats stats[SC_BROADCAST_SERVER_MAX_CLIENTS];
+    size_t count = sc_broadcast_server_get_stats(&server->broadcast, stats,
+                                                 ARRAY_LEN(stats));
+    assert(count <= ARRAY_LEN(stats));
+
+    if (!sc_strbuf_append_str(buf, "{\"viewers\":[")) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const struct sc_broadcast_client_stats *s = &stats[i];
+
+        char item[320];
+        int len = snprintf(item, sizeof(item),
+                           "%s{\"id\":%" PRIu32 ",\"duration_ms\":%" PRItick
+                           ",\"frames\":%" PRIu64 ",\"dropped_frames\":%"
+                           PRIu64 ",\"bytes_sent\":%" PRIu64
+                           ",\"queue_packets\":%zu,\"queue_bytes\":%zu"
+                           ",\"max_queue_bytes\":%zu}",
+                           i ? "," : "", s->id, SC_TICK_TO_MS(s->duration),
+                           s->frames, s->dropped_frames, s->bytes_sent,
+                           s->queue_packets, s->queue_bytes,
+                           s->max_queue_bytes);
+        assert(len > 0 && (size_t) len < sizeof(item));
+        if (!sc_strbuf_append(buf, item, len)) {
+            return false;
+        }
+    }
+
+    return sc_strbuf_append_str(buf, "]}");
+}
+
+static void
+sc_ws_server_respond_stats(struct sc_ws_server *server,
+                           struct sc_broadcast_client *client) {
+    struct sc_strbuf buf;
+    if (!sc_strbuf_init(&buf, 256)) {
+        LOG_OOM();
+        client->failed = true;
+        return;
+    }
+
+    if (!sc_ws_server_format_stats(server, &buf)) {
+        LOG_OOM();
+        free(buf.s);
+        client->failed = true;
+        return;
+    }
+
+    sc_broadcast_server_respond(&server->broadcast, client, "200 OK",
+                                "application/json", buf.s, buf.len);
+    free(buf.s);
+}
+
+// Find the value of an HTTP header (the name is case-insensitive)
+static const char *
+find_header(const char *request, const char *name, size_t *value_len) {
+    size_t name_len = strlen(name);
+
+    // Skip the request line
+    const char *line = strstr(request, "\r\n");
+    while (line) {
+        line += 2;
+        const char *end = strstr(line, "\r\n");
+        if (!end || end == line) {
+            // End of headers
+            return NULL;
+        }
+
+        if (!strncasecmp(line, name, name_len) && line[name_len] == ':') {
+            const char *value = &line[name_len + 1];
+            while (*value == ' ' || *value == '\t') {
+                ++value;
+            }
+            const char *value_end = end;
+            while (value_end > value
+                    && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+                --value_end;
+            }
+            *value_len = value_end - value;
+            return value;
+        }
+
+        line = end;
+    }
+
+    return NULL;
+}
+
+static void
+sc_ws_server_on_request(struct sc_broadcast_server *bs,
+                        struct sc_broadcast_client *client) {
+    struct sc_ws_server *server = DOWNCAST_BROADCAST(bs);
+    const char *request = client->request;
+
+    if (strncmp(request, "GET ", 4)) {
+        sc_broadcast_server_respond_error(bs, client,
+                                          "405 Method Not Allowed");
+        return;
+    }
+
+    const char *path = &request[4];
+    size_t path_len = strcspn(path, " \r\n");
+    if (path_len == 6 && !strncmp(path, "/stats", 6)) {
+        sc_ws_server_respond_stats(server, client);
+        return;
+    }
+
+    size_t key_len;
+    const char *key = find_header(request, "Sec-WebSocket-Key", &key_len);
+    if (!key) {
+        sc_broadcast_server_respond_error(bs, client, "426 Upgrade Required");
+        return;
+    }
+
+    char accept[SC_WEBSOCKET_ACCEPT_SIZE];
+    if (!sc_websocket_compute_accept(key, key_len, accept)) {
+        client->failed = true;
+        return;
+    }
+
+    char response[256];
+    int len = snprintf(response, sizeof(response),
+                       "HTTP/1.1 101 Switching Protocols\r\n"
+                       "Upgrade: websocket\r\n"
+                       "Connection: Upgrade\r\n"
+                       "Sec-WebSocket-Accept: %s\r\n"
+                       "\r\n", accept);
+    assert(len > 0 && (size_t) len < sizeof(response));
+
+    struct sc_broadcast_packet *p =
+        sc_ws_packet_new_message(response, len, false);
+    if (!p) {
+        client->failed = true;
+        return;
+    }
+
+    // Start streaming: send the stream info, then the config and the packets
+    // since the last key frame, so that the viewer can start immediately
+    sc_mutex_lock(&bs->mutex);
+    bool ok = sc_broadcast_client_push(client, p);
+    size_t count = 0;
+    if (ok) {
+        if (server->stream_info) {
+            sc_broadcast_client_push(client, server->stream_info);
+        }
+        if (server->config) {
+            sc_broadcast_client_push(client, server->config);
+        }
+        count = sc_broadcast_server_start_client(bs, client);
+    }
+    sc_mutex_unlock(&bs->mutex);
+
+    sc_broadcast_packet_unref(p);
+
+    if (ok) {
+        LOGI("WebSocket viewer %" PRIu32 " connected (%zu packets cached)",
+             client->id, count);
+    }
+}
+
+// Discard the incoming frames, return false on close frame
+static bool
+sc_ws_viewer_consume_input(struct sc_ws_viewer *viewer, const uint8_t *data,
+                           size_t len) {
+    while (len) {
+        if (viewer->rx_skip) {
+            size_t n = MIN(len, viewer->rx_skip);
+            data += n;
+            len -= n;
+            viewer->rx_skip -= n;
+            continue;
+        }
+
+        assert(viewer->rx_header_len < sizeof(viewer->rx_header));
+        viewer->rx_header[viewer->rx_header_len++] = *data++;
+        --len;
+
+        struct sc_websocket_frame_info info;
+        if (!sc_websocket_parse_frame_header(viewer->rx_header,
+                                             viewer->rx_header_len, &info)) {
+            // Not complete
+            continue;
+        }
+
+        viewer->rx_header_len = 0;
+        if (info.opcode == SC_WEBSOCKET_OPCODE_CLOSE) {
+            LOGD("WebSocket viewer %" PRIu32 ": close frame received",
+                 viewer->client.id);
+            return false;
+        }
+        viewer->rx_skip = info.payload_length;
+    }
+
+    return true;
+}
+
+static bool
+sc_ws_server_on_input(struct sc_broadcast_server *bs,
+                      struct sc_broadcast_client *client, const uint8_t *data,
+                      size_t len) {
+    (void) bs;
+    return sc_ws_viewer_consume_input(DOWNCAST_CLIENT(client), data, len);
+}
+
+static bool
+sc_ws_server_packet_sink_open(struct sc_packet_sink *sink,
+                              AVCodecContext *ctx) {
+    struct sc_ws_server *server = DOWNCAST(sink);
+
+    char message[256];
+    int len = snprintf(message, sizeof(message), STREAM_INFO_TEMPLATE,
+                       get_codec_name(ctx->codec_id), ctx->width, ctx->height);
+    assert(len > 0 && (size_t) len < sizeof(message));
+
+    struct sc_broadcast_packet *p =
+        sc_ws_packet_new_message(message, len, true);
+    if (!p) {
+        return false;
+    }
+
+    sc_mutex_lock(&server->broadcast.mutex);
+    assert(!server->stream_info);
+    server->stream_info = p;
+    sc_broadcast_server_broadcast(&server->broadcast, p);
+    sc_mutex_unlock(&server->broadcast.mutex);
+
+    return true;
+}
+
+static void
+sc_ws_server_packet_sink_close(struct sc_packet_sink *sink) {
+    // Nothing to do, the viewers remain connected until the server is stopped
+    (void) sink;
+}
+
+static bool
+sc_ws_server_packet_sink_push(struct sc_packet_sink *sink,
+                              const AVPacket *packet) {
+    struct sc_ws_server *server = DOWNCAST(sink);
+
+    bool config = packet->pts == AV_NOPTS_VALUE;
+    uint8_t flags = config ? SC_MEDIA_FLAG_CONFIG
+                  : packet->flags & AV_PKT_FLAG_KEY ? SC_MEDIA_FLAG_KEY_FRAME
+                  : 0;
+
+    struct sc_broadcast_packet *p = sc_ws_packet_new_media(packet, flags);
+    if (!p) {
+        return false;
+    }
+
+    sc_mutex_lock(&server->broadcast.mutex);
+
+    if (config) {
+        // The config packet is merged into the next media packet by the
+        // demuxer, it is only sent alone to late joiners
+        if (server->config) {
+            sc_broadcast_packet_unref(server->config);
+        }
+        server->config = p; // move the reference
+        sc_mutex_unlock(&server->broadcast.mutex);
+        return true;
+    }
+
+    bool ok = sc_broadcast_server_cache(&server->broadcast, p);
+    if (ok) {
+        sc_broadcast_server_broadcast(&server->broadcast, p);
+    }
+
+    sc_broadcast_packet_unref(p);
+    sc_mutex_unlock(&server->broadcast.mutex);
+
+    return ok;
+}
+
+bool
+sc_ws_server_init(struct sc_ws_server *server, uint16_t port) {
+    static const struct sc_broadcast_server_ops broadcast_ops = {
+        .name = "WebSocket",
+        .thread_name = "scrcpy-ws",
+        .client_size = sizeof(struct sc_ws_viewer),
+        .on_request = sc_ws_server_on_request,
+        .on_input = sc_ws_server_on_input,
+    };
+
+    if (!sc_broadcast_server_init(&server->broadcast, port, &broadcast_ops)) {
+        return false;
+    }
+
+    server->stream_info = NULL;
+    server->config = NULL;
+
+    static const struct sc_packet_sink_ops ops = {
+        .open = sc_ws_server_packet_sink_open,
+        .close = sc_ws_server_packet_sink_close,
+        .push = sc_ws_server_packet_sink_push,
+    };
+
+    server->packet_sink.ops = &ops;
+
+    return true;
+}
+
+bool
+sc_ws_server_start(struct sc_ws_server *server) {
+    if (!sc_broadcast_server_start(&server->broadcast)) {
+        return false;
+    }
+
+    LOGI("WebSocket server listening on ws://127.0.0.1:%" PRIu16 "/",
+         server->broadcast.port);
+    return true;
+}
+
+void
+sc_ws_server_stop(struct sc_ws_server *server) {
+    sc_broadcast_server_stop(&server->broadcast);
+}
+
+void
+sc_ws_server_join(struct sc_ws_server *server) {
+    sc_broadcast_server_join(&server->broadcast);
+}
+
+void
+sc_ws_server_destroy(struct sc_ws_server *server) {
+    sc_broadcast_server_destroy(&server->broadcast);
+
+    if (server->config) {
+        sc_broadcast_packet_unref(server->config);
+    }
+    if (server->stream_info) {
+        sc_broadcast_packet_unref(server->stream_info);
+    }
+}
+
+size_t
+sc_ws_server_get_stats(struct sc_ws_server *server,
+                       struct sc_broadcast_client_stats *stats, size_t max) {
+    return sc_broadcast_server_get_stats(&server->broadcast, stats, max);
+}
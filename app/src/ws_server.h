@@ -0,0 +1,72 @@
+#ifndef SC_WS_SERVER_H
+#define SC_WS_SERVER_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <libavcodec/avcodec.h>
+
+#include "broadcast_server.h"
+#include "trait/packet_sink.h"
+
+/**
+ * WebSocket broadcast server
+ *
+ * Serve the encoded video stream (as received from the device, without
+ * re-encoding) to several WebSocket viewers, in the same format as the WebRTC
+ * streamer: a JSON "stream_info" text message, then one binary message per
+ * packet (see websocket.h).
+ *
+ * The packets are shared between the viewers (see broadcast_server.h): a slow
+ * viewer drops frames (until the next key frame) without impacting the others.
+ *
+ * A late joiner immediately receives the codec config and the packets since
+ * the last key frame, so that it can start decoding without waiting for the
+ * next key frame.
+ *
+ * The stats of the viewers are available in JSON at /stats.
+ */
+
+struct sc_ws_server {
+    struct sc_packet_sink packet_sink; // packet sink trait
+
+    struct sc_broadcast_server broadcast;
+
+    // The fields below are protected by broadcast.mutex
+
+    // the "stream_info" message, once the stream is open
+    struct sc_broadcast_packet *stream_info;
+    // the last config packet
+    struct sc_broadcast_packet *config;
+};
+
+bool
+sc_ws_server_init(struct sc_ws_server *server, uint16_t port);
+
+/**
+ * Listen on localhost and start the server thread
+ */
+bool
+sc_ws_server_start(struct sc_ws_server *server);
+
+void
+sc_ws_server_stop(struct sc_ws_server *server);
+
+void
+sc_ws_server_join(struct sc_ws_server *server);
+
+void
+sc_ws_server_destroy(struct sc_ws_server *server);
+
+/**
+ * Get the stats of (at most `max`) connected viewers
+ *
+ * Return the number of connected viewers (which may be greater than `max`).
+ */
+size_t
+sc_ws_server_get_stats(struct sc_ws_server *server,
+                       struct sc_broadcast_client_stats *stats, size_t max);
+
+#endif
@@ -0,0 +1,304 @@
+#include "common.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adaptive_buffering.h"
+
+#define SAMPLE_RATE 48000
+#define MS(ms) ((ms) * SAMPLE_RATE / 1000)
+
+static void test_raise_on_jitter(void) {
+    struct sc_adaptive_buffering ab;
+    sc_adaptive_buffering_init(&ab, SAMPLE_RATE, MS(50), MS(20), MS(200));
+
+    // 40ms of jitter
+    for (unsigned i = 0; i < 50; ++i) {
+        int64_t pts = i * 20000;
+        sc_tick delay = i % 2 ? 40000 : 0;
+        sc_adaptive_buffering_push(&ab, pts, 1000000 + pts + delay);
+    }
+
+    bool changed = sc_adaptive_buffering_update(&ab, 0);
+    assert(changed);
+    assert(ab.jitter == 40000);
+    // min + jitter + 25%
+    assert(ab.target == MS(20 + 40 + 10));
+}
+
+static void test_raise_on_underflow(void) {
+    struct sc_adaptive_buffering ab;
+    sc_adaptive_buffering_init(&ab, SAMPLE_RATE, MS(50), MS(20), MS(60));
+
+    // No jitter, but underflow
+    for (unsigned i = 0; i < 50; ++i) {
+        int64_t pts = i * 20000;
+        sc_adaptive_buffering_push(&ab, pts, pts);
+    }
+
+    bool changed = sc_adaptive_buffering_update(&ab, MS(2));
+    assert(changed);
+    // Raised by one step (10ms)
+    assert(ab.target == MS(60));
+
+    // Never exceed the max
+    changed = sc_adaptive_buffering_update(&ab, MS(2));
+    assert(!changed);
+    assert(ab.target == MS(60));
+}
+
+static void test_lower_with_hysteresis(void) {
+    struct sc_adaptive_buffering ab;
+    sc_adaptive_buffering_init(&ab, SAMPLE_RATE, MS(50), MS(20), MS(200));
+
+    for (unsigned updates = 1; updates <= 30; ++updates) {
+        for (unsigned i = 0; i < 50; ++i) {
+            int64_t pts = i * 20000;
+            sc_adaptive_buffering_push(&ab, pts, pts);
+        }
+        bool changed = sc_adaptive_buffering_update(&ab, 0);
+        // Not lowered during the first 10 seconds, then lowered by steps of
+        // 10ms until the difference is below the threshold (10ms)
+        assert(changed == (updates == 11 || updates == 12));
+    }
+
+    assert(ab.target == MS(30));
+}
+
+/*
+ * Simulation of the audio regulator fed with synthetic network traces, to
+ * compare the adaptive target buffering with a fixed setting.
+ *
+ * The device produces packets of 20ms, the player consumes blocks of 5ms. The
+ * packets arrive in order (TCP), delayed according to the trace. Like the
+ * audio regulator, silence is inserted on underflow, samples are dropped when
+ * the buffering exceeds a threshold, and a compensation (limited to 2%) is
+ * recomputed every second to converge to the target buffering.
+ */
+
+#define PACKET_SAMPLES 960 // 20ms
+#define PULL_SAMPLES 240 // 5ms
+#define SIMULATION_PACKETS (120 * 50) // 120 seconds
+
+enum trace {
+    TRACE_USB,
+    TRACE_WIFI,
+    // Wi-Fi degraded during 40 seconds
+    TRACE_MIXED,
+};
+
+static sc_tick
+trace_delay(enum trace trace, unsigned packet, uint32_t *rnd) {
+    *rnd = *rnd * 1103515245 + 12345;
+    uint32_t r = *rnd >> 8;
+
+    if (trace == TRACE_MIXED) {
+        unsigned sec = packet / 50;
+        trace = sec >= 40 && sec < 80 ? TRACE_WIFI : TRACE_USB;
+    }
+
+    if (trace == TRACE_USB) {
+        // 1 to 3ms
+        return 1000 + r % 2000;
+    }
+
+    // 3 to 23ms, with frequent spikes up to 70ms
+    sc_tick delay = 3000 + r % 20000;
+    if (r % 50 == 0) {
+        delay += 30000 + (r >> 8) % 40000;
+    }
+    return delay;
+}
+
+struct simulation_result {
+    double latency; // average buffering in ms
+    double underflow; // silence inserted in ms
+    unsigned adjustments;
+};
+
+static struct simulation_result
+simulate(enum trace trace, unsigned target_ms, unsigned min_ms,
+         unsigned max_ms) {
+    bool adaptive = min_ms < max_ms;
+    struct sc_adaptive_buffering ab;
+    if (adaptive) {
+        sc_adaptive_buffering_init(&ab, SAMPLE_RATE, MS(target_ms),
+                                   MS(min_ms), MS(max_ms));
+    }
+
+    uint32_t target = MS(target_ms);
+    int64_t buffered = 0;
+    bool played = false;
+
+    uint64_t latency_sum = 0;
+    uint64_t pulls = 0;
+    uint64_t underflow = 0;
+    uint32_t underflow_period = 0;
+    unsigned adjustments = 0;
+
+    // Compensation state
+    int64_t period_sum = 0;
+    unsigned period_pulls = 0;
+    double compensation = 0; // samples per pull
+    double compensation_acc = 0;
+
+    uint32_t rnd = 42;
+    unsigned packet = 0;
+    sc_tick last_arrival = 0;
+    sc_tick next_arrival = trace_delay(trace, 0, &rnd);
+    sc_tick next_pull = 0;
+
+    while (packet < SIMULATION_PACKETS) {
+        if (next_arrival <= next_pull) {
+            int64_t pts = (int64_t) packet * 20000;
+            buffered += PACKET_SAMPLES;
+            if (played && adaptive) {
+                sc_adaptive_buffering_push(&ab, pts, next_arrival);
+            }
+
+            uint32_t max_buffered = played ? target * 11 / 10 + MS(60)
+                                           : target + MS(10);
+            if (buffered > max_buffered) {
+                buffered = max_buffered;
+            }
+
+            last_arrival = next_arrival;
+            ++packet;
+            sc_tick arrival = (int64_t) packet * 20000
+                            + trace_delay(trace, packet, &rnd);
+            // In order
+            next_arrival = MAX(arrival, last_arrival);
+            continue;
+        }
+
+        next_pull += 5000;
+
+        if (!played) {
+            if (buffered < target) {
+                continue;
+            }
+            played = true;
+        }
+
+        compensation_acc += compensation;
+        int adjust = (int) compensation_acc;
+        compensation_acc -= adjust;
+        int64_t consume = PULL_SAMPLES - adjust;
+
+        if (buffered >= consume) {
+            buffered -= consume;
+        } else {
+            underflow_period += consume - buffered;
+            buffered = 0;
+        }
+
+        latency_sum += buffered;
+        ++pulls;
+        period_sum += buffered;
+        ++period_pulls;
+
+        if (period_pulls == SAMPLE_RATE / PULL_SAMPLES) {
+            // Every second
+            if (adaptive && sc_adaptive_buffering_update(&ab,
+                                                         underflow_period)) {
+                target = ab.target;
+                ++adjustments;
+            }
+            assert(target >= MS(min_ms) && target <= MS(max_ms));
+
+            underflow += underflow_period;
+            underflow_period = 0;
+
+            int64_t avg = period_sum / period_pulls;
+            int64_t diff = (int64_t) target - avg;
+            int64_t threshold = compensation ? MS(1) : MS(4);
+            if (llabs(diff) < threshold || (diff < 0 && buffered < target)) {
+                diff = 0;
+            }
+            // Compensate over 4 seconds, limited to 2%
+            int64_t distance = 4 * SAMPLE_RATE;
+            diff = CLAMP(diff, -distance / 50, distance / 50);
+            compensation = (double) diff * PULL_SAMPLES / distance;
+
+            period_sum = 0;
+            period_pulls = 0;
+        }
+    }
+
+    struct simulation_result result = {
+        .latency = (double) latency_sum / pulls * 1000 / SAMPLE_RATE,
+        .underflow = (double) (underflow + underflow_period) * 1000
+                   / SAMPLE_RATE,
+        .adjustments = adjustments,
+    };
+    return result;
+}
+
+struct simulation_results {
+    struct simulation_result fixed20;
+    struct simulation_result fixed50;
+    struct simulation_result adaptive;
+};
+
+static void
+simulate_all(enum trace t, struct simulation_results *r) {
+    r->fixed20 = simulate(t, 20, 20, 20);
+    r->fixed50 = simulate(t, 50, 50, 50);
+    r->adaptive = simulate(t, 50, 20, 200);
+}
+
+static void test_simulation(void) {
+    for (enum trace t = TRACE_USB; t <= TRACE_MIXED; ++t) {
+        struct simulation_results r;
+        simulate_all(t, &r);
+
+        // Never worse than the fixed setting at the same initial target
+        assert(r.adaptive.underflow <= r.fixed50.underflow);
+
+        if (t == TRACE_USB) {
+            // Low jitter: the latency is reduced
+            assert(r.adaptive.latency < r.fixed50.latency);
+        } else {
+            // High jitter: the underflow is reduced
+            assert(r.adaptive.underflow < r.fixed20.underflow);
+            assert(r.adaptive.adjustments);
+        }
+    }
+}
+
+static void
+print_result(const char *name, struct simulation_result *r) {
+    printf("%-22s latency %6.1f ms, underflow %7.1f ms, %u adjustments\n",
+           name, r->latency, r->underflow, r->adjustments);
+}
+
+static void
+bench_simulation(void) {
+    static const char *const names[] = {"usb", "wifi", "mixed"};
+
+    for (enum trace t = TRACE_USB; t <= TRACE_MIXED; ++t) {
+        struct simulation_results r;
+        simulate_all(t, &r);
+
+        printf("[%s]\n", names[t]);
+        print_result("fixed 20ms", &r.fixed20);
+        print_result("fixed 50ms", &r.fixed50);
+        print_result("adaptive 20-200ms", &r.adaptive);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && !strcmp(argv[1], "--benchmark")) {
+        bench_simulation();
+        return 0;
+    }
+
+    test_raise_on_jitter();
+    test_raise_on_underflow();
+    test_lower_with_hysteresis();
+    test_simulation();
+
+    return 0;
+}
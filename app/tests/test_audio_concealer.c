@@ -0,0 +1,166 @@
+#include "common.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "audio_concealer.h"
+
+#define SAMPLE_RATE 48000
+#define CHANNELS 2
+#define AMPLITUDE 0.8f
+
+#define FREQUENCY 440
+// The max difference between two consecutive samples of the signal
+#define SIGNAL_STEP (4 * AMPLITUDE * FREQUENCY / SAMPLE_RATE)
+
+// 440Hz triangle wave, with the right channel in opposite phase
+static void
+generate_signal(float *out, uint32_t offset, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t x = (offset + i) * FREQUENCY % SAMPLE_RATE;
+        float p = (float) x / SAMPLE_RATE;
+        float v = AMPLITUDE * (p < 0.5f ? 4 * p - 1 : 3 - 4 * p);
+        out[i * CHANNELS] = v;
+        out[i * CHANNELS + 1] = -v;
+    }
+}
+
+static float
+abs_float(float v) {
+    return v < 0 ? -v : v;
+}
+
+// Return the max difference between two consecutive samples
+static float
+max_step(const float *samples, uint32_t count) {
+    float max = 0;
+    for (uint32_t i = 1; i < count; ++i) {
+        for (unsigned c = 0; c < CHANNELS; ++c) {
+            float step = abs_float(samples[i * CHANNELS + c]
+                             - samples[(i - 1) * CHANNELS + c]);
+            max = MAX(max, step);
+        }
+    }
+    return max;
+}
+
+static void test_conceal_continuity(void) {
+    struct sc_audio_concealer ac;
+    bool ok = sc_audio_concealer_init(&ac, CHANNELS, SAMPLE_RATE);
+    assert(ok);
+
+    // 10ms of real samples, 30ms concealed, then 10ms of real samples
+    static float out[2400 * CHANNELS];
+    generate_signal(out, 0, 480);
+    sc_audio_concealer_feed(&ac, out, 480);
+
+    sc_audio_concealer_conceal(&ac, &out[480 * CHANNELS], 1000);
+    sc_audio_concealer_conceal(&ac, &out[1480 * CHANNELS], 440);
+
+    generate_signal(&out[1920 * CHANNELS], 1920, 480);
+    sc_audio_concealer_feed(&ac, &out[1920 * CHANNELS], 480);
+
+    // The first concealed sample is the last real sample
+    assert(out[480 * CHANNELS] == out[479 * CHANNELS]);
+    assert(out[480 * CHANNELS + 1] == out[479 * CHANNELS + 1]);
+
+    // Faded out after 20ms
+    for (uint32_t i = 480 + 960; i < 1920; ++i) {
+        assert(out[i * CHANNELS] == 0);
+        assert(out[i * CHANNELS + 1] == 0);
+    }
+
+    // No discontinuity (inserting silence would cause steps up to the
+    // amplitude)
+    assert(max_step(out, 2400) < SIGNAL_STEP * 1.1f);
+
+    // The concealment has been counted once
+    assert(ac.concealment_count == 1);
+    assert(ac.concealed_samples == 1440);
+
+    sc_audio_concealer_conceal(&ac, out, 10);
+    assert(ac.concealment_count == 2);
+    assert(ac.concealed_samples == 1450);
+
+    sc_audio_concealer_destroy(&ac);
+}
+
+static void test_crossfade(void) {
+    struct sc_audio_concealer ac;
+    bool ok = sc_audio_concealer_init(&ac, CHANNELS, SAMPLE_RATE);
+    assert(ok);
+
+    // Short underflow (2ms), then real samples by small blocks (the
+    // crossfade spans several blocks)
+    static float out[1200 * CHANNELS];
+    generate_signal(out, 0, 480);
+    sc_audio_concealer_feed(&ac, out, 480);
+
+    sc_audio_concealer_conceal(&ac, &out[480 * CHANNELS], 96);
+
+    for (uint32_t i = 576; i < 1200; i += 48) {
+        // The device samples are late, so the signal continues from 480
+        generate_signal(&out[i * CHANNELS], i - 96, 48);
+        sc_audio_concealer_feed(&ac, &out[i * CHANNELS], 48);
+    }
+
+    // Replaying the history backwards does not exceed the signal slope, but
+    // the crossfade may add a small slope
+    assert(max_step(out, 1200) < SIGNAL_STEP * 1.5f);
+
+    // After the crossfade (5ms), the real samples are unchanged
+    float expected[48 * CHANNELS];
+    generate_signal(expected, 1152 - 96, 48);
+    assert(!memcmp(&out[1152 * CHANNELS], expected, sizeof(expected)));
+
+    sc_audio_concealer_destroy(&ac);
+}
+
+static void test_conceal_short_history(void) {
+    struct sc_audio_concealer ac;
+    bool ok = sc_audio_concealer_init(&ac, CHANNELS, SAMPLE_RATE);
+    assert(ok);
+
+    float out[16 * CHANNELS];
+
+    // No history: silence
+    sc_audio_concealer_conceal(&ac, out, 16);
+    for (unsigned i = 0; i < 16 * CHANNELS; ++i) {
+        assert(out[i] == 0);
+    }
+
+    float samples[] = {0.1f, -0.1f, 0.2f, -0.2f, 0.3f, -0.3f};
+    sc_audio_concealer_feed(&ac, samples, 3);
+    // The first samples were crossfaded with the (silent) concealment signal
+    assert(samples[0] != 0.1f);
+
+    sc_audio_concealer_destroy(&ac);
+
+    ok = sc_audio_concealer_init(&ac, CHANNELS, SAMPLE_RATE);
+    assert(ok);
+
+    // The history is replayed backwards, then forwards
+    sc_audio_concealer_feed_const(&ac, (float[]) {0.1f, -0.1f, 0.2f, -0.2f,
+                                                 0.3f, -0.3f}, 3);
+    sc_audio_concealer_conceal(&ac, out, 6);
+    float gain_step = 1.0f / (SAMPLE_RATE / 50);
+    static const float expected[] = {0.3f, 0.2f, 0.1f, 0.1f, 0.2f, 0.3f};
+    for (unsigned i = 0; i < 6; ++i) {
+        float gain = 1 - i * gain_step;
+        assert(abs_float(out[i * CHANNELS] - expected[i] * gain) < 1e-6f);
+        assert(abs_float(out[i * CHANNELS + 1] + expected[i] * gain) < 1e-6f);
+    }
+
+    sc_audio_concealer_destroy(&ac);
+}
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    test_conceal_continuity();
+    test_crossfade();
+    test_conceal_short_history();
+
+    return 0;
+}
@@ -1,9 +1,14 @@
 #include "common.h"
 
 #include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "util/audiobuf.h"
+#include "util/thread.h"
+#include "util/tick.h"
 
 static void test_audiobuf_simple(void) {
     struct sc_audiobuf buf;
@@ -124,13 +129,322 @@ static void test_audiobuf_partial_read_write(void) {
     sc_audiobuf_destroy(&buf);
 }
 
+static void test_audiobuf_write_overwrite(void) {
+    struct sc_audiobuf buf;
+    uint32_t data[10];
+
+    bool ok = sc_audiobuf_init(&buf, 4, 8);
+    assert(ok);
+
+    uint32_t samples[] = {1, 2, 3, 4, 5, 6};
+    uint32_t dropped = sc_audiobuf_write_overwrite(&buf, samples, 6);
+    assert(dropped == 0);
+
+    uint32_t samples2[] = {7, 8, 9, 10, 11};
+    dropped = sc_audiobuf_write_overwrite(&buf, samples2, 5);
+    assert(dropped == 3);
+    assert(sc_audiobuf_can_read(&buf) == 8);
+
+    uint32_t r = sc_audiobuf_read(&buf, data, 10);
+    assert(r == 8);
+    uint32_t expected[] = {4, 5, 6, 7, 8, 9, 10, 11};
+    assert(!memcmp(data, expected, 32));
+
+    sc_audiobuf_destroy(&buf);
+}
+
+static void test_audiobuf_drop(void) {
+    struct sc_audiobuf buf;
+    uint32_t data[10];
+
+    bool ok = sc_audiobuf_init(&buf, 4, 8);
+    assert(ok);
+
+    uint32_t samples[] = {1, 2, 3, 4, 5, 6};
+    uint32_t w = sc_audiobuf_write(&buf, samples, 6);
+    assert(w == 6);
+
+    // The samples are only dropped by the reader
+    sc_audiobuf_drop(&buf, 4);
+    assert(sc_audiobuf_can_read(&buf) == 2);
+    assert(buf.tail == 0);
+
+    uint32_t r = sc_audiobuf_read(&buf, data, 1);
+    assert(r == 1);
+    assert(data[0] == 5);
+    assert(sc_audiobuf_can_read(&buf) == 1);
+
+    // If the reader consumes the samples before they are dropped, the next
+    // samples are dropped instead
+    sc_audiobuf_drop(&buf, 1);
+    r = sc_audiobuf_read(&buf, NULL, 1);
+    assert(r == 0);
+
+    uint32_t samples2[] = {7, 8, 9};
+    w = sc_audiobuf_write(&buf, samples2, 3);
+    assert(w == 3);
+    assert(sc_audiobuf_can_read(&buf) == 3);
+
+    sc_audiobuf_drop(&buf, 1);
+    assert(sc_audiobuf_can_read(&buf) == 2);
+
+    r = sc_audiobuf_read(&buf, data, 10);
+    assert(r == 2);
+    uint32_t expected[] = {8, 9};
+    assert(!memcmp(data, expected, 8));
+    assert(!sc_audiobuf_can_read(&buf));
+
+    sc_audiobuf_destroy(&buf);
+}
+
+static void test_audiobuf_mirror(void) {
+    struct sc_audiobuf buf;
+
+    // 3 bytes per sample, so that the page size is not a multiple of the
+    // sample size
+    bool ok = sc_audiobuf_init_mirror(&buf, 3, 1000);
+    assert(ok);
+
+    uint32_t capacity = sc_audiobuf_capacity(&buf);
+    assert(capacity >= 1000);
+
+    if (buf.mirror_size) {
+        long page_size = sysconf(_SC_PAGESIZE);
+        assert(buf.mirror_size % page_size == 0);
+        assert(buf.mirror_size == buf.alloc_size * buf.sample_size);
+
+        // The memory after the end of the buffer is the beginning of the
+        // buffer
+        buf.data[0] = 42;
+        assert(buf.data[buf.mirror_size] == 42);
+        buf.data[2 * buf.mirror_size - 1] = 43;
+        assert(buf.data[buf.mirror_size - 1] == 43);
+    }
+    // Without mirrored mapping, the fallback must behave the same
+
+    // Write and read blocks crossing the end of the buffer several times
+    uint8_t block[3 * 700];
+    uint8_t data[3 * 700];
+    uint32_t value = 0;
+    uint32_t expected = 0;
+    for (unsigned i = 0; i < 20; ++i) {
+        uint32_t count = 300 + (i * 37) % 400;
+        for (uint32_t j = 0; j < count; ++j) {
+            block[j * 3] = value & 0xFF;
+            block[j * 3 + 1] = (value >> 8) & 0xFF;
+            block[j * 3 + 2] = (value >> 16) & 0xFF;
+            ++value;
+        }
+
+        uint32_t w = sc_audiobuf_write(&buf, block, count);
+        assert(w == count);
+
+        uint32_t r = sc_audiobuf_read(&buf, data, count);
+        assert(r == count);
+        for (uint32_t j = 0; j < count; ++j) {
+            uint32_t v = data[j * 3]
+                       | (data[j * 3 + 1] << 8)
+                       | (data[j * 3 + 2] << 16);
+            assert(v == expected);
+            ++expected;
+        }
+    }
+
+    // Silence across the end of the buffer
+    uint32_t w = sc_audiobuf_write_silence(&buf, capacity);
+    assert(w == capacity);
+    w = sc_audiobuf_write_silence(&buf, 1);
+    assert(!w);
+
+    for (uint32_t remaining = capacity; remaining;) {
+        uint32_t r = sc_audiobuf_read(&buf, data, MIN(remaining, 700));
+        assert(r);
+        for (size_t j = 0; j < r * 3; ++j) {
+            assert(!data[j]);
+        }
+        remaining -= r;
+    }
+
+    sc_audiobuf_destroy(&buf);
+}
+
+#define STRESS_SAMPLES 200000
+#define STRESS_MAX_BUFFERED 80
+
+struct stress {
+    struct sc_audiobuf buf;
+    // Number of iterations to spin between two reads or two writes, to make
+    // the producer and the consumer run at different rates
+    unsigned producer_spin;
+    unsigned consumer_spin;
+    atomic_bool producer_done;
+    uint32_t dropped;
+};
+
+static void
+spin(unsigned count) {
+    for (volatile unsigned i = 0; i < count; ++i);
+}
+
+static int
+run_producer(void *userdata) {
+    struct stress *stress = userdata;
+
+    uint32_t block[64];
+    uint32_t next = 0;
+    unsigned rnd = 42;
+    while (next < STRESS_SAMPLES) {
+        rnd = rnd * 1103515245 + 12345;
+        uint32_t count = 1 + (rnd >> 16) % 64;
+        if (count > STRESS_SAMPLES - next) {
+            count = STRESS_SAMPLES - next;
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            block[i] = next++;
+        }
+        // The samples which do not fit are dropped
+        uint32_t w = sc_audiobuf_write(&stress->buf, block, count);
+        stress->dropped += count - w;
+
+        // Limit the buffering, like the audio regulator
+        uint32_t can_read = sc_audiobuf_can_read(&stress->buf);
+        if (can_read > STRESS_MAX_BUFFERED) {
+            sc_audiobuf_drop(&stress->buf, can_read - STRESS_MAX_BUFFERED);
+            stress->dropped += can_read - STRESS_MAX_BUFFERED;
+        }
+
+        spin(stress->producer_spin);
+    }
+
+    atomic_store(&stress->producer_done, true);
+    return 0;
+}
+
+static void
+stress_audiobuf(unsigned producer_spin, unsigned consumer_spin, bool mirror) {
+    struct stress stress = {
+        .producer_spin = producer_spin,
+        .consumer_spin = consumer_spin,
+        .dropped = 0,
+    };
+    atomic_init(&stress.producer_done, false);
+
+    // Small capacity to make the producer drop samples often (the mirrored
+    // buffer capacity is rounded to the page size, 1023 samples for 4K pages,
+    // so it never overflows, but the buffering is limited)
+    bool ok = mirror ? sc_audiobuf_init_mirror(&stress.buf, 4, 100)
+                     : sc_audiobuf_init(&stress.buf, 4, 100);
+    assert(ok);
+
+    sc_thread thread;
+    ok = sc_thread_create(&thread, run_producer, "producer", &stress);
+    assert(ok);
+
+    // The consumer (this thread) reads without any lock: the samples must be
+    // strictly increasing (no duplicates, no torn reads), and all the samples
+    // not read must have been reported as dropped (except the drop still
+    // pending at the end, if the reader consumed the samples first)
+    uint32_t data[48];
+    uint32_t read_count = 0;
+    int64_t last = -1;
+    for (;;) {
+        bool done = atomic_load(&stress.producer_done);
+        uint32_t r = sc_audiobuf_read(&stress.buf, data, 48);
+        for (uint32_t i = 0; i < r; ++i) {
+            assert(data[i] < STRESS_SAMPLES);
+            assert((int64_t) data[i] > last);
+            last = data[i];
+        }
+        read_count += r;
+        if (!r && done) {
+            break;
+        }
+        spin(stress.consumer_spin);
+    }
+
+    sc_thread_join(&thread, NULL);
+
+    uint32_t pending_drop = atomic_load(&stress.buf.drop);
+    assert(read_count + stress.dropped - pending_drop == STRESS_SAMPLES);
+
+    sc_audiobuf_destroy(&stress.buf);
+}
+
+static void test_audiobuf_stress(void) {
+    for (unsigned i = 0; i < 2; ++i) {
+        bool mirror = i;
+        // Producer faster than the consumer (samples are dropped)
+        stress_audiobuf(0, 2000, mirror);
+        // Consumer faster than the producer (the buffer is often empty)
+        stress_audiobuf(2000, 0, mirror);
+        // Similar rates
+        stress_audiobuf(500, 500, mirror);
+    }
+}
+
+#define BENCH_SAMPLE_SIZE 8 // stereo float
+#define BENCH_CAPACITY 48000 // 1 second at 48kHz
+#define BENCH_ITERATIONS 200000
+
+static void
+bench_audiobuf(bool mirror) {
+    struct sc_audiobuf buf;
+    bool ok = mirror ? sc_audiobuf_init_mirror(&buf, BENCH_SAMPLE_SIZE,
+                                               BENCH_CAPACITY)
+                     : sc_audiobuf_init(&buf, BENCH_SAMPLE_SIZE,
+                                        BENCH_CAPACITY);
+    assert(ok);
+
+    if (mirror && !buf.mirror_size) {
+        printf("audiobuf benchmark: mirrored mapping not available\n");
+        sc_audiobuf_destroy(&buf);
+        return;
+    }
+
+    // Blocks of variable sizes (around the size of an audio frame and of an
+    // SDL callback), so that many copies cross the end of the buffer
+    static uint8_t block[1024 * BENCH_SAMPLE_SIZE];
+    memset(block, 1, sizeof(block));
+
+    // Keep about 50ms in the buffer, like the audio regulator
+    uint32_t w = sc_audiobuf_write_silence(&buf, 2400);
+    assert(w == 2400);
+
+    uint64_t samples = 0;
+    sc_tick start = sc_tick_now();
+    for (unsigned i = 0; i < BENCH_ITERATIONS; ++i) {
+        uint32_t count = 240 + (i * 97) % 784;
+        w = sc_audiobuf_write(&buf, block, count);
+        assert(w == count);
+        uint32_t r = sc_audiobuf_read(&buf, block, count);
+        assert(r == count);
+        samples += count;
+    }
+    sc_tick duration = sc_tick_now() - start;
+
+    double ns_per_sample = (double) duration * 1000 / samples;
+    printf("audiobuf %s: %" PRIu64 " samples written and read, "
+           "%.2f ns/sample, %.1f MB/s\n",
+           mirror ? "mirror" : "default", samples, ns_per_sample,
+           BENCH_SAMPLE_SIZE * 2 / ns_per_sample * 1000);
+
+    sc_audiobuf_destroy(&buf);
+}
+
 int main(int argc, char *argv[]) {
-    (void) argc;
-    (void) argv;
+    if (argc > 1 && !strcmp(argv[1], "--benchmark")) {
+        bench_audiobuf(false);
+        bench_audiobuf(true);
+        return 0;
+    }
 
     test_audiobuf_simple();
     test_audiobuf_boundaries();
     test_audiobuf_partial_read_write();
+    test_audiobuf_write_overwrite();
+    test_audiobuf_drop();
+    test_audiobuf_mirror();
+    test_audiobuf_stress();
 
     return 0;
 }
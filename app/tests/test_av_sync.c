@@ -0,0 +1,80 @@
+#include "common.h"
+
+#include <assert.h>
+
+#include "av_sync.h"
+
+static void test_audio_clock(void) {
+    struct sc_av_sync sync;
+    sc_av_sync_init(&sync);
+
+    sc_tick offset;
+    bool ok = sc_av_sync_get_audio_offset(&sync, &offset);
+    assert(!ok);
+
+    // The audio player pulls 5ms every 5ms, the samples are played 80ms after
+    // their capture on the device
+    for (unsigned i = 0; i < 200; ++i) {
+        sc_tick pts = i * SC_TICK_FROM_MS(5);
+        sc_av_sync_update_audio(&sync, pts + SC_TICK_FROM_MS(80), pts);
+    }
+
+    ok = sc_av_sync_get_audio_offset(&sync, &offset);
+    assert(ok);
+    assert(offset == SC_TICK_FROM_MS(80));
+
+    // The jitter of the pull dates is smoothed
+    for (unsigned i = 0; i < 200; ++i) {
+        sc_tick pts = i * SC_TICK_FROM_MS(5);
+        sc_tick jitter = i % 2 ? SC_TICK_FROM_MS(2) : -SC_TICK_FROM_MS(2);
+        sc_av_sync_update_audio(&sync, pts + SC_TICK_FROM_MS(80) + jitter,
+                                pts);
+    }
+
+    ok = sc_av_sync_get_audio_offset(&sync, &offset);
+    assert(ok);
+    assert(offset > SC_TICK_FROM_MS(79) && offset < SC_TICK_FROM_MS(81));
+}
+
+static void test_report_video(void) {
+    struct sc_av_sync sync;
+    sc_av_sync_init(&sync);
+
+    // Not measured until the audio clock is known
+    sc_av_sync_report_video(&sync, 0, SC_TICK_FROM_MS(10), 0);
+    assert(!sync.total_offset_count);
+
+    sc_av_sync_update_audio(&sync, SC_TICK_FROM_MS(100), 0);
+
+    // A video frame presented 10ms after the audio samples having the same PTS
+    sc_av_sync_report_video(&sync, SC_TICK_FROM_MS(20), SC_TICK_FROM_MS(130),
+                            SC_TICK_FROM_MS(90));
+    // A video frame presented 30ms before
+    sc_av_sync_report_video(&sync, SC_TICK_FROM_MS(40), SC_TICK_FROM_MS(110),
+                            SC_TICK_FROM_MS(90));
+
+    assert(sync.offset_count == 2);
+    assert(sync.offset_min == -SC_TICK_FROM_MS(30));
+    assert(sync.offset_max == SC_TICK_FROM_MS(10));
+    assert(sync.total_offset_count == 2);
+    assert(sync.total_abs_offset_sum == SC_TICK_FROM_MS(40));
+    assert(sync.total_abs_offset_max == SC_TICK_FROM_MS(30));
+
+    // The periodic statistics are reset every second
+    sc_av_sync_report_video(&sync, SC_TICK_FROM_MS(1100),
+                            SC_TICK_FROM_MS(1200), SC_TICK_FROM_MS(90));
+    assert(sync.offset_count == 0);
+    assert(sync.total_offset_count == 3);
+
+    sc_av_sync_log_summary(&sync);
+}
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    test_audio_clock();
+    test_report_video();
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include "common.h"
+
+#include <assert.h>
+
+#include "bitrate_controller.h"
+
+#define MAX_BIT_RATE 4000000
+#define STEP SC_TICK_FROM_MS(10)
+
+struct link {
+    uint32_t capacity; // bits per second
+    size_t queue_bytes;
+    uint64_t acked_bytes;
+    sc_tick now;
+
+    unsigned downs;
+    unsigned ups;
+};
+
+// Simulate an encoder producing the target bitrate of the controller, sending
+// through a link of limited capacity
+static void
+simulate(struct sc_bitrate_controller *bc, struct link *link,
+         sc_tick duration) {
+    sc_tick end = link->now + duration;
+    while (link->now < end) {
+        link->now += STEP;
+
+        uint32_t bit_rate = sc_bitrate_controller_get_bit_rate(bc);
+        link->queue_bytes += (uint64_t) bit_rate * STEP / SC_TICK_FREQ / 8;
+
+        size_t sent = (uint64_t) link->capacity * STEP / SC_TICK_FREQ / 8;
+        sent = MIN(sent, link->queue_bytes);
+        link->queue_bytes -= sent;
+        link->acked_bytes += sent;
+
+        struct sc_bitrate_sample sample = {
+            .queue_bytes = link->queue_bytes,
+            .acked_bytes = link->acked_bytes,
+            .dropped_frames = 0,
+        };
+        enum sc_bitrate_change change =
+            sc_bitrate_controller_update(bc, link->now, &sample);
+        if (change == SC_BITRATE_DOWN) {
+            ++link->downs;
+        } else if (change == SC_BITRATE_UP) {
+            ++link->ups;
+        }
+    }
+}
+
+static void test_get_size(void) {
+    struct sc_bitrate_controller bc;
+    sc_bitrate_controller_init(&bc, MAX_BIT_RATE, 1920, 0);
+
+    uint16_t w, h;
+    sc_bitrate_controller_get_size(&bc, 1080, 2400, &w, &h);
+    assert(w == 864);
+    assert(h == 1920);
+
+    sc_bitrate_controller_get_size(&bc, 2400, 1080, &w, &h);
+    assert(w == 1920);
+    assert(h == 864);
+
+    // Never upscaled
+    sc_bitrate_controller_get_size(&bc, 1280, 720, &w, &h);
+    assert(w == 1280);
+    assert(h == 720);
+
+    // The levels with a reduced size
+    bc.level = 2;
+    sc_bitrate_controller_get_size(&bc, 1080, 2400, &w, &h);
+    assert(w == 648);
+    assert(h == 1440);
+
+    // Without max size, relative to the source size (rounded to even values)
+    sc_bitrate_controller_init(&bc, MAX_BIT_RATE, 0, 0);
+    sc_bitrate_controller_get_size(&bc, 1081, 2401, &w, &h);
+    assert(w == 1080);
+    assert(h == 2400);
+
+    bc.level = SC_BITRATE_CONTROLLER_LEVELS - 1;
+    sc_bitrate_controller_get_size(&bc, 1080, 2400, &w, &h);
+    assert(w == 540);
+    assert(h == 1200);
+    (void) w;
+    (void) h;
+}
+
+static void test_congestion(void) {
+    struct sc_bitrate_controller bc;
+    sc_bitrate_controller_init(&bc, MAX_BIT_RATE, 0, 0);
+
+    struct link link = {
+        .capacity = 5000000,
+    };
+
+    // The link is fast enough
+    simulate(&bc, &link, SC_TICK_FROM_SEC(30));
+    assert(bc.level == 0);
+    assert(!link.downs);
+
+    // The link becomes too slow: step down one level per second, to the
+    // first level which fits (3 levels down, at 1.4 Mbps)
+    link.capacity = 1500000;
+    sc_tick start = link.now;
+    while (sc_bitrate_controller_get_bit_rate(&bc) > link.capacity) {
+        simulate(&bc, &link, STEP);
+        assert(link.now - start < SC_TICK_FROM_MS(3500));
+    }
+    assert(link.downs == 3);
+
+    // It stays stable (the failed steps up are delayed more and more)
+    link.downs = 0;
+    link.ups = 0;
+    simulate(&bc, &link, SC_TICK_FROM_SEC(120));
+    assert(link.downs <= 4);
+    assert(sc_bitrate_controller_get_bit_rate(&bc) <= link.capacity);
+    assert(sc_bitrate_controller_get_bit_rate(&bc) >= link.capacity / 2);
+
+    // The link recovers
+    link.capacity = 10000000;
+    simulate(&bc, &link, SC_TICK_FROM_SEC(300));
+    assert(bc.level == 0);
+    assert(link.queue_bytes == 0);
+    (void) start;
+}
+
+static void test_dropped_frames(void) {
+    struct sc_bitrate_controller bc;
+    sc_bitrate_controller_init(&bc, MAX_BIT_RATE, 0, 0);
+
+    struct sc_bitrate_sample sample = {
+        .queue_bytes = 0,
+        .acked_bytes = 500000,
+        .dropped_frames = 0,
+    };
+    enum sc_bitrate_change change =
+        sc_bitrate_controller_update(&bc, SC_TICK_FROM_SEC(1), &sample);
+    assert(change == SC_BITRATE_KEEP);
+
+    // Dropped frames mean congestion, even if the queue is empty
+    sample.acked_bytes = 1000000;
+    sample.dropped_frames = 3;
+    change = sc_bitrate_controller_update(&bc, SC_TICK_FROM_SEC(2), &sample);
+    assert(change == SC_BITRATE_DOWN);
+    // One level down, whatever the measured throughput
+    assert(sc_bitrate_controller_get_bit_rate(&bc) == 2800000);
+    assert(bc.level == 1);
+
+    // The congestion persists: the next step down waits for 1 second
+    sample.acked_bytes = 1100000;
+    sample.dropped_frames = 6;
+    change = sc_bitrate_controller_update(&bc, SC_TICK_FROM_MS(2500), &sample);
+    assert(change == SC_BITRATE_KEEP);
+
+    sample.acked_bytes = 1200000;
+    sample.dropped_frames = 9;
+    change = sc_bitrate_controller_update(&bc, SC_TICK_FROM_SEC(3), &sample);
+    assert(change == SC_BITRATE_DOWN);
+    assert(bc.level == 2);
+    (void) change;
+}
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    test_get_size();
+    test_congestion();
+    test_dropped_frames();
+    return 0;
+}
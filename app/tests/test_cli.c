@@ -121,6 +121,54 @@ static void test_options2(void) {
     assert(opts->record_format == SC_RECORD_FORMAT_MP4);
 }
 
+static void test_options_record_stdout(void) {
+    struct scrcpy_cli_args args = {
+        .opts = scrcpy_options_default,
+        .help = false,
+        .version = false,
+    };
+
+    char *argv[] = {
+        "scrcpy",
+        "--no-playback",
+        "--record=-",
+        "--record-format=ts",
+    };
+
+    bool ok = scrcpy_parse_args(&args, ARRAY_LEN(argv), argv);
+    assert(ok);
+
+    const struct scrcpy_options *opts = &args.opts;
+    assert(sc_record_is_stdout(opts->record_filename));
+    assert(opts->record_format == SC_RECORD_FORMAT_TS);
+}
+
+#ifdef HAVE_V4L2
+static void test_options_v4l2(void) {
+    struct scrcpy_cli_args args = {
+        .opts = scrcpy_options_default,
+        .help = false,
+        .version = false,
+    };
+
+    char *argv[] = {
+        "scrcpy",
+        "--v4l2-sink=/dev/video2",
+        "--v4l2-format=nv12",
+        "--v4l2-size=1280x720",
+    };
+
+    bool ok = scrcpy_parse_args(&args, ARRAY_LEN(argv), argv);
+    assert(ok);
+
+    const struct scrcpy_options *opts = &args.opts;
+    assert(!strcmp(opts->v4l2_device, "/dev/video2"));
+    assert(opts->v4l2_format == SC_V4L2_FORMAT_NV12);
+    assert(opts->v4l2_width == 1280);
+    assert(opts->v4l2_height == 720);
+}
+#endif
+
 static void test_parse_shortcut_mods(void) {
     uint8_t mods;
     bool ok;
@@ -157,6 +205,10 @@ int main(int argc, char *argv[]) {
     test_flag_help();
     test_options();
     test_options2();
+    test_options_record_stdout();
+#ifdef HAVE_V4L2
+    test_options_v4l2();
+#endif
     test_parse_shortcut_mods();
     return 0;
 }
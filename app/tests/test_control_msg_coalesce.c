@@ -0,0 +1,220 @@
+#include "common.h"
+
+#include <assert.h>
+
+#include "control_msg.h"
+#include "hid/hid_gamepad.h"
+#include "hid/hid_keyboard.h"
+#include "hid/hid_mouse.h"
+
+static struct sc_control_msg
+touch(enum android_motionevent_action action, uint64_t pointer_id,
+      int32_t x, int32_t y, enum android_motionevent_buttons buttons) {
+    struct sc_control_msg msg = {
+        .type = SC_CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT,
+        .inject_touch_event = {
+            .action = action,
+            .action_button = 0,
+            .buttons = buttons,
+            .pointer_id = pointer_id,
+            .position = {
+                .point = {
+                    .x = x,
+                    .y = y,
+                },
+                .screen_size = {
+                    .width = 1080,
+                    .height = 1920,
+                },
+            },
+            .pressure = 1.0f,
+        },
+    };
+    return msg;
+}
+
+static struct sc_control_msg
+scroll(float hscroll, float vscroll, enum android_motionevent_buttons buttons) {
+    struct sc_control_msg msg = {
+        .type = SC_CONTROL_MSG_TYPE_INJECT_SCROLL_EVENT,
+        .inject_scroll_event = {
+            .position = {
+                .point = {
+                    .x = 260,
+                    .y = 1026,
+                },
+                .screen_size = {
+                    .width = 1080,
+                    .height = 1920,
+                },
+            },
+            .hscroll = hscroll,
+            .vscroll = vscroll,
+            .buttons = buttons,
+        },
+    };
+    return msg;
+}
+
+static void test_coalesce_touch_move(void) {
+    struct sc_control_msg queued =
+        touch(AMOTION_EVENT_ACTION_MOVE, SC_POINTER_ID_MOUSE, 100, 200,
+              AMOTION_EVENT_BUTTON_PRIMARY);
+    struct sc_control_msg msg =
+        touch(AMOTION_EVENT_ACTION_MOVE, SC_POINTER_ID_MOUSE, 110, 220,
+              AMOTION_EVENT_BUTTON_PRIMARY);
+    msg.inject_touch_event.pressure = 0.5f;
+
+    bool ok = sc_control_msg_coalesce(&queued, &msg);
+    assert(ok);
+    assert(queued.inject_touch_event.position.point.x == 110);
+    assert(queued.inject_touch_event.position.point.y == 220);
+    assert(queued.inject_touch_event.pressure == 0.5f);
+}
+
+static void test_coalesce_touch_move_mismatch(void) {
+    struct sc_control_msg queued =
+        touch(AMOTION_EVENT_ACTION_MOVE, SC_POINTER_ID_MOUSE, 100, 200,
+              AMOTION_EVENT_BUTTON_PRIMARY);
+
+    // Another pointer
+    struct sc_control_msg msg =
+        touch(AMOTION_EVENT_ACTION_MOVE, SC_POINTER_ID_VIRTUAL_FINGER, 110,
+              220, AMOTION_EVENT_BUTTON_PRIMARY);
+    assert(!sc_control_msg_coalesce(&queued, &msg));
+    assert(sc_control_msg_can_overtake(&queued, &msg));
+
+    // Other buttons
+    msg = touch(AMOTION_EVENT_ACTION_MOVE, SC_POINTER_ID_MOUSE, 110, 220,
+                AMOTION_EVENT_BUTTON_PRIMARY | AMOTION_EVENT_BUTTON_SECONDARY);
+    assert(!sc_control_msg_coalesce(&queued, &msg));
+    assert(!sc_control_msg_can_overtake(&queued, &msg));
+
+    // Not a MOVE
+    msg = touch(AMOTION_EVENT_ACTION_UP, SC_POINTER_ID_MOUSE, 110, 220, 0);
+    assert(!sc_control_msg_coalesce(&queued, &msg));
+    assert(!sc_control_msg_can_overtake(&queued, &msg));
+
+    // A MOVE must not be merged into a DOWN
+    queued = touch(AMOTION_EVENT_ACTION_DOWN, SC_POINTER_ID_MOUSE, 100, 200,
+                   AMOTION_EVENT_BUTTON_PRIMARY);
+    msg = touch(AMOTION_EVENT_ACTION_MOVE, SC_POINTER_ID_MOUSE, 110, 220,
+                AMOTION_EVENT_BUTTON_PRIMARY);
+    assert(!sc_control_msg_coalesce(&queued, &msg));
+    assert(!sc_control_msg_can_overtake(&queued, &msg));
+
+    // The queued message is unchanged
+    assert(queued.inject_touch_event.position.point.x == 100);
+    assert(queued.inject_touch_event.position.point.y == 200);
+}
+
+static void test_coalesce_scroll(void) {
+    struct sc_control_msg queued = scroll(1, -2, 0);
+    struct sc_control_msg msg = scroll(0.5f, -3, 0);
+
+    bool ok = sc_control_msg_coalesce(&queued, &msg);
+    assert(ok);
+    assert(queued.inject_scroll_event.hscroll == 1.5f);
+    assert(queued.inject_scroll_event.vscroll == -5);
+
+    // Other buttons
+    msg = scroll(1, 1, AMOTION_EVENT_BUTTON_PRIMARY);
+    assert(!sc_control_msg_coalesce(&queued, &msg));
+
+    // Scroll events never overtake each other
+    assert(!sc_control_msg_can_overtake(&queued, &msg));
+}
+
+static void test_coalesce_scroll_limit(void) {
+    struct sc_control_msg queued = scroll(0, 12, 0);
+    struct sc_control_msg msg = scroll(0, 4, 0);
+
+    // Exactly the max amount
+    bool ok = sc_control_msg_coalesce(&queued, &msg);
+    assert(ok);
+    assert(queued.inject_scroll_event.vscroll == 16);
+
+    // Would be clamped on serialization
+    msg = scroll(0, 1, 0);
+    assert(!sc_control_msg_coalesce(&queued, &msg));
+    assert(queued.inject_scroll_event.vscroll == 16);
+}
+
+static void test_coalesce_other(void) {
+    struct sc_control_msg queued = {
+        .type = SC_CONTROL_MSG_TYPE_INJECT_KEYCODE,
+        .inject_keycode = {
+            .action = AKEY_EVENT_ACTION_DOWN,
+            .keycode = AKEYCODE_ENTER,
+        },
+    };
+    struct sc_control_msg msg = queued;
+    assert(!sc_control_msg_coalesce(&queued, &msg));
+    assert(!sc_control_msg_can_overtake(&queued, &msg));
+}
+
+static void test_priority(void) {
+    struct sc_control_msg move =
+        touch(AMOTION_EVENT_ACTION_MOVE, 1, 100, 200, 0);
+    struct sc_control_msg up = touch(AMOTION_EVENT_ACTION_UP, 1, 100, 200, 0);
+    struct sc_control_msg down =
+        touch(AMOTION_EVENT_ACTION_DOWN, 2, 100, 200, 0);
+    struct sc_control_msg scr = scroll(1, 1, 0);
+    struct sc_control_msg input = {
+        .type = SC_CONTROL_MSG_TYPE_UHID_INPUT,
+        .uhid_input = {
+            .id = SC_HID_ID_MOUSE,
+        },
+    };
+    struct sc_control_msg gamepad_input = {
+        .type = SC_CONTROL_MSG_TYPE_UHID_INPUT,
+        .uhid_input = {
+            .id = SC_HID_ID_GAMEPAD_FIRST,
+        },
+    };
+    struct sc_control_msg keyboard_input = {
+        .type = SC_CONTROL_MSG_TYPE_UHID_INPUT,
+        .uhid_input = {
+            .id = SC_HID_ID_KEYBOARD,
+        },
+    };
+    struct sc_control_msg destroy = {
+        .type = SC_CONTROL_MSG_TYPE_UHID_DESTROY,
+        .uhid_destroy = {
+            .id = SC_HID_ID_MOUSE,
+        },
+    };
+
+    assert(sc_control_msg_is_low_priority(&move));
+    assert(sc_control_msg_is_low_priority(&scr));
+    assert(sc_control_msg_is_low_priority(&input));
+    assert(sc_control_msg_is_low_priority(&gamepad_input));
+    // UHID keyboard input has the same priority as key events
+    assert(!sc_control_msg_is_low_priority(&keyboard_input));
+    assert(!sc_control_msg_is_low_priority(&up));
+    assert(!sc_control_msg_is_low_priority(&down));
+    assert(!sc_control_msg_is_low_priority(&destroy));
+
+    // Same pointer
+    assert(sc_control_msg_must_follow(&move, &up));
+    // Other pointer
+    assert(!sc_control_msg_must_follow(&move, &down));
+    // Same UHID device
+    assert(sc_control_msg_must_follow(&input, &destroy));
+    destroy.uhid_destroy.id = SC_HID_ID_GAMEPAD_FIRST;
+    assert(!sc_control_msg_must_follow(&input, &destroy));
+    assert(!sc_control_msg_must_follow(&scr, &down));
+}
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    test_coalesce_touch_move();
+    test_coalesce_touch_move_mismatch();
+    test_coalesce_scroll();
+    test_coalesce_scroll_limit();
+    test_coalesce_other();
+    test_priority();
+    return 0;
+}
@@ -0,0 +1,661 @@
+#include "common.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "controller.h"
+#include "device_msg.h"
+#include "hid/hid_gamepad.h"
+#include "hid/hid_keyboard.h"
+#include "util/binary.h"
+#include "util/net.h"
+#include "util/thread.h"
+#include "util/tick.h"
+
+/*
+ * The controller is connected to a stand-in server, which records the
+ * messages received.
+ */
+
+// Input events are generated by bursts (like several SDL events handled in
+// one frame)
+#define STORM_BURST_COUNT 200
+#define STORM_BURST_SIZE 10
+
+#define MAX_RECORDED_MSGS 4096
+
+struct test_received_msg {
+    enum sc_control_msg_type type;
+    sc_tick time;
+    // key events only
+    uint32_t repeat;
+    // touch events only
+    enum android_motionevent_action action;
+    uint64_t pointer_id;
+    int32_t x;
+    // pings only
+    uint64_t sequence;
+    // UHID input only
+    uint16_t uhid_id;
+    uint8_t uhid_data0;
+};
+
+struct test_reader {
+    sc_socket socket;
+    sc_thread thread;
+    bool reply_pings;
+
+    // The fields below are protected by the mutex, the condition is signaled
+    // on every reception
+    sc_mutex mutex;
+    sc_cond cond;
+    uint64_t received; // in bytes
+    unsigned total_count; // including the messages not recorded
+    uint64_t last_ping; // sequence of the last ping received
+    unsigned msg_count;
+    struct test_received_msg msgs[MAX_RECORDED_MSGS];
+};
+
+// Connect a socket pair through localhost (like the real server connection)
+static void
+connect_sockets(sc_socket *server, sc_socket *client) {
+    sc_socket listener = net_socket();
+    assert(listener != SC_SOCKET_NONE);
+
+    uint16_t port;
+    bool ok = false;
+    for (port = 27400; port < 27500; ++port) {
+        ok = net_listen(listener, IPV4_LOCALHOST, port, 1);
+        if (ok) {
+            break;
+        }
+    }
+    assert(ok);
+
+    *client = net_socket();
+    assert(*client != SC_SOCKET_NONE);
+    ok = net_connect(*client, IPV4_LOCALHOST, port);
+    assert(ok);
+
+    *server = net_accept(listener);
+    assert(*server != SC_SOCKET_NONE);
+
+    net_close(listener);
+
+    // Like the real control socket
+    ok = net_set_tcp_nodelay(*client, true);
+    assert(ok);
+    ok = net_set_tcp_nodelay(*server, true);
+    assert(ok);
+}
+
+// Return the size of the message at the start of buf, or 0 if incomplete
+static size_t
+parse_msg(const uint8_t *buf, size_t len, struct test_received_msg *msg) {
+    if (!len) {
+        return 0;
+    }
+
+    msg->type = buf[0];
+    switch (msg->type) {
+        case SC_CONTROL_MSG_TYPE_INJECT_KEYCODE:
+            if (len < 14) {
+                return 0;
+            }
+            msg->repeat = sc_read32be(&buf[6]);
+            return 14;
+        case SC_CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT:
+            if (len < 32) {
+                return 0;
+            }
+            msg->action = buf[1];
+            msg->pointer_id = sc_read64be(&buf[2]);
+            msg->x = sc_read32be(&buf[10]);
+            return 32;
+        case SC_CONTROL_MSG_TYPE_PING:
+            if (len < 9) {
+                return 0;
+            }
+            msg->sequence = sc_read64be(&buf[1]);
+            return 9;
+        case SC_CONTROL_MSG_TYPE_UHID_INPUT: {
+            if (len < 5) {
+                return 0;
+            }
+            size_t size = 5 + sc_read16be(&buf[3]);
+            if (len < size) {
+                return 0;
+            }
+            msg->uhid_id = sc_read16be(&buf[1]);
+            msg->uhid_data0 = buf[5];
+            return size;
+        }
+        default:
+            // not generated by the tests
+            assert(!"unexpected message type");
+            return 0;
+    }
+}
+
+static int
+run_reader(void *data) {
+    struct test_reader *reader = data;
+
+    static uint8_t buf[1 << 16];
+    size_t len = 0;
+    for (;;) {
+        ssize_t r = net_recv(reader->socket, &buf[len], sizeof(buf) - len);
+        if (r <= 0) {
+            break;
+        }
+        sc_tick now = sc_tick_now();
+        sc_mutex_lock(&reader->mutex);
+        reader->received += r;
+        len += r;
+
+        size_t pos = 0;
+        for (;;) {
+            struct test_received_msg msg;
+            size_t size = parse_msg(&buf[pos], len - pos, &msg);
+            if (!size) {
+                break;
+            }
+            pos += size;
+
+            if (msg.type == SC_CONTROL_MSG_TYPE_PING) {
+                if (reader->reply_pings) {
+                    uint8_t ack[9];
+                    ack[0] = DEVICE_MSG_TYPE_ACK_PING;
+                    sc_write64be(&ack[1], msg.sequence);
+                    ssize_t w = net_send_all(reader->socket, ack, sizeof(ack));
+                    assert(w == sizeof(ack));
+                    (void) w;
+                }
+                reader->last_ping = msg.sequence;
+            }
+
+            ++reader->total_count;
+            if (reader->msg_count < MAX_RECORDED_MSGS) {
+                msg.time = now;
+                reader->msgs[reader->msg_count++] = msg;
+            }
+        }
+
+        sc_cond_broadcast(&reader->cond);
+        sc_mutex_unlock(&reader->mutex);
+
+        memmove(buf, &buf[pos], len - pos);
+        len -= pos;
+    }
+
+    return 0;
+}
+
+static void
+on_controller_ended(struct sc_controller *controller, bool error,
+                    void *userdata) {
+    (void) controller;
+    (void) error;
+    (void) userdata;
+}
+
+struct storm {
+    const char *name;
+    // size of the serialized messages
+    size_t msg_size;
+    struct sc_control_msg (*generate)(unsigned i);
+};
+
+static struct sc_control_msg
+generate_key(unsigned i) {
+    struct sc_control_msg msg = {
+        .type = SC_CONTROL_MSG_TYPE_INJECT_KEYCODE,
+        .inject_keycode = {
+            .action = i % 2 ? AKEY_EVENT_ACTION_UP : AKEY_EVENT_ACTION_DOWN,
+            .keycode = AKEYCODE_A,
+        },
+    };
+    return msg;
+}
+
+static struct sc_control_msg
+generate_touch_move(unsigned i) {
+    // 10 fingers moving at once
+    struct sc_control_msg msg = {
+        .type = SC_CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT,
+        .inject_touch_event = {
+            .action = AMOTION_EVENT_ACTION_MOVE,
+            .pointer_id = i % 10,
+            .position = {
+                .point = {
+                    .x = i % 1080,
+                    .y = i % 1920,
+                },
+                .screen_size = {
+                    .width = 1080,
+                    .height = 1920,
+                },
+            },
+            .pressure = 1.0f,
+        },
+    };
+    return msg;
+}
+
+static struct sc_control_msg
+generate_uhid_input(unsigned i) {
+    // gamepad reports
+    struct sc_control_msg msg = {
+        .type = SC_CONTROL_MSG_TYPE_UHID_INPUT,
+        .uhid_input = {
+            .id = SC_HID_ID_GAMEPAD_FIRST,
+            .size = SC_HID_MAX_SIZE,
+        },
+    };
+    msg.uhid_input.data[0] = i;
+    return msg;
+}
+
+static struct sc_control_msg
+generate_uhid_key(unsigned i) {
+    // keyboard reports (8 bytes)
+    struct sc_control_msg msg = {
+        .type = SC_CONTROL_MSG_TYPE_UHID_INPUT,
+        .uhid_input = {
+            .id = SC_HID_ID_KEYBOARD,
+            .size = 8,
+        },
+    };
+    msg.uhid_input.data[0] = i;
+    return msg;
+}
+
+struct test_context {
+    sc_socket server;
+    sc_socket client;
+    struct test_reader reader;
+    struct sc_controller controller;
+};
+
+static void
+test_context_init(struct test_context *ctx) {
+    connect_sockets(&ctx->server, &ctx->client);
+
+    struct test_reader *reader = &ctx->reader;
+    reader->socket = ctx->server;
+    reader->reply_pings = false;
+    reader->received = 0;
+    reader->total_count = 0;
+    reader->last_ping = 0;
+    reader->msg_count = 0;
+    bool ok = sc_mutex_init(&reader->mutex);
+    assert(ok);
+    ok = sc_cond_init(&reader->cond);
+    assert(ok);
+    ok = sc_thread_create(&reader->thread, run_reader, "test-reader",
+                               reader);
+    assert(ok);
+
+    static const struct sc_controller_callbacks cbs = {
+        .on_ended = on_controller_ended,
+    };
+
+    ok = sc_controller_init(&ctx->controller, ctx->client, &cbs, NULL);
+    assert(ok);
+    // Only enabled explicitly by the tests
+    ctx->controller.ping_interval = 0;
+}
+
+// Return the number of messages which will be sent for the pushed messages
+// (the coalesced messages have been merged into queued messages)
+static unsigned
+get_expected_count(struct sc_controller *controller, unsigned pushed) {
+    sc_mutex_lock(&controller->mutex);
+    uint64_t coalesced = controller->stats.touch_moves_coalesced
+                       + controller->stats.scrolls_coalesced;
+    sc_mutex_unlock(&controller->mutex);
+
+    assert(coalesced <= pushed);
+    return pushed - coalesced;
+}
+
+// Wait until the reader has received count messages
+static void
+wait_received(struct test_reader *reader, unsigned count) {
+    sc_mutex_lock(&reader->mutex);
+    while (reader->total_count < count) {
+        sc_cond_wait(&reader->cond, &reader->mutex);
+    }
+    sc_mutex_unlock(&reader->mutex);
+}
+
+// Wait until the reader has received the ping with the given sequence
+static void
+wait_ping(struct test_reader *reader, uint64_t sequence) {
+    sc_mutex_lock(&reader->mutex);
+    while (reader->last_ping < sequence) {
+        sc_cond_wait(&reader->cond, &reader->mutex);
+    }
+    sc_mutex_unlock(&reader->mutex);
+}
+
+static void
+test_context_stop(struct test_context *ctx) {
+    sc_controller_stop(&ctx->controller);
+    net_interrupt(ctx->client);
+    sc_controller_join(&ctx->controller);
+    net_close(ctx->client);
+
+    sc_thread_join(&ctx->reader.thread, NULL);
+    net_close(ctx->server);
+
+    sc_cond_destroy(&ctx->reader.cond);
+    sc_mutex_destroy(&ctx->reader.mutex);
+}
+
+static void
+run_storm(const struct storm *storm) {
+    // static because it is big
+    static struct test_context ctx;
+    test_context_init(&ctx);
+    struct sc_controller *controller = &ctx.controller;
+
+    bool ok = sc_controller_start(controller);
+    assert(ok);
+
+    unsigned pushed = 0;
+    sc_tick start = sc_tick_now();
+    for (unsigned i = 0; i < STORM_BURST_COUNT; ++i) {
+        for (unsigned j = 0; j < STORM_BURST_SIZE; ++j) {
+            struct sc_control_msg msg =
+                storm->generate(i * STORM_BURST_SIZE + j);
+            if (sc_controller_push_msg(controller, &msg)) {
+                ++pushed;
+            }
+        }
+        usleep(500);
+    }
+
+    wait_received(&ctx.reader, get_expected_count(controller, pushed));
+    sc_tick elapsed = sc_tick_now() - start;
+
+    test_context_stop(&ctx);
+
+    uint64_t sent = controller->stats.sent;
+    uint64_t writes = controller->stats.writes;
+    assert(sent <= pushed);
+    assert(writes && writes <= sent);
+    assert(ctx.reader.received == sent * storm->msg_size);
+
+    printf("Control storm (%s): %u messages pushed, %" PRIu64 " sent in %"
+           PRIu64 " writes (%.3f syscalls/message) in %" PRItick " ms\n",
+           storm->name, pushed, sent, writes, (double) writes / sent,
+           SC_TICK_TO_MS(elapsed));
+
+    sc_controller_destroy(controller);
+}
+
+static void bench_control_storms(void) {
+    static const struct storm storms[] = {
+        {
+            .name = "keys",
+            .msg_size = 14,
+            .generate = generate_key,
+        },
+        {
+            .name = "touch moves",
+            .msg_size = 32,
+            .generate = generate_touch_move,
+        },
+        {
+            .name = "gamepad",
+            .msg_size = 5 + SC_HID_MAX_SIZE,
+            .generate = generate_uhid_input,
+        },
+    };
+
+    for (size_t i = 0; i < ARRAY_LEN(storms); ++i) {
+        run_storm(&storms[i]);
+    }
+}
+
+static struct sc_control_msg
+make_touch(enum android_motionevent_action action, uint64_t pointer_id,
+           int32_t x) {
+    struct sc_control_msg msg = generate_touch_move(0);
+    msg.inject_touch_event.action = action;
+    msg.inject_touch_event.pointer_id = pointer_id;
+    msg.inject_touch_event.position.point.x = x;
+    return msg;
+}
+
+static struct sc_control_msg
+make_key(uint32_t repeat) {
+    struct sc_control_msg msg = generate_key(0);
+    msg.inject_keycode.repeat = repeat;
+    return msg;
+}
+
+static void
+push(struct sc_controller *controller, const struct sc_control_msg *msg) {
+    bool ok = sc_controller_push_msg(controller, msg);
+    assert(ok);
+}
+
+static void test_priority_lanes(void) {
+    static struct test_context ctx;
+    test_context_init(&ctx);
+    struct sc_controller *controller = &ctx.controller;
+
+    // Queue the messages before starting the controller, so that the order is
+    // deterministic
+    for (int32_t i = 0; i < 20; ++i) {
+        struct sc_control_msg msg =
+            make_touch(AMOTION_EVENT_ACTION_MOVE, 1, i);
+        push(controller, &msg);
+        // Interleave gamepad reports, so that the moves are not coalesced
+        msg = generate_uhid_input(i);
+        push(controller, &msg);
+    }
+
+    // Must not overtake the moves of the same pointer
+    struct sc_control_msg msg = make_touch(AMOTION_EVENT_ACTION_UP, 1, 20);
+    push(controller, &msg);
+
+    // Must overtake the moves and the gamepad reports
+    msg = make_key(42);
+    push(controller, &msg);
+    msg = make_touch(AMOTION_EVENT_ACTION_DOWN, 2, 100);
+    push(controller, &msg);
+    msg = generate_uhid_key(43);
+    push(controller, &msg);
+
+    bool ok = sc_controller_start(controller);
+    assert(ok);
+
+    wait_received(&ctx.reader, 44);
+    test_context_stop(&ctx);
+
+    struct test_reader *reader = &ctx.reader;
+    assert(reader->msg_count == 44);
+
+    assert(reader->msgs[0].type == SC_CONTROL_MSG_TYPE_INJECT_KEYCODE);
+    assert(reader->msgs[0].repeat == 42);
+    assert(reader->msgs[1].type == SC_CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT);
+    assert(reader->msgs[1].action == AMOTION_EVENT_ACTION_DOWN);
+    assert(reader->msgs[1].pointer_id == 2);
+    // UHID keyboard input is not low-priority (contrary to gamepad input)
+    assert(reader->msgs[2].type == SC_CONTROL_MSG_TYPE_UHID_INPUT);
+    assert(reader->msgs[2].uhid_id == SC_HID_ID_KEYBOARD);
+    assert(reader->msgs[2].uhid_data0 == 43);
+
+    // The events of pointer 1 are kept in order
+    int32_t x = 0;
+    for (unsigned i = 3; i < reader->msg_count; ++i) {
+        const struct test_received_msg *rmsg = &reader->msgs[i];
+        if (rmsg->type == SC_CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT) {
+            assert(rmsg->pointer_id == 1);
+            assert(rmsg->x == x);
+            ++x;
+        }
+    }
+    assert(x == 21);
+    assert(reader->msgs[43].action == AMOTION_EVENT_ACTION_UP);
+
+    sc_controller_destroy(controller);
+}
+
+#define LATENCY_KEY_COUNT 50
+
+// Return the index of the key event, or -1 if msg is not a key event
+static int
+get_key_index(const struct test_received_msg *msg, bool uhid) {
+    if (uhid) {
+        if (msg->type == SC_CONTROL_MSG_TYPE_UHID_INPUT
+                && msg->uhid_id == SC_HID_ID_KEYBOARD) {
+            return msg->uhid_data0;
+        }
+    } else if (msg->type == SC_CONTROL_MSG_TYPE_INJECT_KEYCODE) {
+        return msg->repeat;
+    }
+    return -1;
+}
+
+static void
+run_keypress_latency(bool uhid) {
+    static struct test_context ctx;
+    test_context_init(&ctx);
+    struct sc_controller *controller = &ctx.controller;
+
+    bool ok = sc_controller_start(controller);
+    assert(ok);
+
+    sc_tick push_times[LATENCY_KEY_COUNT];
+    unsigned pushed = 0;
+
+    // Flood the controller with motion events (and gamepad reports, so that
+    // they are not coalesced), and push a key event from time to time
+    for (unsigned i = 0; i < LATENCY_KEY_COUNT; ++i) {
+        for (int32_t j = 0; j < 50; ++j) {
+            struct sc_control_msg msg =
+                make_touch(AMOTION_EVENT_ACTION_MOVE, 1, j);
+            if (sc_controller_push_msg(controller, &msg)) {
+                ++pushed;
+            }
+            msg = generate_uhid_input(j);
+            if (sc_controller_push_msg(controller, &msg)) {
+                ++pushed;
+            }
+        }
+
+        struct sc_control_msg msg = uhid ? generate_uhid_key(i) : make_key(i);
+        push_times[i] = sc_tick_now();
+        push(controller, &msg);
+        ++pushed;
+
+        usleep(1000);
+    }
+
+    wait_received(&ctx.reader, get_expected_count(controller, pushed));
+    test_context_stop(&ctx);
+
+    struct test_reader *reader = &ctx.reader;
+    assert(reader->msg_count < MAX_RECORDED_MSGS);
+
+    sc_tick total = 0;
+    sc_tick max = 0;
+    unsigned keys = 0;
+    for (unsigned i = 0; i < reader->msg_count; ++i) {
+        const struct test_received_msg *rmsg = &reader->msgs[i];
+        int index = get_key_index(rmsg, uhid);
+        if (index != -1) {
+            assert(index == (int) keys);
+            sc_tick delay = rmsg->time - push_times[keys];
+            total += delay;
+            max = MAX(max, delay);
+            ++keys;
+        }
+    }
+    // The key events are never dropped
+    assert(keys == LATENCY_KEY_COUNT);
+
+    printf("Keypress latency under a motion flood (%s): avg=%" PRItick
+           "us max=%" PRItick "us (%u messages received, %" PRIu64
+           " dropped)\n", uhid ? "uhid" : "inject", total / keys, max,
+           reader->msg_count, controller->stats.dropped);
+
+    sc_controller_destroy(controller);
+}
+
+static void bench_keypress_latency(void) {
+    run_keypress_latency(false);
+    run_keypress_latency(true);
+}
+
+#define PING_COUNT 5
+
+static void test_ping(void) {
+    static struct test_context ctx;
+    test_context_init(&ctx);
+    struct sc_controller *controller = &ctx.controller;
+
+    ctx.reader.reply_pings = true;
+    controller->ping_interval = SC_TICK_FROM_MS(10);
+
+    bool ok = sc_controller_start(controller);
+    assert(ok);
+
+    // A ping is sent after some input (the first one immediately, the next
+    // ones once the interval has elapsed)
+    for (unsigned i = 0; i < PING_COUNT; ++i) {
+        struct sc_control_msg msg = make_key(i);
+        push(controller, &msg);
+        wait_ping(&ctx.reader, i + 1);
+    }
+
+    // Without input since the last ping, no ping is scheduled
+    sc_mutex_lock(&controller->mutex);
+    assert(!controller->input_since_ping);
+    assert(controller->ping_sequence == PING_COUNT);
+    sc_mutex_unlock(&controller->mutex);
+
+    // Close the server side first, so that the controller receives all the
+    // acks before the end of stream
+    net_interrupt(ctx.server);
+    test_context_stop(&ctx);
+
+    unsigned pings = 0;
+    for (unsigned i = 0; i < ctx.reader.msg_count; ++i) {
+        const struct test_received_msg *rmsg = &ctx.reader.msgs[i];
+        if (rmsg->type == SC_CONTROL_MSG_TYPE_PING) {
+            assert(rmsg->sequence == ++pings);
+        }
+    }
+    assert(pings == PING_COUNT);
+
+    // All the pings have been acked
+    assert(controller->stats.rtt.count == PING_COUNT);
+    assert(controller->stats.queue_time.count == controller->stats.sent);
+
+    sc_controller_destroy(controller);
+}
+
+int main(int argc, char *argv[]) {
+    bool ok = net_init();
+    assert(ok);
+
+    if (argc > 1 && !strcmp(argv[1], "--benchmark")) {
+        bench_control_storms();
+        bench_keypress_latency();
+    } else {
+        test_priority_lanes();
+        test_ping();
+    }
+
+    net_cleanup();
+
+    return 0;
+}
@@ -0,0 +1,224 @@
+#include "common.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "demuxer.h"
+#include "util/binary.h"
+#include "util/net.h"
+
+/*
+ * The demuxer is connected to a stand-in server, which sends a hand-crafted
+ * stream (as the scrcpy server would).
+ */
+
+#define SC_CODEC_ID_RAW UINT32_C(0x00726177) // "raw" in ASCII
+
+struct test_sink {
+    struct sc_packet_sink packet_sink;
+    bool opened;
+    bool closed;
+    int sample_rate;
+    int channels;
+    enum AVSampleFormat sample_fmt;
+    unsigned packets;
+    int64_t last_pts;
+    int last_size;
+};
+
+struct test_demuxer_result {
+    bool ended;
+    enum sc_demuxer_status status;
+};
+
+#define DOWNCAST(SINK) container_of(SINK, struct test_sink, packet_sink)
+
+static bool
+test_sink_open(struct sc_packet_sink *sink, AVCodecContext *ctx) {
+    struct test_sink *ts = DOWNCAST(sink);
+    ts->opened = true;
+    ts->sample_rate = ctx->sample_rate;
+#ifdef SCRCPY_LAVU_HAS_CHLAYOUT
+    ts->channels = ctx->ch_layout.nb_channels;
+#else
+    ts->channels = ctx->channels;
+#endif
+    ts->sample_fmt = ctx->sample_fmt;
+    return true;
+}
+
+static void
+test_sink_close(struct sc_packet_sink *sink) {
+    struct test_sink *ts = DOWNCAST(sink);
+    ts->closed = true;
+}
+
+static bool
+test_sink_push(struct sc_packet_sink *sink, const AVPacket *packet) {
+    struct test_sink *ts = DOWNCAST(sink);
+    ++ts->packets;
+    ts->last_pts = packet->pts;
+    ts->last_size = packet->size;
+    return true;
+}
+
+static void
+test_sink_init(struct test_sink *ts) {
+    memset(ts, 0, sizeof(*ts));
+
+    static const struct sc_packet_sink_ops ops = {
+        .open = test_sink_open,
+        .close = test_sink_close,
+        .push = test_sink_push,
+    };
+
+    ts->packet_sink.ops = &ops;
+}
+
+static void
+on_demuxer_ended(struct sc_demuxer *demuxer, enum sc_demuxer_status status,
+                 void *userdata) {
+    (void) demuxer;
+    struct test_demuxer_result *result = userdata;
+    result->ended = true;
+    result->status = status;
+}
+
+// Connect a socket pair through localhost (like the real server connection)
+static void
+connect_sockets(sc_socket *server, sc_socket *client) {
+    sc_socket listener = net_socket();
+    assert(listener != SC_SOCKET_NONE);
+
+    uint16_t port;
+    bool ok = false;
+    for (port = 27300; port < 27400; ++port) {
+        ok = net_listen(listener, IPV4_LOCALHOST, port, 1);
+        if (ok) {
+            break;
+        }
+    }
+    assert(ok);
+
+    *client = net_socket();
+    assert(*client != SC_SOCKET_NONE);
+    ok = net_connect(*client, IPV4_LOCALHOST, port);
+    assert(ok);
+
+    *server = net_accept(listener);
+    assert(*server != SC_SOCKET_NONE);
+
+    net_close(listener);
+}
+
+static void
+send_u32(sc_socket socket, uint32_t value) {
+    uint8_t data[4];
+    sc_write32be(data, value);
+    ssize_t w = net_send_all(socket, data, sizeof(data));
+    assert(w == sizeof(data));
+}
+
+static void
+send_packet(sc_socket socket, uint64_t pts, const uint8_t *data,
+            uint32_t len) {
+    uint8_t header[12];
+    sc_write64be(header, pts);
+    sc_write32be(&header[8], len);
+    ssize_t w = net_send_all(socket, header, sizeof(header));
+    assert(w == sizeof(header));
+    w = net_send_all(socket, data, len);
+    assert(w == (ssize_t) len);
+}
+
+static void
+demux_stream(sc_socket client, struct test_sink *sink,
+             struct test_demuxer_result *result) {
+    static const struct sc_demuxer_callbacks cbs = {
+        .on_ended = on_demuxer_ended,
+    };
+
+    struct sc_demuxer demuxer;
+    sc_demuxer_init(&demuxer, "audio", client, &cbs, result);
+    sc_packet_source_add_sink(&demuxer.packet_source, &sink->packet_sink);
+
+    bool ok = sc_demuxer_start(&demuxer);
+    assert(ok);
+
+    sc_demuxer_join(&demuxer);
+}
+
+static void test_negotiated_audio_config(void) {
+    sc_socket server;
+    sc_socket client;
+    connect_sockets(&server, &client);
+
+    // 16kHz mono raw audio
+    send_u32(server, SC_CODEC_ID_RAW);
+    send_u32(server, 16000);
+    send_u32(server, 1);
+
+    // 20ms packets (320 samples of 2 bytes)
+    static uint8_t data[640];
+    send_packet(server, 0, data, sizeof(data));
+    send_packet(server, 20000, data, sizeof(data));
+
+    // End of stream
+    net_close(server);
+
+    struct test_sink sink;
+    test_sink_init(&sink);
+    struct test_demuxer_result result = {0};
+    demux_stream(client, &sink, &result);
+
+    assert(result.ended);
+    assert(result.status == SC_DEMUXER_STATUS_EOS);
+
+    assert(sink.opened);
+    assert(sink.closed);
+    assert(sink.sample_rate == 16000);
+    assert(sink.channels == 1);
+    assert(sink.sample_fmt == AV_SAMPLE_FMT_S16);
+    assert(sink.packets == 2);
+    assert(sink.last_pts == 20000);
+    assert(sink.last_size == 640);
+
+    net_close(client);
+}
+
+static void test_invalid_audio_config(void) {
+    sc_socket server;
+    sc_socket client;
+    connect_sockets(&server, &client);
+
+    send_u32(server, SC_CODEC_ID_RAW);
+    send_u32(server, 48000);
+    send_u32(server, 0); // no channel
+    net_close(server);
+
+    struct test_sink sink;
+    test_sink_init(&sink);
+    struct test_demuxer_result result = {0};
+    demux_stream(client, &sink, &result);
+
+    assert(result.ended);
+    assert(result.status == SC_DEMUXER_STATUS_ERROR);
+    assert(!sink.opened);
+
+    net_close(client);
+}
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    bool ok = net_init();
+    assert(ok);
+
+    test_negotiated_audio_config();
+    test_invalid_audio_config();
+
+    net_cleanup();
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include "common.h"
+
+#include <assert.h>
+
+#include "util/latency.h"
+
+static void test_latency(void) {
+    struct sc_latency latency;
+    sc_latency_init(&latency);
+
+    // Push 100..1 in reverse order
+    for (sc_tick i = 100; i > 0; --i) {
+        sc_latency_push(&latency, i);
+    }
+
+    assert(latency.count == 100);
+    assert(latency.max == 100);
+    assert(sc_latency_get_avg(&latency) == 50); // 50.5 rounded down
+    assert(sc_latency_get_percentile(&latency, 0) == 1);
+    assert(sc_latency_get_percentile(&latency, 50) == 50);
+    assert(sc_latency_get_percentile(&latency, 90) == 90);
+    assert(sc_latency_get_percentile(&latency, 99) == 99);
+    assert(sc_latency_get_percentile(&latency, 100) == 100);
+}
+
+static void test_latency_single(void) {
+    struct sc_latency latency;
+    sc_latency_init(&latency);
+
+    sc_latency_push(&latency, 42);
+    assert(sc_latency_get_avg(&latency) == 42);
+    assert(sc_latency_get_percentile(&latency, 50) == 42);
+    assert(sc_latency_get_percentile(&latency, 99) == 42);
+}
+
+static void test_latency_window(void) {
+    struct sc_latency latency;
+    sc_latency_init(&latency);
+
+    // Large old values
+    for (unsigned i = 0; i < SC_LATENCY_WINDOW; ++i) {
+        sc_latency_push(&latency, 1000);
+    }
+    // Small recent values
+    for (unsigned i = 0; i < SC_LATENCY_WINDOW; ++i) {
+        sc_latency_push(&latency, 10);
+    }
+
+    // The percentiles only consider the most recent values
+    assert(sc_latency_get_percentile(&latency, 100) == 10);
+    // But the max and the average consider all the values
+    assert(latency.max == 1000);
+    assert(sc_latency_get_avg(&latency) == 505);
+}
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    test_latency();
+    test_latency_single();
+    test_latency_window();
+    return 0;
+}
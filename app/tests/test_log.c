@@ -0,0 +1,129 @@
+#include "common.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <libavutil/log.h>
+
+#include "util/log.h"
+
+struct capture {
+    int saved_fd;
+    int pipe[2];
+};
+
+static void
+capture_start(struct capture *cap, int fd) {
+    int r = pipe(cap->pipe);
+    assert(!r);
+    // Never block on write, the pipe content is read only once captured
+    r = fcntl(cap->pipe[1], F_SETFL, O_NONBLOCK);
+    assert(!r);
+
+    cap->saved_fd = dup(fd);
+    assert(cap->saved_fd != -1);
+    r = dup2(cap->pipe[1], fd);
+    assert(r == fd);
+    close(cap->pipe[1]);
+}
+
+// Return the number of bytes written to fd since capture_start()
+static size_t
+capture_stop(struct capture *cap, int fd, char *buf, size_t len) {
+    int r = dup2(cap->saved_fd, fd);
+    assert(r == fd);
+    close(cap->saved_fd);
+
+    size_t total = 0;
+    for (;;) {
+        ssize_t n = read(cap->pipe[0], &buf[total], len - 1 - total);
+        assert(n >= 0);
+        if (!n) {
+            break;
+        }
+        total += n;
+    }
+    buf[total] = '\0';
+    close(cap->pipe[0]);
+    return total;
+}
+
+static void
+log_all(void) {
+    LOGV("verbose");
+    LOGD("debug");
+    LOGI("info");
+    LOGW("warn");
+    LOGE("error");
+    av_log(NULL, AV_LOG_INFO, "ffmpeg info\n");
+    av_log(NULL, AV_LOG_WARNING, "ffmpeg warn\n");
+    fflush(stdout);
+    fflush(stderr);
+}
+
+static void test_log_stdout(void) {
+    sc_log_configure(false);
+    sc_set_log_level(SC_LOG_LEVEL_VERBOSE);
+
+    struct capture out;
+    struct capture err;
+    capture_start(&out, STDOUT_FILENO);
+    capture_start(&err, STDERR_FILENO);
+    log_all();
+    char err_buf[4096];
+    size_t err_len = capture_stop(&err, STDERR_FILENO, err_buf,
+                                  sizeof(err_buf));
+    char out_buf[4096];
+    size_t out_len = capture_stop(&out, STDOUT_FILENO, out_buf,
+                                  sizeof(out_buf));
+
+    assert(out_len);
+    assert(strstr(out_buf, "INFO: info\n"));
+    assert(strstr(out_buf, "INFO: [FFmpeg] ffmpeg info\n"));
+    assert(!strstr(out_buf, "warn"));
+
+    assert(err_len);
+    assert(strstr(err_buf, "WARN: warn\n"));
+    assert(strstr(err_buf, "ERROR: error\n"));
+    assert(!strstr(err_buf, "info"));
+}
+
+static void test_log_stdout_reserved(void) {
+    sc_log_configure(true);
+    sc_set_log_level(SC_LOG_LEVEL_VERBOSE);
+
+    struct capture out;
+    struct capture err;
+    capture_start(&out, STDOUT_FILENO);
+    capture_start(&err, STDERR_FILENO);
+    log_all();
+    char err_buf[4096];
+    size_t err_len = capture_stop(&err, STDERR_FILENO, err_buf,
+                                  sizeof(err_buf));
+    char out_buf[4096];
+    size_t out_len = capture_stop(&out, STDOUT_FILENO, out_buf,
+                                  sizeof(out_buf));
+
+    // Nothing must be written to stdout
+    assert(!out_len);
+
+    assert(err_len);
+    assert(strstr(err_buf, "VERBOSE: verbose\n"));
+    assert(strstr(err_buf, "DEBUG: debug\n"));
+    assert(strstr(err_buf, "INFO: info\n"));
+    assert(strstr(err_buf, "WARN: warn\n"));
+    assert(strstr(err_buf, "ERROR: error\n"));
+    assert(strstr(err_buf, "INFO: [FFmpeg] ffmpeg info\n"));
+    assert(strstr(err_buf, "WARN: [FFmpeg] ffmpeg warn\n"));
+}
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    test_log_stdout();
+    test_log_stdout_reserved();
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include "common.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "muxer.h"
+
+static void test_codec_string_h264_annexb(void) {
+    // config packet: SPS (High profile, level 3.1) then PPS
+    const uint8_t config[] = {
+        0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x1F, 0xAC, 0xD9, 0x40,
+        0x00, 0x00, 0x00, 0x01, 0x68, 0xEB, 0xE3, 0xCB, 0x22, 0xC0,
+    };
+
+    char codec[SC_MUXER_CODEC_STRING_MAX];
+    bool ok = sc_muxer_get_codec_string(AV_CODEC_ID_H264, config,
+                                        sizeof(config), codec);
+    assert(ok);
+    assert(!strcmp(codec, "avc1.64001f"));
+}
+
+static void test_codec_string_h264_pps_first(void) {
+    // 3-byte start codes, PPS before SPS (Baseline, level 3.0)
+    const uint8_t config[] = {
+        0x00, 0x00, 0x01, 0x68, 0xCE, 0x3C, 0x80,
+        0x00, 0x00, 0x01, 0x67, 0x42, 0xC0, 0x1E, 0xDA,
+    };
+
+    char codec[SC_MUXER_CODEC_STRING_MAX];
+    bool ok = sc_muxer_get_codec_string(AV_CODEC_ID_H264, config,
+                                        sizeof(config), codec);
+    assert(ok);
+    assert(!strcmp(codec, "avc1.42c01e"));
+}
+
+static void test_codec_string_h264_avcc(void) {
+    // AVCDecoderConfigurationRecord (Main profile, level 4.0)
+    const uint8_t config[] = {0x01, 0x4D, 0x40, 0x28, 0xFF, 0xE1};
+
+    char codec[SC_MUXER_CODEC_STRING_MAX];
+    bool ok = sc_muxer_get_codec_string(AV_CODEC_ID_H264, config,
+                                        sizeof(config), codec);
+    assert(ok);
+    assert(!strcmp(codec, "avc1.4d4028"));
+}
+
+static void test_codec_string_h264_no_sps(void) {
+    // PPS only, and a truncated SPS
+    const uint8_t config[] = {
+        0x00, 0x00, 0x00, 0x01, 0x68, 0xEB, 0xE3, 0xCB,
+        0x00, 0x00, 0x01, 0x67, 0x64,
+    };
+
+    char codec[SC_MUXER_CODEC_STRING_MAX];
+    bool ok = sc_muxer_get_codec_string(AV_CODEC_ID_H264, config,
+                                        sizeof(config), codec);
+    assert(!ok);
+
+    ok = sc_muxer_get_codec_string(AV_CODEC_ID_H264, NULL, 0, codec);
+    assert(!ok);
+}
+
+static void test_codec_string_audio(void) {
+    char codec[SC_MUXER_CODEC_STRING_MAX];
+
+    bool ok = sc_muxer_get_codec_string(AV_CODEC_ID_OPUS, NULL, 0, codec);
+    assert(ok);
+    assert(!strcmp(codec, "opus"));
+
+    ok = sc_muxer_get_codec_string(AV_CODEC_ID_AAC, NULL, 0, codec);
+    assert(ok);
+    assert(!strcmp(codec, "mp4a.40.2"));
+
+    ok = sc_muxer_get_codec_string(AV_CODEC_ID_FLAC, NULL, 0, codec);
+    assert(ok);
+    assert(!strcmp(codec, "flac"));
+}
+
+static void test_codec_string_unknown(void) {
+    const uint8_t config[] = {0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0C};
+
+    char codec[SC_MUXER_CODEC_STRING_MAX];
+    bool ok = sc_muxer_get_codec_string(AV_CODEC_ID_HEVC, config,
+                                        sizeof(config), codec);
+    assert(!ok);
+}
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    test_codec_string_h264_annexb();
+    test_codec_string_h264_pps_first();
+    test_codec_string_h264_avcc();
+    test_codec_string_h264_no_sps();
+    test_codec_string_audio();
+    test_codec_string_unknown();
+    return 0;
+}
@@ -0,0 +1,322 @@
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <libavutil/channel_layout.h>
+
+#include "pcm_sink.h"
+#include "shm_ring.h"
+#include "util/tick.h"
+
+#define SAMPLE_RATE 48000
+#define CHANNELS 2
+// 10ms
+#define FRAME_SAMPLES 480
+
+// 0.25 in s16
+#define EXPECTED_S16 8192
+
+static char path[64];
+
+static AVCodecContext *
+create_codec_context(void) {
+    AVCodecContext *ctx = avcodec_alloc_context3(NULL);
+    assert(ctx);
+
+    ctx->sample_rate = SAMPLE_RATE;
+    ctx->sample_fmt = AV_SAMPLE_FMT_FLT;
+#ifdef SCRCPY_LAVU_HAS_CHLAYOUT
+    av_channel_layout_default(&ctx->ch_layout, CHANNELS);
+#else
+    ctx->channel_layout = av_get_default_channel_layout(CHANNELS);
+    ctx->channels = CHANNELS;
+#endif
+
+    return ctx;
+}
+
+// Push count frames of constant samples (0.25 on the left channel, -0.25 on
+// the right channel)
+static void
+push_frames(struct sc_pcm_sink *ps, unsigned count, int64_t *pts) {
+    static float samples[FRAME_SAMPLES * CHANNELS];
+    for (unsigned i = 0; i < FRAME_SAMPLES; ++i) {
+        samples[i * CHANNELS] = 0.25f;
+        samples[i * CHANNELS + 1] = -0.25f;
+    }
+
+    AVFrame *frame = av_frame_alloc();
+    assert(frame);
+    frame->format = AV_SAMPLE_FMT_FLT;
+    frame->sample_rate = SAMPLE_RATE;
+    frame->nb_samples = FRAME_SAMPLES;
+    frame->data[0] = (uint8_t *) samples;
+    frame->linesize[0] = sizeof(samples);
+
+    for (unsigned i = 0; i < count; ++i) {
+        frame->pts = *pts;
+        bool ok = ps->frame_sink.ops->push(&ps->frame_sink, frame);
+        assert(ok);
+        *pts += SC_TICK_FROM_MS(10);
+    }
+
+    // The data is not owned by the frame
+    frame->data[0] = NULL;
+    av_frame_free(&frame);
+}
+
+// Read exactly len bytes (the fd is non-blocking)
+static void
+read_all(int fd, uint8_t *data, size_t len) {
+    while (len) {
+        struct pollfd pfd = {
+            .fd = fd,
+            .events = POLLIN,
+        };
+        int r = poll(&pfd, 1, 5000);
+        assert(r == 1);
+
+        ssize_t n = read(fd, data, len);
+        if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+            continue;
+        }
+        assert(n > 0);
+        data += n;
+        len -= n;
+    }
+}
+
+static void
+assert_constant_s16(const int16_t *samples, size_t count, int tolerance) {
+    for (size_t i = 0; i < count; ++i) {
+        int left = samples[i * CHANNELS];
+        int right = samples[i * CHANNELS + 1];
+        assert(left >= EXPECTED_S16 - tolerance
+                && left <= EXPECTED_S16 + tolerance);
+        assert(right >= -EXPECTED_S16 - tolerance
+                && right <= -EXPECTED_S16 + tolerance);
+    }
+}
+
+static int
+connect_unix(const char *socket_path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(fd != -1);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    int r = connect(fd, (struct sockaddr *) &addr, sizeof(addr));
+    assert(!r);
+
+    r = fcntl(fd, F_SETFL, O_NONBLOCK);
+    assert(!r);
+
+    return fd;
+}
+
+static void test_unix_socket(void) {
+    snprintf(path, sizeof(path), "/tmp/scrcpy_test_pcm_%d.sock",
+             (int) getpid());
+
+    struct sc_pcm_sink ps;
+    bool ok = sc_pcm_sink_init(&ps, SC_AUDIO_EXPORT_TARGET_UNIX, path,
+                               SC_AUDIO_EXPORT_FORMAT_S16, 0);
+    assert(ok);
+
+    AVCodecContext *ctx = create_codec_context();
+    ok = ps.frame_sink.ops->open(&ps.frame_sink, ctx);
+    assert(ok);
+
+    int fd = connect_unix(path);
+
+    int64_t pts = 0;
+    push_frames(&ps, 10, &pts);
+
+    // Converted to s16 without resampling
+    static int16_t samples[10 * FRAME_SAMPLES * CHANNELS];
+    read_all(fd, (uint8_t *) samples, sizeof(samples));
+    assert_constant_s16(samples, 10 * FRAME_SAMPLES, 1);
+
+    ps.frame_sink.ops->close(&ps.frame_sink);
+    assert(ps.consumer_count == 1);
+    assert(!ps.dropped_samples);
+
+    // The socket is removed
+    struct stat st;
+    assert(stat(path, &st) == -1 && errno == ENOENT);
+
+    close(fd);
+    avcodec_free_context(&ctx);
+    sc_pcm_sink_destroy(&ps);
+}
+
+static void test_resample(void) {
+    snprintf(path, sizeof(path), "/tmp/scrcpy_test_pcm_%d.sock",
+             (int) getpid());
+
+    struct sc_pcm_sink ps;
+    bool ok = sc_pcm_sink_init(&ps, SC_AUDIO_EXPORT_TARGET_UNIX, path,
+                               SC_AUDIO_EXPORT_FORMAT_S16, 16000);
+    assert(ok);
+
+    AVCodecContext *ctx = create_codec_context();
+    ok = ps.frame_sink.ops->open(&ps.frame_sink, ctx);
+    assert(ok);
+    assert(ps.sample_rate == 16000);
+
+    int fd = connect_unix(path);
+
+    // 1 second at 48kHz
+    int64_t pts = 0;
+    push_frames(&ps, 100, &pts);
+
+    // Nearly 1 second at 16kHz (the resampler keeps a few samples)
+    static int16_t samples[15000 * CHANNELS];
+    read_all(fd, (uint8_t *) samples, sizeof(samples));
+    // Ignore the beginning, where the resampling filter starts from silence
+    assert_constant_s16(&samples[1000 * CHANNELS], 14000, 16);
+
+    ps.frame_sink.ops->close(&ps.frame_sink);
+
+    close(fd);
+    avcodec_free_context(&ctx);
+    sc_pcm_sink_destroy(&ps);
+}
+
+static void test_slow_consumer(void) {
+    snprintf(path, sizeof(path), "/tmp/scrcpy_test_pcm_%d.sock",
+             (int) getpid());
+
+    struct sc_pcm_sink ps;
+    bool ok = sc_pcm_sink_init(&ps, SC_AUDIO_EXPORT_TARGET_UNIX, path,
+                               SC_AUDIO_EXPORT_FORMAT_F32, 0);
+    assert(ok);
+
+    AVCodecContext *ctx = create_codec_context();
+    ok = ps.frame_sink.ops->open(&ps.frame_sink, ctx);
+    assert(ok);
+
+    // The client never reads
+    int fd = connect_unix(path);
+
+    // 20 seconds of audio, much more than the socket buffer and the sink
+    // buffer: the push must never block
+    int64_t pts = 0;
+    push_frames(&ps, 2000, &pts);
+
+    assert(ps.dropped_samples);
+
+    // Must not hang, even if the export thread is waiting for the consumer
+    ps.frame_sink.ops->close(&ps.frame_sink);
+
+    close(fd);
+    avcodec_free_context(&ctx);
+    sc_pcm_sink_destroy(&ps);
+}
+
+static void test_fifo(void) {
+    snprintf(path, sizeof(path), "/tmp/scrcpy_test_pcm_%d.fifo",
+             (int) getpid());
+
+    struct sc_pcm_sink ps;
+    bool ok = sc_pcm_sink_init(&ps, SC_AUDIO_EXPORT_TARGET_FIFO, path,
+                               SC_AUDIO_EXPORT_FORMAT_S16, 0);
+    assert(ok);
+
+    AVCodecContext *ctx = create_codec_context();
+    ok = ps.frame_sink.ops->open(&ps.frame_sink, ctx);
+    assert(ok);
+
+    // The FIFO is created by the sink
+    struct stat st;
+    assert(!stat(path, &st) && S_ISFIFO(st.st_mode));
+
+    int fd = open(path, O_RDONLY | O_NONBLOCK);
+    assert(fd != -1);
+
+    int64_t pts = 0;
+    push_frames(&ps, 5, &pts);
+
+    static int16_t samples[5 * FRAME_SAMPLES * CHANNELS];
+    read_all(fd, (uint8_t *) samples, sizeof(samples));
+    assert_constant_s16(samples, 5 * FRAME_SAMPLES, 1);
+
+    ps.frame_sink.ops->close(&ps.frame_sink);
+
+    // The FIFO is removed
+    assert(stat(path, &st) == -1 && errno == ENOENT);
+
+    close(fd);
+    avcodec_free_context(&ctx);
+    sc_pcm_sink_destroy(&ps);
+}
+
+static void test_shm(void) {
+    snprintf(path, sizeof(path), "/scrcpy_test_pcm_%d", (int) getpid());
+
+    struct sc_pcm_sink ps;
+    bool ok = sc_pcm_sink_init(&ps, SC_AUDIO_EXPORT_TARGET_SHM, path,
+                               SC_AUDIO_EXPORT_FORMAT_S16, 0);
+    assert(ok);
+
+    AVCodecContext *ctx = create_codec_context();
+    ok = ps.frame_sink.ops->open(&ps.frame_sink, ctx);
+    assert(ok);
+
+    struct sc_shm_ring ring;
+    ok = sc_shm_ring_open(&ring, path);
+    assert(ok);
+
+    // Starting from the first frame
+    int64_t pts = 0;
+    push_frames(&ps, 1, &pts);
+
+    sc_tick deadline = sc_tick_now() + SC_TICK_FROM_SEC(5);
+    while (!sc_shm_ring_latest(&ring)) {
+        assert(sc_tick_now() < deadline);
+        usleep(1000);
+    }
+
+    struct sc_shm_frame frame;
+    ok = sc_shm_ring_acquire(&ring, 1, &frame);
+    assert(ok);
+    assert(frame.format == SC_SHM_RING_FORMAT_PCM_S16);
+    assert(frame.sample_rate == SAMPLE_RATE);
+    assert(frame.channels == CHANNELS);
+    assert(frame.plane_count == 1);
+    assert(frame.size == FRAME_SAMPLES * CHANNELS * sizeof(int16_t));
+    assert(frame.pts == 0);
+    assert_constant_s16((const int16_t *) frame.data[0], FRAME_SAMPLES, 1);
+    assert(sc_shm_ring_validate(&ring, &frame));
+
+    sc_shm_ring_close(&ring);
+
+    ps.frame_sink.ops->close(&ps.frame_sink);
+
+    avcodec_free_context(&ctx);
+    sc_pcm_sink_destroy(&ps);
+}
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    test_unix_socket();
+    test_resample();
+    test_slow_consumer();
+    test_fifo();
+    test_shm();
+
+    return 0;
+}
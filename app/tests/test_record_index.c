@@ -0,0 +1,351 @@
+#include "common.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavformat/avformat.h>
+
+#include "record_index.h"
+#include "util/str.h"
+
+#define TEST_FRAME_COUNT 100
+#define TEST_FRAME_DURATION 20000 // in us (50 fps)
+#define TEST_GOP_SIZE 25
+#define TEST_SAMPLE_RATE 48000
+// in us (about 1024 samples at 48000 Hz)
+#define TEST_AUDIO_FRAME_DURATION 21000
+
+static const AVRational TEST_TIME_BASE = {1, 1000000};
+
+static char *
+get_tmp_filename(void) {
+    char *filename = strdup("/tmp/scrcpy_test_record_index_XXXXXX");
+    assert(filename);
+    int fd = mkstemp(filename);
+    assert(fd != -1);
+    fclose(fdopen(fd, "w"));
+    return filename;
+}
+
+static void test_record_index_get_filename(void) {
+    char *s = sc_record_index_get_filename("file.mkv");
+    assert(s);
+    assert(!strcmp(s, "file.mkv.idx"));
+    free(s);
+}
+
+static void test_record_index_write_load(void) {
+    char *filename = get_tmp_filename();
+
+    struct sc_record_index_writer writer;
+    bool ok = sc_record_index_writer_open(&writer, filename);
+    assert(ok);
+
+    for (int i = 0; i < 100; ++i) {
+        struct sc_record_index_entry entry = {
+            .pts = i * 1000000,
+            .offset = UINT64_C(0x100000000) * i + 42,
+            .size = 1000 + i,
+        };
+        ok = sc_record_index_writer_append(&writer, &entry);
+        assert(ok);
+    }
+
+    ok = sc_record_index_writer_close(&writer);
+    assert(ok);
+
+    struct sc_record_index index;
+    ok = sc_record_index_load(&index, filename);
+    assert(ok);
+
+    assert(index.entries.size == 100);
+    for (int i = 0; i < 100; ++i) {
+        struct sc_record_index_entry *entry = &index.entries.data[i];
+        assert(entry->pts == i * 1000000);
+        assert(entry->offset == UINT64_C(0x100000000) * i + 42);
+        assert(entry->size == (uint32_t) (1000 + i));
+    }
+
+    sc_record_index_destroy(&index);
+
+    remove(filename);
+    free(filename);
+}
+
+static void test_record_index_truncated(void) {
+    char *filename = get_tmp_filename();
+
+    struct sc_record_index_writer writer;
+    bool ok = sc_record_index_writer_open(&writer, filename);
+    assert(ok);
+
+    struct sc_record_index_entry entry = {
+        .pts = 1234,
+        .offset = 5678,
+        .size = 42,
+    };
+    ok = sc_record_index_writer_append(&writer, &entry);
+    assert(ok);
+    // a partial entry, as if the writer was killed
+    fwrite("abcdef", 6, 1, writer.file);
+    ok = sc_record_index_writer_close(&writer);
+    assert(ok);
+
+    struct sc_record_index index;
+    ok = sc_record_index_load(&index, filename);
+    assert(ok);
+    assert(index.entries.size == 1);
+    assert(index.entries.data[0].pts == 1234);
+    sc_record_index_destroy(&index);
+
+    // not an index file
+    FILE *file = fopen(filename, "wb");
+    assert(file);
+    fwrite("not an index file", 17, 1, file);
+    fclose(file);
+
+    ok = sc_record_index_load(&index, filename);
+    assert(!ok);
+
+    remove(filename);
+    free(filename);
+}
+
+static void test_record_index_find(void) {
+    struct sc_record_index index;
+    sc_vector_init(&index.entries);
+
+    assert(!sc_record_index_find(&index, 0));
+
+    int64_t pts[] = {0, 1000, 2000, 5000};
+    for (size_t i = 0; i < ARRAY_LEN(pts); ++i) {
+        struct sc_record_index_entry entry = {
+            .pts = pts[i],
+            .offset = i * 100,
+            .size = 10,
+        };
+        bool ok = sc_vector_push(&index.entries, entry);
+        assert(ok);
+    }
+
+    assert(sc_record_index_find(&index, -10)->pts == 0);
+    assert(sc_record_index_find(&index, 0)->pts == 0);
+    assert(sc_record_index_find(&index, 999)->pts == 0);
+    assert(sc_record_index_find(&index, 1000)->pts == 1000);
+    assert(sc_record_index_find(&index, 4999)->pts == 2000);
+    assert(sc_record_index_find(&index, 5000)->pts == 5000);
+    assert(sc_record_index_find(&index, 100000)->pts == 5000);
+
+    sc_record_index_destroy(&index);
+}
+
+static AVStream *
+add_video_stream(AVFormatContext *ctx) {
+    AVStream *stream = avformat_new_stream(ctx, NULL);
+    assert(stream);
+    stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    stream->codecpar->codec_id = AV_CODEC_ID_HEVC;
+    stream->codecpar->width = 1280;
+    stream->codecpar->height = 720;
+    stream->time_base = TEST_TIME_BASE;
+    return stream;
+}
+
+static AVStream *
+add_audio_stream(AVFormatContext *ctx) {
+    AVStream *stream = avformat_new_stream(ctx, NULL);
+    assert(stream);
+    stream->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
+    stream->codecpar->codec_id = AV_CODEC_ID_AAC;
+    stream->codecpar->sample_rate = TEST_SAMPLE_RATE;
+#ifdef SCRCPY_LAVU_HAS_CHLAYOUT
+    av_channel_layout_default(&stream->codecpar->ch_layout, 2);
+#else
+    stream->codecpar->channel_layout = av_get_default_channel_layout(2);
+    stream->codecpar->channels = 2;
+#endif
+    stream->time_base = TEST_TIME_BASE;
+    return stream;
+}
+
+// A (fake) H.265 frame in Annex B format, the frame index in the last byte
+static void
+fill_video_packet(AVPacket *packet, int i, bool key_frame) {
+    int r = av_new_packet(packet, 8);
+    assert(!r);
+    (void) r;
+
+    // start code, NAL unit header (IDR_W_RADL or TRAIL_R), slice data
+    static const uint8_t data[] = {0, 0, 0, 1, 0, 0x01, 0x80};
+    memcpy(packet->data, data, sizeof(data));
+    packet->data[4] = (key_frame ? 19 : 1) << 1;
+    packet->data[7] = i;
+}
+
+// A (fake) AAC frame with an ADTS header (48000 Hz, stereo)
+static void
+fill_audio_packet(AVPacket *packet, int i) {
+    int r = av_new_packet(packet, 11);
+    assert(!r);
+    (void) r;
+
+    static const uint8_t data[] = {0xFF, 0xF1, 0x4C, 0x80, 0x01, 0x7F, 0xFC};
+    memcpy(packet->data, data, sizeof(data));
+    memset(&packet->data[7], 0, 4);
+    packet->data[7] = i;
+}
+
+// Write an MPEG-TS recording (video and audio) and its index, like the
+// recorder does
+static void
+write_recording(const char *filename, struct sc_record_index *index) {
+    AVFormatContext *ctx = NULL;
+    int r = avformat_alloc_output_context2(&ctx, NULL, "mpegts", filename);
+    assert(r >= 0);
+
+    AVStream *video_stream = add_video_stream(ctx);
+    AVStream *audio_stream = add_audio_stream(ctx);
+
+    r = avio_open(&ctx->pb, filename, AVIO_FLAG_WRITE);
+    assert(r >= 0);
+    r = avformat_write_header(ctx, NULL);
+    assert(r >= 0);
+
+    sc_vector_init(&index->entries);
+
+    AVPacket *packet = av_packet_alloc();
+    assert(packet);
+
+    int video_count = 0;
+    int audio_count = 0;
+    while (video_count < TEST_FRAME_COUNT) {
+        int64_t video_pts = (int64_t) video_count * TEST_FRAME_DURATION;
+        int64_t audio_pts = (int64_t) audio_count * TEST_AUDIO_FRAME_DURATION;
+
+        if (audio_pts < video_pts) {
+            fill_audio_packet(packet, audio_count++);
+            packet->stream_index = audio_stream->index;
+            packet->pts = av_rescale_q(audio_pts, TEST_TIME_BASE,
+                                       audio_stream->time_base);
+            packet->flags = AV_PKT_FLAG_KEY;
+        } else {
+            bool key_frame = !(video_count % TEST_GOP_SIZE);
+            fill_video_packet(packet, video_count++, key_frame);
+            packet->stream_index = video_stream->index;
+            packet->pts = av_rescale_q(video_pts, TEST_TIME_BASE,
+                                       video_stream->time_base);
+            packet->flags = key_frame ? AV_PKT_FLAG_KEY : 0;
+
+            if (key_frame) {
+                // Like the recorder, the interleaving queue is not flushed
+                struct sc_record_index_entry entry = {
+                    .pts = video_pts,
+                    .offset = avio_tell(ctx->pb),
+                    .size = packet->size,
+                };
+                bool ok = sc_vector_push(&index->entries, entry);
+                assert(ok);
+                (void) ok;
+            }
+        }
+        packet->dts = packet->pts;
+
+        r = av_interleaved_write_frame(ctx, packet);
+        assert(r >= 0);
+    }
+
+    av_packet_free(&packet);
+
+    r = av_write_trailer(ctx);
+    assert(r >= 0);
+    avio_closep(&ctx->pb);
+    avformat_free_context(ctx);
+    (void) r;
+}
+
+static void test_record_index_extract(void) {
+    char *input_tmp = get_tmp_filename();
+    // The formats are guessed from the extension
+    char *input = sc_str_concat(input_tmp, ".ts");
+    assert(input);
+    char *output = sc_str_concat(input_tmp, "-extract.ts");
+    assert(output);
+
+    struct sc_record_index index;
+    write_recording(input, &index);
+    assert(index.entries.size == TEST_FRAME_COUNT / TEST_GOP_SIZE);
+
+    // The range starts between two keyframes (at 1s and 1.5s)
+    bool ok = sc_record_index_extract(&index, input, output, 1200000,
+                                      1800000);
+    assert(ok);
+
+    AVFormatContext *ctx = NULL;
+    int r = avformat_open_input(&ctx, output, NULL, NULL);
+    assert(!r);
+    assert(ctx->nb_streams == 2);
+
+    AVPacket *packet = av_packet_alloc();
+    assert(packet);
+
+    unsigned video_count = 0;
+    int64_t first_video_pts = -1;
+    int64_t last_video_pts = -1;
+    int64_t last_audio_pts = -1;
+    while (av_read_frame(ctx, packet) >= 0) {
+        AVStream *stream = ctx->streams[packet->stream_index];
+        int64_t pts = av_rescale_q(packet->pts, stream->time_base,
+                                   TEST_TIME_BASE);
+        if (stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            if (!video_count) {
+                // The extracted file starts at the keyframe at 1s (the muxer
+                // may insert an access unit delimiter before the frame)
+                assert(packet->flags & AV_PKT_FLAG_KEY);
+                assert(packet->data[packet->size - 1] == 50);
+                first_video_pts = pts;
+            }
+            last_video_pts = pts;
+            ++video_count;
+        } else {
+            assert(pts >= 0);
+            last_audio_pts = pts;
+        }
+        av_packet_unref(packet);
+    }
+
+    // Frames 50 to 90 (at 1.8s), included
+    assert(video_count == 41);
+    assert(first_video_pts == 0);
+    // The extracted duration is 800ms (from the keyframe to the range end)
+    assert(last_video_pts - first_video_pts == 800000);
+    // Each stream is extracted up to the range end, whatever the interleaving
+    assert(last_audio_pts <= 800000);
+    assert(last_audio_pts > 800000 - TEST_AUDIO_FRAME_DURATION);
+
+    av_packet_free(&packet);
+    avformat_close_input(&ctx);
+    sc_record_index_destroy(&index);
+
+    remove(output);
+    remove(input);
+    remove(input_tmp);
+    free(output);
+    free(input);
+    free(input_tmp);
+    (void) r;
+    (void) ok;
+}
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    test_record_index_get_filename();
+    test_record_index_write_load();
+    test_record_index_truncated();
+    test_record_index_find();
+    test_record_index_extract();
+
+    return 0;
+}
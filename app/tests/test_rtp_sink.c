@@ -0,0 +1,500 @@
+#include "common.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "rtp_sink.h"
+#include "util/binary.h"
+
+#define MAX_AU_SIZE 65536
+
+struct rtp_packet {
+    bool marker;
+    uint8_t payload_type;
+    uint16_t seq;
+    uint32_t timestamp;
+    uint32_t ssrc;
+    uint8_t payload[2048];
+    size_t len;
+};
+
+struct receiver {
+    int fd;
+    bool started;
+    uint16_t next_seq;
+    uint32_t ssrc;
+};
+
+struct access_unit {
+    uint8_t data[MAX_AU_SIZE];
+    size_t len;
+    uint32_t timestamp;
+    unsigned packets;
+};
+
+static int
+bind_udp(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    assert(fd != -1);
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        .sin_port = htons(port),
+    };
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+
+    // Never block forever if a packet is missing
+    struct timeval tv = {.tv_sec = 2};
+    int r = setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    assert(!r);
+    int size = 4 * 1024 * 1024;
+    r = setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    assert(!r);
+    (void) r;
+
+    return fd;
+}
+
+// Bind the video receiver on any port, and the audio receiver on port + 2
+static uint16_t
+bind_receivers(struct receiver *video, struct receiver *audio) {
+    for (int i = 0; i < 100; ++i) {
+        int fd = bind_udp(0);
+        assert(fd != -1);
+
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int r = getsockname(fd, (struct sockaddr *) &addr, &len);
+        assert(!r);
+        (void) r;
+        uint16_t port = ntohs(addr.sin_port);
+
+        int audio_fd = port <= UINT16_MAX - 3 ? bind_udp(port + 2) : -1;
+        if (audio_fd == -1) {
+            close(fd);
+            continue;
+        }
+
+        *video = (struct receiver) {.fd = fd};
+        *audio = (struct receiver) {.fd = audio_fd};
+        return port;
+    }
+
+    assert(!"could not bind the receivers");
+    return 0;
+}
+
+static void
+recv_rtp(struct receiver *receiver, struct rtp_packet *packet) {
+    uint8_t buf[2048];
+    ssize_t r = recv(receiver->fd, buf, sizeof(buf), 0);
+    assert(r > 12);
+    assert(r <= 12 + SC_RTP_MAX_PAYLOAD_SIZE);
+
+    assert(buf[0] == 0x80); // version 2, no padding, extension or CSRC
+    packet->marker = buf[1] & 0x80;
+    packet->payload_type = buf[1] & 0x7F;
+    packet->seq = sc_read16be(&buf[2]);
+    packet->timestamp = sc_read32be(&buf[4]);
+    packet->ssrc = sc_read32be(&buf[8]);
+    packet->len = r - 12;
+    memcpy(packet->payload, &buf[12], packet->len);
+
+    // No packet is lost or reordered on loopback
+    if (receiver->started) {
+        assert(packet->seq == receiver->next_seq);
+        assert(packet->ssrc == receiver->ssrc);
+    }
+    receiver->started = true;
+    receiver->next_seq = packet->seq + 1;
+    receiver->ssrc = packet->ssrc;
+}
+
+static void
+append_nal(struct access_unit *au, const uint8_t *data, size_t len) {
+    assert(au->len + 4 + len <= MAX_AU_SIZE);
+    static const uint8_t start_code[] = {0, 0, 0, 1};
+    memcpy(&au->data[au->len], start_code, 4);
+    memcpy(&au->data[au->len + 4], data, len);
+    au->len += 4 + len;
+}
+
+// Reassemble an access unit (in Annex B format with 4-byte start codes)
+static void
+recv_access_unit(struct receiver *receiver, bool h265,
+                 struct access_unit *au) {
+    au->len = 0;
+    au->packets = 0;
+
+    // Fragmented NAL unit being reassembled
+    uint8_t nal[MAX_AU_SIZE];
+    size_t nal_len = 0;
+    bool in_fu = false;
+
+    struct rtp_packet packet;
+    do {
+        recv_rtp(receiver, &packet);
+        assert(packet.payload_type == 96);
+        if (au->packets++) {
+            assert(packet.timestamp == au->timestamp);
+        }
+        au->timestamp = packet.timestamp;
+
+        uint8_t type = h265 ? (packet.payload[0] >> 1) & 0x3F
+                            : packet.payload[0] & 0x1F;
+        bool fu = h265 ? type == 49 : type == 28;
+        if (!fu) {
+            assert(!in_fu);
+            append_nal(au, packet.payload, packet.len);
+            continue;
+        }
+
+        size_t fu_header_size = h265 ? 3 : 2;
+        uint8_t fu_header = packet.payload[fu_header_size - 1];
+        bool start = fu_header & 0x80;
+        bool end = fu_header & 0x40;
+        uint8_t nal_type = h265 ? fu_header & 0x3F : fu_header & 0x1F;
+
+        assert(start == !in_fu);
+        if (start) {
+            // Restore the NAL unit header
+            if (h265) {
+                nal[0] = (packet.payload[0] & 0x81) | (nal_type << 1);
+                nal[1] = packet.payload[1];
+                nal_len = 2;
+            } else {
+                nal[0] = (packet.payload[0] & 0xE0) | nal_type;
+                nal_len = 1;
+            }
+            in_fu = true;
+        }
+
+        size_t len = packet.len - fu_header_size;
+        assert(nal_len + len <= sizeof(nal));
+        memcpy(&nal[nal_len], &packet.payload[fu_header_size], len);
+        nal_len += len;
+
+        // Only the last fragment may be the last packet of the access unit
+        assert(end || !packet.marker);
+        if (end) {
+            append_nal(au, nal, nal_len);
+            in_fu = false;
+        }
+    } while (!packet.marker);
+
+    assert(!in_fu);
+}
+
+static void
+push(struct sc_packet_sink *sink, uint8_t *data, size_t len, int64_t pts,
+     bool key) {
+    AVPacket *packet = av_packet_alloc();
+    assert(packet);
+    packet->data = data;
+    packet->size = len;
+    packet->pts = pts;
+    packet->dts = pts;
+    if (key) {
+        packet->flags |= AV_PKT_FLAG_KEY;
+    }
+
+    bool ok = sink->ops->push(sink, packet);
+    assert(ok);
+    (void) ok;
+
+    av_packet_free(&packet);
+}
+
+static void
+open_sink(struct sc_packet_sink *sink, enum AVCodecID codec_id,
+          unsigned channels) {
+    AVCodecContext *ctx = avcodec_alloc_context3(NULL);
+    assert(ctx);
+    ctx->codec_id = codec_id;
+    if (channels) {
+#ifdef SCRCPY_LAVU_HAS_CHLAYOUT
+        av_channel_layout_default(&ctx->ch_layout, channels);
+#else
+        ctx->channels = channels;
+#endif
+    }
+
+    bool ok = sink->ops->open(sink, ctx);
+    assert(ok);
+    (void) ok;
+
+    // The sinks do not keep the context
+    avcodec_free_context(&ctx);
+}
+
+// Append a NAL unit with a 4-byte (or 3-byte) start code, with a payload
+// which does not contain any start code
+static size_t
+write_nal(uint8_t *buf, bool long_start_code, const uint8_t *header,
+          size_t header_len, size_t payload_len) {
+    size_t i = 0;
+    if (long_start_code) {
+        buf[i++] = 0;
+    }
+    buf[i++] = 0;
+    buf[i++] = 0;
+    buf[i++] = 1;
+    memcpy(&buf[i], header, header_len);
+    i += header_len;
+    for (size_t j = 0; j < payload_len; ++j) {
+        buf[i++] = j % 251 + 1;
+    }
+    return i;
+}
+
+static const uint8_t h264_sps[] = {0x67, 0x42, 0xC0, 0x1F};
+static const uint8_t h264_pps[] = {0x68, 0xCE};
+static const uint8_t h264_idr[] = {0x65};
+static const uint8_t h264_p[] = {0x41};
+static const uint8_t h265_vps[] = {0x40, 0x01};
+static const uint8_t h265_sps[] = {0x42, 0x01};
+static const uint8_t h265_pps[] = {0x44, 0x01};
+static const uint8_t h265_idr[] = {0x26, 0x01};
+static const uint8_t h265_trail[] = {0x02, 0x01};
+
+// Write the config packet (SPS/PPS, or VPS/SPS/PPS for H.265)
+static size_t
+write_config(uint8_t *buf, bool h265) {
+    size_t len = 0;
+    if (h265) {
+        len += write_nal(&buf[len], true, h265_vps, 2, 20);
+        len += write_nal(&buf[len], true, h265_sps, 2, 30);
+        len += write_nal(&buf[len], true, h265_pps, 2, 5);
+    } else {
+        len += write_nal(&buf[len], true, h264_sps, 4, 10);
+        len += write_nal(&buf[len], true, h264_pps, 2, 2);
+    }
+    return len;
+}
+
+static void
+normalize(const uint8_t *data, size_t len, struct access_unit *expected) {
+    // Convert the 3-byte start codes to 4-byte start codes
+    expected->len = 0;
+    size_t i = 0;
+    while (i < len) {
+        // Skip the start code
+        while (!data[i]) {
+            ++i;
+        }
+        assert(data[i] == 1);
+        ++i;
+
+        size_t end = i;
+        while (end < len && !(end + 2 < len && !data[end] && !data[end + 1])) {
+            ++end;
+        }
+        append_nal(expected, &data[i], end - i);
+        i = end;
+    }
+}
+
+static void
+check_access_unit(struct receiver *receiver, bool h265, const uint8_t *data,
+                  size_t len, struct access_unit *au) {
+    static struct access_unit expected;
+    normalize(data, len, &expected);
+
+    recv_access_unit(receiver, h265, au);
+    assert(au->len == expected.len);
+    assert(!memcmp(au->data, expected.data, au->len));
+}
+
+static void
+test_video(bool h265) {
+    struct receiver video;
+    struct receiver audio;
+    uint16_t port = bind_receivers(&video, &audio);
+
+    struct sc_rtp_sink rtp;
+    bool ok = sc_rtp_sink_init(&rtp, "127.0.0.1", port, true,
+                               h265 ? SC_CODEC_H265 : SC_CODEC_H264, false,
+                               0, 0, NULL);
+    assert(ok);
+    (void) ok;
+
+    struct sc_packet_sink *sink = &rtp.video_packet_sink;
+    open_sink(sink, h265 ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264, 0);
+
+    static uint8_t buf[MAX_AU_SIZE];
+
+    // Config packet (not sent, merged with the next packet by the demuxer)
+    size_t config_len = write_config(buf, h265);
+    size_t len = config_len;
+    push(sink, buf, len, AV_NOPTS_VALUE, false);
+
+    // Key frame with the config, fragmented (with a 3-byte start code)
+    if (h265) {
+        len += write_nal(&buf[len], false, h265_idr, 2, 5000);
+    } else {
+        len += write_nal(&buf[len], false, h264_idr, 1, 5000);
+    }
+    push(sink, buf, len, 100000, true);
+
+    struct access_unit au;
+    check_access_unit(&video, h265, buf, len, &au);
+    // 3 config NAL units (2 for H.264) + 5 fragments
+    assert(au.packets == (h265 ? 3 : 2) + 5);
+    uint32_t timestamp = au.timestamp;
+
+    // Non-key frame in a single packet
+    if (h265) {
+        len = write_nal(buf, true, h265_trail, 2, 300);
+    } else {
+        len = write_nal(buf, true, h264_p, 1, 300);
+    }
+    push(sink, buf, len, 133333, false);
+
+    check_access_unit(&video, h265, buf, len, &au);
+    assert(au.packets == 1);
+    // 90 kHz clock
+    assert(au.timestamp - timestamp == 2999);
+
+    // Next key frame, without the config (the device does not repeat it):
+    // the parameter sets must be sent again, so that a receiver started
+    // after the first key frame can decode the stream
+    len = write_config(buf, h265);
+    if (h265) {
+        len += write_nal(&buf[len], true, h265_idr, 2, 100);
+    } else {
+        len += write_nal(&buf[len], true, h264_idr, 1, 100);
+    }
+    push(sink, &buf[config_len], len - config_len, 10100000, true);
+
+    check_access_unit(&video, h265, buf, len, &au);
+    assert(au.packets == (h265 ? 3 : 2) + 1);
+    assert(au.timestamp - timestamp == 900000);
+
+    sink->ops->close(sink);
+    sc_rtp_sink_destroy(&rtp);
+    close(video.fd);
+    close(audio.fd);
+}
+
+static void test_h264(void) {
+    test_video(false);
+}
+
+static void test_h265(void) {
+    test_video(true);
+}
+
+static void test_opus(void) {
+    struct receiver video;
+    struct receiver audio;
+    uint16_t port = bind_receivers(&video, &audio);
+
+    struct sc_rtp_sink rtp;
+    bool ok = sc_rtp_sink_init(&rtp, "127.0.0.1", port, false, SC_CODEC_H264,
+                               true, 48000, 2, NULL);
+    assert(ok);
+    (void) ok;
+
+    struct sc_packet_sink *sink = &rtp.audio_packet_sink;
+    open_sink(sink, AV_CODEC_ID_OPUS, 2);
+
+    // OpusHead config packet, not sent
+    uint8_t head[19] = "OpusHead";
+    push(sink, head, sizeof(head), AV_NOPTS_VALUE, false);
+
+    uint8_t data[120];
+    uint32_t timestamp = 0;
+    for (unsigned i = 0; i < 3; ++i) {
+        memset(data, i + 1, sizeof(data));
+        push(sink, data, sizeof(data), i * 20000, false); // 20 ms per packet
+
+        struct rtp_packet packet;
+        recv_rtp(&audio, &packet);
+        assert(packet.payload_type == 97);
+        assert(packet.len == sizeof(data));
+        assert(!memcmp(packet.payload, data, sizeof(data)));
+        if (i) {
+            // 48 kHz clock
+            assert(packet.timestamp - timestamp == 960);
+        }
+        timestamp = packet.timestamp;
+    }
+
+    sink->ops->close(sink);
+    sc_rtp_sink_destroy(&rtp);
+    close(video.fd);
+    close(audio.fd);
+}
+
+static void
+read_sdp(uint8_t channels, uint32_t sample_rate, char *sdp, size_t size) {
+    char filename[] = "/tmp/scrcpy_test_rtp_XXXXXX";
+    int fd = mkstemp(filename);
+    assert(fd != -1);
+    close(fd);
+
+    struct sc_rtp_sink rtp;
+    bool ok = sc_rtp_sink_init(&rtp, "127.0.0.1", 5004, true, SC_CODEC_H265,
+                               true, sample_rate, channels, filename);
+    assert(ok);
+    (void) ok;
+    sc_rtp_sink_destroy(&rtp);
+
+    FILE *file = fopen(filename, "r");
+    assert(file);
+    size_t len = fread(sdp, 1, size - 1, file);
+    sdp[len] = '\0';
+    fclose(file);
+    unlink(filename);
+}
+
+static void test_sdp(void) {
+    char sdp[1024];
+    read_sdp(2, 48000, sdp, sizeof(sdp));
+
+    assert(!strncmp(sdp, "v=0\r\n", 5));
+    assert(strstr(sdp, "c=IN IP4 127.0.0.1\r\n"));
+    assert(strstr(sdp, "m=video 5004 RTP/AVP 96\r\n"));
+    assert(strstr(sdp, "a=rtpmap:96 H265/90000\r\n"));
+    assert(strstr(sdp, "m=audio 5006 RTP/AVP 97\r\n"));
+    assert(strstr(sdp, "a=rtpmap:97 opus/48000/2\r\n"));
+    assert(strstr(sdp, "a=fmtp:97 sprop-stereo=1; "
+                       "sprop-maxcapturerate=48000\r\n"));
+
+    // Every line is terminated by CRLF
+    for (const char *p = sdp; (p = strchr(p, '\n')); ++p) {
+        assert(p > sdp && p[-1] == '\r');
+    }
+}
+
+static void test_sdp_mono(void) {
+    char sdp[1024];
+    read_sdp(1, 16000, sdp, sizeof(sdp));
+
+    // RFC 7587 7: the encoding name is always "opus/48000/2"
+    assert(strstr(sdp, "a=rtpmap:97 opus/48000/2\r\n"));
+    assert(strstr(sdp, "a=fmtp:97 sprop-stereo=0; "
+                       "sprop-maxcapturerate=16000\r\n"));
+}
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    test_h264();
+    test_h265();
+    test_opus();
+    test_sdp();
+    test_sdp_mono();
+    return 0;
+}
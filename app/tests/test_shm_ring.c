@@ -0,0 +1,293 @@
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "shm_ring.h"
+#include "util/tick.h"
+
+#define BENCH_WIDTH 1280
+#define BENCH_HEIGHT 720
+#define BENCH_FRAME_SIZE (BENCH_WIDTH * BENCH_HEIGHT * 3 / 2)
+#define BENCH_FRAMES 300
+#define BENCH_SLOTS 3
+#define BENCH_READERS 4
+
+static void
+get_name(char *name, size_t len, const char *suffix) {
+    snprintf(name, len, "/scrcpy-test-%ld-%s", (long) getpid(), suffix);
+}
+
+static void
+sleep_us(long us) {
+    struct timespec ts = {
+        .tv_sec = us / 1000000,
+        .tv_nsec = (us % 1000000) * 1000,
+    };
+    nanosleep(&ts, NULL);
+}
+
+static void
+write_frame(struct sc_shm_ring *ring, uint8_t value, uint32_t size) {
+    uint8_t *data;
+    struct sc_shm_ring_slot *slot = sc_shm_ring_begin_write(ring, &data);
+    slot->format = SC_SHM_RING_FORMAT_YUV420P;
+    slot->width = 4;
+    slot->height = 2;
+    slot->size = size;
+    slot->plane_count = 1;
+    slot->offsets[0] = 0;
+    slot->linesizes[0] = 4;
+    slot->pts = value * 1000;
+    memset(data, value, size);
+    slot->publish_time = sc_tick_now();
+    sc_shm_ring_end_write(ring, slot);
+}
+
+static void test_shm_ring_simple(void) {
+    char name[64];
+    get_name(name, sizeof(name), "simple");
+
+    struct sc_shm_ring writer;
+    bool ok = sc_shm_ring_create(&writer, name, 2, 16);
+    assert(ok);
+
+    struct sc_shm_ring reader;
+    ok = sc_shm_ring_open(&reader, name);
+    assert(ok);
+    assert(reader.header->slot_count == 2);
+    assert(reader.header->data_capacity == 16);
+
+    struct sc_shm_frame frame;
+    assert(sc_shm_ring_latest(&reader) == 0);
+    assert(!sc_shm_ring_acquire(&reader, 1, &frame));
+
+    write_frame(&writer, 42, 8);
+    assert(sc_shm_ring_latest(&reader) == 1);
+
+    ok = sc_shm_ring_acquire(&reader, 1, &frame);
+    assert(ok);
+    assert(frame.number == 1);
+    assert(frame.size == 8);
+    assert(frame.pts == 42000);
+    assert(frame.plane_count == 1);
+    assert(frame.data[0][0] == 42 && frame.data[0][7] == 42);
+    assert(sc_shm_ring_validate(&reader, &frame));
+
+    // Frame 2 is stored in the other slot, frame 1 is still valid
+    write_frame(&writer, 43, 8);
+    assert(sc_shm_ring_latest(&reader) == 2);
+    assert(sc_shm_ring_validate(&reader, &frame));
+
+    // Frame 3 overwrites frame 1
+    write_frame(&writer, 44, 8);
+    assert(!sc_shm_ring_validate(&reader, &frame));
+    assert(!sc_shm_ring_acquire(&reader, 1, &frame));
+
+    ok = sc_shm_ring_acquire(&reader, 3, &frame);
+    assert(ok);
+    assert(frame.data[0][0] == 44);
+
+    sc_shm_ring_close(&reader);
+    sc_shm_ring_close(&writer);
+
+    // The writer unlinks the shared memory
+    ok = sc_shm_ring_open(&reader, name);
+    assert(!ok);
+    assert(errno == ENOENT);
+}
+
+static void test_shm_ring_being_written(void) {
+    char name[64];
+    get_name(name, sizeof(name), "written");
+
+    struct sc_shm_ring writer;
+    bool ok = sc_shm_ring_create(&writer, name, 2, 16);
+    assert(ok);
+
+    struct sc_shm_ring reader;
+    ok = sc_shm_ring_open(&reader, name);
+    assert(ok);
+
+    write_frame(&writer, 1, 8);
+    write_frame(&writer, 2, 8);
+
+    struct sc_shm_frame frame;
+    ok = sc_shm_ring_acquire(&reader, 1, &frame);
+    assert(ok);
+
+    // Start to overwrite the slot of frame 1
+    uint8_t *data;
+    struct sc_shm_ring_slot *slot = sc_shm_ring_begin_write(&writer, &data);
+    slot->size = 8;
+    memset(data, 3, 8);
+
+    // The partial write must be detected
+    assert(!sc_shm_ring_validate(&reader, &frame));
+    assert(!sc_shm_ring_acquire(&reader, 1, &frame));
+    assert(!sc_shm_ring_acquire(&reader, 3, &frame));
+
+    sc_shm_ring_end_write(&writer, slot);
+    assert(sc_shm_ring_acquire(&reader, 3, &frame));
+
+    sc_shm_ring_close(&reader);
+    sc_shm_ring_close(&writer);
+}
+
+struct bench_result {
+    uint64_t frames;
+    uint64_t torn;
+    int64_t latency_sum; // in microseconds
+    int64_t latency_max;
+};
+
+static void
+bench_reader(const char *name, int fd) {
+    struct sc_shm_ring ring;
+    bool ok = sc_shm_ring_open(&ring, name);
+    assert(ok);
+
+    struct bench_result result = {0};
+    uint64_t last = 0;
+    uint64_t checksum = 0;
+
+    while (last < BENCH_FRAMES) {
+        uint64_t latest = sc_shm_ring_latest(&ring);
+        if (latest == last) {
+            sleep_us(50);
+            continue;
+        }
+
+        // Always read the most recent frame (skip the older ones)
+        struct sc_shm_frame frame;
+        if (!sc_shm_ring_acquire(&ring, latest, &frame)) {
+            ++result.torn;
+            continue;
+        }
+
+        sc_tick latency = sc_tick_now() - frame.publish_time;
+
+        // Read the whole frame in place
+        const uint8_t *data = frame.data[0];
+        for (uint32_t i = 0; i < frame.size; i += 64) {
+            checksum += data[i];
+        }
+
+        if (!sc_shm_ring_validate(&ring, &frame)) {
+            ++result.torn;
+            continue;
+        }
+
+        last = latest;
+        ++result.frames;
+        result.latency_sum += latency;
+        result.latency_max = MAX(result.latency_max, latency);
+    }
+
+    (void) checksum;
+    sc_shm_ring_close(&ring);
+
+    ssize_t w = write(fd, &result, sizeof(result));
+    assert(w == sizeof(result));
+    (void) w;
+}
+
+static void
+bench_shm_ring(void) {
+    char name[64];
+    get_name(name, sizeof(name), "bench");
+
+    struct sc_shm_ring writer;
+    bool ok = sc_shm_ring_create(&writer, name, BENCH_SLOTS, BENCH_FRAME_SIZE);
+    assert(ok);
+
+    int fds[2];
+    int r = pipe(fds);
+    assert(!r);
+    (void) r;
+
+    pid_t pids[BENCH_READERS];
+    for (unsigned i = 0; i < BENCH_READERS; ++i) {
+        pids[i] = fork();
+        assert(pids[i] != -1);
+        if (!pids[i]) {
+            close(fds[0]);
+            bench_reader(name, fds[1]);
+            _exit(0);
+        }
+    }
+
+    // Let the readers open the ring
+    sleep_us(100000);
+
+    sc_tick write_total = 0;
+    sc_tick start = sc_tick_now();
+    for (unsigned i = 1; i <= BENCH_FRAMES; ++i) {
+        sc_tick t = sc_tick_now();
+        uint8_t *data;
+        struct sc_shm_ring_slot *slot = sc_shm_ring_begin_write(&writer, &data);
+        slot->format = SC_SHM_RING_FORMAT_YUV420P;
+        slot->width = BENCH_WIDTH;
+        slot->height = BENCH_HEIGHT;
+        slot->size = BENCH_FRAME_SIZE;
+        slot->plane_count = 1;
+        slot->offsets[0] = 0;
+        slot->linesizes[0] = BENCH_WIDTH;
+        slot->pts = i;
+        memset(data, i & 0xFF, BENCH_FRAME_SIZE);
+        slot->publish_time = sc_tick_now();
+        sc_shm_ring_end_write(&writer, slot);
+        write_total += sc_tick_now() - t;
+
+        // ~120 fps
+        sleep_us(8000);
+    }
+    sc_tick duration = sc_tick_now() - start;
+
+    close(fds[1]);
+    for (unsigned i = 0; i < BENCH_READERS; ++i) {
+        struct bench_result result;
+        ssize_t rd = read(fds[0], &result, sizeof(result));
+        assert(rd == sizeof(result));
+        (void) rd;
+
+        assert(result.frames);
+        printf("reader %u: %" PRIu64 "/%u frames, %" PRIu64 " torn, latency "
+               "avg %" PRIi64 " us, max %" PRIi64 " us\n", i, result.frames,
+               BENCH_FRAMES, result.torn,
+               result.latency_sum / (int64_t) result.frames,
+               result.latency_max);
+    }
+    close(fds[0]);
+
+    for (unsigned i = 0; i < BENCH_READERS; ++i) {
+        int status;
+        waitpid(pids[i], &status, 0);
+        assert(WIFEXITED(status) && !WEXITSTATUS(status));
+    }
+
+    double seconds = (double) duration / SC_TICK_FREQ;
+    printf("writer: %u frames of %u bytes, %.1f us/frame, %.1f MB/s "
+           "per reader\n", BENCH_FRAMES, BENCH_FRAME_SIZE,
+           (double) write_total / BENCH_FRAMES,
+           (double) BENCH_FRAMES * BENCH_FRAME_SIZE / seconds / 1000000);
+
+    sc_shm_ring_close(&writer);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && !strcmp(argv[1], "--benchmark")) {
+        bench_shm_ring();
+        return 0;
+    }
+
+    test_shm_ring_simple();
+    test_shm_ring_being_written();
+    return 0;
+}
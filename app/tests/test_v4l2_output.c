@@ -0,0 +1,200 @@
+#include "common.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/videodev2.h>
+#include <libavcodec/avcodec.h>
+#include <libavdevice/avdevice.h>
+#include <libavformat/avformat.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+
+#include "util/tick.h"
+#include "v4l2_output.h"
+
+/*
+ * The tests and the benchmark writing to a device require a v4l2loopback
+ * device, for example:
+ *
+ *     sudo modprobe v4l2loopback
+ *     SCRCPY_TEST_V4L2_DEVICE=/dev/video0 meson test --benchmark -v \
+ *         test_v4l2_output
+ */
+#define TEST_DEVICE_ENV "SCRCPY_TEST_V4L2_DEVICE"
+
+#define BENCH_WIDTH 1280
+#define BENCH_HEIGHT 720
+#define BENCH_FRAMES 300
+
+static AVFrame *
+alloc_frame(enum AVPixelFormat fmt, int width, int height) {
+    AVFrame *frame = av_frame_alloc();
+    assert(frame);
+
+    frame->format = fmt;
+    frame->width = width;
+    frame->height = height;
+    int ret = av_frame_get_buffer(frame, 0);
+    assert(!ret);
+    (void) ret;
+
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; ++i) {
+        memset(frame->buf[i]->data, 0x80, frame->buf[i]->size);
+    }
+
+    return frame;
+}
+
+static void test_get_pix_fmt(void) {
+    assert(sc_v4l2_output_get_pix_fmt(V4L2_PIX_FMT_YUV420)
+            == AV_PIX_FMT_YUV420P);
+    assert(sc_v4l2_output_get_pix_fmt(V4L2_PIX_FMT_NV12) == AV_PIX_FMT_NV12);
+    assert(sc_v4l2_output_get_pix_fmt(V4L2_PIX_FMT_YUYV)
+            == AV_PIX_FMT_YUYV422);
+}
+
+static void test_write_without_consumer(const char *device) {
+    struct sc_v4l2_output out;
+    bool ok = sc_v4l2_output_open(&out, device, 320, 240,
+                                  V4L2_PIX_FMT_YUV420);
+    assert(ok);
+    (void) ok;
+
+    AVFrame *frame = alloc_frame(AV_PIX_FMT_YUV420P, 320, 240);
+
+    // Nobody reads the device: the writes must never block (the frames are
+    // dropped once all the buffers are queued)
+    for (unsigned i = 0; i < 4 * SC_V4L2_OUTPUT_BUFFER_COUNT; ++i) {
+        frame->pts = i * 16666;
+        enum sc_v4l2_output_result result = sc_v4l2_output_write(&out, frame);
+        assert(result != SC_V4L2_OUTPUT_RESULT_ERROR);
+        (void) result;
+    }
+
+    av_frame_free(&frame);
+    sc_v4l2_output_close(&out);
+}
+
+static void
+bench_native(const char *device) {
+    struct sc_v4l2_output out;
+    bool ok = sc_v4l2_output_open(&out, device, BENCH_WIDTH, BENCH_HEIGHT,
+                                  V4L2_PIX_FMT_YUV420);
+    assert(ok);
+    (void) ok;
+
+    AVFrame *frame = alloc_frame(AV_PIX_FMT_YUV420P, BENCH_WIDTH,
+                                 BENCH_HEIGHT);
+
+    unsigned dropped = 0;
+    sc_tick start = sc_tick_now();
+    for (unsigned i = 0; i < BENCH_FRAMES; ++i) {
+        frame->pts = i * 16666;
+        enum sc_v4l2_output_result result = sc_v4l2_output_write(&out, frame);
+        assert(result != SC_V4L2_OUTPUT_RESULT_ERROR);
+        if (result == SC_V4L2_OUTPUT_RESULT_DROPPED) {
+            ++dropped;
+        }
+    }
+    sc_tick duration = sc_tick_now() - start;
+
+    printf("v4l2 native: %u frames %dx%d, %.1f us/frame (%u dropped)\n",
+           BENCH_FRAMES, BENCH_WIDTH, BENCH_HEIGHT,
+           (double) SC_TICK_TO_US(duration) / BENCH_FRAMES, dropped);
+
+    av_frame_free(&frame);
+    sc_v4l2_output_close(&out);
+}
+
+// Same path as the v4l2 sink fallback: encode the frames to rawvideo packets,
+// written by the libavdevice v4l2 muxer
+static void
+bench_libavdevice(const char *device) {
+    avdevice_register_all();
+
+    AVFormatContext *format_ctx = NULL;
+    int ret = avformat_alloc_output_context2(&format_ctx, NULL, "v4l2",
+                                             device);
+    assert(ret >= 0);
+
+    const AVCodec *encoder = avcodec_find_encoder(AV_CODEC_ID_RAWVIDEO);
+    assert(encoder);
+
+    AVStream *ostream = avformat_new_stream(format_ctx, encoder);
+    assert(ostream);
+    ostream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    ostream->codecpar->codec_id = encoder->id;
+    ostream->codecpar->format = AV_PIX_FMT_YUV420P;
+    ostream->codecpar->width = BENCH_WIDTH;
+    ostream->codecpar->height = BENCH_HEIGHT;
+
+    ret = avio_open(&format_ctx->pb, device, AVIO_FLAG_WRITE);
+    assert(ret >= 0);
+    ret = avformat_write_header(format_ctx, NULL);
+    assert(ret >= 0);
+
+    AVCodecContext *encoder_ctx = avcodec_alloc_context3(encoder);
+    assert(encoder_ctx);
+    encoder_ctx->width = BENCH_WIDTH;
+    encoder_ctx->height = BENCH_HEIGHT;
+    encoder_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    encoder_ctx->time_base.num = 1;
+    encoder_ctx->time_base.den = 1;
+    ret = avcodec_open2(encoder_ctx, encoder, NULL);
+    assert(ret >= 0);
+
+    AVPacket *packet = av_packet_alloc();
+    assert(packet);
+
+    AVFrame *frame = alloc_frame(AV_PIX_FMT_YUV420P, BENCH_WIDTH,
+                                 BENCH_HEIGHT);
+
+    sc_tick start = sc_tick_now();
+    for (unsigned i = 0; i < BENCH_FRAMES; ++i) {
+        frame->pts = i;
+        ret = avcodec_send_frame(encoder_ctx, frame);
+        assert(ret >= 0);
+        ret = avcodec_receive_packet(encoder_ctx, packet);
+        assert(ret >= 0);
+        ret = av_write_frame(format_ctx, packet);
+        assert(ret >= 0);
+        av_packet_unref(packet);
+    }
+    sc_tick duration = sc_tick_now() - start;
+
+    printf("v4l2 libavdevice: %u frames %dx%d, %.1f us/frame\n",
+           BENCH_FRAMES, BENCH_WIDTH, BENCH_HEIGHT,
+           (double) SC_TICK_TO_US(duration) / BENCH_FRAMES);
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&encoder_ctx);
+    av_write_trailer(format_ctx);
+    avio_close(format_ctx->pb);
+    avformat_free_context(format_ctx);
+}
+
+int main(int argc, char *argv[]) {
+    const char *device = getenv(TEST_DEVICE_ENV);
+
+    if (argc > 1 && !strcmp(argv[1], "--benchmark")) {
+        if (!device) {
+            fprintf(stderr, "v4l2 benchmark: set " TEST_DEVICE_ENV "\n");
+            // Skipped
+            return 77;
+        }
+        bench_native(device);
+        bench_libavdevice(device);
+        return 0;
+    }
+
+    test_get_pix_fmt();
+    if (device) {
+        test_write_without_consumer(device);
+    }
+
+    return 0;
+}
@@ -184,6 +184,40 @@ static void test_vecdeque_push_hole(void) {
     sc_vecdeque_destroy(&vdq);
 }
 
+static void test_vecdeque_get(void) {
+    struct SC_VECDEQUE(int) vdq = SC_VECDEQUE_INITIALIZER;
+
+    bool ok = sc_vecdeque_reserve(&vdq, 10);
+    assert(ok);
+
+    // Make the content wrap around the end of the internal array
+    for (int i = 0; i < 7; ++i) {
+        sc_vecdeque_push_noresize(&vdq, i);
+    }
+    for (int i = 0; i < 5; ++i) {
+        int v = sc_vecdeque_pop(&vdq);
+        assert(v == i);
+    }
+    for (int i = 7; i < 12; ++i) {
+        sc_vecdeque_push_noresize(&vdq, i);
+    }
+
+    assert(sc_vecdeque_size(&vdq) == 7);
+    assert(sc_vecdeque_peek(&vdq) == 5);
+
+    for (int i = 0; i < 7; ++i) {
+        assert(sc_vecdeque_get(&vdq, i) == 5 + i);
+    }
+
+    *sc_vecdeque_getref(&vdq, 6) = 42;
+    assert(sc_vecdeque_get(&vdq, 6) == 42);
+
+    // Nothing has been removed
+    assert(sc_vecdeque_size(&vdq) == 7);
+
+    sc_vecdeque_destroy(&vdq);
+}
+
 int main(int argc, char *argv[]) {
     (void) argc;
     (void) argv;
@@ -192,6 +226,7 @@ int main(int argc, char *argv[]) {
     test_vecdeque_reserve();
     test_vecdeque_grow();
     test_vecdeque_push_hole();
+    test_vecdeque_get();
 
     return 0;
 }
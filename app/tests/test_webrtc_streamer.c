@@ -0,0 +1,325 @@
+#include "common.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "webrtc_streamer.h"
+#include "websocket.h"
+#include "util/tick.h"
+
+#define MAX_MESSAGE_SIZE 4096
+
+static const uint8_t CONFIG[] = {0, 0, 0, 1, 0x67, 0x42, 0, 0, 0, 1, 0x68};
+
+struct message {
+    uint8_t opcode;
+    uint8_t data[MAX_MESSAGE_SIZE + 1]; // + 1 for the text null byte
+    size_t len;
+    struct sc_media_header media; // for binary messages
+};
+
+static atomic_uint key_frame_requests;
+
+static void
+on_key_frame_request(struct sc_webrtc_streamer *streamer, void *userdata) {
+    (void) streamer;
+    (void) userdata;
+    atomic_fetch_add(&key_frame_requests, 1);
+}
+
+static bool
+read_all(int fd, void *buf, size_t len) {
+    uint8_t *p = buf;
+    while (len) {
+        ssize_t r = read(fd, p, len);
+        if (r <= 0) {
+            return false;
+        }
+        p += r;
+        len -= r;
+    }
+    return true;
+}
+
+static int
+server_listen(uint16_t *port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd != -1);
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        .sin_port = 0, // any port
+    };
+    int r = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    assert(!r);
+    r = listen(fd, 1);
+    assert(!r);
+    socklen_t addrlen = sizeof(addr);
+    r = getsockname(fd, (struct sockaddr *) &addr, &addrlen);
+    assert(!r);
+    (void) r;
+
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// Accept a WebSocket connection (a minimal stand-in for a real server)
+static int
+server_accept(int server_fd) {
+    int fd = accept(server_fd, NULL, NULL);
+    assert(fd != -1);
+
+    // Read the HTTP upgrade request
+    char request[1024];
+    size_t len = 0;
+    for (;;) {
+        assert(len < sizeof(request) - 1);
+        ssize_t r = read(fd, &request[len], sizeof(request) - 1 - len);
+        assert(r > 0);
+        len += r;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n")) {
+            break;
+        }
+    }
+    assert(!strncmp(request, "GET /ws HTTP/1.1\r\n", 18));
+    assert(strstr(request, "Upgrade: websocket\r\n"));
+
+    static const char response[] = "HTTP/1.1 101 Switching Protocols\r\n"
+                                   "Upgrade: websocket\r\n"
+                                   "Connection: Upgrade\r\n"
+                                   "\r\n";
+    ssize_t w = write(fd, response, sizeof(response) - 1);
+    assert(w == sizeof(response) - 1);
+    (void) w;
+
+    return fd;
+}
+
+static void
+read_message(int fd, struct message *msg) {
+    uint8_t header[SC_WEBSOCKET_FRAME_HEADER_MAX_SIZE];
+    struct sc_websocket_frame_info info;
+
+    bool ok = read_all(fd, header, 2);
+    assert(ok);
+    size_t len = 2;
+    while (!sc_websocket_parse_frame_header(header, len, &info)) {
+        ok = read_all(fd, &header[len], 1);
+        assert(ok);
+        ++len;
+    }
+
+    // A client frame must be masked
+    assert(info.fin);
+    assert(info.masked);
+    assert(info.payload_length <= MAX_MESSAGE_SIZE);
+
+    msg->opcode = info.opcode;
+    msg->len = info.payload_length;
+    ok = read_all(fd, msg->data, msg->len);
+    assert(ok);
+    (void) ok;
+    sc_websocket_mask_copy(msg->data, msg->data, msg->len, info.mask, 0);
+
+    if (msg->opcode == SC_WEBSOCKET_OPCODE_BINARY) {
+        assert(msg->len >= SC_MEDIA_HEADER_SIZE);
+        sc_media_header_read(msg->data, &msg->media);
+        assert(msg->media.stream_id == SC_MEDIA_STREAM_VIDEO);
+        assert(msg->media.size == msg->len - SC_MEDIA_HEADER_SIZE);
+    }
+}
+
+static void
+read_stream_info(int fd) {
+    struct message msg;
+    read_message(fd, &msg);
+    assert(msg.opcode == SC_WEBSOCKET_OPCODE_TEXT);
+    msg.data[msg.len] = '\0';
+    assert(strstr((char *) msg.data, "\"type\":\"stream_info\""));
+    assert(strstr((char *) msg.data, "\"codec\":\"h264\""));
+}
+
+static void
+read_media(int fd, int64_t pts, uint8_t flags) {
+    struct message msg;
+    read_message(fd, &msg);
+    assert(msg.opcode == SC_WEBSOCKET_OPCODE_BINARY);
+    assert(msg.media.pts == pts);
+    assert(msg.media.flags == flags);
+
+    if (flags & SC_MEDIA_FLAG_CONFIG) {
+        assert(msg.media.size == sizeof(CONFIG));
+        assert(!memcmp(&msg.data[SC_MEDIA_HEADER_SIZE], CONFIG,
+                       sizeof(CONFIG)));
+    } else {
+        // The payload is filled with the pts
+        assert(msg.media.size == 1000);
+        assert(msg.data[SC_MEDIA_HEADER_SIZE] == (uint8_t) pts);
+    }
+}
+
+static void
+push(struct sc_webrtc_streamer *streamer, int64_t pts, bool key_frame) {
+    AVPacket *packet = av_packet_alloc();
+    assert(packet);
+
+    bool config = pts == AV_NOPTS_VALUE;
+    int size = config ? (int) sizeof(CONFIG) : 1000;
+    int r = av_new_packet(packet, size);
+    assert(!r);
+    (void) r;
+
+    if (config) {
+        memcpy(packet->data, CONFIG, sizeof(CONFIG));
+    } else {
+        memset(packet->data, (uint8_t) pts, size);
+    }
+    packet->pts = pts;
+    packet->dts = pts;
+    packet->flags = key_frame ? AV_PKT_FLAG_KEY : 0;
+
+    struct sc_packet_sink *sink = &streamer->packet_sink;
+    bool ok = sink->ops->push(sink, packet);
+    assert(ok);
+    (void) ok;
+
+    av_packet_free(&packet);
+}
+
+static void test_reconnect(void) {
+    uint16_t port;
+    int server_fd = server_listen(&port);
+
+    char url[64];
+    snprintf(url, sizeof(url), "wss://127.0.0.1:%" PRIu16 "/ws", port);
+
+    static const struct sc_webrtc_streamer_callbacks cbs = {
+        .on_key_frame_request = on_key_frame_request,
+    };
+
+    struct sc_webrtc_streamer streamer;
+    bool ok = sc_webrtc_streamer_init(&streamer, url, url, 42, true, 0, 0,
+                                      &cbs, NULL);
+    assert(ok);
+
+    AVCodecContext *ctx = avcodec_alloc_context3(NULL);
+    assert(ctx);
+    ctx->codec_id = AV_CODEC_ID_H264;
+    ctx->width = 1920;
+    ctx->height = 1080;
+
+    struct sc_packet_sink *sink = &streamer.packet_sink;
+    ok = sink->ops->open(sink, ctx);
+    assert(ok);
+
+    ok = sc_webrtc_streamer_start(&streamer);
+    assert(ok);
+
+    int fd = server_accept(server_fd);
+    read_stream_info(fd);
+
+    push(&streamer, AV_NOPTS_VALUE, false); // config packet, not sent alone
+    push(&streamer, 0, true);
+    push(&streamer, 1, false);
+    read_media(fd, 0, SC_MEDIA_FLAG_KEY_FRAME);
+    read_media(fd, 1, 0);
+
+    // The server drops the connection
+    close(fd);
+    sc_tick drop_time = sc_tick_now();
+
+    // Keep streaming (at 200 fps) until the streamer reconnects
+    int64_t pts = 2;
+    for (;;) {
+        struct pollfd pfd = {.fd = server_fd, .events = POLLIN};
+        int r = poll(&pfd, 1, 5);
+        assert(r != -1);
+        if (r) {
+            break;
+        }
+        push(&streamer, pts++, false);
+        // Very generous bound, only to never loop forever
+        assert(sc_tick_now() - drop_time < SC_TICK_FROM_SEC(30));
+    }
+
+    fd = server_accept(server_fd);
+    read_stream_info(fd);
+
+    // The viewer immediately receives the config and the last key frame
+    read_media(fd, -1, SC_MEDIA_FLAG_CONFIG);
+    read_media(fd, 0, SC_MEDIA_FLAG_KEY_FRAME);
+
+    // The streamer requested a new key frame
+    assert(atomic_load(&key_frame_requests) == 1);
+
+    // The non-key frames are dropped until the new key frame
+    push(&streamer, pts++, false);
+    push(&streamer, pts, true);
+    push(&streamer, pts + 1, false);
+    read_media(fd, pts, SC_MEDIA_FLAG_KEY_FRAME);
+    read_media(fd, pts + 1, 0);
+
+    sc_webrtc_streamer_stop(&streamer);
+    sc_webrtc_streamer_join(&streamer);
+    sink->ops->close(sink);
+    sc_webrtc_streamer_destroy(&streamer);
+
+    avcodec_free_context(&ctx);
+    close(fd);
+    close(server_fd);
+}
+
+static void test_stop_during_handshake(void) {
+    uint16_t port;
+    int server_fd = server_listen(&port);
+
+    char url[64];
+    snprintf(url, sizeof(url), "wss://127.0.0.1:%" PRIu16 "/ws", port);
+
+    struct sc_webrtc_streamer streamer;
+    bool ok = sc_webrtc_streamer_init(&streamer, url, url, 42, true, 0, 0,
+                                      NULL, NULL);
+    assert(ok);
+
+    ok = sc_webrtc_streamer_start(&streamer);
+    assert(ok);
+
+    // The server accepts the connection but never answers the upgrade request
+    int fd = accept(server_fd, NULL, NULL);
+    assert(fd != -1);
+    char request[1024];
+    ssize_t r = read(fd, request, sizeof(request));
+    assert(r > 0);
+    (void) r;
+
+    // Stopping must not wait for the handshake timeout (5 seconds). The
+    // bound is very generous: the stop is expected within 100 ms.
+    sc_tick start = sc_tick_now();
+    sc_webrtc_streamer_stop(&streamer);
+    sc_webrtc_streamer_join(&streamer);
+    assert(sc_tick_now() - start < SC_TICK_FROM_SEC(4));
+
+    sc_webrtc_streamer_destroy(&streamer);
+
+    close(fd);
+    close(server_fd);
+}
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    test_reconnect();
+    test_stop_during_handshake();
+    return 0;
+}
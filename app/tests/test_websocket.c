@@ -0,0 +1,529 @@
+#include "common.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "util/tick.h"
+#include "websocket.h"
+
+#define BENCH_PACKETS 2000
+#define BENCH_PACKET_SIZE 50000
+
+static void test_frame_header(void) {
+    uint8_t buf[SC_WEBSOCKET_FRAME_HEADER_MAX_SIZE];
+    struct sc_websocket_frame_info info;
+    const uint8_t mask[] = {0x12, 0x34, 0x56, 0x78};
+
+    size_t len = sc_websocket_write_frame_header(buf, true,
+                                                 SC_WEBSOCKET_OPCODE_BINARY,
+                                                 125, NULL);
+    assert(len == 2);
+    assert(buf[0] == 0x82);
+    assert(buf[1] == 125);
+    assert(sc_websocket_parse_frame_header(buf, len, &info) == 2);
+    assert(info.fin);
+    assert(info.opcode == SC_WEBSOCKET_OPCODE_BINARY);
+    assert(!info.masked);
+    assert(info.payload_length == 125);
+
+    len = sc_websocket_write_frame_header(buf, true, SC_WEBSOCKET_OPCODE_TEXT,
+                                          126, mask);
+    assert(len == 8);
+    assert(buf[0] == 0x81);
+    assert(buf[1] == (0x80 | 126));
+    assert(buf[2] == 0 && buf[3] == 126);
+    assert(!memcmp(&buf[4], mask, 4));
+    // incomplete
+    assert(!sc_websocket_parse_frame_header(buf, 7, &info));
+    assert(sc_websocket_parse_frame_header(buf, len, &info) == 8);
+    assert(info.masked);
+    assert(!memcmp(info.mask, mask, 4));
+    assert(info.payload_length == 126);
+
+    len = sc_websocket_write_frame_header(buf, false,
+                                          SC_WEBSOCKET_OPCODE_BINARY, 0x10000,
+                                          mask);
+    assert(len == 14);
+    assert(buf[0] == 0x02);
+    assert(buf[1] == (0x80 | 127));
+    assert(sc_websocket_parse_frame_header(buf, len, &info) == 14);
+    assert(!info.fin);
+    assert(info.payload_length == 0x10000);
+}
+
+static void test_mask(void) {
+    const uint8_t mask[] = {0x12, 0x34, 0x56, 0x78};
+
+    uint8_t data[37];
+    for (unsigned i = 0; i < sizeof(data); ++i) {
+        data[i] = i;
+    }
+
+    uint8_t masked[37];
+    sc_websocket_mask_copy(masked, data, sizeof(data), mask, 0);
+    for (unsigned i = 0; i < sizeof(data); ++i) {
+        assert(masked[i] == (data[i] ^ mask[i % 4]));
+    }
+
+    // Masking in two parts gives the same result
+    uint8_t masked2[37];
+    sc_websocket_mask_copy(masked2, data, 5, mask, 0);
+    sc_websocket_mask_copy(&masked2[5], &data[5], sizeof(data) - 5, mask, 5);
+    assert(!memcmp(masked, masked2, sizeof(data)));
+
+    // Unmask in place
+    sc_websocket_mask_copy(masked, masked, sizeof(masked), mask, 0);
+    assert(!memcmp(masked, data, sizeof(data)));
+}
+
+static void test_compute_accept(void) {
+    // Example from RFC 6455, section 1.3
+    static const char key[] = "dGhlIHNhbXBsZSBub25jZQ==";
+
+    char accept[SC_WEBSOCKET_ACCEPT_SIZE];
+    bool ok = sc_websocket_compute_accept(key, sizeof(key) - 1, accept);
+    assert(ok);
+    (void) ok;
+    assert(!strcmp(accept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo="));
+}
+
+static void test_media_header(void) {
+    struct sc_media_header header = {
+        .stream_id = SC_MEDIA_STREAM_VIDEO,
+        .flags = SC_MEDIA_FLAG_KEY_FRAME,
+        .pts = 0x0102030405060708,
+        .size = 0x11223344,
+    };
+
+    uint8_t buf[SC_MEDIA_HEADER_SIZE];
+    sc_media_header_write(buf, &header);
+
+    const uint8_t expected[] = {
+        0x00, 0x01, 0x00, 0x00,
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+        0x11, 0x22, 0x33, 0x44,
+    };
+    assert(!memcmp(buf, expected, sizeof(expected)));
+
+    struct sc_media_header header2;
+    sc_media_header_read(buf, &header2);
+    assert(header2.stream_id == header.stream_id);
+    assert(header2.flags == header.flags);
+    assert(header2.pts == header.pts);
+    assert(header2.size == header.size);
+
+    header.pts = -1;
+    sc_media_header_write(buf, &header);
+    sc_media_header_read(buf, &header2);
+    assert(header2.pts == -1);
+}
+
+static bool
+read_all(int fd, void *buf, size_t len) {
+    uint8_t *p = buf;
+    while (len) {
+        ssize_t r = read(fd, p, len);
+        if (r <= 0) {
+            return false;
+        }
+        p += r;
+        len -= r;
+    }
+    return true;
+}
+
+static uint8_t
+payload_byte(uint32_t packet, uint32_t i) {
+    return (packet * 31 + i) & 0xFF;
+}
+
+// Stand-in server: read and verify the frames sent by the client
+static void
+run_server(int fd, unsigned packet_count) {
+    uint8_t *payload = malloc(SC_MEDIA_HEADER_SIZE + BENCH_PACKET_SIZE);
+    assert(payload);
+
+    for (unsigned i = 0; i < packet_count; ++i) {
+        uint8_t header[SC_WEBSOCKET_FRAME_HEADER_MAX_SIZE];
+        struct sc_websocket_frame_info info;
+
+        // Read the fixed part, then the remaining header bytes
+        bool ok = read_all(fd, header, 2);
+        assert(ok);
+        size_t len = 2;
+        size_t header_len;
+        while (!(header_len = sc_websocket_parse_frame_header(header, len,
+                                                              &info))) {
+            ok = read_all(fd, &header[len], 1);
+            assert(ok);
+            ++len;
+        }
+
+        // A client frame must be masked
+        assert(info.fin);
+        assert(info.masked);
+        assert(info.opcode == SC_WEBSOCKET_OPCODE_BINARY);
+        assert(info.payload_length >= SC_MEDIA_HEADER_SIZE);
+        assert(info.payload_length
+                <= SC_MEDIA_HEADER_SIZE + BENCH_PACKET_SIZE);
+
+        ok = read_all(fd, payload, info.payload_length);
+        assert(ok);
+        sc_websocket_mask_copy(payload, payload, info.payload_length,
+                               info.mask, 0);
+
+        struct sc_media_header media;
+        sc_media_header_read(payload, &media);
+        assert(media.stream_id == SC_MEDIA_STREAM_VIDEO);
+        assert(media.pts == (int64_t) i * 1000);
+        assert(media.flags == (i % 30 ? 0 : SC_MEDIA_FLAG_KEY_FRAME));
+        assert(media.size == info.payload_length - SC_MEDIA_HEADER_SIZE);
+
+        const uint8_t *data = &payload[SC_MEDIA_HEADER_SIZE];
+        for (uint32_t j = 0; j < media.size; ++j) {
+            assert(data[j] == payload_byte(i, j));
+        }
+    }
+
+    free(payload);
+}
+
+static void test_send_masked(void) {
+    int fds[2];
+    int r = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(!r);
+    (void) r;
+
+    unsigned packet_count = 100;
+
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (!pid) {
+        close(fds[0]);
+        run_server(fds[1], packet_count);
+        _exit(0);
+    }
+    close(fds[1]);
+
+    uint8_t *data = malloc(BENCH_PACKET_SIZE);
+    assert(data);
+
+    struct sc_websocket_sender sender;
+    sc_websocket_sender_init(&sender, true, 0);
+
+    for (unsigned i = 0; i < packet_count; ++i) {
+        // various sizes, to test the 3 payload length encodings
+        uint32_t size = (i * 997) % BENCH_PACKET_SIZE;
+        for (uint32_t j = 0; j < size; ++j) {
+            data[j] = payload_byte(i, j);
+        }
+
+        struct sc_media_header header = {
+            .stream_id = SC_MEDIA_STREAM_VIDEO,
+            .flags = i % 30 ? 0 : SC_MEDIA_FLAG_KEY_FRAME,
+            .pts = i * 1000,
+            .size = size,
+        };
+        enum sc_websocket_push_result result =
+            sc_websocket_sender_push_media(&sender, &header, data);
+        assert(result == SC_WEBSOCKET_PUSH_OK);
+        (void) result;
+
+        // The socket is blocking, so everything is written
+        bool ok = sc_websocket_sender_flush(&sender, fds[0]);
+        assert(ok);
+        assert(!sc_websocket_sender_pending(&sender));
+        (void) ok;
+    }
+
+    sc_websocket_sender_destroy(&sender);
+    free(data);
+
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && !WEXITSTATUS(status));
+    close(fds[0]);
+}
+
+static enum sc_websocket_push_result
+push_frame(struct sc_websocket_sender *sender, bool key_frame, uint32_t size) {
+    static uint8_t data[1000];
+    assert(size <= sizeof(data));
+
+    struct sc_media_header header = {
+        .stream_id = SC_MEDIA_STREAM_VIDEO,
+        .flags = key_frame ? SC_MEDIA_FLAG_KEY_FRAME : 0,
+        .pts = 0,
+        .size = size,
+    };
+    return sc_websocket_sender_push_media(sender, &header, data);
+}
+
+static void test_sender_drop(void) {
+    struct sc_websocket_sender sender;
+    sc_websocket_sender_init(&sender, true, 1000);
+
+    // frame size: 4 (frame header) + 4 (mask) + 16 (media header) + 500
+    // (the frame header is 2 bytes for a payload of less than 126 bytes)
+    assert(push_frame(&sender, true, 500) == SC_WEBSOCKET_PUSH_OK);
+    assert(sc_websocket_sender_pending(&sender) == 524);
+    assert(push_frame(&sender, false, 400) == SC_WEBSOCKET_PUSH_OK);
+    assert(push_frame(&sender, false, 100) == SC_WEBSOCKET_PUSH_OK);
+    assert(sc_websocket_sender_pending(&sender) == 524 + 424 + 122);
+
+    // Above the watermark
+    assert(push_frame(&sender, false, 100) == SC_WEBSOCKET_PUSH_DROPPED);
+    assert(sc_websocket_sender_pending(&sender) == 1070);
+
+    // Text messages are never dropped
+    bool ok = sc_websocket_sender_push_text(&sender, "{}", 2);
+    assert(ok);
+    assert(sc_websocket_sender_pending(&sender) == 1070 + 8);
+
+    int fds[2];
+    int r = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(!r);
+    (void) r;
+
+    ok = sc_websocket_sender_flush(&sender, fds[0]);
+    assert(ok);
+    assert(!sc_websocket_sender_pending(&sender));
+
+    // The queue is empty, but the next frames depend on the dropped one
+    assert(push_frame(&sender, false, 100) == SC_WEBSOCKET_PUSH_DROPPED);
+    assert(push_frame(&sender, true, 100) == SC_WEBSOCKET_PUSH_OK);
+    assert(push_frame(&sender, false, 100) == SC_WEBSOCKET_PUSH_OK);
+
+    assert(sender.stats.frames == 5);
+    assert(sender.stats.dropped_frames == 2);
+    assert(sender.stats.bytes_sent == 1078);
+    assert(sender.stats.max_queue_bytes == 1078);
+
+    // Even key frames are dropped if the peer is stuck
+    while (push_frame(&sender, true, 1000) == SC_WEBSOCKET_PUSH_OK) {
+        assert(sc_websocket_sender_pending(&sender)
+                <= 1000 * (SC_WEBSOCKET_QUEUE_LIMIT_FACTOR + 1));
+    }
+    assert(push_frame(&sender, false, 100) == SC_WEBSOCKET_PUSH_DROPPED);
+
+    sc_websocket_sender_destroy(&sender);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void test_sender_flush_non_blocking(void) {
+    int fds[2];
+    int r = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(!r);
+    int flags = fcntl(fds[0], F_GETFL);
+    assert(flags != -1);
+    r = fcntl(fds[0], F_SETFL, flags | O_NONBLOCK);
+    assert(!r);
+    (void) r;
+
+    uint8_t *data = malloc(BENCH_PACKET_SIZE);
+    assert(data);
+
+    struct sc_websocket_sender sender;
+    sc_websocket_sender_init(&sender, false, 0);
+
+    unsigned packet_count = 100;
+    for (unsigned i = 0; i < packet_count; ++i) {
+        for (uint32_t j = 0; j < BENCH_PACKET_SIZE; ++j) {
+            data[j] = payload_byte(i, j);
+        }
+
+        struct sc_media_header header = {
+            .stream_id = SC_MEDIA_STREAM_VIDEO,
+            .flags = 0,
+            .pts = i,
+            .size = BENCH_PACKET_SIZE,
+        };
+        enum sc_websocket_push_result result =
+            sc_websocket_sender_push_media(&sender, &header, data);
+        assert(result == SC_WEBSOCKET_PUSH_OK);
+        (void) result;
+    }
+
+    size_t frame_size = 4 + SC_MEDIA_HEADER_SIZE + BENCH_PACKET_SIZE;
+    size_t total = packet_count * frame_size;
+    assert(sc_websocket_sender_pending(&sender) == total);
+
+    // The peer does not read: the flush must not block
+    bool ok = sc_websocket_sender_flush(&sender, fds[0]);
+    assert(ok);
+    size_t pending = sc_websocket_sender_pending(&sender);
+    assert(pending && pending < total);
+
+    // Read everything, flushing as the peer reads
+    uint8_t *received = malloc(total);
+    assert(received);
+    size_t len = 0;
+    while (len < total) {
+        ok = sc_websocket_sender_flush(&sender, fds[0]);
+        assert(ok);
+        ssize_t rd = read(fds[1], &received[len], total - len);
+        assert(rd > 0);
+        len += rd;
+    }
+    assert(!sc_websocket_sender_pending(&sender));
+    assert(sender.stats.bytes_sent == total);
+
+    // Check the stream
+    for (unsigned i = 0; i < packet_count; ++i) {
+        const uint8_t *frame = &received[i * frame_size];
+        struct sc_websocket_frame_info info;
+        size_t header_len = sc_websocket_parse_frame_header(frame, frame_size,
+                                                            &info);
+        assert(header_len == 4);
+        assert(!info.masked);
+        assert(info.payload_length == SC_MEDIA_HEADER_SIZE
+                                    + BENCH_PACKET_SIZE);
+
+        struct sc_media_header media;
+        sc_media_header_read(&frame[header_len], &media);
+        assert(media.pts == i);
+        const uint8_t *payload = &frame[header_len + SC_MEDIA_HEADER_SIZE];
+        assert(payload[0] == payload_byte(i, 0));
+        assert(payload[BENCH_PACKET_SIZE - 1]
+                == payload_byte(i, BENCH_PACKET_SIZE - 1));
+        (void) payload;
+    }
+
+    free(received);
+    free(data);
+    sc_websocket_sender_destroy(&sender);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// Stand-in server: only count the bytes
+static void
+run_bench_server(int fd) {
+    uint8_t buf[65536];
+    uint64_t total = 0;
+    ssize_t r;
+    while ((r = read(fd, buf, sizeof(buf))) > 0) {
+        total += r;
+    }
+
+    ssize_t w = write(fd, &total, sizeof(total));
+    assert(w == sizeof(total));
+    (void) w;
+}
+
+static void bench_send_media(void) {
+    // Local TCP connection, as with a real WebSocket server
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(server_fd != -1);
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        .sin_port = 0, // any port
+    };
+    int r = bind(server_fd, (struct sockaddr *) &addr, sizeof(addr));
+    assert(!r);
+    r = listen(server_fd, 1);
+    assert(!r);
+    socklen_t addrlen = sizeof(addr);
+    r = getsockname(server_fd, (struct sockaddr *) &addr, &addrlen);
+    assert(!r);
+    (void) r;
+
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (!pid) {
+        int fd = accept(server_fd, NULL, NULL);
+        assert(fd != -1);
+        run_bench_server(fd);
+        _exit(0);
+    }
+    close(server_fd);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd != -1);
+    r = connect(fd, (struct sockaddr *) &addr, sizeof(addr));
+    assert(!r);
+
+    uint8_t *data = malloc(BENCH_PACKET_SIZE);
+    assert(data);
+    memset(data, 42, BENCH_PACKET_SIZE);
+
+    struct sc_websocket_sender sender;
+    sc_websocket_sender_init(&sender, true, 0);
+
+    sc_tick start = sc_tick_now();
+    for (unsigned i = 0; i < BENCH_PACKETS; ++i) {
+        struct sc_media_header header = {
+            .stream_id = SC_MEDIA_STREAM_VIDEO,
+            .flags = 0,
+            .pts = i,
+            .size = BENCH_PACKET_SIZE,
+        };
+        enum sc_websocket_push_result result =
+            sc_websocket_sender_push_media(&sender, &header, data);
+        assert(result == SC_WEBSOCKET_PUSH_OK);
+        (void) result;
+        bool ok = sc_websocket_sender_flush(&sender, fd);
+        assert(ok);
+        (void) ok;
+    }
+    sc_tick duration = sc_tick_now() - start;
+
+    // Let the server read the end of stream, then its result
+    shutdown(fd, SHUT_WR);
+    uint64_t total;
+    bool ok = read_all(fd, &total, sizeof(total));
+    assert(ok);
+    (void) ok;
+
+    uint8_t frame_header[SC_WEBSOCKET_FRAME_HEADER_MAX_SIZE];
+    uint8_t mask[4] = {0};
+    size_t frame_header_len =
+        sc_websocket_write_frame_header(frame_header, true,
+                                        SC_WEBSOCKET_OPCODE_BINARY,
+                                        SC_MEDIA_HEADER_SIZE
+                                            + BENCH_PACKET_SIZE, mask);
+    uint64_t expected = (uint64_t) BENCH_PACKETS
+                      * (frame_header_len + SC_MEDIA_HEADER_SIZE
+                                          + BENCH_PACKET_SIZE);
+    assert(total == expected);
+
+    double seconds = (double) duration / SC_TICK_FREQ;
+    printf("websocket: %u packets of %u bytes in %.3f s: %.1f MB/s, "
+           "%.1f us/packet\n", BENCH_PACKETS, BENCH_PACKET_SIZE, seconds,
+           total / seconds / 1000000, (double) duration / BENCH_PACKETS);
+
+    sc_websocket_sender_destroy(&sender);
+    free(data);
+    close(fd);
+
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && !WEXITSTATUS(status));
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && !strcmp(argv[1], "--benchmark")) {
+        bench_send_media();
+        return 0;
+    }
+
+    test_frame_header();
+    test_mask();
+    test_compute_accept();
+    test_media_header();
+    test_send_masked();
+    test_sender_drop();
+    test_sender_flush_non_blocking();
+    return 0;
+}
@@ -0,0 +1,500 @@
+#include "common.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "websocket.h"
+#include "ws_server.h"
+#include "util/thread.h"
+#include "util/tick.h"
+
+#define PACKET_SIZE 20000
+#define GOP_SIZE 30
+// The last packet is a key frame (never dropped by a fast viewer)
+#define LOAD_PACKETS (33 * GOP_SIZE + 1)
+#define LOAD_VIEWERS 50
+
+static const uint8_t CONFIG[] = {0, 0, 0, 1, 0x67, 0x42, 0, 0, 0, 1, 0x68};
+
+struct message {
+    uint8_t opcode;
+    uint8_t *data;
+    size_t len;
+    struct sc_media_header media; // for binary messages
+};
+
+static bool
+read_all(int fd, void *buf, size_t len) {
+    uint8_t *p = buf;
+    while (len) {
+        ssize_t r = read(fd, p, len);
+        if (r <= 0) {
+            return false;
+        }
+        p += r;
+        len -= r;
+    }
+    return true;
+}
+
+static int
+connect_to(uint16_t port, bool small_buffer) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd != -1);
+
+    if (small_buffer) {
+        // Make a slow viewer saturate quickly
+        int size = 4096;
+        int r = setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        assert(!r);
+        (void) r;
+    }
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        .sin_port = htons(port),
+    };
+    int r = connect(fd, (struct sockaddr *) &addr, sizeof(addr));
+    assert(!r);
+    (void) r;
+
+    return fd;
+}
+
+// Read an HTTP response header (byte per byte, not to consume the next
+// WebSocket frames)
+static void
+read_http_header(int fd, char *buf, size_t size) {
+    size_t len = 0;
+    for (;;) {
+        assert(len < size - 1);
+        bool ok = read_all(fd, &buf[len], 1);
+        assert(ok);
+        (void) ok;
+        ++len;
+        buf[len] = '\0';
+        if (len >= 4 && !strcmp(&buf[len - 4], "\r\n\r\n")) {
+            return;
+        }
+    }
+}
+
+static int
+connect_viewer(uint16_t port, bool small_buffer) {
+    int fd = connect_to(port, small_buffer);
+
+    // Example from RFC 6455, section 1.3 (the header names are
+    // case-insensitive)
+    static const char request[] =
+        "GET /ws HTTP/1.1\r\n"
+        "Host: 127.0.0.1\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "sec-websocket-key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n"
+        "\r\n";
+    ssize_t w = write(fd, request, sizeof(request) - 1);
+    assert(w == sizeof(request) - 1);
+    (void) w;
+
+    char response[1024];
+    read_http_header(fd, response, sizeof(response));
+    assert(!strncmp(response, "HTTP/1.1 101 ", 13));
+    assert(strstr(response,
+                  "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"));
+
+    return fd;
+}
+
+static bool
+read_message(int fd, struct message *msg) {
+    uint8_t header[SC_WEBSOCKET_FRAME_HEADER_MAX_SIZE];
+    struct sc_websocket_frame_info info;
+
+    if (!read_all(fd, header, 2)) {
+        return false;
+    }
+    size_t len = 2;
+    while (!sc_websocket_parse_frame_header(header, len, &info)) {
+        if (!read_all(fd, &header[len], 1)) {
+            return false;
+        }
+        ++len;
+    }
+
+    // A server frame must not be masked
+    assert(info.fin);
+    assert(!info.masked);
+
+    msg->opcode = info.opcode;
+    msg->len = info.payload_length;
+    msg->data = malloc(msg->len + 1); // + 1 for the text null byte
+    assert(msg->data);
+    if (!read_all(fd, msg->data, msg->len)) {
+        free(msg->data);
+        return false;
+    }
+    msg->data[msg->len] = '\0';
+
+    if (msg->opcode == SC_WEBSOCKET_OPCODE_BINARY) {
+        assert(msg->len >= SC_MEDIA_HEADER_SIZE);
+        sc_media_header_read(msg->data, &msg->media);
+        assert(msg->media.stream_id == SC_MEDIA_STREAM_VIDEO);
+        assert(msg->media.size == msg->len - SC_MEDIA_HEADER_SIZE);
+    }
+
+    return true;
+}
+
+static void
+read_stream_info(int fd) {
+    struct message msg;
+    bool ok = read_message(fd, &msg);
+    assert(ok);
+    (void) ok;
+    assert(msg.opcode == SC_WEBSOCKET_OPCODE_TEXT);
+    assert(strstr((char *) msg.data, "\"type\":\"stream_info\""));
+    assert(strstr((char *) msg.data, "\"codec\":\"h264\""));
+    free(msg.data);
+}
+
+static void
+check_media(const struct message *msg) {
+    assert(msg->opcode == SC_WEBSOCKET_OPCODE_BINARY);
+    const uint8_t *payload = &msg->data[SC_MEDIA_HEADER_SIZE];
+    if (msg->media.flags & SC_MEDIA_FLAG_CONFIG) {
+        assert(msg->media.pts == -1);
+        assert(msg->media.size == sizeof(CONFIG));
+        assert(!memcmp(payload, CONFIG, sizeof(CONFIG)));
+    } else {
+        // The payload is filled with the pts
+        bool key_frame = msg->media.pts % GOP_SIZE == 0;
+        assert(!!(msg->media.flags & SC_MEDIA_FLAG_KEY_FRAME) == key_frame);
+        assert(msg->media.size == PACKET_SIZE);
+        assert(payload[0] == (uint8_t) msg->media.pts);
+        assert(payload[PACKET_SIZE - 1] == (uint8_t) msg->media.pts);
+        (void) payload;
+        (void) key_frame;
+    }
+}
+
+static void
+read_media(int fd, int64_t pts) {
+    struct message msg;
+    bool ok = read_message(fd, &msg);
+    assert(ok);
+    (void) ok;
+    check_media(&msg);
+    assert(msg.media.pts == pts);
+    free(msg.data);
+}
+
+static void
+push(struct sc_ws_server *server, int64_t pts) {
+    AVPacket *packet = av_packet_alloc();
+    assert(packet);
+
+    bool config = pts == AV_NOPTS_VALUE;
+    int size = config ? (int) sizeof(CONFIG) : PACKET_SIZE;
+    int r = av_new_packet(packet, size);
+    assert(!r);
+    (void) r;
+
+    if (config) {
+        memcpy(packet->data, CONFIG, sizeof(CONFIG));
+    } else {
+        memset(packet->data, (uint8_t) pts, size);
+    }
+    packet->pts = pts;
+    packet->dts = pts;
+    packet->flags = !config && pts % GOP_SIZE == 0 ? AV_PKT_FLAG_KEY : 0;
+
+    struct sc_packet_sink *sink = &server->packet_sink;
+    bool ok = sink->ops->push(sink, packet);
+    assert(ok);
+    (void) ok;
+
+    av_packet_free(&packet);
+}
+
+static AVCodecContext *
+start_server(struct sc_ws_server *server) {
+    bool ok = sc_ws_server_init(server, 0);
+    assert(ok);
+
+    ok = sc_ws_server_start(server);
+    assert(ok);
+    assert(server->broadcast.port);
+
+    AVCodecContext *ctx = avcodec_alloc_context3(NULL);
+    assert(ctx);
+    ctx->codec_id = AV_CODEC_ID_H264;
+    ctx->width = 1920;
+    ctx->height = 1080;
+
+    struct sc_packet_sink *sink = &server->packet_sink;
+    ok = sink->ops->open(sink, ctx);
+    assert(ok);
+    (void) ok;
+
+    return ctx;
+}
+
+static void
+stop_server(struct sc_ws_server *server, AVCodecContext *ctx) {
+    sc_ws_server_stop(server);
+    sc_ws_server_join(server);
+    struct sc_packet_sink *sink = &server->packet_sink;
+    sink->ops->close(sink);
+    sc_ws_server_destroy(server);
+    avcodec_free_context(&ctx);
+}
+
+static void test_late_join(void) {
+    struct sc_ws_server server;
+    AVCodecContext *ctx = start_server(&server);
+
+    push(&server, AV_NOPTS_VALUE); // config packet, not sent alone
+    for (int64_t pts = 0; pts < GOP_SIZE + 3; ++pts) {
+        push(&server, pts);
+    }
+
+    // A late joiner immediately receives the config and the packets since the
+    // last key frame
+    int fd = connect_viewer(server.broadcast.port, false);
+    read_stream_info(fd);
+    read_media(fd, -1);
+    read_media(fd, GOP_SIZE);
+    read_media(fd, GOP_SIZE + 1);
+    read_media(fd, GOP_SIZE + 2);
+
+    // Then the live packets
+    push(&server, GOP_SIZE + 3);
+    read_media(fd, GOP_SIZE + 3);
+
+    // The stats are available in JSON (the request is handled by the server
+    // thread once it has reported the packets written)
+    int http_fd = connect_to(server.broadcast.port, false);
+    static const char request[] = "GET /stats HTTP/1.1\r\n\r\n";
+    ssize_t w = write(http_fd, request, sizeof(request) - 1);
+    assert(w == sizeof(request) - 1);
+    (void) w;
+
+    char response[1024];
+    read_http_header(http_fd, response, sizeof(response));
+    assert(!strncmp(response, "HTTP/1.1 200 OK\r\n", 17));
+    assert(strstr(response, "Content-Type: application/json\r\n"));
+    ssize_t r = read(http_fd, response, sizeof(response) - 1);
+    assert(r > 0);
+    response[r] = '\0';
+    assert(!strncmp(response, "{\"viewers\":[{\"id\":1,", 20));
+    assert(strstr(response, "\"frames\":5,"));
+    // The connection is closed after the response
+    r = read(http_fd, response, sizeof(response));
+    assert(!r);
+    (void) r;
+    close(http_fd);
+
+    struct sc_broadcast_client_stats stats;
+    size_t count = sc_ws_server_get_stats(&server, &stats, 1);
+    assert(count == 1);
+    assert(stats.frames == 5);
+    assert(!stats.dropped_frames);
+    assert(!stats.queue_packets);
+    (void) count;
+
+    // A plain HTTP request is rejected
+    http_fd = connect_to(server.broadcast.port, false);
+    static const char plain_request[] = "GET / HTTP/1.1\r\n\r\n";
+    w = write(http_fd, plain_request, sizeof(plain_request) - 1);
+    assert(w == sizeof(plain_request) - 1);
+    read_http_header(http_fd, response, sizeof(response));
+    assert(!strncmp(response, "HTTP/1.1 426 ", 13));
+    close(http_fd);
+
+    close(fd);
+    stop_server(&server, ctx);
+}
+
+struct load_viewer {
+    int fd;
+    sc_thread thread;
+    // the last key frame pushed before the connection
+    int64_t join_key_frame;
+
+    uint64_t frames;
+    int64_t first_pts;
+};
+
+static int
+run_load_viewer(void *data) {
+    struct load_viewer *viewer = data;
+
+    read_stream_info(viewer->fd);
+
+    viewer->first_pts = -1;
+    int64_t last_pts = -1;
+    for (;;) {
+        struct message msg;
+        bool ok = read_message(viewer->fd, &msg);
+        assert(ok);
+        (void) ok;
+        check_media(&msg);
+
+        int64_t pts = msg.media.pts;
+        free(msg.data);
+
+        if (pts == -1) {
+            // config
+            continue;
+        }
+
+        if (viewer->first_pts == -1) {
+            // The first frame is a key frame, the most recent one
+            assert(pts == viewer->join_key_frame);
+            viewer->first_pts = pts;
+        }
+
+        // Frames may be dropped, but never reordered
+        assert(pts > last_pts);
+        last_pts = pts;
+        ++viewer->frames;
+
+        if (pts == LOAD_PACKETS - 1) {
+            return 0;
+        }
+    }
+}
+
+static void
+start_load_viewer(struct load_viewer *viewer, uint16_t port, int64_t pushed) {
+    viewer->fd = connect_viewer(port, false);
+    viewer->join_key_frame = (pushed - 1) / GOP_SIZE * GOP_SIZE;
+    viewer->frames = 0;
+    bool ok = sc_thread_create(&viewer->thread, run_load_viewer, "viewer",
+                               viewer);
+    assert(ok);
+    (void) ok;
+}
+
+// Check the stream received by many viewers (the stats are printed for the
+// benchmark)
+static void
+run_load(bool benchmark) {
+    struct sc_ws_server server;
+    AVCodecContext *ctx = start_server(&server);
+
+    struct load_viewer *viewers = calloc(LOAD_VIEWERS, sizeof(*viewers));
+    assert(viewers);
+
+    push(&server, AV_NOPTS_VALUE);
+    push(&server, 0);
+
+    sc_tick start = sc_tick_now();
+
+    // Half the viewers join at the beginning
+    for (int i = 0; i < LOAD_VIEWERS / 2; ++i) {
+        start_load_viewer(&viewers[i], server.broadcast.port, 1);
+    }
+
+    // A viewer which never reads must not slow down the others
+    int slow_fd = connect_viewer(server.broadcast.port, true);
+
+    for (int64_t pts = 1; pts < LOAD_PACKETS; ++pts) {
+        if (pts == LOAD_PACKETS / 2 + 7) {
+            // The other half join in the middle of a GOP
+            for (int i = LOAD_VIEWERS / 2; i < LOAD_VIEWERS; ++i) {
+                start_load_viewer(&viewers[i], server.broadcast.port, pts);
+            }
+        }
+        push(&server, pts);
+        usleep(1000);
+    }
+
+    for (int i = 0; i < LOAD_VIEWERS; ++i) {
+        sc_thread_join(&viewers[i].thread, NULL);
+    }
+
+    sc_tick duration = sc_tick_now() - start;
+
+    // The server thread reports the packets written before it terminates
+    sc_ws_server_stop(&server);
+    sc_ws_server_join(&server);
+
+    struct sc_broadcast_client_stats stats[LOAD_VIEWERS + 1];
+    size_t count = sc_ws_server_get_stats(&server, stats, LOAD_VIEWERS + 1);
+    assert(count == LOAD_VIEWERS + 1);
+    (void) count;
+
+    uint64_t frames = 0;
+    uint64_t dropped = 0;
+    uint64_t bytes = 0;
+    size_t max_queue_bytes = 0;
+    for (int i = 0; i < LOAD_VIEWERS + 1; ++i) {
+        const struct sc_broadcast_client_stats *s = &stats[i];
+        // The viewers are connected in order, the slow viewer is the 26th
+        bool slow = s->id == LOAD_VIEWERS / 2 + 1;
+        if (slow) {
+            // Its drops depend on the timing, it must just not block the
+            // others
+            continue;
+        }
+
+        size_t index = s->id > LOAD_VIEWERS / 2 ? s->id - 2 : s->id - 1;
+        struct load_viewer *viewer = &viewers[index];
+        // All the frames pushed by the server have been received (the
+        // config is counted by the server)
+        assert(s->frames == viewer->frames + 1);
+
+        frames += s->frames;
+        dropped += s->dropped_frames;
+        bytes += s->bytes_sent;
+        if (s->max_queue_bytes > max_queue_bytes) {
+            max_queue_bytes = s->max_queue_bytes;
+        }
+    }
+
+    if (benchmark) {
+        printf("ws server: %d viewers, %" PRIu64 " frames sent (%.1f MB) in "
+               "%.3f s, %" PRIu64 " dropped, max queue %zu KiB\n",
+               LOAD_VIEWERS, frames, (double) bytes / 1e6,
+               (double) duration / 1e6, dropped, max_queue_bytes / 1024);
+    }
+
+    close(slow_fd);
+    for (int i = 0; i < LOAD_VIEWERS; ++i) {
+        close(viewers[i].fd);
+    }
+    free(viewers);
+
+    struct sc_packet_sink *sink = &server.packet_sink;
+    sink->ops->close(sink);
+    sc_ws_server_destroy(&server);
+    avcodec_free_context(&ctx);
+}
+
+static void test_load(void) {
+    run_load(false);
+}
+
+static void bench_load(void) {
+    run_load(true);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && !strcmp(argv[1], "--benchmark")) {
+        bench_load();
+        return 0;
+    }
+
+    test_late_join();
+    test_load();
+    return 0;
+}
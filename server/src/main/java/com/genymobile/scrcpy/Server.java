@@ -2,6 +2,7 @@ package com.genymobile.scrcpy;
 
 import com.genymobile.scrcpy.audio.AudioCapture;
 import com.genymobile.scrcpy.audio.AudioCodec;
+import com.genymobile.scrcpy.audio.AudioConfig;
 import com.genymobile.scrcpy.audio.AudioDirectCapture;
 import com.genymobile.scrcpy.audio.AudioEncoder;
 import com.genymobile.scrcpy.audio.AudioPlaybackCapture;
@@ -121,19 +122,20 @@ public final class Server {
             if (audio) {
                 AudioCodec audioCodec = options.getAudioCodec();
                 AudioSource audioSource = options.getAudioSource();
+                AudioConfig audioConfig = new AudioConfig(options.getAudioSampleRate(), options.getAudioChannels());
                 AudioCapture audioCapture;
                 if (audioSource.isDirect()) {
-                    audioCapture = new AudioDirectCapture(audioSource);
+                    audioCapture = new AudioDirectCapture(audioSource, audioConfig);
                 } else {
-                    audioCapture = new AudioPlaybackCapture(options.getAudioDup());
+                    audioCapture = new AudioPlaybackCapture(options.getAudioDup(), audioConfig);
                 }
 
                 Streamer audioStreamer = new Streamer(connection.getAudioFd(), audioCodec, options.getSendCodecMeta(), options.getSendFrameMeta());
                 AsyncProcessor audioRecorder;
                 if (audioCodec == AudioCodec.RAW) {
-                    audioRecorder = new AudioRawRecorder(audioCapture, audioStreamer);
+                    audioRecorder = new AudioRawRecorder(audioCapture, audioStreamer, audioConfig);
                 } else {
-                    audioRecorder = new AudioEncoder(audioCapture, audioStreamer, options);
+                    audioRecorder = new AudioEncoder(audioCapture, audioStreamer, audioConfig, options);
                 }
                 asyncProcessors.add(audioRecorder);
             }
@@ -3,27 +3,63 @@ package com.genymobile.scrcpy.audio;
 import android.media.AudioFormat;
 
 public final class AudioConfig {
-    public static final int SAMPLE_RATE = 48000;
-    public static final int CHANNEL_CONFIG = AudioFormat.CHANNEL_IN_STEREO;
-    public static final int CHANNELS = 2;
-    public static final int CHANNEL_MASK = AudioFormat.CHANNEL_IN_LEFT | AudioFormat.CHANNEL_IN_RIGHT;
+    public static final int DEFAULT_SAMPLE_RATE = 48000;
+    public static final int DEFAULT_CHANNELS = 2;
     public static final int ENCODING = AudioFormat.ENCODING_PCM_16BIT;
     public static final int BYTES_PER_SAMPLE = 2;
 
-    // Never read more than 1024 samples, even if the buffer is bigger (that would increase latency).
+    // Never read more than 1024 samples at 48kHz (~21ms), even if the buffer is bigger (that would increase latency).
     // A lower value is useless, since the system captures audio samples by blocks of 1024 (so for example if we read by blocks of 256 samples, we
     // receive 4 successive blocks without waiting, then we wait for the 4 next ones).
-    public static final int MAX_READ_SIZE = 1024 * CHANNELS * BYTES_PER_SAMPLE;
+    private static final int MAX_READ_SAMPLES_AT_48KHZ = 1024;
 
-    private AudioConfig() {
-        // Not instantiable
+    private final int sampleRate;
+    private final int channels;
+
+    public AudioConfig(int sampleRate, int channels) {
+        if (channels != 1 && channels != 2) {
+            throw new IllegalArgumentException("Unsupported audio channel count: " + channels);
+        }
+        this.sampleRate = sampleRate;
+        this.channels = channels;
+    }
+
+    public int getSampleRate() {
+        return sampleRate;
+    }
+
+    public int getChannels() {
+        return channels;
+    }
+
+    public int getChannelConfig() {
+        return channels == 1 ? AudioFormat.CHANNEL_IN_MONO : AudioFormat.CHANNEL_IN_STEREO;
     }
 
-    public static AudioFormat createAudioFormat() {
+    public int getChannelMask() {
+        return channels == 1 ? AudioFormat.CHANNEL_IN_MONO : AudioFormat.CHANNEL_IN_LEFT | AudioFormat.CHANNEL_IN_RIGHT;
+    }
+
+    public int getBytesPerFrame() {
+        return channels * BYTES_PER_SAMPLE;
+    }
+
+    public int getMaxReadSize() {
+        // Read blocks of the same duration whatever the sample rate
+        int samples = (int) ((long) MAX_READ_SAMPLES_AT_48KHZ * sampleRate / DEFAULT_SAMPLE_RATE);
+        return samples * getBytesPerFrame();
+    }
+
+    public AudioFormat createAudioFormat() {
         AudioFormat.Builder builder = new AudioFormat.Builder();
         builder.setEncoding(ENCODING);
-        builder.setSampleRate(SAMPLE_RATE);
-        builder.setChannelMask(CHANNEL_CONFIG);
+        builder.setSampleRate(sampleRate);
+        builder.setChannelMask(getChannelConfig());
         return builder.build();
     }
+
+    @Override
+    public String toString() {
+        return sampleRate + "Hz, " + channels + (channels == 1 ? " channel" : " channels");
+    }
 }
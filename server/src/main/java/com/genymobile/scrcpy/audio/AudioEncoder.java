@@ -46,11 +46,9 @@ public final class AudioEncoder implements AsyncProcessor {
         }
     }
 
-    private static final int SAMPLE_RATE = AudioConfig.SAMPLE_RATE;
-    private static final int CHANNELS = AudioConfig.CHANNELS;
-
     private final AudioCapture capture;
     private final Streamer streamer;
+    private final AudioConfig config;
     private final int bitRate;
     private final List<CodecOption> codecOptions;
     private final String encoderName;
@@ -71,20 +69,21 @@ public final class AudioEncoder implements AsyncProcessor {
 
     private boolean ended;
 
-    public AudioEncoder(AudioCapture capture, Streamer streamer, Options options) {
+    public AudioEncoder(AudioCapture capture, Streamer streamer, AudioConfig config, Options options) {
         this.capture = capture;
         this.streamer = streamer;
+        this.config = config;
         this.bitRate = options.getAudioBitRate();
         this.codecOptions = options.getAudioCodecOptions();
         this.encoderName = options.getAudioEncoder();
     }
 
-    private static MediaFormat createFormat(String mimeType, int bitRate, List<CodecOption> codecOptions) {
+    private static MediaFormat createFormat(String mimeType, int bitRate, AudioConfig config, List<CodecOption> codecOptions) {
         MediaFormat format = new MediaFormat();
         format.setString(MediaFormat.KEY_MIME, mimeType);
         format.setInteger(MediaFormat.KEY_BIT_RATE, bitRate);
-        format.setInteger(MediaFormat.KEY_CHANNEL_COUNT, CHANNELS);
-        format.setInteger(MediaFormat.KEY_SAMPLE_RATE, SAMPLE_RATE);
+        format.setInteger(MediaFormat.KEY_CHANNEL_COUNT, config.getChannels());
+        format.setInteger(MediaFormat.KEY_SAMPLE_RATE, config.getSampleRate());
 
         if (codecOptions != null) {
             for (CodecOption option : codecOptions) {
@@ -115,7 +114,7 @@ public final class AudioEncoder implements AsyncProcessor {
     }
 
     private void outputThread(MediaCodec mediaCodec) throws IOException, InterruptedException {
-        streamer.writeAudioHeader();
+        streamer.writeAudioHeader(config.getSampleRate(), config.getChannels());
 
         while (!Thread.currentThread().isInterrupted()) {
             OutputTask task = outputTasks.take();
@@ -228,7 +227,7 @@ public final class AudioEncoder implements AsyncProcessor {
             mediaCodecThread = new HandlerThread("media-codec");
             mediaCodecThread.start();
 
-            MediaFormat format = createFormat(codec.getMimeType(), bitRate, codecOptions);
+            MediaFormat format = createFormat(codec.getMimeType(), bitRate, config, codecOptions);
             mediaCodec.setCallback(new EncoderCallback(), new Handler(mediaCodecThread.getLooper()));
             mediaCodec.configure(format, null, null, MediaCodec.CONFIGURE_FLAG_ENCODE);
 
@@ -16,12 +16,14 @@ public final class AudioRawRecorder implements AsyncProcessor {
 
     private final AudioCapture capture;
     private final Streamer streamer;
+    private final AudioConfig config;
 
     private Thread thread;
 
-    public AudioRawRecorder(AudioCapture capture, Streamer streamer) {
+    public AudioRawRecorder(AudioCapture capture, Streamer streamer, AudioConfig config) {
         this.capture = capture;
         this.streamer = streamer;
+        this.config = config;
     }
 
     private void record() throws IOException, AudioCaptureException {
@@ -31,7 +33,7 @@ public final class AudioRawRecorder implements AsyncProcessor {
             return;
         }
 
-        final ByteBuffer buffer = ByteBuffer.allocateDirect(AudioConfig.MAX_READ_SIZE);
+        final ByteBuffer buffer = ByteBuffer.allocateDirect(config.getMaxReadSize());
         final MediaCodec.BufferInfo bufferInfo = new MediaCodec.BufferInfo();
 
         try {
@@ -43,7 +45,7 @@ public final class AudioRawRecorder implements AsyncProcessor {
                 throw t;
             }
 
-            streamer.writeAudioHeader();
+            streamer.writeAudioHeader(config.getSampleRate(), config.getChannels());
             while (!Thread.currentThread().isInterrupted()) {
                 buffer.position(0);
                 int r = capture.read(buffer, bufferInfo);
@@ -25,6 +25,7 @@ public final class ControlMessage {
     public static final int TYPE_OPEN_HARD_KEYBOARD_SETTINGS = 15;
     public static final int TYPE_START_APP = 16;
     public static final int TYPE_RESET_VIDEO = 17;
+    public static final int TYPE_PING = 18;
 
     public static final long SEQUENCE_INVALID = 0;
 
@@ -166,6 +167,13 @@ public final class ControlMessage {
         return msg;
     }
 
+    public static ControlMessage createPing(long sequence) {
+        ControlMessage msg = new ControlMessage();
+        msg.type = TYPE_PING;
+        msg.sequence = sequence;
+        return msg;
+    }
+
     public int getType() {
         return type;
     }
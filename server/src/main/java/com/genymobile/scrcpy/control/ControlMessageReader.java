@@ -56,6 +56,8 @@ public class ControlMessageReader {
                 return parseUhidDestroy();
             case ControlMessage.TYPE_START_APP:
                 return parseStartApp();
+            case ControlMessage.TYPE_PING:
+                return parsePing();
             default:
                 throw new ControlProtocolException("Unknown event type: " + type);
         }
@@ -166,6 +168,11 @@ public class ControlMessageReader {
         return ControlMessage.createStartApp(name);
     }
 
+    private ControlMessage parsePing() throws IOException {
+        long sequence = dis.readLong();
+        return ControlMessage.createPing(sequence);
+    }
+
     private Position parsePosition() throws IOException {
         int x = dis.readInt();
         int y = dis.readInt();
@@ -331,6 +331,10 @@ public class Controller implements AsyncProcessor, VirtualDisplayListener {
             case ControlMessage.TYPE_RESET_VIDEO:
                 resetVideo();
                 break;
+            case ControlMessage.TYPE_PING:
+                // Reply immediately, so that the client can measure the round-trip time
+                sender.send(DeviceMessage.createAckPing(msg.getSequence()));
+                break;
             default:
                 // do nothing
         }
@@ -5,6 +5,7 @@ public final class DeviceMessage {
     public static final int TYPE_CLIPBOARD = 0;
     public static final int TYPE_ACK_CLIPBOARD = 1;
     public static final int TYPE_UHID_OUTPUT = 2;
+    public static final int TYPE_ACK_PING = 3;
 
     private int type;
     private String text;
@@ -37,6 +38,13 @@ public final class DeviceMessage {
         return event;
     }
 
+    public static DeviceMessage createAckPing(long sequence) {
+        DeviceMessage event = new DeviceMessage();
+        event.type = TYPE_ACK_PING;
+        event.sequence = sequence;
+        return event;
+    }
+
     public int getType() {
         return type;
     }
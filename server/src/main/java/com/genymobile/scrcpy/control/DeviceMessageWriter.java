@@ -31,6 +31,7 @@ public class DeviceMessageWriter {
                 dos.write(raw, 0, len);
                 break;
             case DeviceMessage.TYPE_ACK_CLIPBOARD:
+            case DeviceMessage.TYPE_ACK_PING:
                 dos.writeLong(msg.getSequence());
                 break;
             case DeviceMessage.TYPE_UHID_OUTPUT:
@@ -35,10 +35,12 @@ public final class Streamer {
         return codec;
     }
 
-    public void writeAudioHeader() throws IOException {
+    public void writeAudioHeader(int sampleRate, int channels) throws IOException {
         if (sendCodecMeta) {
-            ByteBuffer buffer = ByteBuffer.allocate(4);
+            ByteBuffer buffer = ByteBuffer.allocate(12);
             buffer.putInt(codec.getId());
+            buffer.putInt(sampleRate);
+            buffer.putInt(channels);
             buffer.flip();
             IO.writeFully(fd, buffer);
         }